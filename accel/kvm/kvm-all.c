@@ -72,6 +72,9 @@
 
 #define KVM_MSI_HASHTAB_SIZE    256
 
+/* How often the coalesced MMIO thread looks at the ring */
+#define KVM_COALESCED_MMIO_POLL_MS  1
+
 struct KVMParkedVcpu {
     unsigned long vcpu_id;
     int kvm_fd;
@@ -89,6 +92,13 @@ struct KVMState
     int coalesced_pio;
     struct kvm_coalesced_mmio_ring *coalesced_mmio_ring;
     bool coalesced_flush_in_progress;
+    /* Protects consuming coalesced_mmio_ring */
+    QemuRecMutex coalesced_lock;
+    bool coalesced_thread_enabled;
+    bool coalesced_thread_stop;
+    QemuThread coalesced_thread;
+    QemuSemaphore coalesced_thread_sem;
+    Notifier coalesced_thread_exit;
     int vcpu_events;
     int robust_singlestep;
     int debugregs;
@@ -479,8 +489,8 @@ int kvm_init_vcpu(CPUState *cpu, Error **errp)
     }
 
     if (s->coalesced_mmio && !s->coalesced_mmio_ring) {
-        s->coalesced_mmio_ring =
-            (void *)cpu->kvm_run + s->coalesced_mmio * PAGE_SIZE;
+        qatomic_set(&s->coalesced_mmio_ring,
+                    (void *)cpu->kvm_run + s->coalesced_mmio * PAGE_SIZE);
     }
 
     ret = kvm_arch_init_vcpu(cpu);
@@ -1994,6 +2004,8 @@ bool kvm_vcpu_id_is_valid(int vcpu_id)
     return vcpu_id >= 0 && vcpu_id < kvm_max_vcpu_id(s);
 }
 
+static void kvm_coalesced_mmio_thread_start(KVMState *s);
+
 static int kvm_init(MachineState *ms)
 {
     MachineClass *mc = MACHINE_GET_CLASS(ms);
@@ -2246,6 +2258,15 @@ static int kvm_init(MachineState *ms)
     memory_listener_register(&kvm_coalesced_pio_listener,
                              &address_space_io);
 
+    if (s->coalesced_thread_enabled) {
+        if (s->coalesced_mmio) {
+            kvm_coalesced_mmio_thread_start(s);
+        } else {
+            warn_report("KVM does not support coalesced MMIO, "
+                        "coalesced-mmio-thread ignored");
+        }
+    }
+
     s->many_ioeventfds = kvm_check_many_ioeventfds();
 
     s->sync_mmu = !!kvm_vm_check_extension(kvm_state, KVM_CAP_SYNC_MMU);
@@ -2315,36 +2336,148 @@ static int kvm_handle_internal_error(CPUState *cpu, struct kvm_run *run)
     return -1;
 }
 
+/*
+ * Dispatch a coalesced write without taking the BQL, if the target region
+ * does not use global locking.  Returns false if the write has to go through
+ * the BQL instead.
+ */
+static bool kvm_coalesced_mmio_write_unlocked(struct kvm_coalesced_mmio *ent)
+{
+    AddressSpace *as = ent->pio == 1 ? &address_space_io :
+                                       &address_space_memory;
+    MemoryRegion *mr;
+    hwaddr xlat, len = ent->len;
+
+    if (len > 8 || !is_power_of_2(len)) {
+        return false;
+    }
+
+    RCU_READ_LOCK_GUARD();
+    mr = address_space_translate(as, ent->phys_addr, &xlat, &len, true,
+                                 MEMTXATTRS_UNSPECIFIED);
+    if (mr->global_locking || len < ent->len) {
+        return false;
+    }
+    memory_region_dispatch_write(mr, xlat, ldn_he_p(ent->data, ent->len),
+                                 size_memop(ent->len),
+                                 MEMTXATTRS_UNSPECIFIED);
+    return true;
+}
+
+/*
+ * Called with coalesced_lock held.  Without the BQL, stop at the first
+ * write that needs it and return false, so that writes stay in order.
+ */
+static bool kvm_coalesced_mmio_drain(KVMState *s, bool iothread_locked)
+{
+    struct kvm_coalesced_mmio_ring *ring = s->coalesced_mmio_ring;
+
+    while (ring->first != ring->last) {
+        struct kvm_coalesced_mmio *ent;
+
+        smp_rmb();
+        ent = &ring->coalesced_mmio[ring->first];
+
+        if (!iothread_locked) {
+            if (!kvm_coalesced_mmio_write_unlocked(ent)) {
+                return false;
+            }
+        } else if (ent->pio == 1) {
+            address_space_write(&address_space_io, ent->phys_addr,
+                                MEMTXATTRS_UNSPECIFIED, ent->data,
+                                ent->len);
+        } else {
+            cpu_physical_memory_write(ent->phys_addr, ent->data, ent->len);
+        }
+        smp_wmb();
+        ring->first = (ring->first + 1) % KVM_COALESCED_MMIO_MAX;
+    }
+    return true;
+}
+
 void kvm_flush_coalesced_mmio_buffer(void)
 {
     KVMState *s = kvm_state;
 
-    if (s->coalesced_flush_in_progress) {
-        return;
+    qemu_rec_mutex_lock(&s->coalesced_lock);
+    if (!s->coalesced_flush_in_progress && s->coalesced_mmio_ring) {
+        s->coalesced_flush_in_progress = true;
+        kvm_coalesced_mmio_drain(s, true);
+        s->coalesced_flush_in_progress = false;
     }
+    qemu_rec_mutex_unlock(&s->coalesced_lock);
+}
 
-    s->coalesced_flush_in_progress = true;
+/*
+ * Drain the coalesced MMIO ring between vCPU exits, so that it does not
+ * fill up and devices see posted writes early.  Writes to regions without
+ * global locking are dispatched right here; as soon as another one is
+ * pending, the BQL is taken to flush the rest.
+ *
+ * KVM does not signal new ring entries, so the ring is polled.  The
+ * semaphore is only posted to stop the thread.
+ */
+static void *kvm_coalesced_mmio_thread_fn(void *opaque)
+{
+    KVMState *s = opaque;
+    bool done;
 
-    if (s->coalesced_mmio_ring) {
-        struct kvm_coalesced_mmio_ring *ring = s->coalesced_mmio_ring;
-        while (ring->first != ring->last) {
-            struct kvm_coalesced_mmio *ent;
+    rcu_register_thread();
 
-            ent = &ring->coalesced_mmio[ring->first];
+    while (!qatomic_read(&s->coalesced_thread_stop)) {
+        qemu_sem_timedwait(&s->coalesced_thread_sem,
+                           KVM_COALESCED_MMIO_POLL_MS);
+        if (qatomic_read(&s->coalesced_thread_stop) ||
+            !qatomic_read(&s->coalesced_mmio_ring)) {
+            continue;
+        }
 
-            if (ent->pio == 1) {
-                address_space_write(&address_space_io, ent->phys_addr,
-                                    MEMTXATTRS_UNSPECIFIED, ent->data,
-                                    ent->len);
-            } else {
-                cpu_physical_memory_write(ent->phys_addr, ent->data, ent->len);
-            }
-            smp_wmb();
-            ring->first = (ring->first + 1) % KVM_COALESCED_MMIO_MAX;
+        qemu_rec_mutex_lock(&s->coalesced_lock);
+        s->coalesced_flush_in_progress = true;
+        done = kvm_coalesced_mmio_drain(s, false);
+        s->coalesced_flush_in_progress = false;
+        qemu_rec_mutex_unlock(&s->coalesced_lock);
+
+        if (!done) {
+            qemu_mutex_lock_iothread();
+            kvm_flush_coalesced_mmio_buffer();
+            qemu_mutex_unlock_iothread();
         }
     }
 
-    s->coalesced_flush_in_progress = false;
+    rcu_unregister_thread();
+    return NULL;
+}
+
+static void kvm_coalesced_mmio_thread_stop(Notifier *n, void *data)
+{
+    KVMState *s = container_of(n, KVMState, coalesced_thread_exit);
+    bool locked = qemu_mutex_iothread_locked();
+
+    qatomic_set(&s->coalesced_thread_stop, true);
+    qemu_sem_post(&s->coalesced_thread_sem);
+
+    /* The thread may be waiting for the BQL to flush the ring */
+    if (locked) {
+        qemu_mutex_unlock_iothread();
+    }
+    qemu_thread_join(&s->coalesced_thread);
+    if (locked) {
+        qemu_mutex_lock_iothread();
+    }
+
+    qemu_sem_destroy(&s->coalesced_thread_sem);
+}
+
+static void kvm_coalesced_mmio_thread_start(KVMState *s)
+{
+    qemu_sem_init(&s->coalesced_thread_sem, 0);
+    qemu_thread_create(&s->coalesced_thread, "kvm-coalesced",
+                       kvm_coalesced_mmio_thread_fn, s,
+                       QEMU_THREAD_JOINABLE);
+
+    s->coalesced_thread_exit.notify = kvm_coalesced_mmio_thread_stop;
+    qemu_add_exit_notifier(&s->coalesced_thread_exit);
 }
 
 static void do_kvm_cpu_synchronize_state(CPUState *cpu, run_on_cpu_data arg)
@@ -2760,6 +2893,14 @@ int kvm_has_many_ioeventfds(void)
     return kvm_state->many_ioeventfds;
 }
 
+bool kvm_coalesced_mmio_thread_running(void)
+{
+    if (!kvm_enabled()) {
+        return false;
+    }
+    return kvm_state->coalesced_thread_enabled && kvm_state->coalesced_mmio;
+}
+
 int kvm_has_gsi_routing(void)
 {
 #ifdef KVM_CAP_IRQ_ROUTING
@@ -3179,6 +3320,21 @@ static void kvm_set_kernel_irqchip(Object *obj, Visitor *v,
     }
 }
 
+static bool kvm_get_coalesced_mmio_thread(Object *obj, Error **errp)
+{
+    KVMState *s = KVM_STATE(obj);
+
+    return s->coalesced_thread_enabled;
+}
+
+static void kvm_set_coalesced_mmio_thread(Object *obj, bool value,
+                                          Error **errp)
+{
+    KVMState *s = KVM_STATE(obj);
+
+    s->coalesced_thread_enabled = value;
+}
+
 bool kvm_kernel_irqchip_allowed(void)
 {
     return kvm_state->kernel_irqchip_allowed;
@@ -3201,6 +3357,7 @@ static void kvm_accel_instance_init(Object *obj)
     s->kvm_shadow_mem = -1;
     s->kernel_irqchip_allowed = true;
     s->kernel_irqchip_split = ON_OFF_AUTO_AUTO;
+    qemu_rec_mutex_init(&s->coalesced_lock);
 }
 
 static void kvm_accel_class_init(ObjectClass *oc, void *data)
@@ -3222,6 +3379,11 @@ static void kvm_accel_class_init(ObjectClass *oc, void *data)
         NULL, NULL);
     object_class_property_set_description(oc, "kvm-shadow-mem",
         "KVM shadow MMU size");
+
+    object_class_property_add_bool(oc, "coalesced-mmio-thread",
+        kvm_get_coalesced_mmio_thread, kvm_set_coalesced_mmio_thread);
+    object_class_property_set_description(oc, "coalesced-mmio-thread",
+        "Drain coalesced MMIO writes in a separate thread");
 }
 
 static const TypeInfo kvm_accel_type = {
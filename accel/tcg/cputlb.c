@@ -1633,7 +1633,7 @@ void *probe_access(CPUArchState *env, target_ulong addr, int size,
 
         /* Handle clean RAM pages.  */
         if (flags & TLB_NOTDIRTY) {
-            notdirty_write(env_cpu(env), addr, 1, iotlbentry, retaddr);
+            notdirty_write(env_cpu(env), addr, size, iotlbentry, retaddr);
         }
     }
 
@@ -2585,6 +2585,77 @@ void cpu_stq_le_data_ra(CPUArchState *env, target_ulong ptr,
     cpu_stq_le_mmuidx_ra(env, ptr, val, cpu_mmu_index(env, false), retaddr);
 }
 
+/*
+ * Bulk data accesses
+ */
+
+static void copy_forward(uint8_t *d, const uint8_t *s, size_t n)
+{
+    /*
+     * A forward byte copy into a destination that overlaps the tail of
+     * the source replicates the leading bytes; memmove would not.
+     */
+    if (d > s && d < s + n) {
+        size_t i;
+        for (i = 0; i < n; i++) {
+            d[i] = s[i];
+        }
+    } else {
+        memmove(d, s, n);
+    }
+}
+
+void cpu_memset_data_ra(CPUArchState *env, target_ulong dst, uint8_t val,
+                        target_ulong len, uintptr_t retaddr)
+{
+    int mmu_idx = cpu_mmu_index(env, false);
+
+    while (len != 0) {
+        target_ulong n = MIN(len, -(dst | TARGET_PAGE_MASK));
+        void *host = probe_access(env, dst, n, MMU_DATA_STORE,
+                                  mmu_idx, retaddr);
+
+        if (host) {
+            memset(host, val, n);
+        } else {
+            target_ulong i;
+            for (i = 0; i < n; i++) {
+                cpu_stb_mmuidx_ra(env, dst + i, val, mmu_idx, retaddr);
+            }
+        }
+        dst += n;
+        len -= n;
+    }
+}
+
+void cpu_memcpy_data_ra(CPUArchState *env, target_ulong dst, target_ulong src,
+                        target_ulong len, uintptr_t retaddr)
+{
+    int mmu_idx = cpu_mmu_index(env, false);
+
+    while (len != 0) {
+        target_ulong n = MIN(len, MIN(-(dst | TARGET_PAGE_MASK),
+                                      -(src | TARGET_PAGE_MASK)));
+        void *hsrc = probe_access(env, src, n, MMU_DATA_LOAD,
+                                  mmu_idx, retaddr);
+        void *hdst = probe_access(env, dst, n, MMU_DATA_STORE,
+                                  mmu_idx, retaddr);
+
+        if (hsrc && hdst) {
+            copy_forward(hdst, hsrc, n);
+        } else {
+            target_ulong i;
+            for (i = 0; i < n; i++) {
+                uint8_t b = cpu_ldub_mmuidx_ra(env, src + i, mmu_idx, retaddr);
+                cpu_stb_mmuidx_ra(env, dst + i, b, mmu_idx, retaddr);
+            }
+        }
+        dst += n;
+        src += n;
+        len -= n;
+    }
+}
+
 void cpu_stb_data(CPUArchState *env, target_ulong ptr, uint32_t val)
 {
     cpu_stb_data_ra(env, ptr, val, 0);
@@ -41,6 +41,12 @@
  * optimization to avoid generating redundant operations. For instance, for the
  * second and all subsequent callbacks of an event, we do not need to reload the
  * CPU's index into a TCG temp, since the first callback did it already.
+ *
+ * Inline ops and conditional callbacks do not fit the copying scheme well,
+ * since their shape depends on the op and on whether they target a per-vCPU
+ * scoreboard. Their empty events are just markers, and the ops are generated
+ * with the usual tcg_gen_* API, which TCGContext.emit_before_op redirects to
+ * the marker's position.
  */
 #include "qemu/osdep.h"
 #include "cpu.h"
@@ -75,6 +81,7 @@ enum plugin_gen_from {
 enum plugin_gen_cb {
     PLUGIN_GEN_CB_UDATA,
     PLUGIN_GEN_CB_INLINE,
+    PLUGIN_GEN_CB_COND,
     PLUGIN_GEN_CB_MEM,
     PLUGIN_GEN_ENABLE_MEM_HELPER,
     PLUGIN_GEN_DISABLE_MEM_HELPER,
@@ -125,22 +132,9 @@ static void gen_empty_udata_cb(void)
     tcg_temp_free_i32(cpu_index);
 }
 
-/*
- * For now we only support addi_i64.
- * When we support more ops, we can generate one empty inline cb for each.
- */
+/* inline ops and conditional callbacks are generated in place later */
 static void gen_empty_inline_cb(void)
-{
-    TCGv_i64 val = tcg_temp_new_i64();
-    TCGv_ptr ptr = tcg_const_ptr(NULL); /* overwritten later */
-
-    tcg_gen_ld_i64(val, ptr, 0);
-    /* pass an immediate != 0 so that it doesn't get optimized away */
-    tcg_gen_addi_i64(val, val, 0xdeadface);
-    tcg_gen_st_i64(val, ptr, 0);
-    tcg_temp_free_ptr(ptr);
-    tcg_temp_free_i64(val);
-}
+{ }
 
 static void gen_empty_mem_cb(TCGv addr, uint32_t info)
 {
@@ -198,6 +192,7 @@ static inline void plugin_gen_empty_callback(enum plugin_gen_from from)
     case PLUGIN_GEN_FROM_TB:
         gen_wrapped(from, PLUGIN_GEN_CB_UDATA, gen_empty_udata_cb);
         gen_wrapped(from, PLUGIN_GEN_CB_INLINE, gen_empty_inline_cb);
+        gen_wrapped(from, PLUGIN_GEN_CB_COND, gen_empty_inline_cb);
         break;
     default:
         g_assert_not_reached();
@@ -246,6 +241,17 @@ static TCGOp *find_op(TCGOp *op, TCGOpcode opc)
     return NULL;
 }
 
+static TCGOp *find_op_rev(TCGOp *op, TCGOpcode opc)
+{
+    while (op) {
+        if (op->opc == opc) {
+            return op;
+        }
+        op = QTAILQ_PREV(op, link);
+    }
+    g_assert_not_reached();
+}
+
 static TCGOp *rm_ops_range(TCGOp *begin, TCGOp *end)
 {
     TCGOp *ret = QTAILQ_NEXT(end, link);
@@ -336,11 +342,6 @@ static TCGOp *copy_const_ptr(TCGOp **begin_op, TCGOp *op, void *ptr)
     return op;
 }
 
-static TCGOp *copy_const_i64(TCGOp **begin_op, TCGOp *op, uint64_t v)
-{
-    return copy_movi_i64(begin_op, op, v);
-}
-
 static TCGOp *copy_extu_tl_i64(TCGOp **begin_op, TCGOp *op)
 {
     if (TARGET_LONG_BITS == 32) {
@@ -353,19 +354,6 @@ static TCGOp *copy_extu_tl_i64(TCGOp **begin_op, TCGOp *op)
     return op;
 }
 
-static TCGOp *copy_ld_i64(TCGOp **begin_op, TCGOp *op)
-{
-    if (TCG_TARGET_REG_BITS == 32) {
-        /* 2x ld_i32 */
-        op = copy_op(begin_op, op, INDEX_op_ld_i32);
-        op = copy_op(begin_op, op, INDEX_op_ld_i32);
-    } else {
-        /* ld_i64 */
-        op = copy_op(begin_op, op, INDEX_op_ld_i64);
-    }
-    return op;
-}
-
 static TCGOp *copy_st_i64(TCGOp **begin_op, TCGOp *op)
 {
     if (TCG_TARGET_REG_BITS == 32) {
@@ -379,18 +367,6 @@ static TCGOp *copy_st_i64(TCGOp **begin_op, TCGOp *op)
     return op;
 }
 
-static TCGOp *copy_add_i64(TCGOp **begin_op, TCGOp *op)
-{
-    if (TCG_TARGET_REG_BITS == 32) {
-        /* all 32-bit backends must implement add2_i32 */
-        g_assert(TCG_TARGET_HAS_add2_i32);
-        op = copy_op(begin_op, op, INDEX_op_add2_i32);
-    } else {
-        op = copy_op(begin_op, op, INDEX_op_add_i64);
-    }
-    return op;
-}
-
 static TCGOp *copy_st_ptr(TCGOp **begin_op, TCGOp *op)
 {
     if (UINTPTR_MAX == UINT32_MAX) {
@@ -403,6 +379,22 @@ static TCGOp *copy_st_ptr(TCGOp **begin_op, TCGOp *op)
     return op;
 }
 
+static int find_call_func_idx(const TCGOp *op, void *empty_func)
+{
+    int i;
+
+    /*
+     * Instead of working out the position of the callback in args[], just
+     * look for @empty_func, since it should be a unique pointer.
+     */
+    for (i = 0; i < MAX_OPC_PARAM_ARGS; i++) {
+        if ((uintptr_t)op->args[i] == (uintptr_t)empty_func) {
+            return i;
+        }
+    }
+    g_assert_not_reached();
+}
+
 static TCGOp *copy_call(TCGOp **begin_op, TCGOp *op, void *empty_func,
                         void *func, unsigned tcg_flags, int *cb_idx)
 {
@@ -416,19 +408,7 @@ static TCGOp *copy_call(TCGOp **begin_op, TCGOp *op, void *empty_func,
     op->param2 = (*begin_op)->param2;
     tcg_debug_assert(op->life == 0);
     if (*cb_idx == -1) {
-        int i;
-
-        /*
-         * Instead of working out the position of the callback in args[], just
-         * look for @empty_func, since it should be a unique pointer.
-         */
-        for (i = 0; i < MAX_OPC_PARAM_ARGS; i++) {
-            if ((uintptr_t)(*begin_op)->args[i] == (uintptr_t)empty_func) {
-                *cb_idx = i;
-                break;
-            }
-        }
-        tcg_debug_assert(i < MAX_OPC_PARAM_ARGS);
+        *cb_idx = find_call_func_idx(*begin_op, empty_func);
     }
     op->args[*cb_idx] = (uintptr_t)func;
     op->args[*cb_idx + 1] = tcg_flags;
@@ -457,26 +437,120 @@ static TCGOp *append_udata_cb(const struct qemu_plugin_dyn_cb *cb,
     return op;
 }
 
-static TCGOp *append_inline_cb(const struct qemu_plugin_dyn_cb *cb,
-                               TCGOp *begin_op, TCGOp *op,
-                               int *unused)
+/*
+ * Address of @entry for the executing vCPU, or @global for ops that were
+ * registered against a single memory location.
+ */
+static TCGv_ptr gen_plugin_u64_ptr(qemu_plugin_u64 entry, void *global)
 {
-    /* const_ptr */
-    op = copy_const_ptr(&begin_op, op, cb->userp);
+    GArray *arr;
+    TCGv_i32 cpu_index;
+    TCGv_ptr ptr;
 
-    /* ld_i64 */
-    op = copy_ld_i64(&begin_op, op);
+    if (entry.score == NULL) {
+        return tcg_const_ptr(global);
+    }
+    arr = entry.score->data;
+    cpu_index = tcg_temp_new_i32();
+    ptr = tcg_temp_new_ptr();
 
-    /* const_i64 */
-    op = copy_const_i64(&begin_op, op, cb->inline_insn.imm);
+    tcg_gen_ld_i32(cpu_index, cpu_env,
+                   -offsetof(ArchCPU, env) + offsetof(CPUState, cpu_index));
+    tcg_gen_muli_i32(cpu_index, cpu_index, g_array_get_element_size(arr));
+    tcg_gen_ext_i32_ptr(ptr, cpu_index);
+    tcg_gen_addi_ptr(ptr, ptr, (intptr_t)(arr->data + entry.offset));
 
-    /* add_i64 */
-    op = copy_add_i64(&begin_op, op);
+    tcg_temp_free_i32(cpu_index);
+    return ptr;
+}
 
-    /* st_i64 */
-    op = copy_st_i64(&begin_op, op);
+static void gen_inline_cb(const struct qemu_plugin_dyn_cb *cb)
+{
+    TCGv_ptr ptr = gen_plugin_u64_ptr(cb->inline_insn.entry, cb->userp);
+    TCGv_i64 val = tcg_temp_new_i64();
 
-    return op;
+    switch (cb->inline_insn.op) {
+    case QEMU_PLUGIN_INLINE_ADD_U64:
+        tcg_gen_ld_i64(val, ptr, 0);
+        tcg_gen_addi_i64(val, val, cb->inline_insn.imm);
+        break;
+    case QEMU_PLUGIN_INLINE_STORE_U64:
+        tcg_gen_movi_i64(val, cb->inline_insn.imm);
+        break;
+    default:
+        g_assert_not_reached();
+    }
+    tcg_gen_st_i64(val, ptr, 0);
+
+    tcg_temp_free_i64(val);
+    tcg_temp_free_ptr(ptr);
+}
+
+static TCGCond plugin_cond_to_tcgcond(enum qemu_plugin_cond cond)
+{
+    switch (cond) {
+    case QEMU_PLUGIN_COND_EQ:
+        return TCG_COND_EQ;
+    case QEMU_PLUGIN_COND_NE:
+        return TCG_COND_NE;
+    case QEMU_PLUGIN_COND_LT:
+        return TCG_COND_LTU;
+    case QEMU_PLUGIN_COND_LE:
+        return TCG_COND_LEU;
+    case QEMU_PLUGIN_COND_GT:
+        return TCG_COND_GTU;
+    case QEMU_PLUGIN_COND_GE:
+        return TCG_COND_GEU;
+    default:
+        /* ALWAYS and NEVER are handled by the caller */
+        g_assert_not_reached();
+    }
+}
+
+/*
+ * The branch ends the basic block, which is why conditional callbacks are
+ * only offered at TB and instruction boundaries: no normal temp of the
+ * guest translation is live there.
+ */
+static void gen_cond_cb(const struct qemu_plugin_dyn_cb *cb)
+{
+    TCGLabel *skip = NULL;
+    TCGv_i32 cpu_index;
+    TCGv_ptr udata;
+    TCGOp *op;
+    int idx;
+
+    if (cb->cond.cond != QEMU_PLUGIN_COND_ALWAYS) {
+        TCGv_ptr ptr = gen_plugin_u64_ptr(cb->cond.entry, NULL);
+        TCGv_i64 val = tcg_temp_new_i64();
+
+        skip = gen_new_label();
+        tcg_gen_ld_i64(val, ptr, 0);
+        tcg_gen_brcondi_i64(tcg_invert_cond(
+                                plugin_cond_to_tcgcond(cb->cond.cond)),
+                            val, cb->cond.imm, skip);
+        tcg_temp_free_i64(val);
+        tcg_temp_free_ptr(ptr);
+    }
+
+    cpu_index = tcg_temp_new_i32();
+    udata = tcg_const_ptr(cb->userp);
+    tcg_gen_ld_i32(cpu_index, cpu_env,
+                   -offsetof(ArchCPU, env) + offsetof(CPUState, cpu_index));
+    gen_helper_plugin_vcpu_udata_cb(cpu_index, udata);
+    tcg_temp_free_ptr(udata);
+    tcg_temp_free_i32(cpu_index);
+
+    /* point the call at the plugin's callback, as copy_call() does */
+    op = QTAILQ_PREV(tcg_ctx->emit_before_op, link);
+    op = find_op_rev(op, INDEX_op_call);
+    idx = find_call_func_idx(op, HELPER(plugin_vcpu_udata_cb));
+    op->args[idx] = (uintptr_t)cb->f.vcpu_udata;
+    op->args[idx + 1] = cb->tcg_flags;
+
+    if (skip) {
+        gen_set_label(skip);
+    }
 }
 
 static TCGOp *append_mem_cb(const struct qemu_plugin_dyn_cb *cb,
@@ -565,10 +639,38 @@ inject_udata_cb(const GArray *cbs, TCGOp *begin_op)
     inject_cb_type(cbs, begin_op, append_udata_cb, op_ok);
 }
 
+/* generate the ops for @cbs in front of @begin_op, then drop the marker */
+static void
+inject_direct_cb_type(const GArray *cbs, TCGOp *begin_op, op_ok_fn ok,
+                      void (*gen)(const struct qemu_plugin_dyn_cb *cb))
+{
+    int i;
+
+    if (cbs && cbs->len) {
+        tcg_ctx->emit_before_op = begin_op;
+        for (i = 0; i < cbs->len; i++) {
+            struct qemu_plugin_dyn_cb *cb =
+                &g_array_index(cbs, struct qemu_plugin_dyn_cb, i);
+
+            if (ok(begin_op, cb)) {
+                gen(cb);
+            }
+        }
+        tcg_ctx->emit_before_op = NULL;
+    }
+    rm_ops(begin_op);
+}
+
 static void
 inject_inline_cb(const GArray *cbs, TCGOp *begin_op, op_ok_fn ok)
 {
-    inject_cb_type(cbs, begin_op, append_inline_cb, ok);
+    inject_direct_cb_type(cbs, begin_op, ok, gen_inline_cb);
+}
+
+static void
+inject_cond_cb(const GArray *cbs, TCGOp *begin_op)
+{
+    inject_direct_cb_type(cbs, begin_op, op_ok, gen_cond_cb);
 }
 
 static void
@@ -678,6 +780,12 @@ static void plugin_gen_tb_inline(const struct qemu_plugin_tb *ptb,
     inject_inline_cb(ptb->cbs[PLUGIN_CB_INLINE], begin_op, op_ok);
 }
 
+static void plugin_gen_tb_cond(const struct qemu_plugin_tb *ptb,
+                               TCGOp *begin_op)
+{
+    inject_cond_cb(ptb->cbs[PLUGIN_CB_COND], begin_op);
+}
+
 static void plugin_gen_insn_udata(const struct qemu_plugin_tb *ptb,
                                   TCGOp *begin_op, int insn_idx)
 {
@@ -694,6 +802,14 @@ static void plugin_gen_insn_inline(const struct qemu_plugin_tb *ptb,
                      begin_op, op_ok);
 }
 
+static void plugin_gen_insn_cond(const struct qemu_plugin_tb *ptb,
+                                 TCGOp *begin_op, int insn_idx)
+{
+    struct qemu_plugin_insn *insn = g_ptr_array_index(ptb->insns, insn_idx);
+
+    inject_cond_cb(insn->cbs[PLUGIN_CB_INSN][PLUGIN_CB_COND], begin_op);
+}
+
 static void plugin_gen_mem_regular(const struct qemu_plugin_tb *ptb,
                                    TCGOp *begin_op, int insn_idx)
 {
@@ -740,6 +856,9 @@ static void plugin_inject_cb(const struct qemu_plugin_tb *ptb, TCGOp *begin_op,
         case PLUGIN_GEN_CB_INLINE:
             plugin_gen_tb_inline(ptb, begin_op);
             return;
+        case PLUGIN_GEN_CB_COND:
+            plugin_gen_tb_cond(ptb, begin_op);
+            return;
         default:
             g_assert_not_reached();
         }
@@ -751,6 +870,9 @@ static void plugin_inject_cb(const struct qemu_plugin_tb *ptb, TCGOp *begin_op,
         case PLUGIN_GEN_CB_INLINE:
             plugin_gen_insn_inline(ptb, begin_op, insn_idx);
             return;
+        case PLUGIN_GEN_CB_COND:
+            plugin_gen_insn_cond(ptb, begin_op, insn_idx);
+            return;
         case PLUGIN_GEN_ENABLE_MEM_HELPER:
             plugin_gen_enable_mem_helper(ptb, begin_op, insn_idx);
             return;
@@ -816,6 +938,9 @@ static void pr_ops(void)
             case PLUGIN_GEN_CB_INLINE:
                 type = "inline";
                 break;
+            case PLUGIN_GEN_CB_COND:
+                type = "cond";
+                break;
             case PLUGIN_GEN_CB_MEM:
                 type = "mem";
                 break;
@@ -841,6 +966,11 @@ static void plugin_gen_inject(const struct qemu_plugin_tb *plugin_tb)
     int insn_idx;
 
     pr_ops();
+    /*
+     * Temps freed during translation may still be live at the points
+     * where we insert ops, so only recycle the ones allocated from here on.
+     */
+    memset(tcg_ctx->free_temps, 0, sizeof(tcg_ctx->free_temps));
     insn_idx = -1;
     QSIMPLEQ_FOREACH(op, &tcg_ctx->plugin_ops, plugin_link) {
         enum plugin_gen_from from = op->args[0];
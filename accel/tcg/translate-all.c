@@ -1277,6 +1277,62 @@ void tb_flush(CPUState *cpu)
     }
 }
 
+static gboolean tb_evict_iter(gpointer key, gpointer value, gpointer data)
+{
+    TranslationBlock *tb = value;
+
+    tb_phys_invalidate(tb, -1);
+    return false;
+}
+
+/* flush part of the code cache, falling back to a full flush */
+static void do_tb_evict(CPUState *cpu, run_on_cpu_data tb_flush_count)
+{
+    size_t n_total, n_used, n_evicted;
+
+    mmap_lock();
+    /*
+     * If the cache was flushed, or another vCPU already made room, since
+     * the request was queued, just retry.
+     */
+    tcg_region_stats(&n_total, &n_used, &n_evicted);
+    if (tb_ctx.tb_flush_count != tb_flush_count.host_int ||
+        n_used < n_total) {
+        mmap_unlock();
+        return;
+    }
+
+    /* Recycle an eighth of the cache, oldest code first.  */
+    if (tcg_region_evict(MAX(n_total / 8, 1), tb_evict_iter) == 0) {
+        mmap_unlock();
+        do_tb_flush(cpu, tb_flush_count);
+        return;
+    }
+    qatomic_set(&tb_ctx.tb_evict_count, tb_ctx.tb_evict_count + 1);
+    mmap_unlock();
+
+    /* Plugins may cache per-TB data; treat an eviction like a flush.  */
+    qemu_plugin_flush_cb();
+}
+
+/*
+ * Called when the code cache is full.  Without eviction enabled, or when
+ * the cache is a single region, this is the same as tb_flush.
+ */
+static void tb_make_room(CPUState *cpu)
+{
+    unsigned tb_flush_count = qatomic_mb_read(&tb_ctx.tb_flush_count);
+
+    if (!tb_ctx.evict) {
+        tb_flush(cpu);
+    } else if (cpu_in_exclusive_context(cpu)) {
+        do_tb_evict(cpu, RUN_ON_CPU_HOST_INT(tb_flush_count));
+    } else {
+        async_safe_run_on_cpu(cpu, do_tb_evict,
+                              RUN_ON_CPU_HOST_INT(tb_flush_count));
+    }
+}
+
 /*
  * Formerly ifdef DEBUG_TB_CHECK. These debug functions are user-mode-only,
  * so in order to prevent bit rot we compile them unconditionally in user-mode,
@@ -1713,8 +1769,8 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
  buffer_overflow:
     tb = tcg_tb_alloc(tcg_ctx);
     if (unlikely(!tb)) {
-        /* flush must be done */
-        tb_flush(cpu);
+        /* flush or eviction must be done */
+        tb_make_room(cpu);
         mmap_unlock();
         /* Make the execution loop process the flush as soon as possible.  */
         cpu->exception_index = EXCP_INTERRUPT;
@@ -2102,9 +2158,16 @@ void tb_invalidate_phys_page_fast(struct page_collection *pages,
         unsigned long b;
 
         nr = start & ~TARGET_PAGE_MASK;
-        b = p->code_bitmap[BIT_WORD(nr)] >> (nr & (BITS_PER_LONG - 1));
-        if (b & ((1 << len) - 1)) {
-            goto do_invalidate;
+        if (len > 8) {
+            /* Bulk stores, e.g. from cpu_memset_data_ra.  */
+            if (find_next_bit(p->code_bitmap, nr + len, nr) < nr + len) {
+                goto do_invalidate;
+            }
+        } else {
+            b = p->code_bitmap[BIT_WORD(nr)] >> (nr & (BITS_PER_LONG - 1));
+            if (b & ((1 << len) - 1)) {
+                goto do_invalidate;
+            }
         }
     } else {
     do_invalidate:
@@ -2372,6 +2435,7 @@ void dump_exec_info(void)
     struct tb_tree_stats tst = {};
     struct qht_stats hst;
     size_t nb_tbs, flush_full, flush_part, flush_elide;
+    size_t rg_total, rg_used, rg_evicted;
 
     tcg_tb_foreach(tb_tree_stats_iter, &tst);
     nb_tbs = tst.nb_tbs;
@@ -2406,6 +2470,11 @@ void dump_exec_info(void)
     qemu_printf("\nStatistics:\n");
     qemu_printf("TB flush count      %u\n",
                 qatomic_read(&tb_ctx.tb_flush_count));
+    qemu_printf("TB evict count      %u\n",
+                qatomic_read(&tb_ctx.tb_evict_count));
+    tcg_region_stats(&rg_total, &rg_used, &rg_evicted);
+    qemu_printf("TB regions in use   %zu/%zu (%zu recycled)\n",
+                rg_used, rg_total, rg_evicted);
     qemu_printf("TB invalidate count %zu\n",
                 tcg_tb_phys_invalidate_count());
 
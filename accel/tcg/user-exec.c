@@ -1162,6 +1162,51 @@ void cpu_stq_le_data_ra(CPUArchState *env, abi_ptr ptr,
     clear_helper_retaddr();
 }
 
+void cpu_memset_data_ra(CPUArchState *env, abi_ptr dst, uint8_t val,
+                        abi_ptr len, uintptr_t retaddr)
+{
+    while (len != 0) {
+        abi_ptr n = MIN(len, -(dst | TARGET_PAGE_MASK));
+
+        probe_access(env, dst, n, MMU_DATA_STORE, MMU_USER_IDX, retaddr);
+        set_helper_retaddr(retaddr);
+        memset(g2h(dst), val, n);
+        clear_helper_retaddr();
+        dst += n;
+        len -= n;
+    }
+}
+
+void cpu_memcpy_data_ra(CPUArchState *env, abi_ptr dst, abi_ptr src,
+                        abi_ptr len, uintptr_t retaddr)
+{
+    while (len != 0) {
+        abi_ptr n = MIN(len, MIN(-(dst | TARGET_PAGE_MASK),
+                                 -(src | TARGET_PAGE_MASK)));
+        uint8_t *d, *s;
+
+        probe_access(env, src, n, MMU_DATA_LOAD, MMU_USER_IDX, retaddr);
+        probe_access(env, dst, n, MMU_DATA_STORE, MMU_USER_IDX, retaddr);
+        d = g2h(dst);
+        s = g2h(src);
+
+        set_helper_retaddr(retaddr);
+        /* See copy_forward in cputlb.c.  */
+        if (d > s && d < s + n) {
+            abi_ptr i;
+            for (i = 0; i < n; i++) {
+                d[i] = s[i];
+            }
+        } else {
+            memmove(d, s, n);
+        }
+        clear_helper_retaddr();
+        dst += n;
+        src += n;
+        len -= n;
+    }
+}
+
 uint32_t cpu_ldub_code(CPUArchState *env, abi_ptr ptr)
 {
     uint32_t ret;
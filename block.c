@@ -5550,6 +5550,28 @@ int bdrv_get_info(BlockDriverState *bs, BlockDriverInfo *bdi)
     return drv->bdrv_get_info(bs, bdi);
 }
 
+/*
+ * Return a host file descriptor from which [*offset, *offset + bytes) of
+ * @bs can be read directly, bypassing the block layer, and update *offset
+ * to the matching position in that file.  Returns -ENOTSUP if the data
+ * passes through a driver that does not allow this.
+ *
+ * The caller must keep @bs from being drained while it uses the file
+ * descriptor, for example with an in-flight request on its BlockBackend.
+ */
+int bdrv_get_host_fd(BlockDriverState *bs, uint64_t *offset, uint64_t bytes)
+{
+    BlockDriver *drv = bs->drv;
+
+    if (!drv) {
+        return -ENOMEDIUM;
+    }
+    if (!drv->bdrv_get_host_fd) {
+        return -ENOTSUP;
+    }
+    return drv->bdrv_get_host_fd(bs, offset, bytes);
+}
+
 ImageInfoSpecific *bdrv_get_specific_info(BlockDriverState *bs,
                                           Error **errp)
 {
@@ -26,6 +26,7 @@
 #include "qemu/osdep.h"
 #include "block/accounting.h"
 #include "block/block_int.h"
+#include "qemu/host-utils.h"
 #include "qemu/timer.h"
 #include "sysemu/qtest.h"
 
@@ -280,3 +281,68 @@ double block_acct_queue_depth(BlockAcctTimedStats *stats,
 
     return (double) sum / elapsed;
 }
+
+/*
+ * Enable or disable the node latency histograms of @stats.  Enabling them
+ * starts over from zero.
+ */
+void block_node_latency_enable(BlockNodeLatencyStats *stats, bool enable)
+{
+    int i, j;
+
+    if (enable && !qatomic_read(&stats->enabled)) {
+        for (i = 0; i < BLOCK_MAX_IOTYPE; i++) {
+            stat64_init(&stats->hist[i].total_time_ns, 0);
+            for (j = 0; j < BLOCK_NODE_LATENCY_BINS; j++) {
+                stat64_init(&stats->hist[i].bins[j], 0);
+            }
+        }
+    }
+    qatomic_set(&stats->enabled, enable);
+}
+
+/*
+ * Returns the start time to pass to block_node_latency_done(), or -1 if the
+ * histograms of @stats are disabled.
+ */
+int64_t block_node_latency_start(BlockNodeLatencyStats *stats)
+{
+    if (!qatomic_read(&stats->enabled)) {
+        return -1;
+    }
+    return qemu_clock_get_ns(clock_type);
+}
+
+void block_node_latency_done(BlockNodeLatencyStats *stats,
+                             enum BlockAcctType type, int64_t start_ns)
+{
+    BlockNodeLatencyHistogram *hist;
+    int64_t latency_ns;
+    int bin;
+
+    assert(type < BLOCK_MAX_IOTYPE);
+
+    if (start_ns < 0) {
+        return;
+    }
+
+    latency_ns = qemu_clock_get_ns(clock_type) - start_ns;
+    if (qtest_enabled()) {
+        latency_ns = qtest_latency_ns;
+    }
+    latency_ns = MAX(latency_ns, 0);
+
+    bin = 64 - clz64(latency_ns >> BLOCK_NODE_LATENCY_MIN_SHIFT);
+    bin = MIN(bin, BLOCK_NODE_LATENCY_BINS - 1);
+
+    hist = &stats->hist[type];
+    stat64_add(&hist->total_time_ns, latency_ns);
+    stat64_add(&hist->bins[bin], 1);
+}
+
+/* Returns the lower bound of @bin (which must not be 0) in nanoseconds */
+uint64_t block_node_latency_boundary(int bin)
+{
+    assert(bin > 0 && bin < BLOCK_NODE_LATENCY_BINS);
+    return 1ULL << (BLOCK_NODE_LATENCY_MIN_SHIFT + bin - 1);
+}
@@ -2416,6 +2416,21 @@ int coroutine_fn blk_co_copy_range(BlockBackend *blk_in, int64_t off_in,
                               bytes, read_flags, write_flags);
 }
 
+int coroutine_fn blk_co_share_clusters(BlockBackend *blk, int64_t src_offset,
+                                       int64_t dst_offset, int64_t bytes)
+{
+    int r;
+    r = blk_check_byte_request(blk, src_offset, bytes);
+    if (r) {
+        return r;
+    }
+    r = blk_check_byte_request(blk, dst_offset, bytes);
+    if (r) {
+        return r;
+    }
+    return bdrv_co_share_clusters(blk->root, src_offset, dst_offset, bytes);
+}
+
 const BdrvChild *blk_root(BlockBackend *blk)
 {
     return blk->root;
@@ -51,6 +51,9 @@ struct BdrvDirtyBitmap {
     bool skip_store;            /* We are either migrating or deleting this
                                  * bitmap; it should not be stored on the next
                                  * inactivation. */
+    bool unloaded;              /* Persistent bitmap whose data has not been
+                                   read from the image yet; the HBitmap is
+                                   empty until bdrv_dirty_bitmap_load(). */
     QLIST_ENTRY(BdrvDirtyBitmap) list;
 };
 
@@ -578,7 +581,9 @@ BlockDirtyInfoList *bdrv_query_dirty_bitmaps(BlockDriverState *bs)
     QLIST_FOREACH(bm, &bs->dirty_bitmaps, list) {
         BlockDirtyInfo *info = g_new0(BlockDirtyInfo, 1);
         BlockDirtyInfoList *entry = g_new0(BlockDirtyInfoList, 1);
-        info->count = bdrv_get_dirty_count(bm);
+        /* The data of an unloaded bitmap is not read just to count it */
+        info->has_count = !bm->unloaded;
+        info->count = info->has_count ? bdrv_get_dirty_count(bm) : 0;
         info->granularity = bdrv_dirty_bitmap_granularity(bm);
         info->has_name = !!bm->name;
         info->name = g_strdup(bm->name);
@@ -588,6 +593,8 @@ BlockDirtyInfoList *bdrv_query_dirty_bitmaps(BlockDriverState *bs)
         info->persistent = bm->persistent;
         info->has_inconsistent = bm->inconsistent;
         info->inconsistent = bm->inconsistent;
+        info->has_unloaded = bm->unloaded;
+        info->unloaded = bm->unloaded;
         entry->value = info;
         *plist = entry;
         plist = &entry->next;
@@ -867,6 +874,59 @@ bool bdrv_dirty_bitmap_inconsistent(const BdrvDirtyBitmap *bitmap)
     return bitmap->inconsistent;
 }
 
+/* Called with BQL taken. */
+void bdrv_dirty_bitmap_set_unloaded(BdrvDirtyBitmap *bitmap)
+{
+    bdrv_dirty_bitmaps_lock(bitmap->bs);
+    assert(bitmap->persistent && bitmap->disabled);
+    bitmap->unloaded = true;
+    bdrv_dirty_bitmaps_unlock(bitmap->bs);
+}
+
+bool bdrv_dirty_bitmap_unloaded(const BdrvDirtyBitmap *bitmap)
+{
+    return bitmap->unloaded;
+}
+
+/*
+ * Read the data of a bitmap that was deferred by the driver when opening
+ * the image.  On failure, the bitmap is marked inconsistent.
+ *
+ * Called with BQL taken.
+ */
+int bdrv_dirty_bitmap_load(BdrvDirtyBitmap *bitmap, Error **errp)
+{
+    BlockDriverState *bs = bitmap->bs;
+    AioContext *ctx;
+    int ret;
+
+    if (!bitmap->unloaded) {
+        return 0;
+    }
+
+    if (!bs->drv || !bs->drv->bdrv_load_persistent_dirty_bitmap) {
+        error_setg(errp, "Cannot load bitmap '%s' from node '%s'",
+                   bitmap->name, bdrv_get_device_or_node_name(bs));
+        ret = -ENOMEDIUM;
+    } else {
+        ctx = bdrv_get_aio_context(bs);
+        aio_context_acquire(ctx);
+        ret = bs->drv->bdrv_load_persistent_dirty_bitmap(bs, bitmap, errp);
+        aio_context_release(ctx);
+    }
+
+    bdrv_dirty_bitmaps_lock(bs);
+    bitmap->unloaded = false;
+    if (ret < 0) {
+        /* Partially read data must not be mistaken for the bitmap */
+        hbitmap_reset_all(bitmap->bitmap);
+        bitmap->inconsistent = true;
+    }
+    bdrv_dirty_bitmaps_unlock(bs);
+
+    return ret;
+}
+
 BdrvDirtyBitmap *bdrv_dirty_bitmap_first(BlockDriverState *bs)
 {
     return QLIST_FIRST(&bs->dirty_bitmaps);
@@ -1023,10 +1023,10 @@ static void bdrv_co_io_em_complete(void *opaque, int ret)
     aio_co_wake(co->coroutine);
 }
 
-static int coroutine_fn bdrv_driver_preadv(BlockDriverState *bs,
-                                           uint64_t offset, uint64_t bytes,
-                                           QEMUIOVector *qiov,
-                                           size_t qiov_offset, int flags)
+static int coroutine_fn bdrv_driver_do_preadv(BlockDriverState *bs,
+                                              uint64_t offset, uint64_t bytes,
+                                              QEMUIOVector *qiov,
+                                              size_t qiov_offset, int flags)
 {
     BlockDriver *drv = bs->drv;
     int64_t sector_num;
@@ -1092,10 +1092,24 @@ out:
     return ret;
 }
 
-static int coroutine_fn bdrv_driver_pwritev(BlockDriverState *bs,
-                                            uint64_t offset, uint64_t bytes,
-                                            QEMUIOVector *qiov,
-                                            size_t qiov_offset, int flags)
+static int coroutine_fn bdrv_driver_preadv(BlockDriverState *bs,
+                                           uint64_t offset, uint64_t bytes,
+                                           QEMUIOVector *qiov,
+                                           size_t qiov_offset, int flags)
+{
+    int64_t start_ns = block_node_latency_start(&bs->latency_stats);
+    int ret;
+
+    ret = bdrv_driver_do_preadv(bs, offset, bytes, qiov, qiov_offset, flags);
+    block_node_latency_done(&bs->latency_stats, BLOCK_ACCT_READ, start_ns);
+
+    return ret;
+}
+
+static int coroutine_fn bdrv_driver_do_pwritev(BlockDriverState *bs,
+                                               uint64_t offset, uint64_t bytes,
+                                               QEMUIOVector *qiov,
+                                               size_t qiov_offset, int flags)
 {
     BlockDriver *drv = bs->drv;
     int64_t sector_num;
@@ -1172,6 +1186,20 @@ emulate_flags:
     return ret;
 }
 
+static int coroutine_fn bdrv_driver_pwritev(BlockDriverState *bs,
+                                            uint64_t offset, uint64_t bytes,
+                                            QEMUIOVector *qiov,
+                                            size_t qiov_offset, int flags)
+{
+    int64_t start_ns = block_node_latency_start(&bs->latency_stats);
+    int ret;
+
+    ret = bdrv_driver_do_pwritev(bs, offset, bytes, qiov, qiov_offset, flags);
+    block_node_latency_done(&bs->latency_stats, BLOCK_ACCT_WRITE, start_ns);
+
+    return ret;
+}
+
 static int coroutine_fn
 bdrv_driver_pwritev_compressed(BlockDriverState *bs, uint64_t offset,
                                uint64_t bytes, QEMUIOVector *qiov,
@@ -2887,6 +2915,49 @@ out:
     return ret;
 }
 
+int coroutine_fn bdrv_co_share_clusters(BdrvChild *child, int64_t src_offset,
+                                        int64_t dst_offset, int64_t bytes)
+{
+    BdrvTrackedRequest req;
+    BlockDriverState *bs = child->bs;
+    int ret;
+
+    if (!bs || !bs->drv || !bdrv_is_inserted(bs)) {
+        return -ENOMEDIUM;
+    }
+
+    if (!bs->drv->bdrv_co_share_clusters) {
+        return -ENOTSUP;
+    }
+
+    if (bdrv_has_readonly_bitmaps(bs)) {
+        return -EPERM;
+    }
+
+    ret = bdrv_check_byte_request(bs, src_offset, bytes);
+    if (ret < 0) {
+        return ret;
+    }
+    ret = bdrv_check_byte_request(bs, dst_offset, bytes);
+    if (ret < 0) {
+        return ret;
+    }
+
+    bdrv_inc_in_flight(bs);
+    tracked_request_begin(&req, bs, dst_offset, bytes, BDRV_TRACKED_WRITE);
+
+    ret = bdrv_co_write_req_prepare(child, dst_offset, bytes, &req, 0);
+    if (ret == 0) {
+        ret = bs->drv->bdrv_co_share_clusters(bs, src_offset, dst_offset,
+                                              bytes);
+    }
+
+    bdrv_co_write_req_finish(child, dst_offset, bytes, &req, ret);
+    tracked_request_end(&req);
+    bdrv_dec_in_flight(bs);
+    return ret;
+}
+
 int bdrv_co_ioctl(BlockDriverState *bs, int req, void *buf)
 {
     BlockDriver *drv = bs->drv;
@@ -51,11 +51,22 @@ typedef struct LuringState {
 
     struct io_uring ring;
 
-    /* io queue for submit at batch.  Protected by AioContext lock. */
+    /*
+     * io queue for submit at batch.  Protected by AioContext lock.
+     *
+     * The ring and this queue are shared by all nodes in the AioContext, so
+     * requests are not submitted right away but by submit_bh.  This way all
+     * requests that the nodes queue within one event loop iteration are
+     * submitted with a single io_uring_enter(2), whether or not the
+     * nodes are plugged.
+     */
     LuringQueue io_q;
 
     /* I/O completion processing.  Only runs in I/O thread.  */
     QEMUBH *completion_bh;
+
+    /* Deferred submission of io_q.  Only runs in I/O thread.  */
+    QEMUBH *submit_bh;
 } LuringState;
 
 /**
@@ -268,6 +279,17 @@ static void qemu_luring_completion_bh(void *opaque)
     luring_process_completions_and_submit(s);
 }
 
+static void qemu_luring_submit_bh(void *opaque)
+{
+    LuringState *s = opaque;
+
+    aio_context_acquire(s->aio_context);
+    if (!s->io_q.plugged && !s->io_q.blocked && s->io_q.in_queue > 0) {
+        ioq_submit(s);
+    }
+    aio_context_release(s->aio_context);
+}
+
 static void qemu_luring_completion_cb(void *opaque)
 {
     LuringState *s = opaque;
@@ -308,7 +330,7 @@ void luring_io_unplug(BlockDriverState *bs, LuringState *s)
                            s->io_q.in_queue, s->io_q.in_flight);
     if (--s->io_q.plugged == 0 &&
         !s->io_q.blocked && s->io_q.in_queue > 0) {
-        ioq_submit(s);
+        qemu_bh_schedule(s->submit_bh);
     }
 }
 
@@ -320,7 +342,9 @@ void luring_io_unplug(BlockDriverState *bs, LuringState *s)
  * @offset: offset for request
  * @type: type of request
  *
- * Fetches sqes from ring, adds to pending queue and preps them
+ * Fetches sqes from ring, adds to pending queue and preps them.  The queue
+ * is only submitted right away if it would fill the ring, otherwise this is
+ * left to submit_bh.
  *
  */
 static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
@@ -352,13 +376,17 @@ static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
     s->io_q.in_queue++;
     trace_luring_do_submit(s, s->io_q.blocked, s->io_q.plugged,
                            s->io_q.in_queue, s->io_q.in_flight);
-    if (!s->io_q.blocked &&
-        (!s->io_q.plugged ||
-         s->io_q.in_flight + s->io_q.in_queue >= MAX_ENTRIES)) {
+    if (s->io_q.blocked) {
+        return 0;
+    }
+    if (s->io_q.in_flight + s->io_q.in_queue >= MAX_ENTRIES) {
         ret = ioq_submit(s);
         trace_luring_do_submit_done(s, ret);
         return ret;
     }
+    if (!s->io_q.plugged) {
+        qemu_bh_schedule(s->submit_bh);
+    }
     return 0;
 }
 
@@ -391,6 +419,7 @@ void luring_detach_aio_context(LuringState *s, AioContext *old_context)
     aio_set_fd_handler(old_context, s->ring.ring_fd, false, NULL, NULL, NULL,
                        s);
     qemu_bh_delete(s->completion_bh);
+    qemu_bh_delete(s->submit_bh);
     s->aio_context = NULL;
 }
 
@@ -398,6 +427,7 @@ void luring_attach_aio_context(LuringState *s, AioContext *new_context)
 {
     s->aio_context = new_context;
     s->completion_bh = aio_bh_new(new_context, qemu_luring_completion_bh, s);
+    s->submit_bh = aio_bh_new(new_context, qemu_luring_submit_bh, s);
     aio_set_fd_handler(s->aio_context, s->ring.ring_fd, false,
                        qemu_luring_completion_cb, NULL, qemu_luring_poll_cb, s);
 }
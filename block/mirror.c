@@ -27,6 +27,8 @@
 #define MAX_IN_FLIGHT 16
 #define MAX_IO_BYTES (1 << 20) /* 1 Mb */
 #define DEFAULT_MIRROR_BUF_SIZE (MAX_IN_FLIGHT * MAX_IO_BYTES)
+/* Largest clean gap between dirty chunks that is copied to merge them */
+#define MIRROR_COALESCE_GAP (1 << 18) /* 256 Kb */
 
 /* The mirroring buffer is a list of granularity-sized chunks.
  * Free chunks are organized in a list.
@@ -36,8 +38,18 @@ typedef struct MirrorBuffer {
 } MirrorBuffer;
 
 typedef struct MirrorOp MirrorOp;
+typedef struct MirrorBlockJob MirrorBlockJob;
 
-typedef struct MirrorBlockJob {
+/* A part of the disk that is scanned for dirty chunks with its own cursor */
+typedef struct MirrorRange {
+    MirrorBlockJob *s;
+    int64_t start;
+    int64_t end;
+    BdrvDirtyBitmapIter *dbi;
+    uint64_t delay_ns;
+} MirrorRange;
+
+struct MirrorBlockJob {
     BlockJob common;
     BlockBackend *target;
     BlockDriverState *mirror_top_bs;
@@ -66,7 +78,6 @@ typedef struct MirrorBlockJob {
     int64_t bdev_length;
     unsigned long *cow_bitmap;
     BdrvDirtyBitmap *dirty_bitmap;
-    BdrvDirtyBitmapIter *dbi;
     uint8_t *buf;
     QSIMPLEQ_HEAD(, MirrorBuffer) buf_free;
     int buf_free_count;
@@ -84,7 +95,16 @@ typedef struct MirrorBlockJob {
     int in_active_write_counter;
     bool prepared;
     bool in_drain;
-} MirrorBlockJob;
+
+    /* Number of independent copy pipelines */
+    int workers;
+    int max_in_flight;
+    int64_t coalesce_gap;
+    MirrorRange *ranges;
+    int nb_ranges;
+    int iterations_running;
+    CoQueue iterations_done;
+};
 
 typedef struct MirrorBDSOpaque {
     MirrorBlockJob *job;
@@ -292,9 +312,10 @@ mirror_wait_for_any_operation(MirrorBlockJob *s, bool active)
     QTAILQ_FOREACH(op, &s->ops_in_flight, next) {
         /* Do not wait on pseudo ops, because it may in turn wait on
          * some other operation to start, which may in fact be the
-         * caller of this function.  Since there is only one pseudo op
-         * at any given time, we will always find some real operation
-         * to wait on. */
+         * caller of this function.  Since there is at most one pseudo op
+         * per range at any given time, and pseudo ops do not use up
+         * in-flight slots or buffers, we will always find some real
+         * operation to wait on. */
         if (!op->is_pseudo_op && op->is_in_flight &&
             op->is_active_write == active)
         {
@@ -454,8 +475,9 @@ static unsigned mirror_perform(MirrorBlockJob *s, int64_t offset,
     return bytes_handled;
 }
 
-static uint64_t coroutine_fn mirror_iteration(MirrorBlockJob *s)
+static uint64_t coroutine_fn mirror_iteration(MirrorRange *r)
 {
+    MirrorBlockJob *s = r->s;
     BlockDriverState *source = s->mirror_top_bs->backing->bs;
     MirrorOp *pseudo_op;
     int64_t offset;
@@ -463,21 +485,29 @@ static uint64_t coroutine_fn mirror_iteration(MirrorBlockJob *s)
     /* At least the first dirty chunk is mirrored in one iteration. */
     int nb_chunks = 1;
     bool write_zeroes_ok = bdrv_can_write_zeroes_with_unmap(blk_bs(s->target));
-    int max_io_bytes = MAX(s->buf_size / MAX_IN_FLIGHT, MAX_IO_BYTES);
+    int max_io_bytes = MAX(s->buf_size / s->max_in_flight, MAX_IO_BYTES);
 
     bdrv_dirty_bitmap_lock(s->dirty_bitmap);
-    offset = bdrv_dirty_iter_next(s->dbi);
-    if (offset < 0) {
-        bdrv_set_dirty_iter(s->dbi, 0);
-        offset = bdrv_dirty_iter_next(s->dbi);
+    offset = bdrv_dirty_iter_next(r->dbi);
+    if (offset < 0 || offset >= r->end) {
+        bdrv_set_dirty_iter(r->dbi, r->start);
+        offset = bdrv_dirty_iter_next(r->dbi);
         trace_mirror_restart_iter(s, bdrv_get_dirty_count(s->dirty_bitmap));
-        assert(offset >= 0);
+        if (offset < 0 || offset >= r->end) {
+            /* Other ranges are dirty, but not this one */
+            assert(s->nb_ranges > 1);
+            bdrv_dirty_bitmap_unlock(s->dirty_bitmap);
+            return 0;
+        }
     }
     bdrv_dirty_bitmap_unlock(s->dirty_bitmap);
 
     mirror_wait_on_conflicts(NULL, s, offset, 1);
 
-    job_pause_point(&s->common.job);
+    /* Only the job coroutine itself may pause, see mirror_iterate() */
+    if (qemu_coroutine_self() == s->common.job.co) {
+        job_pause_point(&s->common.job);
+    }
 
     /* Find the number of consective dirty chunks following the first dirty
      * one, and wait for in flight requests in them. */
@@ -486,19 +516,41 @@ static uint64_t coroutine_fn mirror_iteration(MirrorBlockJob *s)
         int64_t next_dirty;
         int64_t next_offset = offset + nb_chunks * s->granularity;
         int64_t next_chunk = next_offset / s->granularity;
-        if (next_offset >= s->bdev_length ||
-            !bdrv_dirty_bitmap_get_locked(s->dirty_bitmap, next_offset)) {
+        if (next_offset >= r->end) {
             break;
         }
+        if (!bdrv_dirty_bitmap_get_locked(s->dirty_bitmap, next_offset)) {
+            int64_t gap_chunks;
+
+            /* Copy a short clean gap too if more dirty chunks follow it, so
+             * that the target sees fewer and larger writes */
+            if (!s->coalesce_gap) {
+                break;
+            }
+            next_dirty = bdrv_dirty_bitmap_next_dirty(
+                s->dirty_bitmap, next_offset,
+                MIN(s->coalesce_gap, r->end - next_offset));
+            if (next_dirty < 0 || next_dirty - offset >= s->buf_size) {
+                break;
+            }
+            gap_chunks = (next_dirty - next_offset) / s->granularity;
+            if (find_next_bit(s->in_flight_bitmap, next_chunk + gap_chunks + 1,
+                              next_chunk) <= next_chunk + gap_chunks) {
+                break;
+            }
+            trace_mirror_coalesce_gap(s, next_offset, next_dirty - next_offset);
+            nb_chunks += gap_chunks;
+            continue;
+        }
         if (test_bit(next_chunk, s->in_flight_bitmap)) {
             break;
         }
 
-        next_dirty = bdrv_dirty_iter_next(s->dbi);
+        next_dirty = bdrv_dirty_iter_next(r->dbi);
         if (next_dirty > next_offset || next_dirty < 0) {
             /* The bitmap iterator's cache is stale, refresh it */
-            bdrv_set_dirty_iter(s->dbi, next_offset);
-            next_dirty = bdrv_dirty_iter_next(s->dbi);
+            bdrv_set_dirty_iter(r->dbi, next_offset);
+            next_dirty = bdrv_dirty_iter_next(r->dbi);
         }
         assert(next_dirty == next_offset);
         nb_chunks++;
@@ -560,7 +612,7 @@ static uint64_t coroutine_fn mirror_iteration(MirrorBlockJob *s)
             }
         }
 
-        while (s->in_flight >= MAX_IN_FLIGHT) {
+        while (s->in_flight >= s->max_in_flight) {
             trace_mirror_yield_in_flight(s, offset, s->in_flight);
             mirror_wait_for_free_in_flight_slot(s);
         }
@@ -592,6 +644,72 @@ fail:
     return ret;
 }
 
+static void coroutine_fn mirror_range_entry(void *opaque)
+{
+    MirrorRange *r = opaque;
+    MirrorBlockJob *s = r->s;
+
+    r->delay_ns = mirror_iteration(r);
+    if (--s->iterations_running == 0) {
+        qemu_co_queue_restart_all(&s->iterations_done);
+    }
+}
+
+/*
+ * Run one iteration in each range.  With more than one range, every
+ * iteration runs in a coroutine of its own, so that the block status
+ * queries of one range overlap with the waits and copies of the others.
+ * The job coroutine waits until all of them have submitted their
+ * requests, and stays busy meanwhile, so that pausing is still done only
+ * from the job coroutine.
+ */
+static uint64_t coroutine_fn mirror_iterate(MirrorBlockJob *s)
+{
+    uint64_t delay_ns = 0;
+    int i;
+
+    if (s->nb_ranges == 1) {
+        return mirror_iteration(&s->ranges[0]);
+    }
+
+    s->iterations_running = s->nb_ranges;
+    for (i = 0; i < s->nb_ranges; i++) {
+        Coroutine *co = qemu_coroutine_create(mirror_range_entry,
+                                              &s->ranges[i]);
+        qemu_coroutine_enter(co);
+    }
+    while (s->iterations_running) {
+        qemu_co_queue_wait(&s->iterations_done, NULL);
+    }
+
+    for (i = 0; i < s->nb_ranges; i++) {
+        delay_ns = MAX(delay_ns, s->ranges[i].delay_ns);
+    }
+    return delay_ns;
+}
+
+/* Split the disk into at most s->workers ranges */
+static void mirror_init_ranges(MirrorBlockJob *s)
+{
+    int64_t align = MAX(s->granularity, s->target_cluster_size);
+    int64_t range_size;
+    int i;
+
+    range_size = ROUND_UP(DIV_ROUND_UP(s->bdev_length, s->workers), align);
+    s->nb_ranges = DIV_ROUND_UP(s->bdev_length, range_size);
+    s->ranges = g_new0(MirrorRange, s->nb_ranges);
+    for (i = 0; i < s->nb_ranges; i++) {
+        MirrorRange *r = &s->ranges[i];
+
+        r->s = s;
+        r->start = i * range_size;
+        r->end = MIN(r->start + range_size, s->bdev_length);
+        r->dbi = bdrv_dirty_iter_new(s->dirty_bitmap);
+        bdrv_set_dirty_iter(r->dbi, r->start);
+    }
+    trace_mirror_init_ranges(s, s->nb_ranges, range_size);
+}
+
 static void mirror_free_init(MirrorBlockJob *s)
 {
     int granularity = s->granularity;
@@ -812,7 +930,7 @@ static int coroutine_fn mirror_dirty_init(MirrorBlockJob *s)
                 return 0;
             }
 
-            if (s->in_flight >= MAX_IN_FLIGHT) {
+            if (s->in_flight >= s->max_in_flight) {
                 trace_mirror_yield(s, UINT64_MAX, s->buf_free_count,
                                    s->in_flight);
                 mirror_wait_for_free_in_flight_slot(s);
@@ -880,6 +998,7 @@ static int coroutine_fn mirror_run(Job *job, Error **errp)
     char backing_filename[2]; /* we only need 2 characters because we are only
                                  checking for a NULL string */
     int ret = 0;
+    int i;
 
     if (job_is_cancelled(&s->common.job)) {
         goto immediate_exit;
@@ -962,8 +1081,8 @@ static int coroutine_fn mirror_run(Job *job, Error **errp)
         }
     }
 
-    assert(!s->dbi);
-    s->dbi = bdrv_dirty_iter_new(s->dirty_bitmap);
+    assert(!s->ranges);
+    mirror_init_ranges(s);
     for (;;) {
         uint64_t delay_ns = 0;
         int64_t cnt, delta;
@@ -995,13 +1114,13 @@ static int coroutine_fn mirror_run(Job *job, Error **errp)
         delta = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - s->last_pause_ns;
         if (delta < BLOCK_JOB_SLICE_TIME &&
             s->common.iostatus == BLOCK_DEVICE_IO_STATUS_OK) {
-            if (s->in_flight >= MAX_IN_FLIGHT || s->buf_free_count == 0 ||
+            if (s->in_flight >= s->max_in_flight || s->buf_free_count == 0 ||
                 (cnt == 0 && s->in_flight > 0)) {
                 trace_mirror_yield(s, cnt, s->buf_free_count, s->in_flight);
                 mirror_wait_for_free_in_flight_slot(s);
                 continue;
             } else if (cnt != 0) {
-                delay_ns = mirror_iteration(s);
+                delay_ns = mirror_iterate(s);
             }
         }
 
@@ -1093,7 +1212,10 @@ immediate_exit:
     qemu_vfree(s->buf);
     g_free(s->cow_bitmap);
     g_free(s->in_flight_bitmap);
-    bdrv_dirty_iter_free(s->dbi);
+    for (i = 0; i < s->nb_ranges; i++) {
+        bdrv_dirty_iter_free(s->ranges[i].dbi);
+    }
+    g_free(s->ranges);
 
     if (need_drain) {
         s->in_drain = true;
@@ -1542,6 +1664,7 @@ static BlockJob *mirror_start_job(
                              int creation_flags, BlockDriverState *target,
                              const char *replaces, int64_t speed,
                              uint32_t granularity, int64_t buf_size,
+                             int workers,
                              BlockMirrorBackingMode backing_mode,
                              bool zero_target,
                              BlockdevOnError on_source_error,
@@ -1574,8 +1697,10 @@ static BlockJob *mirror_start_job(
         return NULL;
     }
 
+    assert(workers >= 1 && workers <= MIRROR_MAX_WORKERS);
+
     if (buf_size == 0) {
-        buf_size = DEFAULT_MIRROR_BUF_SIZE;
+        buf_size = DEFAULT_MIRROR_BUF_SIZE * workers;
     }
 
     if (bdrv_skip_filters(bs) == bdrv_skip_filters(target)) {
@@ -1713,6 +1838,10 @@ static BlockJob *mirror_start_job(
     s->base_overlay = bdrv_find_overlay(bs, base);
     s->granularity = granularity;
     s->buf_size = ROUND_UP(buf_size, granularity);
+    s->workers = workers;
+    s->max_in_flight = MAX_IN_FLIGHT * workers;
+    s->coalesce_gap = workers > 1 ? MIRROR_COALESCE_GAP : 0;
+    qemu_co_queue_init(&s->iterations_done);
     s->unmap = unmap;
     if (auto_complete) {
         s->should_complete = true;
@@ -1819,7 +1948,7 @@ fail:
 void mirror_start(const char *job_id, BlockDriverState *bs,
                   BlockDriverState *target, const char *replaces,
                   int creation_flags, int64_t speed,
-                  uint32_t granularity, int64_t buf_size,
+                  uint32_t granularity, int64_t buf_size, int workers,
                   MirrorSyncMode mode, BlockMirrorBackingMode backing_mode,
                   bool zero_target,
                   BlockdevOnError on_source_error,
@@ -1839,7 +1968,8 @@ void mirror_start(const char *job_id, BlockDriverState *bs,
     is_none_mode = mode == MIRROR_SYNC_MODE_NONE;
     base = mode == MIRROR_SYNC_MODE_TOP ? bdrv_backing_chain_next(bs) : NULL;
     mirror_start_job(job_id, bs, creation_flags, target, replaces,
-                     speed, granularity, buf_size, backing_mode, zero_target,
+                     speed, granularity, buf_size, workers, backing_mode,
+                     zero_target,
                      on_source_error, on_target_error, unmap, NULL, NULL,
                      &mirror_job_driver, is_none_mode, base, false,
                      filter_node_name, true, copy_mode, errp);
@@ -1865,7 +1995,7 @@ BlockJob *commit_active_start(const char *job_id, BlockDriverState *bs,
     }
 
     ret = mirror_start_job(
-                     job_id, bs, creation_flags, base, NULL, speed, 0, 0,
+                     job_id, bs, creation_flags, base, NULL, speed, 0, 0, 1,
                      MIRROR_LEAVE_BACKING_CHAIN, false,
                      on_error, on_error, true, cb, opaque,
                      &commit_active_job_driver, false, base, auto_complete,
@@ -35,6 +35,7 @@
 #include "block/block_int.h"
 #include "qapi/qapi-commands-block.h"
 #include "qapi/error.h"
+#include "qemu/error-report.h"
 
 /**
  * block_dirty_bitmap_lookup:
@@ -55,6 +56,7 @@ BdrvDirtyBitmap *block_dirty_bitmap_lookup(const char *node,
 {
     BlockDriverState *bs;
     BdrvDirtyBitmap *bitmap;
+    Error *local_err = NULL;
 
     if (!node) {
         error_setg(errp, "Node cannot be NULL");
@@ -76,6 +78,14 @@ BdrvDirtyBitmap *block_dirty_bitmap_lookup(const char *node,
         return NULL;
     }
 
+    /*
+     * A bitmap that cannot be read is marked inconsistent, which the caller
+     * checks; it can still be removed.
+     */
+    if (bdrv_dirty_bitmap_load(bitmap, &local_err) < 0) {
+        warn_report_err(local_err);
+    }
+
     if (pbs) {
         *pbs = bs;
     }
@@ -283,6 +293,10 @@ BdrvDirtyBitmap *block_dirty_bitmap_merge(const char *node, const char *target,
                 dst = NULL;
                 goto out;
             }
+            if (bdrv_dirty_bitmap_load(src, errp) < 0) {
+                dst = NULL;
+                goto out;
+            }
             break;
         case QTYPE_QDICT:
             node = lst->value->u.external.node;
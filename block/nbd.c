@@ -34,6 +34,7 @@
 #include "qemu/uri.h"
 #include "qemu/option.h"
 #include "qemu/cutils.h"
+#include "qemu/error-report.h"
 #include "qemu/main-loop.h"
 
 #include "qapi/qapi-visit-sockets.h"
@@ -46,6 +47,7 @@
 
 #define EN_OPTSTR ":exportname="
 #define MAX_NBD_REQUESTS    16
+#define MAX_NBD_CONNECTIONS 16
 
 #define HANDLE_TO_INDEX(bs, handle) ((handle) ^ (uint64_t)(intptr_t)(bs))
 #define INDEX_TO_HANDLE(bs, index)  ((index)  ^ (uint64_t)(intptr_t)(bs))
@@ -104,6 +106,11 @@ typedef struct NBDConnectThread {
     AioContext *bh_ctx; /* where to schedule bh (NULL means don't schedule) */
 } NBDConnectThread;
 
+/*
+ * With the "connections" option, a node talks to the server over several
+ * connections, each with a BDRVNBDState of its own that negotiates,
+ * receives replies and reconnects independently.
+ */
 typedef struct BDRVNBDState {
     QIOChannelSocket *sioc; /* The master data channel */
     QIOChannel *ioc; /* The current I/O channel which may differ (eg TLS) */
@@ -139,15 +146,23 @@ typedef struct BDRVNBDState {
 
     bool wait_connect;
     NBDConnectThread *connect_thread;
+
+    /*
+     * Only set in bs->opaque: all connections of the node, starting with
+     * bs->opaque itself, and where the search for the next one starts.
+     */
+    uint32_t connections;
+    struct BDRVNBDState **conns;
+    int num_conns;
+    int next_conn;
 } BDRVNBDState;
 
 static QIOChannelSocket *nbd_establish_connection(SocketAddress *saddr,
                                                   Error **errp);
-static QIOChannelSocket *nbd_co_establish_connection(BlockDriverState *bs,
+static QIOChannelSocket *nbd_co_establish_connection(BDRVNBDState *s,
                                                      Error **errp);
-static void nbd_co_establish_connection_cancel(BlockDriverState *bs,
-                                               bool detach);
-static int nbd_client_handshake(BlockDriverState *bs, QIOChannelSocket *sioc,
+static void nbd_co_establish_connection_cancel(BDRVNBDState *s, bool detach);
+static int nbd_client_handshake(BDRVNBDState *s, QIOChannelSocket *sioc,
                                 Error **errp);
 
 static void nbd_clear_bdrvstate(BDRVNBDState *s)
@@ -231,24 +246,32 @@ static void reconnect_delay_timer_init(BDRVNBDState *s, uint64_t expire_time_ns)
 static void nbd_client_detach_aio_context(BlockDriverState *bs)
 {
     BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    int i;
 
-    /* Timer is deleted in nbd_client_co_drain_begin() */
-    assert(!s->reconnect_delay_timer);
-    qio_channel_detach_aio_context(QIO_CHANNEL(s->ioc));
+    for (i = 0; i < s->num_conns; i++) {
+        BDRVNBDState *c = s->conns[i];
+
+        /* Timer is deleted in nbd_client_co_drain_begin() */
+        assert(!c->reconnect_delay_timer);
+        qio_channel_detach_aio_context(QIO_CHANNEL(c->ioc));
+    }
 }
 
 static void nbd_client_attach_aio_context_bh(void *opaque)
 {
     BlockDriverState *bs = opaque;
     BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    int i;
 
     /*
-     * The node is still drained, so we know the coroutine has yielded in
-     * nbd_read_eof(), the only place where bs->in_flight can reach 0, or it is
-     * entered for the first time. Both places are safe for entering the
-     * coroutine.
+     * The node is still drained, so we know the coroutines have yielded in
+     * nbd_read_eof(), the only place where bs->in_flight can reach 0, or they
+     * are entered for the first time. Both places are safe for entering the
+     * coroutines.
      */
-    qemu_aio_coroutine_enter(bs->aio_context, s->connection_co);
+    for (i = 0; i < s->num_conns; i++) {
+        qemu_aio_coroutine_enter(bs->aio_context, s->conns[i]->connection_co);
+    }
     bdrv_dec_in_flight(bs);
 }
 
@@ -256,13 +279,18 @@ static void nbd_client_attach_aio_context(BlockDriverState *bs,
                                           AioContext *new_context)
 {
     BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    int i;
 
     /*
-     * s->connection_co is either yielded from nbd_receive_reply or from
+     * connection_co is either yielded from nbd_receive_reply or from
      * nbd_co_reconnect_loop()
      */
-    if (s->state == NBD_CLIENT_CONNECTED) {
-        qio_channel_attach_aio_context(QIO_CHANNEL(s->ioc), new_context);
+    for (i = 0; i < s->num_conns; i++) {
+        BDRVNBDState *c = s->conns[i];
+
+        if (c->state == NBD_CLIENT_CONNECTED) {
+            qio_channel_attach_aio_context(QIO_CHANNEL(c->ioc), new_context);
+        }
     }
 
     bdrv_inc_in_flight(bs);
@@ -277,37 +305,47 @@ static void nbd_client_attach_aio_context(BlockDriverState *bs,
 static void coroutine_fn nbd_client_co_drain_begin(BlockDriverState *bs)
 {
     BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    int i;
 
-    s->drained = true;
-    if (s->connection_co_sleep_ns_state) {
-        qemu_co_sleep_wake(s->connection_co_sleep_ns_state);
-    }
+    for (i = 0; i < s->num_conns; i++) {
+        BDRVNBDState *c = s->conns[i];
 
-    nbd_co_establish_connection_cancel(bs, false);
+        c->drained = true;
+        if (c->connection_co_sleep_ns_state) {
+            qemu_co_sleep_wake(c->connection_co_sleep_ns_state);
+        }
 
-    reconnect_delay_timer_del(s);
+        nbd_co_establish_connection_cancel(c, false);
 
-    if (s->state == NBD_CLIENT_CONNECTING_WAIT) {
-        s->state = NBD_CLIENT_CONNECTING_NOWAIT;
-        qemu_co_queue_restart_all(&s->free_sema);
+        reconnect_delay_timer_del(c);
+
+        if (c->state == NBD_CLIENT_CONNECTING_WAIT) {
+            c->state = NBD_CLIENT_CONNECTING_NOWAIT;
+            qemu_co_queue_restart_all(&c->free_sema);
+        }
     }
 }
 
 static void coroutine_fn nbd_client_co_drain_end(BlockDriverState *bs)
 {
     BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    int i;
 
-    s->drained = false;
-    if (s->wait_drained_end) {
-        s->wait_drained_end = false;
-        aio_co_wake(s->connection_co);
+    for (i = 0; i < s->num_conns; i++) {
+        BDRVNBDState *c = s->conns[i];
+
+        c->drained = false;
+        if (c->wait_drained_end) {
+            c->wait_drained_end = false;
+            aio_co_wake(c->connection_co);
+        }
     }
 }
 
 
-static void nbd_teardown_connection(BlockDriverState *bs)
+static void nbd_teardown_connection(BDRVNBDState *s)
 {
-    BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    BlockDriverState *bs = s->bs;
 
     if (s->ioc) {
         /* finish any pending coroutines */
@@ -323,7 +361,7 @@ static void nbd_teardown_connection(BlockDriverState *bs)
         if (s->connection_co_sleep_ns_state) {
             qemu_co_sleep_wake(s->connection_co_sleep_ns_state);
         }
-        nbd_co_establish_connection_cancel(bs, true);
+        nbd_co_establish_connection_cancel(s, true);
     }
     if (qemu_in_coroutine()) {
         s->teardown_co = qemu_coroutine_self();
@@ -425,10 +463,9 @@ static void *connect_thread_func(void *opaque)
 }
 
 static QIOChannelSocket *coroutine_fn
-nbd_co_establish_connection(BlockDriverState *bs, Error **errp)
+nbd_co_establish_connection(BDRVNBDState *s, Error **errp)
 {
     QemuThread thread;
-    BDRVNBDState *s = bs->opaque;
     QIOChannelSocket *res;
     NBDConnectThread *thr = s->connect_thread;
 
@@ -520,10 +557,8 @@ nbd_co_establish_connection(BlockDriverState *bs, Error **errp)
  * to CONNECT_THREAD_RUNNING_DETACHED state). s->connect_thread becomes NULL if
  * detach is true.
  */
-static void nbd_co_establish_connection_cancel(BlockDriverState *bs,
-                                               bool detach)
+static void nbd_co_establish_connection_cancel(BDRVNBDState *s, bool detach)
 {
-    BDRVNBDState *s = bs->opaque;
     NBDConnectThread *thr = s->connect_thread;
     bool wake = false;
     bool do_free = false;
@@ -600,7 +635,7 @@ static coroutine_fn void nbd_reconnect_attempt(BDRVNBDState *s)
         s->ioc = NULL;
     }
 
-    sioc = nbd_co_establish_connection(s->bs, &local_err);
+    sioc = nbd_co_establish_connection(s, &local_err);
     if (!sioc) {
         ret = -ECONNREFUSED;
         goto out;
@@ -608,7 +643,7 @@ static coroutine_fn void nbd_reconnect_attempt(BDRVNBDState *s)
 
     bdrv_dec_in_flight(s->bs);
 
-    ret = nbd_client_handshake(s->bs, sioc, &local_err);
+    ret = nbd_client_handshake(s, sioc, &local_err);
 
     if (s->drained) {
         s->wait_drained_end = true;
@@ -765,11 +800,35 @@ static coroutine_fn void nbd_connection_entry(void *opaque)
     aio_wait_kick();
 }
 
-static int nbd_co_send_request(BlockDriverState *bs,
+/*
+ * Pick the connection for a new request: the connected one with the fewest
+ * requests in flight.  The search starts after the connection picked last,
+ * so that requests are striped evenly.  If none is connected, the first
+ * one decides whether the request waits for a reconnect or fails.
+ */
+static BDRVNBDState *nbd_pick_connection(BlockDriverState *bs)
+{
+    BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    BDRVNBDState *best = NULL;
+    int i;
+
+    for (i = 0; i < s->num_conns; i++) {
+        BDRVNBDState *c = s->conns[(s->next_conn + i) % s->num_conns];
+
+        if (c->state == NBD_CLIENT_CONNECTED &&
+            (!best || c->in_flight < best->in_flight)) {
+            best = c;
+        }
+    }
+    s->next_conn = (s->next_conn + 1) % s->num_conns;
+
+    return best ?: s;
+}
+
+static int nbd_co_send_request(BDRVNBDState *s,
                                NBDRequest *request,
                                QEMUIOVector *qiov)
 {
-    BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
     int rc, i = -1;
 
     qemu_co_mutex_lock(&s->send_mutex);
@@ -1480,7 +1539,7 @@ static int nbd_co_request(BlockDriverState *bs, NBDRequest *request,
 {
     int ret, request_ret;
     Error *local_err = NULL;
-    BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    BDRVNBDState *s;
 
     assert(request->type != NBD_CMD_READ);
     if (write_qiov) {
@@ -1491,7 +1550,8 @@ static int nbd_co_request(BlockDriverState *bs, NBDRequest *request,
     }
 
     do {
-        ret = nbd_co_send_request(bs, request, write_qiov);
+        s = nbd_pick_connection(bs);
+        ret = nbd_co_send_request(s, request, write_qiov);
         if (ret < 0) {
             continue;
         }
@@ -1518,6 +1578,7 @@ static int nbd_client_co_preadv(BlockDriverState *bs, uint64_t offset,
     int ret, request_ret;
     Error *local_err = NULL;
     BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    BDRVNBDState *c;
     NBDRequest request = {
         .type = NBD_CMD_READ,
         .from = offset,
@@ -1550,12 +1611,13 @@ static int nbd_client_co_preadv(BlockDriverState *bs, uint64_t offset,
     }
 
     do {
-        ret = nbd_co_send_request(bs, &request, NULL);
+        c = nbd_pick_connection(bs);
+        ret = nbd_co_send_request(c, &request, NULL);
         if (ret < 0) {
             continue;
         }
 
-        ret = nbd_co_receive_cmdread_reply(s, request.handle, offset, qiov,
+        ret = nbd_co_receive_cmdread_reply(c, request.handle, offset, qiov,
                                            &request_ret, &local_err);
         if (local_err) {
             trace_nbd_co_request_fail(request.from, request.len, request.handle,
@@ -1565,7 +1627,7 @@ static int nbd_client_co_preadv(BlockDriverState *bs, uint64_t offset,
             error_free(local_err);
             local_err = NULL;
         }
-    } while (ret < 0 && nbd_client_connecting_wait(s));
+    } while (ret < 0 && nbd_client_connecting_wait(c));
 
     return ret ? ret : request_ret;
 }
@@ -1667,6 +1729,7 @@ static int coroutine_fn nbd_client_co_block_status(
     int ret, request_ret;
     NBDExtent extent = { 0 };
     BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    BDRVNBDState *c;
     Error *local_err = NULL;
 
     NBDRequest request = {
@@ -1702,12 +1765,13 @@ static int coroutine_fn nbd_client_co_block_status(
         assert(QEMU_IS_ALIGNED(request.len, s->info.min_block));
     }
     do {
-        ret = nbd_co_send_request(bs, &request, NULL);
+        c = nbd_pick_connection(bs);
+        ret = nbd_co_send_request(c, &request, NULL);
         if (ret < 0) {
             continue;
         }
 
-        ret = nbd_co_receive_blockstatus_reply(s, request.handle, bytes,
+        ret = nbd_co_receive_blockstatus_reply(c, request.handle, bytes,
                                                &extent, &request_ret,
                                                &local_err);
         if (local_err) {
@@ -1718,7 +1782,7 @@ static int coroutine_fn nbd_client_co_block_status(
             error_free(local_err);
             local_err = NULL;
         }
-    } while (ret < 0 && nbd_client_connecting_wait(s));
+    } while (ret < 0 && nbd_client_connecting_wait(c));
 
     if (ret < 0 || request_ret < 0) {
         return ret ? ret : request_ret;
@@ -1749,12 +1813,17 @@ static void nbd_client_close(BlockDriverState *bs)
 {
     BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
     NBDRequest request = { .type = NBD_CMD_DISC };
+    int i;
 
-    if (s->ioc) {
-        nbd_send_request(s->ioc, &request);
-    }
+    for (i = 0; i < s->num_conns; i++) {
+        BDRVNBDState *c = s->conns[i];
 
-    nbd_teardown_connection(bs);
+        if (c->ioc) {
+            nbd_send_request(c->ioc, &request);
+        }
+
+        nbd_teardown_connection(c);
+    }
 }
 
 static QIOChannelSocket *nbd_establish_connection(SocketAddress *saddr,
@@ -1778,10 +1847,10 @@ static QIOChannelSocket *nbd_establish_connection(SocketAddress *saddr,
 }
 
 /* nbd_client_handshake takes ownership on sioc. On failure it is unref'ed. */
-static int nbd_client_handshake(BlockDriverState *bs, QIOChannelSocket *sioc,
+static int nbd_client_handshake(BDRVNBDState *s, QIOChannelSocket *sioc,
                                 Error **errp)
 {
-    BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    BlockDriverState *bs = s->bs;
     AioContext *aio_context = bdrv_get_aio_context(bs);
     int ret;
 
@@ -2174,6 +2243,12 @@ static QemuOptsList nbd_runtime_opts = {
                     "future requests before a successful reconnect will "
                     "immediately fail. Default 0",
         },
+        {
+            .name = "connections",
+            .type = QEMU_OPT_NUMBER,
+            .help = "Number of connections to the server, if it allows "
+                    "more than one. Default 1",
+        },
         { /* end of list */ }
     },
 };
@@ -2230,6 +2305,13 @@ static int nbd_process_options(BlockDriverState *bs, QDict *options,
 
     s->reconnect_delay = qemu_opt_get_number(opts, "reconnect-delay", 0);
 
+    s->connections = qemu_opt_get_number(opts, "connections", 1);
+    if (s->connections < 1 || s->connections > MAX_NBD_CONNECTIONS) {
+        error_setg(errp, "connections must be between 1 and %d",
+                   MAX_NBD_CONNECTIONS);
+        goto error;
+    }
+
     ret = 0;
 
  error:
@@ -2240,10 +2322,105 @@ static int nbd_process_options(BlockDriverState *bs, QDict *options,
     return ret;
 }
 
+/*
+ * Open the connections after the first one.  They must all see the same
+ * export; the server promises with NBD_FLAG_CAN_MULTI_CONN that a flush on
+ * one of them covers writes completed on the others.
+ */
+static int nbd_open_connections(BlockDriverState *bs, Error **errp)
+{
+    BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
+    int i, ret;
+
+    s->num_conns = s->connections;
+    if (s->num_conns > 1 && !(s->info.flags & NBD_FLAG_CAN_MULTI_CONN)) {
+        warn_report("NBD server does not allow multiple connections, "
+                    "using one instead of %" PRIu32, s->connections);
+        s->num_conns = 1;
+    }
+
+    s->conns = g_new0(BDRVNBDState *, s->num_conns);
+    s->conns[0] = s;
+
+    for (i = 1; i < s->num_conns; i++) {
+        BDRVNBDState *c = g_new0(BDRVNBDState, 1);
+        QIOChannelSocket *sioc;
+
+        s->conns[i] = c;
+        c->bs = bs;
+        c->reconnect_delay = s->reconnect_delay;
+        c->saddr = QAPI_CLONE(SocketAddress, s->saddr);
+        c->export = g_strdup(s->export);
+        c->tlscredsid = g_strdup(s->tlscredsid);
+        if (s->tlscreds) {
+            c->tlscreds = s->tlscreds;
+            object_ref(OBJECT(c->tlscreds));
+            c->hostname = c->saddr->u.inet.host;
+        }
+        c->x_dirty_bitmap = g_strdup(s->x_dirty_bitmap);
+        qemu_co_mutex_init(&c->send_mutex);
+        qemu_co_queue_init(&c->free_sema);
+
+        sioc = nbd_establish_connection(c->saddr, errp);
+        if (!sioc) {
+            return -ECONNREFUSED;
+        }
+
+        ret = nbd_client_handshake(c, sioc, errp);
+        if (ret < 0) {
+            return ret;
+        }
+        c->state = NBD_CLIENT_CONNECTED;
+
+        if (c->info.size != s->info.size || c->info.flags != s->info.flags ||
+            c->info.min_block != s->info.min_block ||
+            c->info.structured_reply != s->info.structured_reply ||
+            c->info.base_allocation != s->info.base_allocation) {
+            error_setg(errp, "NBD server exports a different image on "
+                       "connection %d", i);
+            return -EINVAL;
+        }
+    }
+
+    return 0;
+}
+
+/* Free the connections after the first one, once they are torn down */
+static void nbd_free_connections(BDRVNBDState *s)
+{
+    NBDRequest request = { .type = NBD_CMD_DISC };
+    int i;
+
+    for (i = 0; i < s->num_conns; i++) {
+        BDRVNBDState *c = s->conns[i];
+
+        if (!c) {
+            continue;
+        }
+        if (c->ioc) {
+            /* Only after a failed nbd_open_connections() */
+            assert(!c->connection_co);
+            nbd_send_request(c->ioc, &request);
+            object_unref(OBJECT(c->sioc));
+            c->sioc = NULL;
+            object_unref(OBJECT(c->ioc));
+            c->ioc = NULL;
+        }
+        if (c != s) {
+            nbd_clear_bdrvstate(c);
+            g_free(c);
+        }
+    }
+
+    g_free(s->conns);
+    s->conns = NULL;
+    s->num_conns = 0;
+}
+
 static int nbd_open(BlockDriverState *bs, QDict *options, int flags,
                     Error **errp)
 {
-    int ret;
+    int ret, i;
     BDRVNBDState *s = (BDRVNBDState *)bs->opaque;
     QIOChannelSocket *sioc;
 
@@ -2265,7 +2442,7 @@ static int nbd_open(BlockDriverState *bs, QDict *options, int flags,
         return -ECONNREFUSED;
     }
 
-    ret = nbd_client_handshake(bs, sioc, errp);
+    ret = nbd_client_handshake(s, sioc, errp);
     if (ret < 0) {
         nbd_clear_bdrvstate(s);
         return ret;
@@ -2273,11 +2450,22 @@ static int nbd_open(BlockDriverState *bs, QDict *options, int flags,
     /* successfully connected */
     s->state = NBD_CLIENT_CONNECTED;
 
-    nbd_init_connect_thread(s);
+    ret = nbd_open_connections(bs, errp);
+    if (ret < 0) {
+        nbd_free_connections(s);
+        nbd_clear_bdrvstate(s);
+        return ret;
+    }
+
+    for (i = 0; i < s->num_conns; i++) {
+        BDRVNBDState *c = s->conns[i];
 
-    s->connection_co = qemu_coroutine_create(nbd_connection_entry, s);
-    bdrv_inc_in_flight(bs);
-    aio_co_schedule(bdrv_get_aio_context(bs), s->connection_co);
+        nbd_init_connect_thread(c);
+
+        c->connection_co = qemu_coroutine_create(nbd_connection_entry, c);
+        bdrv_inc_in_flight(bs);
+        aio_co_schedule(bdrv_get_aio_context(bs), c->connection_co);
+    }
 
     return 0;
 }
@@ -2326,6 +2514,7 @@ static void nbd_close(BlockDriverState *bs)
     BDRVNBDState *s = bs->opaque;
 
     nbd_client_close(bs);
+    nbd_free_connections(s);
     nbd_clear_bdrvstate(s);
 }
 
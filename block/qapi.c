@@ -23,6 +23,7 @@
  */
 
 #include "qemu/osdep.h"
+#include "qemu/bswap.h"
 #include "qemu/cutils.h"
 #include "block/qapi.h"
 #include "block/block_int.h"
@@ -445,6 +446,49 @@ static void bdrv_latency_histogram_stats(BlockLatencyHistogram *hist,
     }
 }
 
+static BlockLatencyHistogramInfo *
+bdrv_node_latency_histogram_info(BlockNodeLatencyHistogram *hist)
+{
+    BlockLatencyHistogramInfo *info = g_new0(BlockLatencyHistogramInfo, 1);
+    uint64_t boundaries[BLOCK_NODE_LATENCY_BINS - 1];
+    uint64_t bins[BLOCK_NODE_LATENCY_BINS];
+    int i;
+
+    for (i = 0; i < BLOCK_NODE_LATENCY_BINS; i++) {
+        if (i > 0) {
+            boundaries[i - 1] = block_node_latency_boundary(i);
+        }
+        bins[i] = stat64_get(&hist->bins[i]);
+    }
+
+    info->boundaries = uint64_list(boundaries, BLOCK_NODE_LATENCY_BINS - 1);
+    info->bins = uint64_list(bins, BLOCK_NODE_LATENCY_BINS);
+
+    return info;
+}
+
+static BlockNodeLatencyInfo *bdrv_query_node_latency(BlockDriverState *bs)
+{
+    BlockNodeLatencyStats *stats = &bs->latency_stats;
+    BlockNodeLatencyInfo *info;
+
+    if (!qatomic_read(&stats->enabled)) {
+        return NULL;
+    }
+
+    info = g_new0(BlockNodeLatencyInfo, 1);
+    info->rd_total_time_ns =
+        stat64_get(&stats->hist[BLOCK_ACCT_READ].total_time_ns);
+    info->wr_total_time_ns =
+        stat64_get(&stats->hist[BLOCK_ACCT_WRITE].total_time_ns);
+    info->rd_histogram =
+        bdrv_node_latency_histogram_info(&stats->hist[BLOCK_ACCT_READ]);
+    info->wr_histogram =
+        bdrv_node_latency_histogram_info(&stats->hist[BLOCK_ACCT_WRITE]);
+
+    return info;
+}
+
 static void bdrv_query_blk_stats(BlockDeviceStats *ds, BlockBackend *blk)
 {
     BlockAcctStats *stats = blk_get_stats(blk);
@@ -561,6 +605,9 @@ static BlockStats *bdrv_query_bds_stats(BlockDriverState *bs,
         s->has_driver_specific = true;
     }
 
+    s->latency = bdrv_query_node_latency(bs);
+    s->has_latency = s->latency != NULL;
+
     parent_child = bdrv_primary_child(bs);
     if (!parent_child ||
         !(parent_child->role & (BDRV_CHILD_DATA | BDRV_CHILD_FILTERED)))
@@ -693,6 +740,90 @@ BlockStatsList *qmp_query_blockstats(bool has_query_nodes,
     return head;
 }
 
+void qmp_block_node_latency_histogram_set(const char *node_name, bool enable,
+                                          Error **errp)
+{
+    BlockDriverState *bs = bdrv_find_node(node_name);
+
+    if (!bs) {
+        error_setg(errp, "Cannot find node %s", node_name);
+        return;
+    }
+
+    block_node_latency_enable(&bs->latency_stats, enable);
+}
+
+#define BLOCK_NODE_LATENCY_DUMP_MAGIC   "QBLH"
+#define BLOCK_NODE_LATENCY_DUMP_VERSION 1
+
+static void latency_dump_put_u32(GByteArray *buf, uint32_t val)
+{
+    val = cpu_to_le32(val);
+    g_byte_array_append(buf, (uint8_t *)&val, sizeof(val));
+}
+
+static void latency_dump_put_u64(GByteArray *buf, uint64_t val)
+{
+    val = cpu_to_le64(val);
+    g_byte_array_append(buf, (uint8_t *)&val, sizeof(val));
+}
+
+static void latency_dump_put_hist(GByteArray *buf,
+                                  BlockNodeLatencyHistogram *hist)
+{
+    int i;
+
+    latency_dump_put_u64(buf, stat64_get(&hist->total_time_ns));
+    for (i = 0; i < BLOCK_NODE_LATENCY_BINS; i++) {
+        latency_dump_put_u64(buf, stat64_get(&hist->bins[i]));
+    }
+}
+
+void qmp_block_node_latency_dump(const char *filename, Error **errp)
+{
+    g_autoptr(GByteArray) buf = g_byte_array_new();
+    BlockDriverState *bs;
+    uint32_t nb_nodes = 0;
+    ssize_t ret;
+    int fd;
+
+    g_byte_array_append(buf, (const uint8_t *)BLOCK_NODE_LATENCY_DUMP_MAGIC,
+                        strlen(BLOCK_NODE_LATENCY_DUMP_MAGIC));
+    latency_dump_put_u32(buf, BLOCK_NODE_LATENCY_DUMP_VERSION);
+    latency_dump_put_u32(buf, BLOCK_NODE_LATENCY_BINS);
+    latency_dump_put_u32(buf, 0); /* number of nodes, filled in below */
+
+    for (bs = bdrv_next_node(NULL); bs; bs = bdrv_next_node(bs)) {
+        BlockNodeLatencyStats *stats = &bs->latency_stats;
+        const char *node_name = bdrv_get_node_name(bs);
+
+        if (!qatomic_read(&stats->enabled)) {
+            continue;
+        }
+
+        latency_dump_put_u32(buf, strlen(node_name));
+        g_byte_array_append(buf, (const uint8_t *)node_name,
+                            strlen(node_name));
+        latency_dump_put_hist(buf, &stats->hist[BLOCK_ACCT_READ]);
+        latency_dump_put_hist(buf, &stats->hist[BLOCK_ACCT_WRITE]);
+        nb_nodes++;
+    }
+    stl_le_p(buf->data + 12, nb_nodes);
+
+    fd = qemu_open_old(filename, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY,
+                       0644);
+    if (fd < 0) {
+        error_setg_file_open(errp, errno, filename);
+        return;
+    }
+
+    ret = qemu_write_full(fd, buf->data, buf->len);
+    if (ret != buf->len) {
+        error_setg_errno(errp, errno, "Could not write to '%s'", filename);
+    }
+    qemu_close(fd);
+}
+
 void bdrv_snapshot_dump(QEMUSnapshotInfo *sn)
 {
     char date_buf[128], clock_buf[128];
@@ -28,6 +28,7 @@
 #include "qemu/osdep.h"
 #include "qapi/error.h"
 #include "qemu/cutils.h"
+#include "qemu/units.h"
 
 #include "qcow2.h"
 
@@ -45,6 +46,9 @@
 /* Size of bitmap table entries */
 #define BME_TABLE_ENTRY_SIZE (sizeof(uint64_t))
 
+/* Contiguous bitmap data clusters are read in chunks of up to this size */
+#define BME_LOAD_BUF_SIZE (1 * MiB)
+
 QEMU_BUILD_BUG_ON(BME_MAX_NAME_SIZE != BDRV_BITMAP_MAX_NAME_SIZE);
 
 #if BME_MAX_TABLE_SIZE * 8ULL > INT_MAX
@@ -303,7 +307,8 @@ static int load_bitmap_data(BlockDriverState *bs,
     uint64_t offset, limit;
     uint64_t bm_size = bdrv_dirty_bitmap_size(bitmap);
     uint8_t *buf = NULL;
-    uint64_t i, tab_size =
+    uint64_t buf_clusters = MAX(BME_LOAD_BUF_SIZE / s->cluster_size, 1);
+    uint64_t i, j, n, tab_size =
             size_to_clusters(s,
                 bdrv_dirty_bitmap_serialization_size(bitmap, 0, bm_size));
 
@@ -311,29 +316,55 @@ static int load_bitmap_data(BlockDriverState *bs,
         return -EINVAL;
     }
 
-    buf = g_malloc(s->cluster_size);
+    buf_clusters = MIN(buf_clusters, tab_size);
     limit = bytes_covered_by_bitmap_cluster(s, bitmap);
-    for (i = 0, offset = 0; i < tab_size; ++i, offset += limit) {
-        uint64_t count = MIN(bm_size - offset, limit);
+    for (i = 0; i < tab_size; i += n) {
         uint64_t entry = bitmap_table[i];
         uint64_t data_offset = entry & BME_TABLE_ENTRY_OFFSET_MASK;
 
         assert(check_table_entry(entry, s->cluster_size) == 0);
 
+        offset = i * limit;
+        n = 1;
+
         if (data_offset == 0) {
             if (entry & BME_TABLE_ENTRY_FLAG_ALL_ONES) {
-                bdrv_dirty_bitmap_deserialize_ones(bitmap, offset, count,
+                bdrv_dirty_bitmap_deserialize_ones(bitmap, offset,
+                                                   MIN(bm_size - offset, limit),
                                                    false);
             } else {
                 /* No need to deserialize zeros because the dirty bitmap is
                  * already cleared */
             }
-        } else {
-            ret = bdrv_pread(bs->file, data_offset, buf, s->cluster_size);
-            if (ret < 0) {
-                goto finish;
-            }
-            bdrv_dirty_bitmap_deserialize_part(bitmap, buf, offset, count,
+            continue;
+        }
+
+        /*
+         * Bitmap data clusters are usually allocated one after another when
+         * the bitmap is stored, so read physically contiguous runs at once.
+         */
+        while (n < buf_clusters && i + n < tab_size &&
+               (bitmap_table[i + n] & BME_TABLE_ENTRY_OFFSET_MASK) ==
+               data_offset + n * s->cluster_size)
+        {
+            assert(check_table_entry(bitmap_table[i + n],
+                                     s->cluster_size) == 0);
+            n++;
+        }
+
+        if (!buf) {
+            buf = g_malloc(buf_clusters * s->cluster_size);
+        }
+        ret = bdrv_pread(bs->file, data_offset, buf, n * s->cluster_size);
+        if (ret < 0) {
+            goto finish;
+        }
+
+        for (j = 0; j < n; j++, offset += limit) {
+            bdrv_dirty_bitmap_deserialize_part(bitmap,
+                                               buf + j * s->cluster_size,
+                                               offset,
+                                               MIN(bm_size - offset, limit),
                                                false);
         }
     }
@@ -347,50 +378,58 @@ finish:
     return ret;
 }
 
-static BdrvDirtyBitmap *load_bitmap(BlockDriverState *bs,
-                                    Qcow2Bitmap *bm, Error **errp)
+static int load_bitmap_table_and_data(BlockDriverState *bs, Qcow2Bitmap *bm,
+                                      BdrvDirtyBitmap *bitmap, Error **errp)
 {
     int ret;
     uint64_t *bitmap_table = NULL;
-    uint32_t granularity;
-    BdrvDirtyBitmap *bitmap = NULL;
-
-    granularity = 1U << bm->granularity_bits;
-    bitmap = bdrv_create_dirty_bitmap(bs, granularity, bm->name, errp);
-    if (bitmap == NULL) {
-        goto fail;
-    }
-
-    if (bm->flags & BME_FLAG_IN_USE) {
-        /* Data is unusable, skip loading it */
-        return bitmap;
-    }
 
     ret = bitmap_table_load(bs, &bm->table, &bitmap_table);
     if (ret < 0) {
         error_setg_errno(errp, -ret,
                          "Could not read bitmap_table table from image for "
                          "bitmap '%s'", bm->name);
-        goto fail;
+        return ret;
     }
 
     ret = load_bitmap_data(bs, bitmap_table, bm->table.size, bitmap);
     if (ret < 0) {
         error_setg_errno(errp, -ret, "Could not read bitmap '%s' from image",
                          bm->name);
-        goto fail;
     }
 
     g_free(bitmap_table);
-    return bitmap;
+    return ret;
+}
 
-fail:
-    g_free(bitmap_table);
-    if (bitmap != NULL) {
+/*
+ * Create the BdrvDirtyBitmap for @bm.  Its data is only read if
+ * @load_data is true; otherwise it is left for
+ * qcow2_load_persistent_dirty_bitmap().
+ */
+static BdrvDirtyBitmap *load_bitmap(BlockDriverState *bs, Qcow2Bitmap *bm,
+                                    bool load_data, Error **errp)
+{
+    uint32_t granularity;
+    BdrvDirtyBitmap *bitmap = NULL;
+
+    granularity = 1U << bm->granularity_bits;
+    bitmap = bdrv_create_dirty_bitmap(bs, granularity, bm->name, errp);
+    if (bitmap == NULL) {
+        return NULL;
+    }
+
+    if (bm->flags & BME_FLAG_IN_USE) {
+        /* Data is unusable, skip loading it */
+        return bitmap;
+    }
+
+    if (load_data && load_bitmap_table_and_data(bs, bm, bitmap, errp) < 0) {
         bdrv_release_dirty_bitmap(bitmap);
+        return NULL;
     }
 
-    return NULL;
+    return bitmap;
 }
 
 /*
@@ -838,6 +877,20 @@ fail:
  * Bitmap List end
  */
 
+static Qcow2Bitmap *find_bitmap_by_name(Qcow2BitmapList *bm_list,
+                                        const char *name)
+{
+    Qcow2Bitmap *bm;
+
+    QSIMPLEQ_FOREACH(bm, bm_list, entry) {
+        if (strcmp(name, bm->name) == 0) {
+            return bm;
+        }
+    }
+
+    return NULL;
+}
+
 static int update_ext_header_and_dir_in_place(BlockDriverState *bs,
                                               Qcow2BitmapList *bm_list)
 {
@@ -977,6 +1030,7 @@ bool qcow2_load_dirty_bitmaps(BlockDriverState *bs, Error **errp)
     GSList *created_dirty_bitmaps = NULL;
     bool header_updated = false;
     bool needs_update = false;
+    bool load_data;
 
     if (s->nb_bitmaps == 0) {
         /* No bitmaps - nothing to do */
@@ -1009,22 +1063,32 @@ bool qcow2_load_dirty_bitmaps(BlockDriverState *bs, Error **errp)
             continue;
         }
 
-        bitmap = load_bitmap(bs, bm, errp);
+        /*
+         * Disabled bitmaps do not change until they are used from the
+         * monitor, so their data is only read at that point.  This keeps
+         * opening images with many checkpoints cheap.
+         */
+        load_data = bm->flags & BME_FLAG_AUTO;
+
+        bitmap = load_bitmap(bs, bm, load_data, errp);
         if (bitmap == NULL) {
             goto fail;
         }
 
         bdrv_dirty_bitmap_set_persistence(bitmap, true);
+        if (!(bm->flags & BME_FLAG_AUTO)) {
+            bdrv_disable_dirty_bitmap(bitmap);
+        }
         if (bm->flags & BME_FLAG_IN_USE) {
             bdrv_dirty_bitmap_set_inconsistent(bitmap);
         } else {
+            if (!load_data) {
+                bdrv_dirty_bitmap_set_unloaded(bitmap);
+            }
             /* NB: updated flags only get written if can_write(bs) is true. */
             bm->flags |= BME_FLAG_IN_USE;
             needs_update = true;
         }
-        if (!(bm->flags & BME_FLAG_AUTO)) {
-            bdrv_disable_dirty_bitmap(bitmap);
-        }
         created_dirty_bitmaps =
             g_slist_append(created_dirty_bitmaps, bitmap);
     }
@@ -1057,6 +1121,47 @@ fail:
     return false;
 }
 
+/*
+ * qcow2_load_persistent_dirty_bitmap()
+ * Read the data of a bitmap that qcow2_load_dirty_bitmaps() left unloaded.
+ * The bitmap was not IN_USE when the image was opened and it has been
+ * disabled since, so its bitmap table is still valid although the directory
+ * entry is now marked IN_USE.
+ */
+int qcow2_load_persistent_dirty_bitmap(BlockDriverState *bs,
+                                       BdrvDirtyBitmap *bitmap, Error **errp)
+{
+    BDRVQcow2State *s = bs->opaque;
+    const char *name = bdrv_dirty_bitmap_name(bitmap);
+    Qcow2BitmapList *bm_list;
+    Qcow2Bitmap *bm;
+    int ret;
+
+    if (s->nb_bitmaps == 0) {
+        error_setg(errp, "Bitmap '%s' not found in the image", name);
+        return -ENOENT;
+    }
+
+    bm_list = bitmap_list_load(bs, s->bitmap_directory_offset,
+                               s->bitmap_directory_size, errp);
+    if (bm_list == NULL) {
+        return -EINVAL;
+    }
+
+    bm = find_bitmap_by_name(bm_list, name);
+    if (bm == NULL) {
+        error_setg(errp, "Bitmap '%s' not found in the image", name);
+        ret = -ENOENT;
+        goto out;
+    }
+
+    ret = load_bitmap_table_and_data(bs, bm, bitmap, errp);
+
+out:
+    bitmap_list_free(bm_list);
+
+    return ret;
+}
 
 static Qcow2BitmapInfoFlagsList *get_bitmap_info_flags(uint32_t flags)
 {
@@ -1262,6 +1367,12 @@ int qcow2_truncate_bitmaps_check(BlockDriverState *bs, Error **errp)
             goto out;
         }
 
+        /* The bitmap is resized in memory and rewritten on store */
+        if (bdrv_dirty_bitmap_load(bitmap, errp) < 0) {
+            ret = -EIO;
+            goto out;
+        }
+
         /*
          * The checks against readonly and busy are redundant, but certainly
          * do no harm. checks against inconsistent are crucial:
@@ -1328,6 +1439,14 @@ static uint64_t *store_bitmap_data(BlockDriverState *bs,
          */
         offset = QEMU_ALIGN_DOWN(offset, limit);
         end = MIN(bm_size, offset + limit);
+
+        if (bdrv_dirty_bitmap_next_zero(bitmap, offset, end - offset) < 0) {
+            /* No need to allocate a cluster for an all-ones part */
+            tb[cluster] = BME_TABLE_ENTRY_FLAG_ALL_ONES;
+            offset = end;
+            continue;
+        }
+
         write_size = bdrv_dirty_bitmap_serialization_size(bitmap, offset,
                                                           end - offset);
         assert(write_size <= s->cluster_size);
@@ -1442,20 +1561,6 @@ fail:
     return ret;
 }
 
-static Qcow2Bitmap *find_bitmap_by_name(Qcow2BitmapList *bm_list,
-                                        const char *name)
-{
-    Qcow2Bitmap *bm;
-
-    QSIMPLEQ_FOREACH(bm, bm_list, entry) {
-        if (strcmp(name, bm->name) == 0) {
-            return bm;
-        }
-    }
-
-    return NULL;
-}
-
 int coroutine_fn qcow2_co_remove_persistent_dirty_bitmap(BlockDriverState *bs,
                                                          const char *name,
                                                          Error **errp)
@@ -1583,6 +1688,21 @@ void qcow2_store_persistent_dirty_bitmaps(BlockDriverState *bs,
 
         need_write = true;
 
+        if (bdrv_dirty_bitmap_unloaded(bitmap)) {
+            /*
+             * The data was never read, so it is unchanged: keep the bitmap
+             * table and only clear the IN_USE flag.
+             */
+            bm = find_bitmap_by_name(bm_list, name);
+            if (bm == NULL) {
+                error_setg(errp, "Bitmap '%s' not found in the image", name);
+                goto fail;
+            }
+            bm->flags &= ~BME_FLAG_IN_USE;
+            bm->dirty_bitmap = bitmap;
+            continue;
+        }
+
         if (check_constraints_on_bitmap(bs, name, granularity, errp) < 0) {
             error_prepend(errp, "Bitmap '%s' doesn't satisfy the constraints: ",
                           name);
@@ -1634,7 +1754,9 @@ void qcow2_store_persistent_dirty_bitmaps(BlockDriverState *bs,
     QSIMPLEQ_FOREACH(bm, bm_list, entry) {
         BdrvDirtyBitmap *bitmap = bm->dirty_bitmap;
 
-        if (bitmap == NULL || bdrv_dirty_bitmap_readonly(bitmap)) {
+        if (bitmap == NULL || bdrv_dirty_bitmap_readonly(bitmap) ||
+            bdrv_dirty_bitmap_unloaded(bitmap))
+        {
             continue;
         }
 
@@ -1674,7 +1796,8 @@ success:
 fail:
     QSIMPLEQ_FOREACH(bm, bm_list, entry) {
         if (bm->dirty_bitmap == NULL || bm->table.offset == 0 ||
-            bdrv_dirty_bitmap_readonly(bm->dirty_bitmap))
+            bdrv_dirty_bitmap_readonly(bm->dirty_bitmap) ||
+            bdrv_dirty_bitmap_unloaded(bm->dirty_bitmap))
         {
             continue;
         }
@@ -233,9 +233,25 @@ static int qcow2_cache_entry_flush(BlockDriverState *bs, Qcow2Cache *c, int i)
     return 0;
 }
 
+static int qcow2_cache_offset_cmp(const void *a, const void *b, void *opaque)
+{
+    Qcow2Cache *c = opaque;
+    int64_t offset_a = c->entries[*(const int *)a].offset;
+    int64_t offset_b = c->entries[*(const int *)b].offset;
+
+    return offset_a < offset_b ? -1 : offset_a > offset_b;
+}
+
+/*
+ * Write back all dirty entries of @c.  This is done in the order of their
+ * offsets in the image file, so that a cache that holds many dirty tables
+ * (e.g. of an append-only image) is written out as sequentially as possible.
+ */
 int qcow2_cache_write(BlockDriverState *bs, Qcow2Cache *c)
 {
     BDRVQcow2State *s = bs->opaque;
+    g_autofree int *dirty = NULL;
+    int nb_dirty = 0;
     int result = 0;
     int ret;
     int i;
@@ -243,7 +259,28 @@ int qcow2_cache_write(BlockDriverState *bs, Qcow2Cache *c)
     trace_qcow2_cache_flush(qemu_coroutine_self(), c == s->l2_table_cache);
 
     for (i = 0; i < c->size; i++) {
-        ret = qcow2_cache_entry_flush(bs, c, i);
+        if (c->entries[i].dirty && c->entries[i].offset) {
+            nb_dirty++;
+        }
+    }
+    if (nb_dirty == 0) {
+        return 0;
+    }
+
+    dirty = g_new(int, nb_dirty);
+    nb_dirty = 0;
+    for (i = 0; i < c->size; i++) {
+        if (c->entries[i].dirty && c->entries[i].offset) {
+            dirty[nb_dirty++] = i;
+        }
+    }
+    if (nb_dirty > 1) {
+        g_qsort_with_data(dirty, nb_dirty, sizeof(dirty[0]),
+                          qcow2_cache_offset_cmp, c);
+    }
+
+    for (i = 0; i < nb_dirty; i++) {
+        ret = qcow2_cache_entry_flush(bs, c, dirty[i]);
         if (ret < 0 && result != -ENOSPC) {
             result = ret;
         }
@@ -2074,6 +2074,162 @@ out:
     return ret;
 }
 
+/*
+ * Make the guest cluster at @dst_offset refer to the host cluster of the
+ * guest cluster at @src_offset, like internal snapshots share clusters.
+ * The refcount of the host cluster is increased and QCOW_OFLAG_COPIED is
+ * cleared in both L2 entries, so that a later write to either guest cluster
+ * allocates a new host cluster.  Once only one of the entries is left, its
+ * flag is set again by qcow2_restore_copied_flags().
+ *
+ * The source must be a normal allocated cluster and the destination must be
+ * unallocated or a plain zero cluster; otherwise -ENOTSUP is returned.
+ */
+int qcow2_share_cluster(BlockDriverState *bs, uint64_t src_offset,
+                        uint64_t dst_offset)
+{
+    BDRVQcow2State *s = bs->opaque;
+    uint64_t *l2_slice;
+    uint64_t l2_entry, host_offset;
+    QCow2ClusterType type;
+    int l2_index, ret;
+
+    assert(offset_into_cluster(s, src_offset) == 0);
+    assert(offset_into_cluster(s, dst_offset) == 0);
+
+    if (has_subclusters(s) || has_data_file(bs)) {
+        return -ENOTSUP;
+    }
+
+    ret = get_cluster_table(bs, dst_offset, &l2_slice, &l2_index);
+    if (ret < 0) {
+        return ret;
+    }
+    type = qcow2_get_cluster_type(bs, get_l2_entry(s, l2_slice, l2_index));
+    qcow2_cache_put(s->l2_table_cache, (void **) &l2_slice);
+    if (type != QCOW2_CLUSTER_UNALLOCATED && type != QCOW2_CLUSTER_ZERO_PLAIN) {
+        return -ENOTSUP;
+    }
+
+    ret = get_cluster_table(bs, src_offset, &l2_slice, &l2_index);
+    if (ret < 0) {
+        return ret;
+    }
+    l2_entry = get_l2_entry(s, l2_slice, l2_index);
+    if (qcow2_get_cluster_type(bs, l2_entry) != QCOW2_CLUSTER_NORMAL) {
+        qcow2_cache_put(s->l2_table_cache, (void **) &l2_slice);
+        return -ENOTSUP;
+    }
+    host_offset = l2_entry & L2E_OFFSET_MASK;
+
+    /* Take the new reference first, a crash can then only leak the cluster */
+    ret = qcow2_update_cluster_refcount(bs, host_offset >> s->cluster_bits,
+                                        1, false, QCOW2_DISCARD_NEVER);
+    if (ret < 0) {
+        qcow2_cache_put(s->l2_table_cache, (void **) &l2_slice);
+        /* -ERANGE means that the refcount is at its maximum already */
+        return ret == -ERANGE ? -ENOTSUP : ret;
+    }
+
+    if (s->use_lazy_refcounts) {
+        qcow2_mark_dirty(bs);
+    }
+    if (qcow2_need_accurate_refcounts(s)) {
+        qcow2_cache_set_dependency(bs, s->l2_table_cache,
+                                   s->refcount_block_cache);
+    }
+
+    qcow2_cache_entry_mark_dirty(s->l2_table_cache, l2_slice);
+    set_l2_entry(s, l2_slice, l2_index, host_offset);
+    qcow2_cache_put(s->l2_table_cache, (void **) &l2_slice);
+
+    /* The slice may have been evicted in the meantime, look it up again */
+    ret = get_cluster_table(bs, dst_offset, &l2_slice, &l2_index);
+    if (ret < 0) {
+        return ret;
+    }
+    qcow2_cache_entry_mark_dirty(s->l2_table_cache, l2_slice);
+    set_l2_entry(s, l2_slice, l2_index, host_offset);
+    qcow2_cache_put(s->l2_table_cache, (void **) &l2_slice);
+
+    return 0;
+}
+
+/*
+ * Set QCOW_OFLAG_COPIED again in the active L2 entries of data clusters
+ * whose refcount has dropped back to 1.  When a cluster shared by
+ * qcow2_share_cluster() loses a reference, the L2 entry that is left cannot
+ * be found from the freed one, so all active L2 tables are scanned.
+ */
+int qcow2_restore_copied_flags(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+    uint64_t *l2_slice;
+    uint64_t l2_offset, l2_entry, refcount;
+    unsigned slice, slice_size2, n_slices;
+    QCow2ClusterType type;
+    int i, j, ret;
+
+    /*
+     * The L2 entries that dropped the other references must be on disk
+     * before the remaining one may be written in place
+     */
+    ret = qcow2_cache_flush(bs, s->l2_table_cache);
+    if (ret < 0) {
+        return ret;
+    }
+
+    if (qcow2_need_accurate_refcounts(s)) {
+        qcow2_cache_set_dependency(bs, s->l2_table_cache,
+                                   s->refcount_block_cache);
+    }
+
+    slice_size2 = s->l2_slice_size * l2_entry_size(s);
+    n_slices = s->cluster_size / slice_size2;
+
+    for (i = 0; i < s->l1_size; i++) {
+        l2_offset = s->l1_table[i] & L1E_OFFSET_MASK;
+        if (!l2_offset) {
+            continue;
+        }
+
+        for (slice = 0; slice < n_slices; slice++) {
+            ret = qcow2_cache_get(bs, s->l2_table_cache,
+                                  l2_offset + slice * slice_size2,
+                                  (void **) &l2_slice);
+            if (ret < 0) {
+                return ret;
+            }
+
+            for (j = 0; j < s->l2_slice_size; j++) {
+                l2_entry = get_l2_entry(s, l2_slice, j);
+                type = qcow2_get_cluster_type(bs, l2_entry);
+                if ((type != QCOW2_CLUSTER_NORMAL &&
+                     type != QCOW2_CLUSTER_ZERO_ALLOC) ||
+                    (l2_entry & QCOW_OFLAG_COPIED)) {
+                    continue;
+                }
+
+                ret = qcow2_get_refcount(bs, (l2_entry & L2E_OFFSET_MASK) >>
+                                             s->cluster_bits, &refcount);
+                if (ret < 0) {
+                    qcow2_cache_put(s->l2_table_cache, (void **) &l2_slice);
+                    return ret;
+                }
+                if (refcount == 1) {
+                    qcow2_cache_entry_mark_dirty(s->l2_table_cache, l2_slice);
+                    set_l2_entry(s, l2_slice, j, l2_entry | QCOW_OFLAG_COPIED);
+                }
+            }
+
+            qcow2_cache_put(s->l2_table_cache, (void **) &l2_slice);
+        }
+    }
+
+    s->restore_copied = false;
+    return 0;
+}
+
 int qcow2_subcluster_zeroize(BlockDriverState *bs, uint64_t offset,
                              uint64_t bytes, int flags)
 {
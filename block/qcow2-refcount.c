@@ -1194,6 +1194,14 @@ void qcow2_free_any_cluster(BlockDriverState *bs, uint64_t l2_entry,
             qcow2_free_clusters(bs, l2_entry & L2E_OFFSET_MASK,
                                 s->cluster_size, type);
         }
+        /*
+         * Without snapshots, only qcow2_share_cluster() shares clusters
+         * between active L2 entries.  The entry that is left may need its
+         * QCOW_OFLAG_COPIED back.
+         */
+        if (!(l2_entry & QCOW_OFLAG_COPIED) && !s->nb_snapshots) {
+            s->restore_copied = true;
+        }
         break;
     case QCOW2_CLUSTER_ZERO_PLAIN:
     case QCOW2_CLUSTER_UNALLOCATED:
@@ -1417,6 +1425,12 @@ int qcow2_update_snapshot_refcount(BlockDriverState *bs,
         }
     }
 
+    /* bdrv_flush() does not write the caches back in append-only mode */
+    ret = qcow2_write_caches(bs);
+    if (ret < 0) {
+        goto fail;
+    }
+
     ret = bdrv_flush(bs);
 fail:
     if (l2_slice) {
@@ -306,6 +306,10 @@ int qcow2_write_snapshots(BlockDriverState *bs)
         ret = offset;
         goto fail;
     }
+    ret = qcow2_write_caches(bs);
+    if (ret < 0) {
+        goto fail;
+    }
     ret = bdrv_flush(bs);
     if (ret < 0) {
         goto fail;
@@ -391,8 +395,13 @@ int qcow2_write_snapshots(BlockDriverState *bs)
 
     /*
      * Update the header to point to the new snapshot table. This requires the
-     * new table and its refcounts to be stable on disk.
+     * new table and its refcounts to be stable on disk. In append-only
+     * mode the latter are only written back by qcow2_write_caches().
      */
+    ret = qcow2_write_caches(bs);
+    if (ret < 0) {
+        goto fail;
+    }
     ret = bdrv_flush(bs);
     if (ret < 0) {
         goto fail;
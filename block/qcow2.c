@@ -697,6 +697,7 @@ static const char *const mutable_opts[] = {
     QCOW2_OPT_L2_CACHE_ENTRY_SIZE,
     QCOW2_OPT_REFCOUNT_CACHE_SIZE,
     QCOW2_OPT_CACHE_CLEAN_INTERVAL,
+    QCOW2_OPT_APPEND_ONLY,
     NULL
 };
 
@@ -808,6 +809,12 @@ static QemuOptsList qcow2_runtime_opts = {
             .type = QEMU_OPT_NUMBER,
             .help = "Clean unused cache entries after this time (in seconds)",
         },
+        {
+            .name = QCOW2_OPT_APPEND_ONLY,
+            .type = QEMU_OPT_BOOL,
+            .help = "Append data sequentially and keep all metadata in memory "
+                    "until the image is closed",
+        },
         BLOCK_CRYPTO_OPT_DEF_KEY_SECRET("encrypt.",
             "ID of secret providing qcow2 AES key or LUKS passphrase"),
         { /* end of list */ }
@@ -878,6 +885,7 @@ static void read_cache_sizes(BlockDriverState *bs, QemuOpts *opts,
     uint64_t combined_cache_size, l2_cache_max_setting;
     bool l2_cache_size_set, refcount_cache_size_set, combined_cache_size_set;
     bool l2_cache_entry_size_set;
+    bool append_only;
     int min_refcount_cache = MIN_REFCOUNT_CACHE_SIZE * s->cluster_size;
     uint64_t virtual_disk_size = bs->total_sectors * BDRV_SECTOR_SIZE;
     uint64_t max_l2_entries = DIV_ROUND_UP(virtual_disk_size, s->cluster_size);
@@ -890,6 +898,37 @@ static void read_cache_sizes(BlockDriverState *bs, QemuOpts *opts,
     l2_cache_size_set = qemu_opt_get(opts, QCOW2_OPT_L2_CACHE_SIZE);
     refcount_cache_size_set = qemu_opt_get(opts, QCOW2_OPT_REFCOUNT_CACHE_SIZE);
     l2_cache_entry_size_set = qemu_opt_get(opts, QCOW2_OPT_L2_CACHE_ENTRY_SIZE);
+    append_only = qemu_opt_get_bool(opts, QCOW2_OPT_APPEND_ONLY, false);
+
+    if (append_only) {
+        int64_t file_size = bdrv_getlength(bs->file->bs);
+        uint64_t nb_clusters, nb_refblocks;
+
+        if (combined_cache_size_set || l2_cache_size_set ||
+            refcount_cache_size_set || l2_cache_entry_size_set) {
+            error_setg(errp, QCOW2_OPT_APPEND_ONLY " may not be combined "
+                       "with cache size options");
+            return;
+        }
+
+        /*
+         * Metadata is only written back when the image is closed, so the
+         * caches must be able to hold all of it: every L2 table, and a
+         * refcount block for every cluster that the image file can grow
+         * to (the existing clusters, all data clusters and L2 tables,
+         * plus the refcount structures themselves).
+         */
+        nb_clusters = size_to_clusters(s, MAX(file_size, 0)) +
+                      max_l2_entries + max_l2_cache / s->cluster_size;
+        nb_clusters += DIV_ROUND_UP(nb_clusters, s->refcount_block_size) + 1;
+        nb_refblocks = DIV_ROUND_UP(nb_clusters, s->refcount_block_size) + 1;
+
+        *l2_cache_size = max_l2_cache;
+        *l2_cache_entry_size = s->cluster_size;
+        *refcount_cache_size = MAX(nb_refblocks * s->cluster_size,
+                                   min_refcount_cache);
+        return;
+    }
 
     combined_cache_size = qemu_opt_get_size(opts, QCOW2_OPT_CACHE_SIZE, 0);
     l2_cache_max_setting = qemu_opt_get_size(opts, QCOW2_OPT_L2_CACHE_SIZE,
@@ -967,6 +1006,7 @@ typedef struct Qcow2ReopenState {
     int overlap_check;
     bool discard_passthrough[QCOW2_DISCARD_MAX];
     uint64_t cache_clean_interval;
+    bool append_only;
     QCryptoBlockOpenOptions *crypto_opts; /* Disk encryption runtime options */
 } Qcow2ReopenState;
 
@@ -1053,10 +1093,13 @@ static int qcow2_update_options_prepare(BlockDriverState *bs,
         goto fail;
     }
 
-    /* New interval for cache cleanup timer */
+    r->append_only = qemu_opt_get_bool(opts, QCOW2_OPT_APPEND_ONLY, false);
+
+    /* New interval for cache cleanup timer; the caches of an append-only
+     * image are sized to hold all metadata, so there is nothing to gain */
     r->cache_clean_interval =
         qemu_opt_get_number(opts, QCOW2_OPT_CACHE_CLEAN_INTERVAL,
-                            DEFAULT_CACHE_CLEAN_INTERVAL);
+                            r->append_only ? 0 : DEFAULT_CACHE_CLEAN_INTERVAL);
 #ifndef CONFIG_LINUX
     if (r->cache_clean_interval != 0) {
         error_setg(errp, QCOW2_OPT_CACHE_CLEAN_INTERVAL
@@ -1210,6 +1253,7 @@ static void qcow2_update_options_commit(BlockDriverState *bs,
 
     s->overlap_check = r->overlap_check;
     s->use_lazy_refcounts = r->use_lazy_refcounts;
+    s->append_only = r->append_only;
 
     for (i = 0; i < QCOW2_DISCARD_MAX; i++) {
         s->discard_passthrough[i] = r->discard_passthrough[i];
@@ -1289,6 +1333,126 @@ static int validate_compression_type(BDRVQcow2State *s, Error **errp)
     return 0;
 }
 
+/*
+ * For append-only images without any L2 tables yet, create refcount
+ * structures that cover the whole virtual disk and reserve all L2 tables
+ * in one contiguous area after them.  Data clusters are then only ever
+ * appended behind that area, and the refcount blocks and L2 tables are
+ * written back in one sequential pass when the image is closed.
+ *
+ * The reserved L2 tables are only zeroed here, because the file may
+ * contain stale data behind the last used cluster (e.g. on a host device).
+ * Their contents are written back later.
+ */
+static int qcow2_append_only_prealloc(BlockDriverState *bs, Error **errp)
+{
+    BDRVQcow2State *s = bs->opaque;
+    uint64_t nb_data_clusters, nb_l2_tables;
+    int64_t file_size, last_cluster, start, allocated;
+    g_autofree uint64_t *l1_table = NULL;
+    int i, ret;
+
+    if (has_data_file(bs) || s->nb_snapshots) {
+        return 0;
+    }
+    for (i = 0; i < s->l1_size; i++) {
+        if (s->l1_table[i]) {
+            return 0;
+        }
+    }
+
+    nb_data_clusters = size_to_clusters(s, bs->total_sectors *
+                                           BDRV_SECTOR_SIZE);
+    nb_l2_tables = DIV_ROUND_UP(nb_data_clusters, s->l2_size);
+    if (nb_l2_tables == 0) {
+        return 0;
+    }
+    assert(nb_l2_tables <= s->l1_size);
+
+    file_size = bdrv_getlength(bs->file->bs);
+    if (file_size < 0) {
+        error_setg_errno(errp, -file_size,
+                         "Failed to inquire current file length");
+        return file_size;
+    }
+    last_cluster = qcow2_get_last_cluster(bs, file_size);
+    if (last_cluster >= 0) {
+        file_size = (last_cluster + 1) * s->cluster_size;
+    } else {
+        file_size = ROUND_UP(file_size, s->cluster_size);
+    }
+
+    start = qcow2_refcount_area(bs, file_size,
+                                nb_l2_tables + nb_data_clusters, true, 0, 0);
+    if (start < 0) {
+        error_setg_errno(errp, -start, "Failed to create refcount structures");
+        return start;
+    }
+
+    allocated = qcow2_alloc_clusters_at(bs, start, nb_l2_tables);
+    if (allocated < 0) {
+        error_setg_errno(errp, -allocated, "Failed to allocate L2 tables");
+        return allocated;
+    }
+    assert(allocated == nb_l2_tables);
+
+    ret = qcow2_pre_write_overlap_check(bs, 0, start,
+                                        nb_l2_tables * s->cluster_size, false);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Failed to zero the L2 tables");
+        return ret;
+    }
+
+    ret = bdrv_pwrite_zeroes(bs->file, start, nb_l2_tables * s->cluster_size,
+                             BDRV_REQ_MAY_UNMAP);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Failed to zero the L2 tables");
+        return ret;
+    }
+
+    /*
+     * The refcounts and the zeroed L2 tables must be on disk before the L1
+     * table points to them; this also flushes bs->file.
+     */
+    ret = qcow2_cache_flush(bs, s->refcount_block_cache);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Failed to flush the refcount block cache");
+        return ret;
+    }
+
+    l1_table = g_try_new0(uint64_t, s->l1_size);
+    if (l1_table == NULL) {
+        error_setg(errp, "Could not allocate L1 table");
+        return -ENOMEM;
+    }
+    for (i = 0; i < nb_l2_tables; i++) {
+        l1_table[i] = cpu_to_be64((start + i * s->cluster_size) |
+                                  QCOW_OFLAG_COPIED);
+    }
+
+    ret = qcow2_pre_write_overlap_check(bs, QCOW2_OL_ACTIVE_L1,
+                                        s->l1_table_offset,
+                                        s->l1_size * L1E_SIZE, false);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Could not write L1 table");
+        return ret;
+    }
+
+    BLKDBG_EVENT(bs->file, BLKDBG_L1_UPDATE);
+    ret = bdrv_pwrite_sync(bs->file, s->l1_table_offset, l1_table,
+                           s->l1_size * L1E_SIZE);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Could not write L1 table");
+        return ret;
+    }
+
+    for (i = 0; i < nb_l2_tables; i++) {
+        s->l1_table[i] = be64_to_cpu(l1_table[i]);
+    }
+
+    return 0;
+}
+
 /* Called with s->lock held.  */
 static int coroutine_fn qcow2_do_open(BlockDriverState *bs, QDict *options,
                                       int flags, Error **errp)
@@ -1824,6 +1988,13 @@ static int coroutine_fn qcow2_do_open(BlockDriverState *bs, QDict *options,
         }
     }
 
+    if (s->append_only && !(flags & BDRV_O_INACTIVE) && !bs->read_only) {
+        ret = qcow2_append_only_prealloc(bs, errp);
+        if (ret < 0) {
+            goto fail;
+        }
+    }
+
 #ifdef DEBUG_ALLOC
     {
         BdrvCheckResult result = {0};
@@ -1944,6 +2115,17 @@ static int qcow2_reopen_prepare(BDRVReopenState *state,
             goto fail;
         }
 
+        /*
+         * In append-only mode bdrv_flush() does not write back the
+         * metadata caches, so do that explicitly before dropping write
+         * access.
+         */
+        ret = qcow2_write_caches(state->bs);
+        if (ret < 0) {
+            error_setg_errno(errp, -ret, "Failed to write metadata caches");
+            goto fail;
+        }
+
         ret = bdrv_flush(state->bs);
         if (ret < 0) {
             goto fail;
@@ -2661,6 +2843,15 @@ static int qcow2_inactivate(BlockDriverState *bs)
                           bdrv_get_device_or_node_name(bs));
     }
 
+    if (s->restore_copied && s->l1_table) {
+        ret = qcow2_restore_copied_flags(bs);
+        if (ret) {
+            result = ret;
+            error_report("Failed to restore OFLAG_COPIED in L2 tables: %s",
+                         strerror(-ret));
+        }
+    }
+
     ret = qcow2_cache_flush(bs, s->l2_table_cache);
     if (ret) {
         result = ret;
@@ -2685,6 +2876,16 @@ static int qcow2_inactivate(BlockDriverState *bs)
 static void qcow2_close(BlockDriverState *bs)
 {
     BDRVQcow2State *s = bs->opaque;
+
+    /* qcow2_inactivate() cannot do this any more without the L1 table */
+    if (!(s->flags & BDRV_O_INACTIVE) && s->restore_copied) {
+        int ret = qcow2_restore_copied_flags(bs);
+        if (ret < 0) {
+            error_report("Failed to restore OFLAG_COPIED in L2 tables: %s",
+                         strerror(-ret));
+        }
+    }
+
     qemu_vfree(s->l1_table);
     /* else pre-write overlap checks in cache_destroy may crash */
     s->l1_table = NULL;
@@ -4125,6 +4326,32 @@ fail:
     return ret;
 }
 
+static int coroutine_fn
+qcow2_co_share_clusters(BlockDriverState *bs, int64_t src_offset,
+                        int64_t dst_offset, int64_t bytes)
+{
+    BDRVQcow2State *s = bs->opaque;
+    int ret = 0;
+
+    if (!QEMU_IS_ALIGNED(src_offset | dst_offset | bytes, s->cluster_size)) {
+        return -ENOTSUP;
+    }
+
+    qemu_co_mutex_lock(&s->lock);
+    while (bytes > 0) {
+        ret = qcow2_share_cluster(bs, src_offset, dst_offset);
+        if (ret < 0) {
+            break;
+        }
+        src_offset += s->cluster_size;
+        dst_offset += s->cluster_size;
+        bytes -= s->cluster_size;
+    }
+    qemu_co_mutex_unlock(&s->lock);
+
+    return ret;
+}
+
 static int coroutine_fn qcow2_co_truncate(BlockDriverState *bs, int64_t offset,
                                           bool exact, PreallocMode prealloc,
                                           BdrvRequestFlags flags, Error **errp)
@@ -4876,6 +5103,11 @@ static coroutine_fn int qcow2_co_flush_to_os(BlockDriverState *bs)
     BDRVQcow2State *s = bs->opaque;
     int ret;
 
+    if (s->append_only) {
+        /* Metadata is only written back on inactivation */
+        return 0;
+    }
+
     qemu_co_mutex_lock(&s->lock);
     ret = qcow2_write_caches(bs);
     qemu_co_mutex_unlock(&s->lock);
@@ -5900,6 +6132,7 @@ BlockDriver bdrv_qcow2 = {
     .bdrv_co_pdiscard       = qcow2_co_pdiscard,
     .bdrv_co_copy_range_from = qcow2_co_copy_range_from,
     .bdrv_co_copy_range_to  = qcow2_co_copy_range_to,
+    .bdrv_co_share_clusters = qcow2_co_share_clusters,
     .bdrv_co_truncate       = qcow2_co_truncate,
     .bdrv_co_pwritev_compressed_part = qcow2_co_pwritev_compressed_part,
     .bdrv_make_empty        = qcow2_make_empty,
@@ -5940,6 +6173,7 @@ BlockDriver bdrv_qcow2 = {
     .bdrv_co_can_store_new_dirty_bitmap = qcow2_co_can_store_new_dirty_bitmap,
     .bdrv_co_remove_persistent_dirty_bitmap =
             qcow2_co_remove_persistent_dirty_bitmap,
+    .bdrv_load_persistent_dirty_bitmap = qcow2_load_persistent_dirty_bitmap,
 };
 
 static void bdrv_qcow2_init(void)
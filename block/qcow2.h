@@ -150,6 +150,7 @@
 #define QCOW2_OPT_L2_CACHE_ENTRY_SIZE "l2-cache-entry-size"
 #define QCOW2_OPT_REFCOUNT_CACHE_SIZE "refcount-cache-size"
 #define QCOW2_OPT_CACHE_CLEAN_INTERVAL "cache-clean-interval"
+#define QCOW2_OPT_APPEND_ONLY "append-only"
 
 typedef struct QCowHeader {
     uint32_t magic;
@@ -377,6 +378,9 @@ typedef struct BDRVQcow2State {
     int flags;
     int qcow_version;
     bool use_lazy_refcounts;
+    bool append_only;
+    /* Shared data clusters lost a reference, see qcow2_share_cluster() */
+    bool restore_copied;
     int refcount_order;
     int refcount_bits;
     uint64_t refcount_max;
@@ -920,6 +924,9 @@ void qcow2_alloc_cluster_abort(BlockDriverState *bs, QCowL2Meta *m);
 int qcow2_cluster_discard(BlockDriverState *bs, uint64_t offset,
                           uint64_t bytes, enum qcow2_discard_type type,
                           bool full_discard);
+int qcow2_share_cluster(BlockDriverState *bs, uint64_t src_offset,
+                        uint64_t dst_offset);
+int qcow2_restore_copied_flags(BlockDriverState *bs);
 int qcow2_subcluster_zeroize(BlockDriverState *bs, uint64_t offset,
                              uint64_t bytes, int flags);
 
@@ -979,6 +986,8 @@ int qcow2_check_bitmaps_refcounts(BlockDriverState *bs, BdrvCheckResult *res,
                                   void **refcount_table,
                                   int64_t *refcount_table_size);
 bool qcow2_load_dirty_bitmaps(BlockDriverState *bs, Error **errp);
+int qcow2_load_persistent_dirty_bitmap(BlockDriverState *bs,
+                                       BdrvDirtyBitmap *bitmap, Error **errp);
 Qcow2BitmapInfoList *qcow2_get_bitmap_info_list(BlockDriverState *bs,
                                                 Error **errp);
 int qcow2_reopen_bitmaps_rw(BlockDriverState *bs, Error **errp);
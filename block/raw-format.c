@@ -201,6 +201,18 @@ static inline int raw_adjust_offset(BlockDriverState *bs, uint64_t *offset,
     return 0;
 }
 
+static int raw_get_host_fd(BlockDriverState *bs, uint64_t *offset,
+                           uint64_t bytes)
+{
+    int ret;
+
+    ret = raw_adjust_offset(bs, offset, bytes, false);
+    if (ret) {
+        return ret;
+    }
+    return bdrv_get_host_fd(bs->file->bs, offset, bytes);
+}
+
 static int coroutine_fn raw_co_preadv(BlockDriverState *bs, uint64_t offset,
                                       uint64_t bytes, QEMUIOVector *qiov,
                                       int flags)
@@ -598,6 +610,7 @@ BlockDriver bdrv_raw = {
     .has_variable_length  = true,
     .bdrv_measure         = &raw_measure,
     .bdrv_get_info        = &raw_get_info,
+    .bdrv_get_host_fd     = &raw_get_host_fd,
     .bdrv_refresh_limits  = &raw_refresh_limits,
     .bdrv_probe_blocksizes = &raw_probe_blocksizes,
     .bdrv_probe_geometry  = &raw_probe_geometry,
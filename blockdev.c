@@ -2842,6 +2842,9 @@ static BlockJob *do_backup_common(BackupCommon *backup,
             error_setg(errp, "Bitmap '%s' could not be found", backup->bitmap);
             return NULL;
         }
+        if (bdrv_dirty_bitmap_load(bmap, errp) < 0) {
+            return NULL;
+        }
         if (!backup->has_bitmap_mode) {
             error_setg(errp, "Bitmap sync mode must be given "
                        "when providing a bitmap");
@@ -2935,6 +2938,7 @@ static void blockdev_mirror_common(const char *job_id, BlockDriverState *bs,
                                    bool has_speed, int64_t speed,
                                    bool has_granularity, uint32_t granularity,
                                    bool has_buf_size, int64_t buf_size,
+                                   bool has_workers, int64_t workers,
                                    bool has_on_source_error,
                                    BlockdevOnError on_source_error,
                                    bool has_on_target_error,
@@ -2965,6 +2969,9 @@ static void blockdev_mirror_common(const char *job_id, BlockDriverState *bs,
     if (!has_buf_size) {
         buf_size = 0;
     }
+    if (!has_workers) {
+        workers = 1;
+    }
     if (!has_unmap) {
         unmap = true;
     }
@@ -2991,6 +2998,11 @@ static void blockdev_mirror_common(const char *job_id, BlockDriverState *bs,
                    "power of 2");
         return;
     }
+    if (workers < 1 || workers > MIRROR_MAX_WORKERS) {
+        error_setg(errp, "Parameter 'workers' expects a value in range "
+                   "[1, %d]", MIRROR_MAX_WORKERS);
+        return;
+    }
 
     if (bdrv_op_is_blocked(bs, BLOCK_OP_TYPE_MIRROR_SOURCE, errp)) {
         return;
@@ -3050,7 +3062,8 @@ static void blockdev_mirror_common(const char *job_id, BlockDriverState *bs,
      */
     mirror_start(job_id, bs, target,
                  has_replaces ? replaces : NULL, job_flags,
-                 speed, granularity, buf_size, sync, backing_mode, zero_target,
+                 speed, granularity, buf_size, workers, sync, backing_mode,
+                 zero_target,
                  on_source_error, on_target_error, unmap, filter_node_name,
                  copy_mode, errp);
 }
@@ -3199,6 +3212,7 @@ void qmp_drive_mirror(DriveMirror *arg, Error **errp)
                            arg->has_speed, arg->speed,
                            arg->has_granularity, arg->granularity,
                            arg->has_buf_size, arg->buf_size,
+                           arg->has_workers, arg->workers,
                            arg->has_on_source_error, arg->on_source_error,
                            arg->has_on_target_error, arg->on_target_error,
                            arg->has_unmap, arg->unmap,
@@ -3226,6 +3240,7 @@ void qmp_blockdev_mirror(bool has_job_id, const char *job_id,
                          bool has_filter_node_name,
                          const char *filter_node_name,
                          bool has_copy_mode, MirrorCopyMode copy_mode,
+                         bool has_workers, int64_t workers,
                          bool has_auto_finalize, bool auto_finalize,
                          bool has_auto_dismiss, bool auto_dismiss,
                          Error **errp)
@@ -3269,6 +3284,7 @@ void qmp_blockdev_mirror(bool has_job_id, const char *job_id,
                            zero_target, has_speed, speed,
                            has_granularity, granularity,
                            has_buf_size, buf_size,
+                           has_workers, workers,
                            has_on_source_error, on_source_error,
                            has_on_target_error, on_target_error,
                            true, true,
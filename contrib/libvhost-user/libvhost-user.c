@@ -139,6 +139,7 @@ vu_request_to_string(unsigned int req)
         REQ(VHOST_USER_GET_MAX_MEM_SLOTS),
         REQ(VHOST_USER_ADD_MEM_REG),
         REQ(VHOST_USER_REM_MEM_REG),
+        REQ(VHOST_USER_SET_LOG_RING),
         REQ(VHOST_USER_MAX),
     };
 #undef REQ
@@ -450,6 +451,33 @@ vu_log_page(uint8_t *log_table, uint64_t page)
     qatomic_or(&log_table[page / 8], 1 << (page % 8));
 }
 
+/* Append a range to the dirty log ring, false if it is full */
+static bool
+vu_log_ring_append(VuDev *dev, uint64_t address, uint64_t length)
+{
+    VuLogRingHdr *hdr = dev->log_ring;
+    VuLogRingEntry *entry;
+    uint32_t head;
+
+    if (length > UINT32_MAX) {
+        return false;
+    }
+
+    /* Reserve an entry, the master clears it before moving the tail */
+    do {
+        head = qatomic_read(&hdr->head);
+        if (head - qatomic_load_acquire(&hdr->tail) >= dev->log_ring_num) {
+            return false;
+        }
+    } while (qatomic_cmpxchg(&hdr->head, head, head + 1) != head);
+
+    entry = &dev->log_ring_entries[head & (dev->log_ring_num - 1)];
+    entry->addr = address;
+    qatomic_store_release(&entry->len, length);
+
+    return true;
+}
+
 static void
 vu_log_write(VuDev *dev, uint64_t address, uint64_t length)
 {
@@ -460,6 +488,11 @@ vu_log_write(VuDev *dev, uint64_t address, uint64_t length)
         return;
     }
 
+    if (dev->log_ring && vu_log_ring_append(dev, address, length)) {
+        vu_log_kick(dev);
+        return;
+    }
+
     assert(dev->log_size > ((address + length - 1) / VHOST_LOG_PAGE / 8));
 
     page = address / VHOST_LOG_PAGE;
@@ -468,6 +501,11 @@ vu_log_write(VuDev *dev, uint64_t address, uint64_t length)
         page += 1;
     }
 
+    /* The ring was full, tell the master to scan the bitmap */
+    if (dev->log_ring) {
+        qatomic_or(&dev->log_ring->flags, VHOST_LOG_RING_F_OVERFLOW);
+    }
+
     vu_log_kick(dev);
 }
 
@@ -574,6 +612,14 @@ vu_close_log(VuDev *dev)
 
         dev->log_table = NULL;
     }
+    if (dev->log_ring) {
+        if (munmap(dev->log_ring, dev->log_ring_size) != 0) {
+            perror("close log ring munmap() error");
+        }
+
+        dev->log_ring = NULL;
+        dev->log_ring_entries = NULL;
+    }
     if (dev->log_call_fd != -1) {
         close(dev->log_call_fd);
         dev->log_call_fd = -1;
@@ -1026,6 +1072,60 @@ vu_set_log_base_exec(VuDev *dev, VhostUserMsg *vmsg)
     return true;
 }
 
+static bool
+vu_set_log_ring_exec(VuDev *dev, VhostUserMsg *vmsg)
+{
+    uint64_t mmap_size, mmap_offset;
+    VuLogRingHdr *hdr;
+    uint32_t num;
+    void *rc;
+
+    if (vmsg->fd_num != 1 ||
+        vmsg->size != sizeof(vmsg->payload.log)) {
+        vmsg_close_fds(vmsg);
+        vu_panic(dev, "Invalid log_ring message");
+        return false;
+    }
+
+    mmap_offset = vmsg->payload.log.mmap_offset;
+    mmap_size = vmsg->payload.log.mmap_size;
+    DPRINT("Log ring mmap_offset: %"PRId64"\n", mmap_offset);
+    DPRINT("Log ring mmap_size:   %"PRId64"\n", mmap_size);
+
+    if (mmap_size < sizeof(VuLogRingHdr)) {
+        close(vmsg->fds[0]);
+        vu_panic(dev, "Log ring too small");
+        return false;
+    }
+
+    rc = mmap(0, mmap_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+              vmsg->fds[0], mmap_offset);
+    close(vmsg->fds[0]);
+    if (rc == MAP_FAILED) {
+        vu_panic(dev, "log ring mmap error: %s", strerror(errno));
+        return false;
+    }
+
+    hdr = rc;
+    num = hdr->num;
+    if (!num || (num & (num - 1)) ||
+        (mmap_size - sizeof(*hdr)) / sizeof(VuLogRingEntry) < num) {
+        munmap(rc, mmap_size);
+        vu_panic(dev, "Invalid log ring size %"PRIu32, num);
+        return false;
+    }
+
+    if (dev->log_ring) {
+        munmap(dev->log_ring, dev->log_ring_size);
+    }
+    dev->log_ring = hdr;
+    dev->log_ring_size = mmap_size;
+    dev->log_ring_num = num;
+    dev->log_ring_entries = (VuLogRingEntry *)(hdr + 1);
+
+    return false;
+}
+
 static bool
 vu_set_log_fd_exec(VuDev *dev, VhostUserMsg *vmsg)
 {
@@ -1412,7 +1512,8 @@ vu_get_protocol_features_exec(VuDev *dev, VhostUserMsg *vmsg)
                         1ULL << VHOST_USER_PROTOCOL_F_HOST_NOTIFIER |
                         1ULL << VHOST_USER_PROTOCOL_F_SLAVE_SEND_FD |
                         1ULL << VHOST_USER_PROTOCOL_F_REPLY_ACK |
-                        1ULL << VHOST_USER_PROTOCOL_F_CONFIGURE_MEM_SLOTS;
+                        1ULL << VHOST_USER_PROTOCOL_F_CONFIGURE_MEM_SLOTS |
+                        1ULL << VHOST_USER_PROTOCOL_F_LOG_RING;
 
     if (have_userfault()) {
         features |= 1ULL << VHOST_USER_PROTOCOL_F_PAGEFAULT;
@@ -1852,6 +1953,8 @@ vu_process_message(VuDev *dev, VhostUserMsg *vmsg)
         return vu_add_mem_reg(dev, vmsg);
     case VHOST_USER_REM_MEM_REG:
         return vu_rem_mem_reg(dev, vmsg);
+    case VHOST_USER_SET_LOG_RING:
+        return vu_set_log_ring_exec(dev, vmsg);
     default:
         vmsg_close_fds(vmsg);
         vu_panic(dev, "Unhandled request: %d", vmsg->request);
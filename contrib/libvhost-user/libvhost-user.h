@@ -64,6 +64,7 @@ enum VhostUserProtocolFeature {
     VHOST_USER_PROTOCOL_F_INFLIGHT_SHMFD = 12,
     VHOST_USER_PROTOCOL_F_INBAND_NOTIFICATIONS = 14,
     VHOST_USER_PROTOCOL_F_CONFIGURE_MEM_SLOTS = 15,
+    VHOST_USER_PROTOCOL_F_LOG_RING = 17,
 
     VHOST_USER_PROTOCOL_F_MAX
 };
@@ -109,6 +110,7 @@ typedef enum VhostUserRequest {
     VHOST_USER_GET_MAX_MEM_SLOTS = 36,
     VHOST_USER_ADD_MEM_REG = 37,
     VHOST_USER_REM_MEM_REG = 38,
+    VHOST_USER_SET_LOG_RING = 41,
     VHOST_USER_MAX
 } VhostUserRequest;
 
@@ -170,6 +172,25 @@ typedef struct VhostUserInflight {
     uint16_t queue_size;
 } VhostUserInflight;
 
+/* Dirty log ring, see docs/interop/vhost-user.rst */
+#define VHOST_LOG_RING_F_OVERFLOW 0x1
+
+typedef struct VuLogRingEntry {
+    uint64_t addr;
+    uint32_t len;
+    uint32_t padding;
+} VuLogRingEntry;
+
+typedef struct VuLogRingHdr {
+    uint32_t num;
+    uint32_t flags;
+    uint8_t padding1[56];
+    uint32_t head;
+    uint8_t padding2[60];
+    uint32_t tail;
+    uint8_t padding3[60];
+} VuLogRingHdr;
+
 #if defined(_WIN32) && (defined(__x86_64__) || defined(__i386__))
 # define VU_PACKED __attribute__((gcc_struct, packed))
 #else
@@ -387,6 +408,10 @@ struct VuDev {
     int slave_fd;
     uint64_t log_size;
     uint8_t *log_table;
+    uint64_t log_ring_size;
+    uint32_t log_ring_num;
+    VuLogRingHdr *log_ring;
+    VuLogRingEntry *log_ring_entries;
     uint64_t features;
     uint64_t protocol_features;
     bool broken;
@@ -2157,20 +2157,75 @@ float16 float16_round_to_int(float16 a, float_status *s)
     return float16_round_pack_canonical(pr, s);
 }
 
-float32 float32_round_to_int(float32 a, float_status *s)
+static float32 QEMU_SOFTFLOAT_ATTR
+soft_f32_round_to_int(float32 a, float_status *s)
 {
     FloatParts pa = float32_unpack_canonical(a, s);
     FloatParts pr = round_to_int(pa, s->float_rounding_mode, 0, s);
     return float32_round_pack_canonical(pr, s);
 }
 
-float64 float64_round_to_int(float64 a, float_status *s)
+static float64 QEMU_SOFTFLOAT_ATTR
+soft_f64_round_to_int(float64 a, float_status *s)
 {
     FloatParts pa = float64_unpack_canonical(a, s);
     FloatParts pr = round_to_int(pa, s->float_rounding_mode, 0, s);
     return float64_round_pack_canonical(pr, s);
 }
 
+/*
+ * With inexact already set and round-to-nearest-even in effect, the only
+ * flag rint() could miss is invalid for signalling NaNs, so leave NaNs
+ * to softfloat.
+ */
+float32 QEMU_FLATTEN float32_round_to_int(float32 xa, float_status *s)
+{
+    union_float32 ua, ur;
+
+    ua.s = xa;
+    if (unlikely(!can_use_fpu(s))) {
+        goto soft;
+    }
+
+    float32_input_flush1(&ua.s, s);
+    if (QEMU_HARDFLOAT_1F32_USE_FP) {
+        if (unlikely(isnan(ua.h))) {
+            goto soft;
+        }
+    } else if (unlikely(float32_is_any_nan(ua.s))) {
+        goto soft;
+    }
+    ur.h = rintf(ua.h);
+    return ur.s;
+
+ soft:
+    return soft_f32_round_to_int(ua.s, s);
+}
+
+float64 QEMU_FLATTEN float64_round_to_int(float64 xa, float_status *s)
+{
+    union_float64 ua, ur;
+
+    ua.s = xa;
+    if (unlikely(!can_use_fpu(s))) {
+        goto soft;
+    }
+
+    float64_input_flush1(&ua.s, s);
+    if (QEMU_HARDFLOAT_1F64_USE_FP) {
+        if (unlikely(isnan(ua.h))) {
+            goto soft;
+        }
+    } else if (unlikely(float64_is_any_nan(ua.s))) {
+        goto soft;
+    }
+    ur.h = rint(ua.h);
+    return ur.s;
+
+ soft:
+    return soft_f64_round_to_int(ua.s, s);
+}
+
 /*
  * Rounds the bfloat16 value `a' to an integer, and returns the
  * result as a bfloat16 value.
@@ -2335,14 +2390,106 @@ int16_t float32_to_int16(float32 a, float_status *s)
     return float32_to_int16_scalbn(a, s->float_rounding_mode, 0, s);
 }
 
+/*
+ * Hardfloat float-to-int conversion of @d, which must already have been
+ * flushed. The host result is used only when it is in [@min, @limit) and
+ * either exact or the inexact flag is already raised, so that no exception
+ * flag can be lost; NaNs fail the range check. Rounding other than to zero
+ * relies on rint() following the host's round-to-nearest-even mode.
+ */
+static inline bool f_to_int_hard(double d, bool rtz, double min, double limit,
+                                 int64_t *ret, const float_status *s)
+{
+    double t;
+
+    if (QEMU_NO_HARDFLOAT) {
+        return false;
+    }
+    if (rtz) {
+        t = trunc(d);
+    } else if (likely(s->float_rounding_mode == float_round_nearest_even)) {
+        t = rint(d);
+    } else {
+        return false;
+    }
+    if (unlikely(!(t >= min && t < limit))) {
+        return false;
+    }
+    if (unlikely(t != d && !(s->float_exception_flags & float_flag_inexact))) {
+        return false;
+    }
+    *ret = t;
+    return true;
+}
+
+static inline int32_t QEMU_FLATTEN
+f32_to_int32(float32 xa, bool rtz, float_status *s)
+{
+    union_float32 ua;
+    int64_t r;
+
+    ua.s = xa;
+    float32_input_flush1(&ua.s, s);
+    if (likely(f_to_int_hard(ua.h, rtz, -0x1p31, 0x1p31, &r, s))) {
+        return r;
+    }
+    return float32_to_int32_scalbn(ua.s, rtz ? float_round_to_zero :
+                                   s->float_rounding_mode, 0, s);
+}
+
+static inline int64_t QEMU_FLATTEN
+f32_to_int64(float32 xa, bool rtz, float_status *s)
+{
+    union_float32 ua;
+    int64_t r;
+
+    ua.s = xa;
+    float32_input_flush1(&ua.s, s);
+    if (likely(f_to_int_hard(ua.h, rtz, -0x1p63, 0x1p63, &r, s))) {
+        return r;
+    }
+    return float32_to_int64_scalbn(ua.s, rtz ? float_round_to_zero :
+                                   s->float_rounding_mode, 0, s);
+}
+
+static inline int32_t QEMU_FLATTEN
+f64_to_int32(float64 xa, bool rtz, float_status *s)
+{
+    union_float64 ua;
+    int64_t r;
+
+    ua.s = xa;
+    float64_input_flush1(&ua.s, s);
+    if (likely(f_to_int_hard(ua.h, rtz, -0x1p31, 0x1p31, &r, s))) {
+        return r;
+    }
+    return float64_to_int32_scalbn(ua.s, rtz ? float_round_to_zero :
+                                   s->float_rounding_mode, 0, s);
+}
+
+static inline int64_t QEMU_FLATTEN
+f64_to_int64(float64 xa, bool rtz, float_status *s)
+{
+    union_float64 ua;
+    int64_t r;
+
+    ua.s = xa;
+    float64_input_flush1(&ua.s, s);
+    if (likely(f_to_int_hard(ua.h, rtz, -0x1p63, 0x1p63, &r, s))) {
+        return r;
+    }
+    return float64_to_int64_scalbn(ua.s, rtz ? float_round_to_zero :
+                                   s->float_rounding_mode, 0, s);
+}
+
 int32_t float32_to_int32(float32 a, float_status *s)
 {
-    return float32_to_int32_scalbn(a, s->float_rounding_mode, 0, s);
+    return f32_to_int32(a, false, s);
 }
 
 int64_t float32_to_int64(float32 a, float_status *s)
 {
-    return float32_to_int64_scalbn(a, s->float_rounding_mode, 0, s);
+    return f32_to_int64(a, false, s);
 }
 
 int16_t float64_to_int16(float64 a, float_status *s)
@@ -2352,12 +2499,12 @@ int16_t float64_to_int16(float64 a, float_status *s)
 
 int32_t float64_to_int32(float64 a, float_status *s)
 {
-    return float64_to_int32_scalbn(a, s->float_rounding_mode, 0, s);
+    return f64_to_int32(a, false, s);
 }
 
 int64_t float64_to_int64(float64 a, float_status *s)
 {
-    return float64_to_int64_scalbn(a, s->float_rounding_mode, 0, s);
+    return f64_to_int64(a, false, s);
 }
 
 int16_t float16_to_int16_round_to_zero(float16 a, float_status *s)
@@ -2382,12 +2529,12 @@ int16_t float32_to_int16_round_to_zero(float32 a, float_status *s)
 
 int32_t float32_to_int32_round_to_zero(float32 a, float_status *s)
 {
-    return float32_to_int32_scalbn(a, float_round_to_zero, 0, s);
+    return f32_to_int32(a, true, s);
 }
 
 int64_t float32_to_int64_round_to_zero(float32 a, float_status *s)
 {
-    return float32_to_int64_scalbn(a, float_round_to_zero, 0, s);
+    return f32_to_int64(a, true, s);
 }
 
 int16_t float64_to_int16_round_to_zero(float64 a, float_status *s)
@@ -2397,12 +2544,12 @@ int16_t float64_to_int16_round_to_zero(float64 a, float_status *s)
 
 int32_t float64_to_int32_round_to_zero(float64 a, float_status *s)
 {
-    return float64_to_int32_scalbn(a, float_round_to_zero, 0, s);
+    return f64_to_int32(a, true, s);
 }
 
 int64_t float64_to_int64_round_to_zero(float64 a, float_status *s)
 {
-    return float64_to_int64_scalbn(a, float_round_to_zero, 0, s);
+    return f64_to_int64(a, true, s);
 }
 
 /*
@@ -2827,19 +2974,35 @@ float32 int16_to_float32_scalbn(int16_t a, int scale, float_status *status)
     return int64_to_float32_scalbn(a, scale, status);
 }
 
-float32 int64_to_float32(int64_t a, float_status *status)
+/*
+ * Integers of up to 24 (float32) or 53 (float64) significant bits convert
+ * exactly regardless of rounding mode; anything wider needs the usual
+ * hardfloat preconditions.
+ */
+float32 QEMU_FLATTEN int64_to_float32(int64_t a, float_status *status)
 {
+    union_float32 ur;
+
+    if (QEMU_NO_HARDFLOAT) {
+        goto soft;
+    }
+    if (likely(a >= -(1 << 24) && a <= (1 << 24)) || can_use_fpu(status)) {
+        ur.h = a;
+        return ur.s;
+    }
+
+ soft:
     return int64_to_float32_scalbn(a, 0, status);
 }
 
 float32 int32_to_float32(int32_t a, float_status *status)
 {
-    return int64_to_float32_scalbn(a, 0, status);
+    return int64_to_float32(a, status);
 }
 
 float32 int16_to_float32(int16_t a, float_status *status)
 {
-    return int64_to_float32_scalbn(a, 0, status);
+    return int64_to_float32(a, status);
 }
 
 float64 int64_to_float64_scalbn(int64_t a, int scale, float_status *status)
@@ -2858,19 +3021,30 @@ float64 int16_to_float64_scalbn(int16_t a, int scale, float_status *status)
     return int64_to_float64_scalbn(a, scale, status);
 }
 
-float64 int64_to_float64(int64_t a, float_status *status)
+float64 QEMU_FLATTEN int64_to_float64(int64_t a, float_status *status)
 {
+    union_float64 ur;
+
+    if (QEMU_NO_HARDFLOAT) {
+        goto soft;
+    }
+    if (likely(a >= -(1LL << 53) && a <= (1LL << 53)) || can_use_fpu(status)) {
+        ur.h = a;
+        return ur.s;
+    }
+
+ soft:
     return int64_to_float64_scalbn(a, 0, status);
 }
 
 float64 int32_to_float64(int32_t a, float_status *status)
 {
-    return int64_to_float64_scalbn(a, 0, status);
+    return int64_to_float64(a, status);
 }
 
 float64 int16_to_float64(int16_t a, float_status *status)
 {
-    return int64_to_float64_scalbn(a, 0, status);
+    return int64_to_float64(a, status);
 }
 
 /*
@@ -68,6 +68,8 @@
 #include "qemu/log.h"
 #include "qemu/module.h"
 #include "qemu/cutils.h"
+#include "qemu/bitmap.h"
+#include "qemu/main-loop.h"
 #include "trace.h"
 #include "nvme.h"
 #include "nvme-ns.h"
@@ -2006,6 +2008,10 @@ static void nvme_clear_ctrl(NvmeCtrl *n)
     n->outstanding_aers = 0;
     n->qs_created = false;
 
+    qemu_mutex_lock(&n->db_lock);
+    bitmap_zero(n->db_pending, n->num_dbs);
+    qemu_mutex_unlock(&n->db_lock);
+
     for (i = 1; i <= n->num_namespaces; i++) {
         ns = nvme_ns(n, i);
         if (!ns) {
@@ -2317,13 +2323,6 @@ static void nvme_process_db(NvmeCtrl *n, hwaddr addr, int val)
 {
     uint32_t qid;
 
-    if (unlikely(addr & ((1 << 2) - 1))) {
-        NVME_GUEST_ERR(pci_nvme_ub_db_wr_misaligned,
-                       "doorbell write not 32-bit aligned,"
-                       " offset=0x%"PRIx64", ignoring", addr);
-        return;
-    }
-
     if (((addr - 0x1000) >> 2) & 1) {
         /* Completion queue doorbell write */
 
@@ -2438,6 +2437,32 @@ static void nvme_process_db(NvmeCtrl *n, hwaddr addr, int val)
     }
 }
 
+/* Process the posted doorbell writes, called with the BQL held */
+static void nvme_db_flush(NvmeCtrl *n)
+{
+    unsigned long i;
+    uint32_t val;
+
+    for (;;) {
+        qemu_mutex_lock(&n->db_lock);
+        i = find_first_bit(n->db_pending, n->num_dbs);
+        if (n->db_unrealized || i >= n->num_dbs) {
+            qemu_mutex_unlock(&n->db_lock);
+            return;
+        }
+        clear_bit(i, n->db_pending);
+        val = n->db_vals[i];
+        qemu_mutex_unlock(&n->db_lock);
+
+        nvme_process_db(n, sizeof(NvmeBar) + i * NVME_DB_SIZE, val);
+    }
+}
+
+static void nvme_db_bh(void *opaque)
+{
+    nvme_db_flush(opaque);
+}
+
 static void nvme_mmio_write(void *opaque, hwaddr addr, uint64_t data,
                             unsigned size)
 {
@@ -2445,11 +2470,47 @@ static void nvme_mmio_write(void *opaque, hwaddr addr, uint64_t data,
 
     trace_pci_nvme_mmio_write(addr, data);
 
-    if (addr < sizeof(n->bar)) {
-        nvme_write_bar(n, addr, data, size);
-    } else {
-        nvme_process_db(n, addr, data);
+    /* Register writes must see the doorbell writes that came before */
+    nvme_db_flush(n);
+    nvme_write_bar(n, addr, data, size);
+}
+
+static uint64_t nvme_db_read(void *opaque, hwaddr addr, unsigned size)
+{
+    return nvme_mmio_read(opaque, sizeof(NvmeBar) + addr, size);
+}
+
+/*
+ * Doorbell writes are dispatched without the BQL.  Only the latest value
+ * of each doorbell is recorded; nvme_db_bh() processes them in the main
+ * loop, the same way the submission queue timers already do the work.
+ */
+static void nvme_db_write(void *opaque, hwaddr addr, uint64_t data,
+                          unsigned size)
+{
+    NvmeCtrl *n = (NvmeCtrl *)opaque;
+    uint32_t i = addr / NVME_DB_SIZE;
+
+    trace_pci_nvme_mmio_write(sizeof(NvmeBar) + addr, data);
+
+    if (unlikely(addr & (NVME_DB_SIZE - 1))) {
+        NVME_GUEST_ERR(pci_nvme_ub_db_wr_misaligned,
+                       "doorbell write not 32-bit aligned,"
+                       " offset=0x%"PRIx64", ignoring",
+                       sizeof(NvmeBar) + addr);
+        return;
+    }
+
+    qemu_mutex_lock(&n->db_lock);
+    if (n->db_unrealized) {
+        /* The queues are gone already */
+        qemu_mutex_unlock(&n->db_lock);
+        return;
     }
+    n->db_vals[i] = data;
+    set_bit(i, n->db_pending);
+    qemu_bh_schedule(n->db_bh);
+    qemu_mutex_unlock(&n->db_lock);
 }
 
 static const MemoryRegionOps nvme_mmio_ops = {
@@ -2462,6 +2523,16 @@ static const MemoryRegionOps nvme_mmio_ops = {
     },
 };
 
+static const MemoryRegionOps nvme_db_ops = {
+    .read = nvme_db_read,
+    .write = nvme_db_write,
+    .endianness = DEVICE_LITTLE_ENDIAN,
+    .impl = {
+        .min_access_size = 2,
+        .max_access_size = 8,
+    },
+};
+
 static void nvme_cmb_write(void *opaque, hwaddr addr, uint64_t data,
                            unsigned size)
 {
@@ -2548,6 +2619,12 @@ static void nvme_init_state(NvmeCtrl *n)
     n->features.temp_thresh_hi = NVME_TEMPERATURE_WARNING;
     n->starttime_ms = qemu_clock_get_ms(QEMU_CLOCK_VIRTUAL);
     n->aer_reqs = g_new0(NvmeRequest *, n->params.aerl + 1);
+
+    n->num_dbs = (n->reg_size - sizeof(NvmeBar)) / NVME_DB_SIZE;
+    n->db_vals = g_new0(uint32_t, n->num_dbs);
+    n->db_pending = bitmap_new(n->num_dbs);
+    qemu_mutex_init(&n->db_lock);
+    n->db_bh = qemu_bh_new(nvme_db_bh, n);
 }
 
 int nvme_register_namespace(NvmeCtrl *n, NvmeNamespace *ns, Error **errp)
@@ -2677,6 +2754,10 @@ static void nvme_init_pci(NvmeCtrl *n, PCIDevice *pci_dev, Error **errp)
 
     memory_region_init_io(&n->iomem, OBJECT(n), &nvme_mmio_ops, n, "nvme",
                           n->reg_size);
+    memory_region_init_io(&n->db_mem, OBJECT(n), &nvme_db_ops, n,
+                          "nvme-doorbell", n->reg_size - sizeof(NvmeBar));
+    memory_region_clear_global_locking(&n->db_mem);
+    memory_region_add_subregion(&n->iomem, sizeof(NvmeBar), &n->db_mem);
     pci_register_bar(pci_dev, 0, PCI_BASE_ADDRESS_SPACE_MEMORY |
                      PCI_BASE_ADDRESS_MEM_TYPE_64, &n->iomem);
     if (msix_init_exclusive_bar(pci_dev, n->params.msix_qsize, 4, errp)) {
@@ -2798,6 +2879,15 @@ static void nvme_exit(PCIDevice *pci_dev)
 {
     NvmeCtrl *n = NVME(pci_dev);
 
+    /*
+     * Doorbell writes may still come in without the BQL; make them and
+     * any scheduled nvme_db_bh() ignore the queues that are freed below.
+     */
+    qemu_mutex_lock(&n->db_lock);
+    n->db_unrealized = true;
+    qemu_bh_cancel(n->db_bh);
+    qemu_mutex_unlock(&n->db_lock);
+
     nvme_clear_ctrl(n);
     g_free(n->cq);
     g_free(n->sq);
@@ -2861,11 +2951,28 @@ static void nvme_instance_init(Object *obj)
     }
 }
 
+/*
+ * The doorbell state is freed only here: vCPUs may still be dispatching
+ * doorbell writes without the BQL after the device is unrealized.
+ */
+static void nvme_instance_finalize(Object *obj)
+{
+    NvmeCtrl *n = NVME(obj);
+
+    if (n->db_bh) {
+        qemu_bh_delete(n->db_bh);
+        qemu_mutex_destroy(&n->db_lock);
+        g_free(n->db_pending);
+        g_free(n->db_vals);
+    }
+}
+
 static const TypeInfo nvme_info = {
     .name          = TYPE_NVME,
     .parent        = TYPE_PCI_DEVICE,
     .instance_size = sizeof(NvmeCtrl),
     .instance_init = nvme_instance_init,
+    .instance_finalize = nvme_instance_finalize,
     .class_init    = nvme_class_init,
     .interfaces = (InterfaceInfo[]) {
         { INTERFACE_PCIE_DEVICE },
@@ -117,6 +117,7 @@ typedef struct NvmeFeatureVal {
 typedef struct NvmeCtrl {
     PCIDevice    parent_obj;
     MemoryRegion iomem;
+    MemoryRegion db_mem;
     MemoryRegion ctrl_mem;
     NvmeBar      bar;
     NvmeParams   params;
@@ -155,6 +156,14 @@ typedef struct NvmeCtrl {
     NvmeCQueue      admin_cq;
     NvmeIdCtrl      id_ctrl;
     NvmeFeatureVal  features;
+
+    /* Doorbell writes posted without the BQL, protected by db_lock */
+    QemuMutex       db_lock;
+    uint32_t        num_dbs;
+    uint32_t        *db_vals;
+    unsigned long   *db_pending;
+    QEMUBH          *db_bh;
+    bool            db_unrealized;
 } NvmeCtrl;
 
 static inline NvmeNamespace *nvme_ns(NvmeCtrl *n, uint32_t nsid)
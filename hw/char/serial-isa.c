@@ -26,6 +26,7 @@
 #include "qemu/osdep.h"
 #include "qapi/error.h"
 #include "qemu/module.h"
+#include "sysemu/kvm.h"
 #include "sysemu/sysemu.h"
 #include "hw/acpi/aml-build.h"
 #include "hw/char/serial.h"
@@ -42,6 +43,7 @@ struct ISASerialState {
     uint32_t index;
     uint32_t iobase;
     uint32_t isairq;
+    bool coalesced_io;
     SerialState state;
 };
 
@@ -73,6 +75,15 @@ static void serial_isa_realizefn(DeviceState *dev, Error **errp)
     if (isa->isairq == -1) {
         isa->isairq = isa_serial_irq[isa->index];
     }
+    /*
+     * Without the thread, posted writes are only flushed by the next access
+     * to another register, which a guest that only transmits never makes.
+     */
+    if (isa->coalesced_io && !kvm_coalesced_mmio_thread_running()) {
+        error_setg(errp, "x-coalesced-io requires "
+                   "-accel kvm,coalesced-mmio-thread=on");
+        return;
+    }
     index++;
 
     isa_init_irq(isadev, &s->irq, isa->isairq);
@@ -80,6 +91,13 @@ static void serial_isa_realizefn(DeviceState *dev, Error **errp)
     qdev_set_legacy_instance_id(dev, isa->iobase, 3);
 
     memory_region_init_io(&s->io, OBJECT(isa), &serial_io_ops, s, "serial", 8);
+    if (isa->coalesced_io) {
+        /*
+         * Post writes to the transmit holding register at offset 0.  Any
+         * other access, such as polling LSR, flushes them first.
+         */
+        memory_region_add_coalescing(&s->io, 0, 1);
+    }
     isa_register_ioport(isadev, &s->io, isa->iobase);
 }
 
@@ -116,6 +134,7 @@ static Property serial_isa_properties[] = {
     DEFINE_PROP_UINT32("index",  ISASerialState, index,   -1),
     DEFINE_PROP_UINT32("iobase",  ISASerialState, iobase,  -1),
     DEFINE_PROP_UINT32("irq",    ISASerialState, isairq,  -1),
+    DEFINE_PROP_BOOL("x-coalesced-io", ISASerialState, coalesced_io, false),
     DEFINE_PROP_END_OF_LIST(),
 };
 
@@ -44,6 +44,7 @@
 #include "hw/pci/pci.h"
 #include "net_rx_pkt.h"
 #include "hw/virtio/vhost.h"
+#include "block/aio-wait.h"
 
 #define VIRTIO_NET_VM_VERSION    11
 
@@ -117,6 +118,36 @@ static int vq2q(int queue_index)
     return queue_index / 2;
 }
 
+/*
+ * With an iothread the datapath may run outside the QEMU global mutex, so
+ * anything touching queue state from the main loop must take the
+ * AioContext lock as well.
+ */
+static void virtio_net_ctx_acquire(VirtIONet *n)
+{
+    if (n->ctx) {
+        aio_context_acquire(n->ctx);
+    }
+}
+
+static void virtio_net_ctx_release(VirtIONet *n)
+{
+    if (n->ctx) {
+        aio_context_release(n->ctx);
+    }
+}
+
+static void virtio_net_notify_queue(VirtIONet *n, VirtQueue *vq)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+
+    if (n->dataplane_started) {
+        virtio_notify_irqfd(vdev, vq);
+    } else {
+        virtio_notify(vdev, vq);
+    }
+}
+
 /* TODO
  * - we could suppress RX interrupt if we were so inclined.
  */
@@ -342,7 +373,7 @@ static void virtio_net_drop_tx_queue_data(VirtIODevice *vdev, VirtQueue *vq)
 {
     unsigned int dropped = virtqueue_drop_all(vq);
     if (dropped) {
-        virtio_notify(vdev, vq);
+        virtio_net_notify_queue(VIRTIO_NET(vdev), vq);
     }
 }
 
@@ -356,6 +387,7 @@ static void virtio_net_set_status(struct VirtIODevice *vdev, uint8_t status)
     virtio_net_vnet_endian_status(n, status);
     virtio_net_vhost_status(n, status);
 
+    virtio_net_ctx_acquire(n);
     for (i = 0; i < n->max_queues; i++) {
         NetClientState *ncs = qemu_get_subqueue(n->nic, i);
         bool queue_started;
@@ -401,6 +433,7 @@ static void virtio_net_set_status(struct VirtIODevice *vdev, uint8_t status)
             }
         }
     }
+    virtio_net_ctx_release(n);
 }
 
 static void virtio_net_set_link_status(NetClientState *nc)
@@ -715,9 +748,12 @@ static uint64_t virtio_net_get_features(VirtIODevice *vdev, uint64_t features,
         virtio_clear_feature(&features, VIRTIO_NET_F_HOST_TSO6);
         virtio_clear_feature(&features, VIRTIO_NET_F_HOST_ECN);
 
-        virtio_clear_feature(&features, VIRTIO_NET_F_GUEST_CSUM);
-        virtio_clear_feature(&features, VIRTIO_NET_F_GUEST_TSO4);
-        virtio_clear_feature(&features, VIRTIO_NET_F_GUEST_TSO6);
+        /* Software GRO produces checksum and TSO offloaded frames */
+        if (!n->gro) {
+            virtio_clear_feature(&features, VIRTIO_NET_F_GUEST_CSUM);
+            virtio_clear_feature(&features, VIRTIO_NET_F_GUEST_TSO4);
+            virtio_clear_feature(&features, VIRTIO_NET_F_GUEST_TSO6);
+        }
         virtio_clear_feature(&features, VIRTIO_NET_F_GUEST_ECN);
 
         virtio_clear_feature(&features, VIRTIO_NET_F_HASH_REPORT);
@@ -762,10 +798,21 @@ static uint64_t virtio_net_bad_features(VirtIODevice *vdev)
 
 static void virtio_net_apply_guest_offloads(VirtIONet *n)
 {
-    qemu_set_offload(qemu_get_queue(n->nic)->peer,
-            !!(n->curr_guest_offloads & (1ULL << VIRTIO_NET_F_GUEST_CSUM)),
-            !!(n->curr_guest_offloads & (1ULL << VIRTIO_NET_F_GUEST_TSO4)),
-            !!(n->curr_guest_offloads & (1ULL << VIRTIO_NET_F_GUEST_TSO6)),
+    bool csum = n->curr_guest_offloads & (1ULL << VIRTIO_NET_F_GUEST_CSUM);
+    bool tso4 = n->curr_guest_offloads & (1ULL << VIRTIO_NET_F_GUEST_TSO4);
+    bool tso6 = n->curr_guest_offloads & (1ULL << VIRTIO_NET_F_GUEST_TSO6);
+    int i;
+
+    if (!n->has_vnet_hdr) {
+        for (i = 0; i < n->max_queues; i++) {
+            if (n->vqs[i].gro) {
+                net_gro_set_offload(n->vqs[i].gro, csum, tso4, tso6);
+            }
+        }
+        return;
+    }
+
+    qemu_set_offload(qemu_get_queue(n->nic)->peer, csum, tso4, tso6,
             !!(n->curr_guest_offloads & (1ULL << VIRTIO_NET_F_GUEST_ECN)),
             !!(n->curr_guest_offloads & (1ULL << VIRTIO_NET_F_GUEST_UFO)));
 }
@@ -906,7 +953,7 @@ static void virtio_net_set_features(VirtIODevice *vdev, uint64_t features)
         virtio_has_feature(features, VIRTIO_NET_F_GUEST_TSO6);
     n->rss_data.redirect = virtio_has_feature(features, VIRTIO_NET_F_RSS);
 
-    if (n->has_vnet_hdr) {
+    if (n->has_vnet_hdr || n->gro) {
         n->curr_guest_offloads =
             virtio_net_guest_offloads_by_features(features);
         virtio_net_apply_guest_offloads(n);
@@ -1004,7 +1051,7 @@ static int virtio_net_handle_offloads(VirtIONet *n, uint8_t cmd,
 
         offloads = virtio_ldq_p(vdev, &offloads);
 
-        if (!n->has_vnet_hdr) {
+        if (!n->has_vnet_hdr && !n->gro) {
             return VIRTIO_NET_ERR;
         }
 
@@ -1354,6 +1401,8 @@ static void virtio_net_handle_ctrl(VirtIODevice *vdev, VirtQueue *vq)
     struct iovec *iov, *iov2;
     unsigned int iov_cnt;
 
+    /* The receive filter and queue pairs are consulted by the datapath */
+    virtio_net_ctx_acquire(n);
     for (;;) {
         elem = virtqueue_pop(vq, sizeof(VirtQueueElement));
         if (!elem) {
@@ -1395,6 +1444,7 @@ static void virtio_net_handle_ctrl(VirtIODevice *vdev, VirtQueue *vq)
         g_free(iov2);
         g_free(elem);
     }
+    virtio_net_ctx_release(n);
 }
 
 /* RX */
@@ -1403,7 +1453,12 @@ static void virtio_net_handle_rx(VirtIODevice *vdev, VirtQueue *vq)
 {
     VirtIONet *n = VIRTIO_NET(vdev);
     int queue_index = vq2q(virtio_get_queue_index(vq));
+    VirtIONetQueue *q = &n->vqs[queue_index];
 
+    /* Held segments go first, they were received before anything queued */
+    if (q->gro && !net_gro_flush(q->gro)) {
+        return;
+    }
     qemu_flush_queued_packets(qemu_get_subqueue(n->nic, queue_index));
 }
 
@@ -1488,9 +1543,17 @@ static void work_around_broken_dhclient(struct virtio_net_hdr *hdr,
 }
 
 static void receive_header(VirtIONet *n, const struct iovec *iov, int iov_cnt,
-                           const void *buf, size_t size)
+                           const void *buf, size_t size,
+                           const struct virtio_net_hdr *gro_hdr)
 {
-    if (n->has_vnet_hdr) {
+    if (gro_hdr) {
+        struct virtio_net_hdr hdr = *gro_hdr;
+
+        if (n->needs_vnet_hdr_swap) {
+            virtio_net_hdr_swap(VIRTIO_DEVICE(n), &hdr);
+        }
+        iov_from_buf(iov, iov_cnt, 0, &hdr, sizeof hdr);
+    } else if (n->has_vnet_hdr) {
         /* FIXME this cast is evil */
         void *wbuf = (void *)buf;
         work_around_broken_dhclient(wbuf, wbuf + n->host_hdr_len,
@@ -1659,8 +1722,13 @@ static int virtio_net_process_rss(NetClientState *nc, const uint8_t *buf,
     return (index == new_index) ? -1 : new_index;
 }
 
+/*
+ * @gro_hdr is the header supplied by software GRO for backends without a
+ * vnet header, in host byte order, or NULL.
+ */
 static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
-                                      size_t size, bool no_rss)
+                                      size_t size, bool no_rss,
+                                      const struct virtio_net_hdr *gro_hdr)
 {
     VirtIONet *n = qemu_get_nic_opaque(nc);
     VirtIONetQueue *q = virtio_net_get_subqueue(nc);
@@ -1678,7 +1746,7 @@ static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
         int index = virtio_net_process_rss(nc, buf, size);
         if (index >= 0) {
             NetClientState *nc2 = qemu_get_subqueue(n->nic, index);
-            return virtio_net_receive_rcu(nc2, buf, size, true);
+            return virtio_net_receive_rcu(nc2, buf, size, true, gro_hdr);
         }
     }
 
@@ -1731,7 +1799,7 @@ static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
                                     sizeof(mhdr.num_buffers));
             }
 
-            receive_header(n, sg, elem->in_num, buf, size);
+            receive_header(n, sg, elem->in_num, buf, size, gro_hdr);
             if (n->rss_data.populate_hash) {
                 offset = sizeof(mhdr);
                 iov_from_buf(sg, elem->in_num, offset,
@@ -1771,7 +1839,7 @@ static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
     }
 
     virtqueue_flush(q->rx_vq, i);
-    virtio_notify(vdev, q->rx_vq);
+    virtio_net_notify_queue(n, q->rx_vq);
 
     return size;
 }
@@ -1781,7 +1849,25 @@ static ssize_t virtio_net_do_receive(NetClientState *nc, const uint8_t *buf,
 {
     RCU_READ_LOCK_GUARD();
 
-    return virtio_net_receive_rcu(nc, buf, size, false);
+    return virtio_net_receive_rcu(nc, buf, size, false, NULL);
+}
+
+static ssize_t virtio_net_gro_output(void *opaque,
+                                     const struct virtio_net_hdr *hdr,
+                                     const uint8_t *buf, size_t size)
+{
+    VirtIONetQueue *q = opaque;
+    VirtIONet *n = q->n;
+    NetClientState *nc = qemu_get_subqueue(n->nic, q - n->vqs);
+    ssize_t ret;
+
+    /* Also called from the GRO bottom half */
+    virtio_net_ctx_acquire(n);
+    WITH_RCU_READ_LOCK_GUARD() {
+        ret = virtio_net_receive_rcu(nc, buf, size, false, hdr);
+    }
+    virtio_net_ctx_release(n);
+    return ret;
 }
 
 static void virtio_net_rsc_extract_unit4(VirtioNetRscChain *chain,
@@ -1854,6 +1940,7 @@ static void virtio_net_rsc_purge(void *opq)
     VirtioNetRscSeg *seg, *rn;
     VirtioNetRscChain *chain = (VirtioNetRscChain *)opq;
 
+    virtio_net_ctx_acquire(chain->n);
     QTAILQ_FOREACH_SAFE(seg, &chain->buffers, next, rn) {
         if (virtio_net_rsc_drain_seg(chain, seg) == 0) {
             chain->stat.purge_failed++;
@@ -1866,6 +1953,7 @@ static void virtio_net_rsc_purge(void *opq)
         timer_mod(chain->drain_timer,
               qemu_clock_get_ns(QEMU_CLOCK_HOST) + chain->n->rsc_timeout);
     }
+    virtio_net_ctx_release(chain->n);
 }
 
 static void virtio_net_rsc_cleanup(VirtIONet *n)
@@ -2382,11 +2470,18 @@ static ssize_t virtio_net_receive(NetClientState *nc, const uint8_t *buf,
                                   size_t size)
 {
     VirtIONet *n = qemu_get_nic_opaque(nc);
+    ssize_t ret;
+
+    virtio_net_ctx_acquire(n);
     if ((n->rsc4_enabled || n->rsc6_enabled)) {
-        return virtio_net_rsc_receive(nc, buf, size);
+        ret = virtio_net_rsc_receive(nc, buf, size);
+    } else if (virtio_net_get_subqueue(nc)->gro && !n->has_vnet_hdr) {
+        ret = net_gro_receive(virtio_net_get_subqueue(nc)->gro, buf, size);
     } else {
-        return virtio_net_do_receive(nc, buf, size);
+        ret = virtio_net_do_receive(nc, buf, size);
     }
+    virtio_net_ctx_release(n);
+    return ret;
 }
 
 static int32_t virtio_net_flush_tx(VirtIONetQueue *q);
@@ -2395,25 +2490,82 @@ static void virtio_net_tx_complete(NetClientState *nc, ssize_t len)
 {
     VirtIONet *n = qemu_get_nic_opaque(nc);
     VirtIONetQueue *q = virtio_net_get_subqueue(nc);
-    VirtIODevice *vdev = VIRTIO_DEVICE(n);
 
+    virtio_net_ctx_acquire(n);
     virtqueue_push(q->tx_vq, q->async_tx.elem, 0);
-    virtio_notify(vdev, q->tx_vq);
+    virtio_net_notify_queue(n, q->tx_vq);
 
     g_free(q->async_tx.elem);
     q->async_tx.elem = NULL;
 
     virtio_queue_set_notification(q->tx_vq, 1);
     virtio_net_flush_tx(q);
+    virtio_net_ctx_release(n);
 }
 
 /* TX */
+
+/* Maximum number of packets handed to the backend in one call */
+#define VIRTIO_NET_TX_BATCH 64
+
+/*
+ * Send the packets collected in @elems with one call into the net layer
+ * and complete them with a single guest notification.  If the backend
+ * queued one of them, it becomes the in-flight async_tx element and the
+ * ones after it go back to the virtqueue.
+ */
+static int32_t virtio_net_flush_tx_batch(VirtIONetQueue *q,
+                                         VirtQueueElement **elems, int count)
+{
+    VirtIONet *n = q->n;
+    int queue_index = vq2q(virtio_get_queue_index(q->tx_vq));
+    const struct iovec *iovs[VIRTIO_NET_TX_BATCH];
+    int iovcnts[VIRTIO_NET_TX_BATCH];
+    int i, sent;
+
+    if (!count) {
+        return 0;
+    }
+
+    for (i = 0; i < count; i++) {
+        iovs[i] = elems[i]->out_sg;
+        iovcnts[i] = elems[i]->out_num;
+    }
+    sent = qemu_sendv_packet_batch_async(qemu_get_subqueue(n->nic,
+                                                           queue_index),
+                                         iovs, iovcnts, count,
+                                         virtio_net_tx_complete);
+
+    for (i = 0; i < sent; i++) {
+        virtqueue_fill(q->tx_vq, elems[i], 0, i);
+        g_free(elems[i]);
+    }
+    if (sent) {
+        virtqueue_flush(q->tx_vq, sent);
+        virtio_net_notify_queue(n, q->tx_vq);
+    }
+
+    if (sent < count) {
+        for (i = count - 1; i > sent; i--) {
+            virtqueue_unpop(q->tx_vq, elems[i], 0);
+            g_free(elems[i]);
+        }
+        virtio_queue_set_notification(q->tx_vq, 0);
+        q->async_tx.elem = elems[sent];
+        return -EBUSY;
+    }
+    return sent;
+}
+
 static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
 {
     VirtIONet *n = q->n;
     VirtIODevice *vdev = VIRTIO_DEVICE(n);
     VirtQueueElement *elem;
+    VirtQueueElement *batch[VIRTIO_NET_TX_BATCH];
     int32_t num_packets = 0;
+    int32_t sent;
+    int nbatch = 0;
     int queue_index = vq2q(virtio_get_queue_index(q->tx_vq));
     if (!(vdev->status & VIRTIO_CONFIG_S_DRIVER_OK)) {
         return num_packets;
@@ -2429,6 +2581,11 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
         unsigned int out_num;
         struct iovec sg[VIRTQUEUE_MAX_SIZE], sg2[VIRTQUEUE_MAX_SIZE + 1], *out_sg;
         struct virtio_net_hdr_mrg_rxbuf mhdr;
+        bool nocopy = true;
+
+        if (num_packets + nbatch >= n->tx_burst) {
+            break;
+        }
 
         elem = virtqueue_pop(q->tx_vq, sizeof(VirtQueueElement));
         if (!elem) {
@@ -2441,30 +2598,63 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
             virtio_error(vdev, "virtio-net header not in first element");
             virtqueue_detach_element(q->tx_vq, elem, 0);
             g_free(elem);
-            return -EINVAL;
+            goto error;
         }
 
-        if (n->has_vnet_hdr) {
-            if (iov_to_buf(out_sg, out_num, 0, &mhdr, n->guest_hdr_len) <
-                n->guest_hdr_len) {
-                virtio_error(vdev, "virtio-net header incorrect");
-                virtqueue_detach_element(q->tx_vq, elem, 0);
-                g_free(elem);
-                return -EINVAL;
-            }
-            if (n->needs_vnet_hdr_swap) {
-                virtio_net_hdr_swap(vdev, (void *) &mhdr);
-                sg2[0].iov_base = &mhdr;
-                sg2[0].iov_len = n->guest_hdr_len;
-                out_num = iov_copy(&sg2[1], ARRAY_SIZE(sg2) - 1,
-                                   out_sg, out_num,
-                                   n->guest_hdr_len, -1);
-                if (out_num == VIRTQUEUE_MAX_SIZE) {
-                    goto drop;
+        if (n->has_vnet_hdr &&
+            iov_size(out_sg, out_num) < n->guest_hdr_len) {
+            virtio_error(vdev, "virtio-net header incorrect");
+            virtqueue_detach_element(q->tx_vq, elem, 0);
+            g_free(elem);
+            goto error;
+        }
+
+        /*
+         * Packets whose header goes to the backend unmodified are sent
+         * straight from the guest buffers, a whole batch at a time.
+         */
+        if (!(n->has_vnet_hdr && n->needs_vnet_hdr_swap) &&
+            n->host_hdr_len == n->guest_hdr_len) {
+            batch[nbatch++] = elem;
+            if (nbatch == VIRTIO_NET_TX_BATCH) {
+                ret = virtio_net_flush_tx_batch(q, batch, nbatch);
+                nbatch = 0;
+                if (ret < 0) {
+                    return ret;
                 }
-                out_num += 1;
-                out_sg = sg2;
+                num_packets += ret;
+            }
+            continue;
+        }
+
+        if (nbatch) {
+            /* Keep packets in order: send what was batched so far first */
+            virtqueue_unpop(q->tx_vq, elem, 0);
+            g_free(elem);
+            ret = virtio_net_flush_tx_batch(q, batch, nbatch);
+            nbatch = 0;
+            if (ret < 0) {
+                return ret;
+            }
+            num_packets += ret;
+            continue;
+        }
+
+        if (n->has_vnet_hdr && n->needs_vnet_hdr_swap) {
+            iov_to_buf(out_sg, out_num, 0, &mhdr, n->guest_hdr_len);
+            virtio_net_hdr_swap(vdev, (void *) &mhdr);
+            sg2[0].iov_base = &mhdr;
+            sg2[0].iov_len = n->guest_hdr_len;
+            out_num = iov_copy(&sg2[1], ARRAY_SIZE(sg2) - 1,
+                               out_sg, out_num,
+                               n->guest_hdr_len, -1);
+            if (out_num == VIRTQUEUE_MAX_SIZE) {
+                goto drop;
             }
+            out_num += 1;
+            out_sg = sg2;
+            /* mhdr is on the stack */
+            nocopy = false;
         }
         /*
          * If host wants to see the guest header as is, we can
@@ -2483,8 +2673,17 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
             out_sg = sg;
         }
 
-        ret = qemu_sendv_packet_async(qemu_get_subqueue(n->nic, queue_index),
-                                      out_sg, out_num, virtio_net_tx_complete);
+        /* The element, and thus the guest buffers, stay around until
+         * virtio_net_tx_complete() */
+        if (nocopy) {
+            ret = qemu_sendv_packet_async_nocopy(
+                qemu_get_subqueue(n->nic, queue_index),
+                out_sg, out_num, virtio_net_tx_complete);
+        } else {
+            ret = qemu_sendv_packet_async(
+                qemu_get_subqueue(n->nic, queue_index),
+                out_sg, out_num, virtio_net_tx_complete);
+        }
         if (ret == 0) {
             virtio_queue_set_notification(q->tx_vq, 0);
             q->async_tx.elem = elem;
@@ -2493,14 +2692,23 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
 
 drop:
         virtqueue_push(q->tx_vq, elem, 0);
-        virtio_notify(vdev, q->tx_vq);
+        virtio_net_notify_queue(n, q->tx_vq);
         g_free(elem);
+        num_packets++;
+    }
 
-        if (++num_packets >= n->tx_burst) {
-            break;
-        }
+    sent = virtio_net_flush_tx_batch(q, batch, nbatch);
+    if (sent < 0) {
+        return sent;
     }
-    return num_packets;
+    return num_packets + sent;
+
+error:
+    while (nbatch--) {
+        virtqueue_detach_element(q->tx_vq, batch[nbatch], 0);
+        g_free(batch[nbatch]);
+    }
+    return -EINVAL;
 }
 
 static void virtio_net_handle_tx_timer(VirtIODevice *vdev, VirtQueue *vq)
@@ -2556,9 +2764,8 @@ static void virtio_net_handle_tx_bh(VirtIODevice *vdev, VirtQueue *vq)
     qemu_bh_schedule(q->tx_bh);
 }
 
-static void virtio_net_tx_timer(void *opaque)
+static void virtio_net_tx_timer_locked(VirtIONetQueue *q)
 {
-    VirtIONetQueue *q = opaque;
     VirtIONet *n = q->n;
     VirtIODevice *vdev = VIRTIO_DEVICE(n);
     /* This happens when device was stopped but BH wasn't. */
@@ -2579,9 +2786,17 @@ static void virtio_net_tx_timer(void *opaque)
     virtio_net_flush_tx(q);
 }
 
-static void virtio_net_tx_bh(void *opaque)
+static void virtio_net_tx_timer(void *opaque)
 {
     VirtIONetQueue *q = opaque;
+
+    virtio_net_ctx_acquire(q->n);
+    virtio_net_tx_timer_locked(q);
+    virtio_net_ctx_release(q->n);
+}
+
+static void virtio_net_tx_bh_locked(VirtIONetQueue *q)
+{
     VirtIONet *n = q->n;
     VirtIODevice *vdev = VIRTIO_DEVICE(n);
     int32_t ret;
@@ -2628,6 +2843,15 @@ static void virtio_net_tx_bh(void *opaque)
     }
 }
 
+static void virtio_net_tx_bh(void *opaque)
+{
+    VirtIONetQueue *q = opaque;
+
+    virtio_net_ctx_acquire(q->n);
+    virtio_net_tx_bh_locked(q);
+    virtio_net_ctx_release(q->n);
+}
+
 static void virtio_net_add_queue(VirtIONet *n, int index)
 {
     VirtIODevice *vdev = VIRTIO_DEVICE(n);
@@ -2649,6 +2873,12 @@ static void virtio_net_add_queue(VirtIONet *n, int index)
         n->vqs[index].tx_bh = qemu_bh_new(virtio_net_tx_bh, &n->vqs[index]);
     }
 
+    if (n->gro) {
+        n->vqs[index].gro = net_gro_new(qemu_get_aio_context(),
+                                        virtio_net_gro_output,
+                                        &n->vqs[index]);
+    }
+
     n->vqs[index].tx_waiting = 0;
     n->vqs[index].n = n;
 }
@@ -2671,6 +2901,8 @@ static void virtio_net_del_queue(VirtIONet *n, int index)
         q->tx_bh = NULL;
     }
     q->tx_waiting = 0;
+    net_gro_free(q->gro);
+    q->gro = NULL;
     virtio_del_queue(vdev, index * 2 + 1);
 }
 
@@ -2798,7 +3030,7 @@ static int virtio_net_post_load_virtio(VirtIODevice *vdev)
      * Restore it back and apply the desired offloads.
      */
     n->curr_guest_offloads = n->saved_guest_offloads;
-    if (peer_has_vnet_hdr(n)) {
+    if (peer_has_vnet_hdr(n) || n->gro) {
         virtio_net_apply_guest_offloads(n);
     }
 
@@ -3251,6 +3483,205 @@ out:
     }
 }
 
+/*
+ * Userspace dataplane: with an iothread configured, the rx/tx virtqueues,
+ * the tx BH/timer and the tap backends are all serviced from the iothread's
+ * AioContext, so the datapath never takes the QEMU global mutex.  The
+ * control virtqueue stays in the main loop.
+ */
+static bool virtio_net_data_plane_handle_output(VirtIODevice *vdev,
+                                                VirtQueue *vq)
+{
+    VirtIONet *n = VIRTIO_NET(vdev);
+    int queue_index = virtio_get_queue_index(vq);
+
+    aio_context_acquire(n->ctx);
+    if (queue_index % 2 == 0) {
+        virtio_net_handle_rx(vdev, vq);
+    } else if (n->vqs[vq2q(queue_index)].tx_timer) {
+        virtio_net_handle_tx_timer(vdev, vq);
+    } else {
+        virtio_net_handle_tx_bh(vdev, vq);
+    }
+    aio_context_release(n->ctx);
+    return true;
+}
+
+/* Recreate the tx BH or timer of @q so that it fires in @ctx */
+static void virtio_net_queue_set_aio_context(VirtIONetQueue *q,
+                                             AioContext *ctx)
+{
+    if (q->tx_timer) {
+        bool pending = timer_pending(q->tx_timer);
+        uint64_t expire = timer_expire_time_ns(q->tx_timer);
+
+        timer_del(q->tx_timer);
+        timer_free(q->tx_timer);
+        q->tx_timer = aio_timer_new(ctx, QEMU_CLOCK_VIRTUAL, SCALE_NS,
+                                    virtio_net_tx_timer, q);
+        if (pending) {
+            timer_mod(q->tx_timer, expire);
+        }
+    } else {
+        qemu_bh_delete(q->tx_bh);
+        q->tx_bh = aio_bh_new(ctx, virtio_net_tx_bh, q);
+        if (q->tx_waiting) {
+            qemu_bh_schedule(q->tx_bh);
+        }
+    }
+    if (q->gro) {
+        net_gro_set_aio_context(q->gro, ctx);
+    }
+}
+
+static bool virtio_net_data_plane_supported(VirtIONet *n)
+{
+    int i;
+
+    for (i = 0; i < n->max_queues; i++) {
+        NetClientState *peer = qemu_get_subqueue(n->nic, i)->peer;
+
+        if (!peer || get_vhost_net(peer) || !qemu_can_set_aio_context(peer)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void virtio_net_data_plane_set_aio_context(VirtIONet *n,
+                                                  AioContext *ctx)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+    int nqueues = (virtio_get_num_queues(vdev) - 1) / 2;
+    int i;
+
+    for (i = 0; i < n->max_queues; i++) {
+        qemu_set_aio_context(qemu_get_subqueue(n->nic, i)->peer, ctx);
+    }
+    for (i = 0; i < nqueues; i++) {
+        virtio_net_queue_set_aio_context(&n->vqs[i],
+                                         ctx ?: qemu_get_aio_context());
+    }
+}
+
+/* Context: QEMU global mutex held */
+static int virtio_net_data_plane_start(VirtIODevice *vdev)
+{
+    VirtIONet *n = VIRTIO_NET(vdev);
+    BusState *qbus = BUS(qdev_get_parent_bus(DEVICE(vdev)));
+    VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+    int nvqs = virtio_get_num_queues(vdev);
+    int i, r;
+
+    if (!n->ctx || !virtio_net_data_plane_supported(n)) {
+        return virtio_device_start_ioeventfd_impl(vdev);
+    }
+
+    /* irqfds are routed directly, there is no vhost backend to mask them */
+    vdev->use_guest_notifier_mask = false;
+
+    /* Set up guest notifier (irq) */
+    r = k->set_guest_notifiers(qbus->parent, nvqs, true);
+    if (r != 0) {
+        error_report("virtio-net failed to set guest notifier (%d), "
+                     "falling back to the main loop", r);
+        return virtio_device_start_ioeventfd_impl(vdev);
+    }
+
+    /* Set up virtqueue notify */
+    for (i = 0; i < nvqs; i++) {
+        r = virtio_bus_set_host_notifier(VIRTIO_BUS(qbus), i, true);
+        if (r != 0) {
+            error_report("virtio-net failed to set host notifier (%d)", r);
+            while (i--) {
+                virtio_bus_set_host_notifier(VIRTIO_BUS(qbus), i, false);
+                virtio_bus_cleanup_host_notifier(VIRTIO_BUS(qbus), i);
+            }
+            k->set_guest_notifiers(qbus->parent, nvqs, false);
+            return r;
+        }
+    }
+
+    /* Control commands still run under the QEMU global mutex */
+    event_notifier_set_handler(virtio_queue_get_host_notifier(n->ctrl_vq),
+                               virtio_queue_host_notifier_read);
+
+    n->dataplane_started = true;
+
+    aio_context_acquire(n->ctx);
+    virtio_net_data_plane_set_aio_context(n, n->ctx);
+    aio_context_release(n->ctx);
+
+    /* Kick right away to begin processing requests already in vring */
+    for (i = 0; i < nvqs; i++) {
+        VirtQueue *vq = virtio_get_queue(vdev, i);
+
+        event_notifier_set(virtio_queue_get_host_notifier(vq));
+    }
+
+    /* Get this show started by hooking up our callbacks */
+    aio_context_acquire(n->ctx);
+    for (i = 0; i < nvqs; i++) {
+        VirtQueue *vq = virtio_get_queue(vdev, i);
+
+        if (vq != n->ctrl_vq) {
+            virtio_queue_aio_set_host_notifier_handler(vq, n->ctx,
+                    virtio_net_data_plane_handle_output);
+        }
+    }
+    aio_context_release(n->ctx);
+    return 0;
+}
+
+/* Context: BH in IOThread */
+static void virtio_net_data_plane_stop_bh(void *opaque)
+{
+    VirtIONet *n = opaque;
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+    int nvqs = virtio_get_num_queues(vdev);
+    int i;
+
+    for (i = 0; i < nvqs; i++) {
+        VirtQueue *vq = virtio_get_queue(vdev, i);
+
+        if (vq != n->ctrl_vq) {
+            virtio_queue_aio_set_host_notifier_handler(vq, n->ctx, NULL);
+        }
+    }
+}
+
+/* Context: QEMU global mutex held */
+static void virtio_net_data_plane_stop(VirtIODevice *vdev)
+{
+    VirtIONet *n = VIRTIO_NET(vdev);
+    BusState *qbus = qdev_get_parent_bus(DEVICE(vdev));
+    VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+    int nvqs = virtio_get_num_queues(vdev);
+    int i;
+
+    if (!n->dataplane_started) {
+        virtio_device_stop_ioeventfd_impl(vdev);
+        return;
+    }
+
+    aio_context_acquire(n->ctx);
+    aio_wait_bh_oneshot(n->ctx, virtio_net_data_plane_stop_bh, n);
+    virtio_net_data_plane_set_aio_context(n, NULL);
+    aio_context_release(n->ctx);
+
+    event_notifier_set_handler(virtio_queue_get_host_notifier(n->ctrl_vq),
+                               NULL);
+    for (i = 0; i < nvqs; i++) {
+        virtio_bus_set_host_notifier(VIRTIO_BUS(qbus), i, false);
+        virtio_bus_cleanup_host_notifier(VIRTIO_BUS(qbus), i);
+    }
+
+    /* Clean up guest notifier (irq) */
+    k->set_guest_notifiers(qbus->parent, nvqs, false);
+
+    n->dataplane_started = false;
+}
+
 static void virtio_net_device_realize(DeviceState *dev, Error **errp)
 {
     VirtIODevice *vdev = VIRTIO_DEVICE(dev);
@@ -3324,6 +3755,27 @@ static void virtio_net_device_realize(DeviceState *dev, Error **errp)
         return;
     }
 
+    if (n->net_conf.iothread) {
+        BusState *qbus = qdev_get_parent_bus(dev);
+        VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+
+        /* Don't try if transport does not support notifiers. */
+        if (!k->set_guest_notifiers || !k->ioeventfd_assign) {
+            error_setg(errp,
+                       "device is incompatible with iothread "
+                       "(transport does not support notifiers)");
+            virtio_cleanup(vdev);
+            return;
+        }
+        if (!virtio_device_ioeventfd_enabled(vdev)) {
+            error_setg(errp, "ioeventfd is required for iothread");
+            virtio_cleanup(vdev);
+            return;
+        }
+        n->ctx = iothread_get_aio_context(n->net_conf.iothread);
+        object_ref(OBJECT(n->net_conf.iothread));
+    }
+
     n->max_queues = MAX(n->nic_conf.peers.queues, 1);
     if (n->max_queues * 2 + 1 > VIRTIO_QUEUE_MAX) {
         error_setg(errp, "Invalid number of queues (= %" PRIu32 "), "
@@ -3444,6 +3896,10 @@ static void virtio_net_device_unrealize(DeviceState *dev)
     virtio_net_rsc_cleanup(n);
     g_free(n->rss_data.indirections_table);
     net_rx_pkt_uninit(n->rx_pkt);
+    if (n->ctx) {
+        object_unref(OBJECT(n->net_conf.iothread));
+        n->ctx = NULL;
+    }
     virtio_cleanup(vdev);
 }
 
@@ -3568,6 +4024,9 @@ static Property virtio_net_properties[] = {
     DEFINE_PROP_INT32("speed", VirtIONet, net_conf.speed, SPEED_UNKNOWN),
     DEFINE_PROP_STRING("duplex", VirtIONet, net_conf.duplex_str),
     DEFINE_PROP_BOOL("failover", VirtIONet, failover, false),
+    DEFINE_PROP_BOOL("gro", VirtIONet, gro, false),
+    DEFINE_PROP_LINK("iothread", VirtIONet, net_conf.iothread, TYPE_IOTHREAD,
+                     IOThread *),
     DEFINE_PROP_END_OF_LIST(),
 };
 
@@ -3588,6 +4047,8 @@ static void virtio_net_class_init(ObjectClass *klass, void *data)
     vdc->bad_features = virtio_net_bad_features;
     vdc->reset = virtio_net_reset;
     vdc->set_status = virtio_net_set_status;
+    vdc->start_ioeventfd = virtio_net_data_plane_start;
+    vdc->stop_ioeventfd = virtio_net_data_plane_stop;
     vdc->guest_notifier_mask = virtio_net_guest_notifier_mask;
     vdc->guest_notifier_pending = virtio_net_guest_notifier_pending;
     vdc->legacy_features |= (0x1 << VIRTIO_NET_F_GSO);
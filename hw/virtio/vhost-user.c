@@ -79,10 +79,14 @@ enum VhostUserProtocolFeature {
     VHOST_USER_PROTOCOL_F_RESET_DEVICE = 13,
     /* Feature 14 reserved for VHOST_USER_PROTOCOL_F_INBAND_NOTIFICATIONS. */
     VHOST_USER_PROTOCOL_F_CONFIGURE_MEM_SLOTS = 15,
+    /* Feature 16 reserved for VHOST_USER_PROTOCOL_F_STATUS. */
+    VHOST_USER_PROTOCOL_F_LOG_RING = 17,
     VHOST_USER_PROTOCOL_F_MAX
 };
 
-#define VHOST_USER_PROTOCOL_FEATURE_MASK ((1 << VHOST_USER_PROTOCOL_F_MAX) - 1)
+/* Bit 16 is not implemented, don't negotiate it */
+#define VHOST_USER_PROTOCOL_FEATURE_MASK \
+    (((1ULL << VHOST_USER_PROTOCOL_F_MAX) - 1) & ~(1ULL << 16))
 
 typedef enum VhostUserRequest {
     VHOST_USER_NONE = 0,
@@ -124,6 +128,8 @@ typedef enum VhostUserRequest {
     VHOST_USER_GET_MAX_MEM_SLOTS = 36,
     VHOST_USER_ADD_MEM_REG = 37,
     VHOST_USER_REM_MEM_REG = 38,
+    /* Message numbers 39 and 40 reserved for VHOST_USER_SET/GET_STATUS. */
+    VHOST_USER_SET_LOG_RING = 41,
     VHOST_USER_MAX
 } VhostUserRequest;
 
@@ -358,6 +364,7 @@ static bool vhost_user_one_time_request(VhostUserRequest request)
     case VHOST_USER_SET_MEM_TABLE:
     case VHOST_USER_GET_QUEUE_NUM:
     case VHOST_USER_NET_SET_MTU:
+    case VHOST_USER_SET_LOG_RING:
         return true;
     default:
         return false;
@@ -447,6 +454,46 @@ static int vhost_user_set_log_base(struct vhost_dev *dev, uint64_t base,
     return 0;
 }
 
+/*
+ * The ring is per backend: vhost_dev_log_ring_start() only registers it
+ * for the first queue pair, and the backend logs the writes of all queues
+ * to it.
+ */
+static int vhost_user_set_log_ring(struct vhost_dev *dev,
+                                   struct vhost_log_ring *ring)
+{
+    bool reply_supported = virtio_has_feature(dev->protocol_features,
+                                              VHOST_USER_PROTOCOL_F_REPLY_ACK);
+    VhostUserMsg msg = {
+        .hdr.request = VHOST_USER_SET_LOG_RING,
+        .hdr.flags = VHOST_USER_VERSION,
+        .payload.log.mmap_size = ring->size,
+        .payload.log.mmap_offset = 0,
+        .hdr.size = sizeof(msg.payload.log),
+    };
+
+    assert(dev->vq_index == 0);
+
+    if (!virtio_has_feature(dev->protocol_features,
+                            VHOST_USER_PROTOCOL_F_LOG_RING)) {
+        return -1;
+    }
+
+    if (reply_supported) {
+        msg.hdr.flags |= VHOST_USER_NEED_REPLY_MASK;
+    }
+
+    if (vhost_user_write(dev, &msg, &ring->fd, 1) < 0) {
+        return -1;
+    }
+
+    if (reply_supported) {
+        return process_message_reply(dev, &msg);
+    }
+
+    return 0;
+}
+
 static MemoryRegion *vhost_user_get_mr_data(uint64_t addr, ram_addr_t *offset,
                                             int *fd)
 {
@@ -2359,6 +2406,7 @@ const VhostOps user_ops = {
         .vhost_backend_cleanup = vhost_user_backend_cleanup,
         .vhost_backend_memslots_limit = vhost_user_memslots_limit,
         .vhost_set_log_base = vhost_user_set_log_base,
+        .vhost_set_log_ring = vhost_user_set_log_ring,
         .vhost_set_mem_table = vhost_user_set_mem_table,
         .vhost_set_vring_addr = vhost_user_set_vring_addr,
         .vhost_set_vring_endian = vhost_user_set_vring_endian,
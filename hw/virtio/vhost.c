@@ -106,18 +106,15 @@ static void vhost_dev_sync_region(struct vhost_dev *dev,
     }
 }
 
-static int vhost_sync_dirty_bitmap(struct vhost_dev *dev,
-                                   MemoryRegionSection *section,
-                                   hwaddr first,
-                                   hwaddr last)
+static void vhost_sync_dirty_log(struct vhost_dev *dev,
+                                 MemoryRegionSection *section,
+                                 hwaddr first,
+                                 hwaddr last)
 {
     int i;
     hwaddr start_addr;
     hwaddr end_addr;
 
-    if (!dev->log_enabled || !dev->started) {
-        return 0;
-    }
     start_addr = section->offset_within_address_space;
     end_addr = range_get_last(start_addr, int128_get64(section->size));
     start_addr = MAX(first, start_addr);
@@ -140,6 +137,111 @@ static int vhost_sync_dirty_bitmap(struct vhost_dev *dev,
         vhost_dev_sync_region(dev, section, start_addr, end_addr, vq->used_phys,
                               range_get_last(vq->used_phys, vq->used_size));
     }
+}
+
+/* Mark the guest range [@addr, @addr + @len) dirty in all memory regions */
+static void vhost_log_ring_set_dirty(struct vhost_dev *dev,
+                                     uint64_t addr, uint64_t len)
+{
+    uint64_t last = addr + len - 1;
+    int i;
+
+    for (i = 0; i < dev->n_mem_sections; i++) {
+        MemoryRegionSection *section = &dev->mem_sections[i];
+        hwaddr start = section->offset_within_address_space;
+        hwaddr end = range_get_last(start, int128_get64(section->size));
+        hwaddr first = MAX(addr, start);
+
+        if (first > MIN(last, end)) {
+            continue;
+        }
+        memory_region_set_dirty(section->mr,
+                                section->offset_within_region + first - start,
+                                MIN(last, end) - first + 1);
+    }
+}
+
+/*
+ * Consume the ranges the backend appended to the dirty log ring.  If the
+ * ring was full at some point, the backend fell back to the bitmap, which
+ * then has to be scanned once.
+ */
+static void vhost_log_ring_sync(struct vhost_dev *dev)
+{
+    struct vhost_log_ring *ring = dev->log_ring;
+    uint32_t mask = ring->hdr->num - 1;
+    uint32_t tail = ring->hdr->tail;
+    int i;
+
+    for (;;) {
+        struct vhost_log_ring_entry *entry = &ring->entries[tail & mask];
+        uint32_t len = qatomic_load_acquire(&entry->len);
+
+        if (!len) {
+            break;
+        }
+        vhost_log_ring_set_dirty(dev, entry->addr, len);
+        qatomic_set(&entry->len, 0);
+        tail++;
+    }
+    /* Entries must be cleared before the backend may reuse them */
+    qatomic_store_release(&ring->hdr->tail, tail);
+
+    if (qatomic_xchg(&ring->hdr->flags, 0) & VHOST_LOG_RING_F_OVERFLOW) {
+        trace_vhost_log_ring_overflow(dev);
+        for (i = 0; i < dev->n_mem_sections; i++) {
+            vhost_sync_dirty_log(dev, &dev->mem_sections[i], 0x0, ~0x0ULL);
+        }
+    }
+}
+
+/*
+ * The ring is registered by the first queue pair only, and the backend
+ * logs the writes of the other queue pairs of the same device to it.
+ */
+static bool vhost_dev_log_ring_owner(struct vhost_dev *dev)
+{
+    return dev->vq_index == 0;
+}
+
+static bool vhost_dev_log_ring_shared(struct vhost_dev *dev)
+{
+    struct vhost_dev *hdev;
+
+    if (vhost_dev_log_ring_owner(dev)) {
+        return false;
+    }
+    QLIST_FOREACH(hdev, &vhost_devices, entry) {
+        if (hdev->vdev == dev->vdev && hdev->log_ring) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static int vhost_sync_dirty_bitmap(struct vhost_dev *dev,
+                                   MemoryRegionSection *section,
+                                   hwaddr first,
+                                   hwaddr last)
+{
+    if (!dev->log_enabled || !dev->started) {
+        return 0;
+    }
+
+    /*
+     * The ring covers every section, so the calls for the other sections
+     * of the same sync find it (almost) empty.
+     */
+    if (dev->log_ring) {
+        vhost_log_ring_sync(dev);
+        return 0;
+    }
+    /* The owner of the ring drains it, and scans the bitmap on overflow */
+    if (vhost_dev_log_ring_shared(dev)) {
+        return 0;
+    }
+
+    vhost_sync_dirty_log(dev, section, first, last);
     return 0;
 }
 
@@ -253,6 +355,74 @@ static void vhost_log_put(struct vhost_dev *dev, bool sync)
     dev->log_size = 0;
 }
 
+static struct vhost_log_ring *vhost_log_ring_alloc(void)
+{
+    Error *err = NULL;
+    struct vhost_log_ring *ring;
+
+    ring = g_new0(struct vhost_log_ring, 1);
+    ring->size = sizeof(*ring->hdr) +
+                 VHOST_LOG_RING_NUM * sizeof(*ring->entries);
+    ring->hdr = qemu_memfd_alloc("vhost-log-ring", ring->size,
+                                 F_SEAL_GROW | F_SEAL_SHRINK | F_SEAL_SEAL,
+                                 &ring->fd, &err);
+    if (err) {
+        error_report_err(err);
+        g_free(ring);
+        return NULL;
+    }
+    memset(ring->hdr, 0, ring->size);
+    ring->hdr->num = VHOST_LOG_RING_NUM;
+    /* What was logged before the ring was set up is in the bitmap */
+    ring->hdr->flags = VHOST_LOG_RING_F_OVERFLOW;
+    ring->entries = (struct vhost_log_ring_entry *)(ring->hdr + 1);
+
+    return ring;
+}
+
+static void vhost_log_ring_free(struct vhost_log_ring *ring)
+{
+    qemu_memfd_free(ring->hdr, ring->size, ring->fd);
+    g_free(ring);
+}
+
+/*
+ * Switch @dev to ring based dirty logging if the backend supports it.
+ * The bitmap stays in place as the fallback for when the ring is full.
+ */
+static void vhost_dev_log_ring_start(struct vhost_dev *dev)
+{
+    struct vhost_log_ring *ring;
+
+    if (dev->log_ring || !dev->vhost_ops->vhost_set_log_ring ||
+        !vhost_dev_log_ring_owner(dev)) {
+        return;
+    }
+
+    ring = vhost_log_ring_alloc();
+    if (!ring) {
+        return;
+    }
+    if (dev->vhost_ops->vhost_set_log_ring(dev, ring) < 0) {
+        vhost_log_ring_free(ring);
+        return;
+    }
+    dev->log_ring = ring;
+}
+
+/* Must be called while dev->log is still valid */
+static void vhost_dev_log_ring_stop(struct vhost_dev *dev, bool sync)
+{
+    if (!dev->log_ring) {
+        return;
+    }
+    if (sync && dev->log) {
+        vhost_log_ring_sync(dev);
+    }
+    vhost_log_ring_free(dev->log_ring);
+    dev->log_ring = NULL;
+}
+
 static bool vhost_dev_log_is_shared(struct vhost_dev *dev)
 {
     return dev->vhost_ops->vhost_requires_shm_log &&
@@ -876,9 +1046,11 @@ static int vhost_migration_log(MemoryListener *listener, bool enable)
         if (r < 0) {
             goto check_dev_state;
         }
+        vhost_dev_log_ring_stop(dev, false);
         vhost_log_put(dev, false);
     } else {
         vhost_dev_log_resize(dev, vhost_get_log_size(dev));
+        vhost_dev_log_ring_start(dev);
         r = vhost_dev_set_log(dev, true);
         if (r < 0) {
             goto check_dev_state;
@@ -1748,6 +1920,7 @@ int vhost_dev_start(struct vhost_dev *hdev, VirtIODevice *vdev)
             r = -errno;
             goto fail_log;
         }
+        vhost_dev_log_ring_start(hdev);
     }
     if (hdev->vhost_ops->vhost_dev_start) {
         r = hdev->vhost_ops->vhost_dev_start(hdev, true);
@@ -1768,6 +1941,7 @@ int vhost_dev_start(struct vhost_dev *hdev, VirtIODevice *vdev)
     }
     return 0;
 fail_log:
+    vhost_dev_log_ring_stop(hdev, false);
     vhost_log_put(hdev, false);
 fail_vq:
     while (--i >= 0) {
@@ -1808,6 +1982,8 @@ void vhost_dev_stop(struct vhost_dev *hdev, VirtIODevice *vdev)
         }
         memory_listener_unregister(&hdev->iommu_listener);
     }
+    /* dev->log may be shared and not synced by vhost_log_put() */
+    vhost_dev_log_ring_stop(hdev, hdev->log_enabled);
     vhost_log_put(hdev, true);
     hdev->started = false;
     hdev->vdev = NULL;
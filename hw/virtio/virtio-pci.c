@@ -36,6 +36,7 @@
 #include "qemu/range.h"
 #include "hw/virtio/virtio-bus.h"
 #include "qapi/visitor.h"
+#include "qemu/main-loop.h"
 
 #define VIRTIO_PCI_REGION_SIZE(dev)     VIRTIO_PCI_CONFIG_OFF(msix_present(dev))
 
@@ -48,6 +49,7 @@
 static void virtio_pci_bus_new(VirtioBusState *bus, size_t bus_size,
                                VirtIOPCIProxy *dev);
 static void virtio_pci_reset(DeviceState *qdev);
+static void virtio_pci_notify_flush(VirtIOPCIProxy *proxy);
 
 /* virtio device */
 /* DeviceState to VirtIOPCIProxy. For use off data-path. TODO: use QOM. */
@@ -81,6 +83,9 @@ static void virtio_pci_save_config(DeviceState *d, QEMUFile *f)
     VirtIOPCIProxy *proxy = to_virtio_pci_proxy(d);
     VirtIODevice *vdev = virtio_bus_get_device(&proxy->bus);
 
+    /* The queue state is saved next, it must include all notifications */
+    virtio_pci_notify_flush(proxy);
+
     pci_device_save(&proxy->pci_dev, f);
     msix_save(&proxy->pci_dev, f);
     if (msix_present(&proxy->pci_dev))
@@ -1085,6 +1090,8 @@ static void virtio_pci_vmstate_change(DeviceState *d, bool running)
         }
         virtio_pci_start_ioeventfd(proxy);
     } else {
+        /* vCPUs are stopped, handle what they notified before the backend */
+        virtio_pci_notify_flush(proxy);
         virtio_pci_stop_ioeventfd(proxy);
     }
 }
@@ -1331,30 +1338,58 @@ static uint64_t virtio_pci_notify_read(void *opaque, hwaddr addr,
     return 0;
 }
 
-static void virtio_pci_notify_write(void *opaque, hwaddr addr,
-                                    uint64_t val, unsigned size)
+static void virtio_pci_notify_bh(void *opaque)
 {
     VirtIOPCIProxy *proxy = opaque;
     VirtIODevice *vdev = virtio_bus_get_device(&proxy->bus);
+    unsigned long pending;
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(proxy->notify_pending); i++) {
+        pending = qatomic_xchg(&proxy->notify_pending[i], 0);
+        while (vdev != NULL && pending) {
+            int bit = ctzl(pending);
+
+            pending &= pending - 1;
+            virtio_queue_notify(vdev, i * BITS_PER_LONG + bit);
+        }
+    }
+}
 
-    unsigned queue = addr / virtio_pci_queue_mem_mult(proxy);
+/* Handle pending notifications now instead of in notify_bh */
+static void virtio_pci_notify_flush(VirtIOPCIProxy *proxy)
+{
+    qemu_bh_cancel(proxy->notify_bh);
+    virtio_pci_notify_bh(proxy);
+}
 
-    if (vdev != NULL && queue < VIRTIO_QUEUE_MAX) {
-        virtio_queue_notify(vdev, queue);
+/*
+ * The notify regions are dispatched without the BQL.  Like an ioeventfd,
+ * a notification only has to be handled eventually, so mark the queue and
+ * leave the work to notify_bh.
+ */
+static void virtio_pci_queue_notify(VirtIOPCIProxy *proxy, unsigned queue)
+{
+    if (queue < VIRTIO_QUEUE_MAX) {
+        set_bit_atomic(queue, proxy->notify_pending);
+        qemu_bh_schedule(proxy->notify_bh);
     }
 }
 
+static void virtio_pci_notify_write(void *opaque, hwaddr addr,
+                                    uint64_t val, unsigned size)
+{
+    VirtIOPCIProxy *proxy = opaque;
+
+    virtio_pci_queue_notify(proxy, addr / virtio_pci_queue_mem_mult(proxy));
+}
+
 static void virtio_pci_notify_write_pio(void *opaque, hwaddr addr,
                                         uint64_t val, unsigned size)
 {
     VirtIOPCIProxy *proxy = opaque;
-    VirtIODevice *vdev = virtio_bus_get_device(&proxy->bus);
 
-    unsigned queue = val;
-
-    if (vdev != NULL && queue < VIRTIO_QUEUE_MAX) {
-        virtio_queue_notify(vdev, queue);
-    }
+    virtio_pci_queue_notify(proxy, val);
 }
 
 static uint64_t virtio_pci_isr_read(void *opaque, hwaddr addr,
@@ -1493,12 +1528,14 @@ static void virtio_pci_modern_regions_init(VirtIOPCIProxy *proxy)
                           proxy,
                           "virtio-pci-notify",
                           proxy->notify.size);
+    memory_region_clear_global_locking(&proxy->notify.mr);
 
     memory_region_init_io(&proxy->notify_pio.mr, OBJECT(proxy),
                           &notify_pio_ops,
                           proxy,
                           "virtio-pci-notify-pio",
                           proxy->notify_pio.size);
+    memory_region_clear_global_locking(&proxy->notify_pio.mr);
 }
 
 static void virtio_pci_modern_region_map(VirtIOPCIProxy *proxy,
@@ -1744,6 +1781,8 @@ static void virtio_pci_realize(PCIDevice *pci_dev, Error **errp)
         proxy->flags &= ~VIRTIO_PCI_FLAG_USE_IOEVENTFD;
     }
 
+    proxy->notify_bh = qemu_bh_new(virtio_pci_notify_bh, proxy);
+
     /*
      * virtio pci bar layout used by default.
      * subclasses can re-arrange things if needed.
@@ -1943,10 +1982,21 @@ static void virtio_pci_class_init(ObjectClass *klass, void *data)
     dc->reset = virtio_pci_reset;
 }
 
+/* vCPUs may still be dispatching notifications after unrealize */
+static void virtio_pci_instance_finalize(Object *obj)
+{
+    VirtIOPCIProxy *proxy = VIRTIO_PCI(obj);
+
+    if (proxy->notify_bh) {
+        qemu_bh_delete(proxy->notify_bh);
+    }
+}
+
 static const TypeInfo virtio_pci_info = {
     .name          = TYPE_VIRTIO_PCI,
     .parent        = TYPE_PCI_DEVICE,
     .instance_size = sizeof(VirtIOPCIProxy),
+    .instance_finalize = virtio_pci_instance_finalize,
     .class_init    = virtio_pci_class_init,
     .class_size    = sizeof(VirtioPCIClass),
     .abstract      = true,
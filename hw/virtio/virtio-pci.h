@@ -143,6 +143,9 @@ struct VirtIOPCIProxy {
     uint32_t gfselect;
     uint32_t guest_features[2];
     VirtIOPCIQueue vqs[VIRTIO_QUEUE_MAX];
+    /* Queues notified without the BQL, handled by notify_bh */
+    unsigned long notify_pending[BITS_TO_LONGS(VIRTIO_QUEUE_MAX)];
+    QEMUBH *notify_bh;
 
     VirtIOIRQFD *vector_irqfd;
     int nvqs_with_notifiers;
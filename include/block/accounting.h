@@ -27,6 +27,7 @@
 
 #include "qemu/timed-average.h"
 #include "qemu/thread.h"
+#include "qemu/stats64.h"
 #include "qapi/qapi-builtin-types.h"
 
 typedef struct BlockAcctTimedStats BlockAcctTimedStats;
@@ -93,6 +94,27 @@ struct BlockAcctStats {
     BlockLatencyHistogram latency_histogram[BLOCK_MAX_IOTYPE];
 };
 
+/*
+ * Node latency histograms have fixed, logarithmic bins so that they can be
+ * updated without a lock: bin 0 counts latencies below
+ * 2^BLOCK_NODE_LATENCY_MIN_SHIFT ns, bin i counts latencies in
+ * [2^(BLOCK_NODE_LATENCY_MIN_SHIFT + i - 1),
+ *  2^(BLOCK_NODE_LATENCY_MIN_SHIFT + i)) ns, and the last bin has no upper
+ * bound.
+ */
+#define BLOCK_NODE_LATENCY_BINS         32
+#define BLOCK_NODE_LATENCY_MIN_SHIFT    10
+
+typedef struct BlockNodeLatencyHistogram {
+    Stat64 total_time_ns;
+    Stat64 bins[BLOCK_NODE_LATENCY_BINS];
+} BlockNodeLatencyHistogram;
+
+typedef struct BlockNodeLatencyStats {
+    bool enabled; /* accessed with atomic ops */
+    BlockNodeLatencyHistogram hist[BLOCK_MAX_IOTYPE];
+} BlockNodeLatencyStats;
+
 typedef struct BlockAcctCookie {
     int64_t bytes;
     int64_t start_time_ns;
@@ -120,4 +142,10 @@ int block_latency_histogram_set(BlockAcctStats *stats, enum BlockAcctType type,
                                 uint64List *boundaries);
 void block_latency_histograms_clear(BlockAcctStats *stats);
 
+void block_node_latency_enable(BlockNodeLatencyStats *stats, bool enable);
+int64_t block_node_latency_start(BlockNodeLatencyStats *stats);
+void block_node_latency_done(BlockNodeLatencyStats *stats,
+                             enum BlockAcctType type, int64_t start_ns);
+uint64_t block_node_latency_boundary(int bin);
+
 #endif
@@ -554,6 +554,7 @@ const char *bdrv_get_device_name(const BlockDriverState *bs);
 const char *bdrv_get_device_or_node_name(const BlockDriverState *bs);
 int bdrv_get_flags(BlockDriverState *bs);
 int bdrv_get_info(BlockDriverState *bs, BlockDriverInfo *bdi);
+int bdrv_get_host_fd(BlockDriverState *bs, uint64_t *offset, uint64_t bytes);
 ImageInfoSpecific *bdrv_get_specific_info(BlockDriverState *bs,
                                           Error **errp);
 BlockStatsSpecific *bdrv_get_specific_stats(BlockDriverState *bs);
@@ -836,4 +837,22 @@ int coroutine_fn bdrv_co_copy_range(BdrvChild *src, uint64_t src_offset,
                                     BdrvChild *dst, uint64_t dst_offset,
                                     uint64_t bytes, BdrvRequestFlags read_flags,
                                     BdrvRequestFlags write_flags);
+
+/**
+ * bdrv_co_share_clusters:
+ *
+ * Make the range at @dst_offset refer to the data that is stored for the
+ * range at @src_offset in the same node, without copying it.  Later writes
+ * to either range do not affect the other one.  Both offsets and @bytes must
+ * be aligned to the cluster size of the node.
+ *
+ * The caller must make sure that there are no requests in flight that write
+ * to the source range.
+ *
+ * Returns: 0 on success, -ENOTSUP if the driver cannot share the clusters in
+ * their current state (the caller should write the data instead), or another
+ * negative errno.
+ */
+int coroutine_fn bdrv_co_share_clusters(BdrvChild *child, int64_t src_offset,
+                                        int64_t dst_offset, int64_t bytes);
 #endif
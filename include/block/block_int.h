@@ -324,6 +324,16 @@ struct BlockDriver {
                                               BdrvRequestFlags read_flags,
                                               BdrvRequestFlags write_flags);
 
+    /*
+     * Make the clusters at @dst_offset refer to the host data of those at
+     * @src_offset.  See the comment of bdrv_co_share_clusters for the
+     * parameter and return value semantics.
+     */
+    int coroutine_fn (*bdrv_co_share_clusters)(BlockDriverState *bs,
+                                               int64_t src_offset,
+                                               int64_t dst_offset,
+                                               int64_t bytes);
+
     /*
      * Building block for bdrv_block_status[_above] and
      * bdrv_is_allocated[_above].  The driver should answer only
@@ -427,6 +437,15 @@ struct BlockDriver {
                                   const char *name,
                                   Error **errp);
     int (*bdrv_get_info)(BlockDriverState *bs, BlockDriverInfo *bdi);
+
+    /*
+     * Map [*offset, *offset + bytes) onto a host file descriptor that holds
+     * the data unmodified, and update *offset to the position in that file.
+     * Only drivers that neither transform the data nor need to see the
+     * read (so no format drivers and no filters) may implement this.
+     */
+    int (*bdrv_get_host_fd)(BlockDriverState *bs, uint64_t *offset,
+                            uint64_t bytes);
     ImageInfoSpecific *(*bdrv_get_specific_info)(BlockDriverState *bs,
                                                  Error **errp);
     BlockStatsSpecific *(*bdrv_get_specific_stats)(BlockDriverState *bs);
@@ -610,6 +629,13 @@ struct BlockDriver {
     int (*bdrv_co_remove_persistent_dirty_bitmap)(BlockDriverState *bs,
                                                   const char *name,
                                                   Error **errp);
+    /*
+     * Read the data of a persistent bitmap that was marked unloaded when
+     * the image was opened.  @bitmap is empty on entry.
+     */
+    int (*bdrv_load_persistent_dirty_bitmap)(BlockDriverState *bs,
+                                             BdrvDirtyBitmap *bitmap,
+                                             Error **errp);
 
     /**
      * Register/unregister a buffer for I/O. For example, when the driver is
@@ -953,6 +979,9 @@ struct BlockDriverState {
     /* Offset after the highest byte written to */
     Stat64 wr_highest_offset;
 
+    /* Latency of the driver's read and write callbacks */
+    BlockNodeLatencyStats latency_stats;
+
     /* If true, copy read backing sectors into image.  Can be >1 if more
      * than one client has requested copy-on-read.  Accessed with atomic
      * ops.
@@ -1196,6 +1225,9 @@ BlockJob *commit_active_start(const char *job_id, BlockDriverState *bs,
                               const char *filter_node_name,
                               BlockCompletionFunc *cb, void *opaque,
                               bool auto_complete, Error **errp);
+/* Largest number of ranges a mirror job copies in parallel */
+#define MIRROR_MAX_WORKERS 16
+
 /*
  * mirror_start:
  * @job_id: The id of the newly-created job, or %NULL to use the
@@ -1209,6 +1241,7 @@ BlockJob *commit_active_start(const char *job_id, BlockDriverState *bs,
  * @speed: The maximum speed, in bytes per second, or 0 for unlimited.
  * @granularity: The chosen granularity for the dirty bitmap.
  * @buf_size: The amount of data that can be in flight at one time.
+ * @workers: The number of ranges that are copied in parallel.
  * @mode: Whether to collapse all images in the chain to the target.
  * @backing_mode: How to establish the target's backing chain after completion.
  * @zero_target: Whether the target should be explicitly zero-initialized
@@ -1229,7 +1262,7 @@ BlockJob *commit_active_start(const char *job_id, BlockDriverState *bs,
 void mirror_start(const char *job_id, BlockDriverState *bs,
                   BlockDriverState *target, const char *replaces,
                   int creation_flags, int64_t speed,
-                  uint32_t granularity, int64_t buf_size,
+                  uint32_t granularity, int64_t buf_size, int workers,
                   MirrorSyncMode mode, BlockMirrorBackingMode backing_mode,
                   bool zero_target,
                   BlockdevOnError on_source_error,
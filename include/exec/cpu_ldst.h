@@ -152,6 +152,22 @@ void cpu_stl_le_data_ra(CPUArchState *env, abi_ptr ptr,
 void cpu_stq_le_data_ra(CPUArchState *env, abi_ptr ptr,
                         uint64_t val, uintptr_t ra);
 
+/*
+ * Bulk data accesses.  The range is processed one guest page at a time:
+ * each page is probed once for the whole span, raising any fault before
+ * that page is modified, and RAM-backed pages are then accessed directly
+ * on the host.  Pages that require I/O fall back to byte accesses.
+ *
+ * cpu_memcpy_data_ra has the semantics of a byte-by-byte copy in
+ * ascending address order, so overlapping ranges behave as they would
+ * for a simple forward string-move loop in the guest.  Direct host
+ * accesses are not reported individually to tracing or plugins.
+ */
+void cpu_memset_data_ra(CPUArchState *env, abi_ptr dst, uint8_t val,
+                        abi_ptr len, uintptr_t ra);
+void cpu_memcpy_data_ra(CPUArchState *env, abi_ptr dst, abi_ptr src,
+                        abi_ptr len, uintptr_t ra);
+
 #if defined(CONFIG_USER_ONLY)
 
 extern __thread uintptr_t helper_retaddr;
@@ -33,8 +33,12 @@ struct TBContext {
 
     struct qht htable;
 
+    /* recycle old code regions instead of flushing the whole cache */
+    bool evict;
+
     /* statistics */
     unsigned tb_flush_count;
+    unsigned tb_evict_count;
 };
 
 extern TBContext tb_ctx;
@@ -29,6 +29,7 @@ typedef enum VhostSetConfigType {
 struct vhost_inflight;
 struct vhost_dev;
 struct vhost_log;
+struct vhost_log_ring;
 struct vhost_memory;
 struct vhost_vring_file;
 struct vhost_vring_state;
@@ -52,6 +53,8 @@ typedef int (*vhost_scsi_get_abi_version_op)(struct vhost_dev *dev,
                                              int *version);
 typedef int (*vhost_set_log_base_op)(struct vhost_dev *dev, uint64_t base,
                                      struct vhost_log *log);
+typedef int (*vhost_set_log_ring_op)(struct vhost_dev *dev,
+                                     struct vhost_log_ring *ring);
 typedef int (*vhost_set_mem_table_op)(struct vhost_dev *dev,
                                       struct vhost_memory *mem);
 typedef int (*vhost_set_vring_addr_op)(struct vhost_dev *dev,
@@ -136,6 +139,7 @@ typedef struct VhostOps {
     vhost_scsi_clear_endpoint_op vhost_scsi_clear_endpoint;
     vhost_scsi_get_abi_version_op vhost_scsi_get_abi_version;
     vhost_set_log_base_op vhost_set_log_base;
+    vhost_set_log_ring_op vhost_set_log_ring;
     vhost_set_mem_table_op vhost_set_mem_table;
     vhost_set_vring_addr_op vhost_set_vring_addr;
     vhost_set_vring_endian_op vhost_set_vring_endian;
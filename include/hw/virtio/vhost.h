@@ -45,6 +45,37 @@ struct vhost_log {
     vhost_log_chunk_t *log;
 };
 
+/*
+ * Dirty log ring shared with the backend, see "Dirty log ring" in
+ * docs/interop/vhost-user.rst.  The backend appends the guest ranges it
+ * writes to, so that syncing does not need to scan the whole bitmap.
+ */
+#define VHOST_LOG_RING_NUM          16384
+#define VHOST_LOG_RING_F_OVERFLOW   0x1
+
+struct vhost_log_ring_entry {
+    uint64_t addr;
+    uint32_t len;       /* non-zero once the entry is valid */
+    uint32_t padding;
+};
+
+struct vhost_log_ring_hdr {
+    uint32_t num;       /* number of entries, a power of two */
+    uint32_t flags;     /* VHOST_LOG_RING_F_*, set by the backend */
+    uint8_t padding1[56];
+    uint32_t head;      /* next entry to reserve, written by the backend */
+    uint8_t padding2[60];
+    uint32_t tail;      /* next entry to consume, written by QEMU */
+    uint8_t padding3[60];
+};
+
+struct vhost_log_ring {
+    int fd;
+    uint64_t size;
+    struct vhost_log_ring_hdr *hdr;
+    struct vhost_log_ring_entry *entries;
+};
+
 struct vhost_dev;
 struct vhost_iommu {
     struct vhost_dev *hdev;
@@ -87,6 +118,7 @@ struct vhost_dev {
     const VhostOps *vhost_ops;
     void *opaque;
     struct vhost_log *log;
+    struct vhost_log_ring *log_ring;
     QLIST_ENTRY(vhost_dev) entry;
     QLIST_HEAD(, vhost_iommu) iommu_list;
     IOMMUNotifier n;
@@ -18,8 +18,10 @@
 #include "standard-headers/linux/virtio_net.h"
 #include "hw/virtio/virtio.h"
 #include "net/announce.h"
+#include "net/gro.h"
 #include "qemu/option_int.h"
 #include "qom/object.h"
+#include "sysemu/iothread.h"
 
 #define TYPE_VIRTIO_NET "virtio-net-device"
 OBJECT_DECLARE_SIMPLE_TYPE(VirtIONet, VIRTIO_NET)
@@ -45,6 +47,7 @@ typedef struct virtio_net_conf
     char *duplex_str;
     uint8_t duplex;
     char *primary_id_str;
+    IOThread *iothread;
 } virtio_net_conf;
 
 /* Coalesced packets type & status */
@@ -148,6 +151,8 @@ typedef struct VirtIONetQueue {
     struct {
         VirtQueueElement *elem;
     } async_tx;
+    /* Software GRO for backends without a vnet header, or NULL */
+    NetGRO *gro;
     struct VirtIONet *n;
 } VirtIONetQueue;
 
@@ -179,6 +184,9 @@ struct VirtIONet {
     uint8_t nouni;
     uint8_t nobcast;
     uint8_t vhost_started;
+    /* Datapath runs in net_conf.iothread; NULL means the main loop */
+    AioContext *ctx;
+    bool dataplane_started;
     struct {
         uint32_t in_use;
         uint32_t first_multi;
@@ -202,6 +210,7 @@ struct VirtIONet {
     AnnounceTimer announce_timer;
     bool needs_vnet_hdr_swap;
     bool mtu_bypass_backend;
+    bool gro;
     QemuOpts *primary_device_opts;
     QDict *primary_device_dict;
     DeviceState *primary_dev;
@@ -0,0 +1,100 @@
+/*
+ * Software generic receive offload
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef QEMU_NET_GRO_H
+#define QEMU_NET_GRO_H
+
+#include "block/aio.h"
+#include "standard-headers/linux/virtio_net.h"
+
+typedef struct NetGRO NetGRO;
+
+/*
+ * Called for every frame that leaves the GRO stage, either a coalesced
+ * TCP segment or a frame that was passed through.  @hdr describes the
+ * offloads that apply to @buf, with its fields in host byte order.
+ *
+ * Returns like NetReceive: 0 means that the frame could not be delivered
+ * yet and must be offered again later.
+ */
+typedef ssize_t (NetGROOutput)(void *opaque, const struct virtio_net_hdr *hdr,
+                               const uint8_t *buf, size_t size);
+
+/**
+ * net_gro_new:
+ * @ctx: the AioContext in which held segments are flushed
+ * @output: callback that consumes frames leaving the GRO stage
+ * @opaque: argument for @output
+ *
+ * Create a GRO stage for frames without a virtio-net header, such as
+ * those received from backends that do not support one.  TCP segments
+ * of the same flow are merged into frames of up to 64 KiB, that are
+ * marked with a VIRTIO_NET_HDR_GSO_TCPV4 or VIRTIO_NET_HDR_GSO_TCPV6
+ * header.  Segments are held at most until @ctx runs its bottom halves.
+ *
+ * Nothing is merged until net_gro_set_offload() enables it.
+ */
+NetGRO *net_gro_new(AioContext *ctx, NetGROOutput *output, void *opaque);
+
+/**
+ * net_gro_free:
+ * @gro: the GRO stage
+ *
+ * Drop the segments that are still held and free @gro.
+ */
+void net_gro_free(NetGRO *gro);
+
+/**
+ * net_gro_set_aio_context:
+ * @gro: the GRO stage
+ * @ctx: the new AioContext
+ *
+ * Move the flush bottom half of @gro to @ctx.
+ */
+void net_gro_set_aio_context(NetGRO *gro, AioContext *ctx);
+
+/**
+ * net_gro_set_offload:
+ * @gro: the GRO stage
+ * @csum: whether the consumer accepts VIRTIO_NET_HDR_F_NEEDS_CSUM and
+ *        VIRTIO_NET_HDR_F_DATA_VALID
+ * @tso4: whether IPv4 TCP segments may be merged
+ * @tso6: whether IPv6 TCP segments may be merged
+ *
+ * Set the offloads the consumer of @gro is able to handle.  Merging
+ * requires @csum.
+ */
+void net_gro_set_offload(NetGRO *gro, bool csum, bool tso4, bool tso6);
+
+/**
+ * net_gro_receive:
+ * @gro: the GRO stage
+ * @buf: an Ethernet frame
+ * @size: the size of @buf
+ *
+ * Feed a frame into @gro.  It is either held for merging, or handed
+ * to the output callback right away together with any segments of its
+ * flow that are held.
+ *
+ * Returns: @size if the frame was consumed, or the return value of the
+ * output callback.  0 means that the frame must be offered again once
+ * the output callback is able to make progress.
+ */
+ssize_t net_gro_receive(NetGRO *gro, const uint8_t *buf, size_t size);
+
+/**
+ * net_gro_flush:
+ * @gro: the GRO stage
+ *
+ * Hand all held segments to the output callback.
+ *
+ * Returns: false if the output callback could not take all of them; the
+ * rest stays held until the next call.
+ */
+bool net_gro_flush(NetGRO *gro);
+
+#endif /* QEMU_NET_GRO_H */
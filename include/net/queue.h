@@ -32,6 +32,16 @@ typedef void (NetPacketSent) (NetClientState *sender, ssize_t ret);
 
 #define QEMU_NET_PACKET_FLAG_NONE  0
 #define QEMU_NET_PACKET_FLAG_RAW  (1<<0)
+/* The sender keeps the data valid until sent_cb, if queued don't copy it */
+#define QEMU_NET_PACKET_FLAG_NOCOPY  (1<<1)
+
+typedef struct NetQueueStats {
+    uint32_t depth;     /* packets currently queued */
+    uint32_t peak;      /* highest depth seen */
+    uint64_t queued;    /* packets that had to be queued */
+    uint64_t dropped;   /* packets dropped because the queue was full,
+                           or purged */
+} NetQueueStats;
 
 /* Returns:
  *   >0 - success
@@ -70,6 +80,8 @@ ssize_t qemu_net_queue_send_iov(NetQueue *queue,
                                 NetPacketSent *sent_cb);
 
 void qemu_net_queue_purge(NetQueue *queue, NetClientState *from);
+bool qemu_net_queue_idle(NetQueue *queue);
+void qemu_net_queue_get_stats(NetQueue *queue, NetQueueStats *stats);
 bool qemu_net_queue_flush(NetQueue *queue);
 
 #endif /* QEMU_NET_QUEUE_H */
@@ -263,6 +263,8 @@ int coroutine_fn blk_co_copy_range(BlockBackend *blk_in, int64_t off_in,
                                    BlockBackend *blk_out, int64_t off_out,
                                    int bytes, BdrvRequestFlags read_flags,
                                    BdrvRequestFlags write_flags);
+int coroutine_fn blk_co_share_clusters(BlockBackend *blk, int64_t src_offset,
+                                       int64_t dst_offset, int64_t bytes);
 
 const BdrvChild *blk_root(BlockBackend *blk);
 
@@ -661,6 +661,9 @@ struct TCGContext {
 
     /* list to quickly access the injected ops */
     QSIMPLEQ_HEAD(, TCGOp) plugin_ops;
+
+    /* if set, tcg_emit_op() inserts before this op instead of at the end */
+    TCGOp *emit_before_op;
 #endif
 
     TCGTempSet free_temps[TCG_TYPE_COUNT * 2];
@@ -836,6 +839,8 @@ TranslationBlock *tcg_tb_alloc(TCGContext *s);
 void tcg_region_init(void);
 void tb_destroy(TranslationBlock *tb);
 void tcg_region_reset_all(void);
+size_t tcg_region_evict(size_t n, GTraverseFunc invalidate);
+void tcg_region_stats(size_t *n_total, size_t *n_used, size_t *n_evicted);
 
 size_t tcg_code_size(void);
 size_t tcg_code_capacity(void);
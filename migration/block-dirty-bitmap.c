@@ -532,6 +532,11 @@ static int add_bitmaps_to_list(DBMSaveState *s, BlockDriverState *bs,
             continue;
         }
 
+        if (bdrv_dirty_bitmap_load(bitmap, &local_err) < 0) {
+            error_report_err(local_err);
+            return -1;
+        }
+
         if (bdrv_dirty_bitmap_check(bitmap, BDRV_BITMAP_DEFAULT, &local_err)) {
             error_report_err(local_err);
             return -1;
@@ -20,12 +20,17 @@
 #include "qemu/osdep.h"
 
 #include "block/export.h"
+#include "block/thread-pool.h"
 #include "qapi/error.h"
 #include "qemu/queue.h"
 #include "trace.h"
 #include "nbd-internal.h"
 #include "qemu/units.h"
 
+#ifdef CONFIG_SENDFILE
+#include <sys/sendfile.h>
+#endif
+
 #define NBD_META_ID_BASE_ALLOCATION 0
 #define NBD_META_ID_ALLOCATION_DEPTH 1
 /* Dirty bitmaps use 'NBD_META_ID_DIRTY_BITMAP + i', so keep this id last. */
@@ -139,6 +144,7 @@ struct NBDClient {
     uint32_t check_align; /* If non-zero, check for aligned client requests */
 
     bool structured_reply;
+    bool zero_copy; /* Try to send read payloads with sendfile() */
     NBDExportMetaContexts export_meta;
 
     uint32_t opt; /* Current option being negotiated */
@@ -1618,6 +1624,11 @@ static int nbd_export_create(BlockExport *blk_exp, BlockExportOptions *exp_args,
             goto fail;
         }
 
+        ret = bdrv_dirty_bitmap_load(bm, errp);
+        if (ret < 0) {
+            goto fail;
+        }
+
         if (bdrv_dirty_bitmap_check(bm, BDRV_BITMAP_ALLOW_RO, errp)) {
             ret = -EINVAL;
             goto fail;
@@ -1850,6 +1861,169 @@ static int coroutine_fn nbd_co_send_structured_error(NBDClient *client,
     return nbd_co_send_iov(client, iov, 1 + !!iov[1].iov_len, errp);
 }
 
+#ifdef CONFIG_SENDFILE
+typedef struct NBDSendFileData {
+    int out_fd;
+    int in_fd;
+    off_t offset;
+    size_t bytes;
+} NBDSendFileData;
+
+/*
+ * Runs in the thread pool, so that page cache misses do not block the
+ * AioContext.  Advances d->offset and d->bytes by what was sent, and
+ * returns -EAGAIN if the socket is full.  d->bytes stays non-zero without
+ * an error if the file ends early.
+ */
+static int nbd_sendfile_worker(void *opaque)
+{
+    NBDSendFileData *d = opaque;
+
+    while (d->bytes) {
+        ssize_t ret = sendfile(d->out_fd, d->in_fd, &d->offset, d->bytes);
+
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -errno;
+        }
+        if (ret == 0) {
+            break;
+        }
+        d->bytes -= ret;
+    }
+    return 0;
+}
+
+/*
+ * Send the reply header in @iov, followed by @size bytes of the export at
+ * @offset that are taken directly from the host file @fd at @file_offset.
+ * If sendfile() fails part way, the rest of the payload is read through
+ * the block layer into @data instead.
+ * Returns -EIO if sending fails; the reply is incomplete in that case.
+ */
+static int coroutine_fn nbd_co_send_iov_file(NBDClient *client,
+                                             struct iovec *iov, unsigned niov,
+                                             uint64_t offset, int fd,
+                                             uint64_t file_offset,
+                                             uint8_t *data, size_t size,
+                                             Error **errp)
+{
+    NBDExport *exp = client->exp;
+    ThreadPool *pool = aio_get_thread_pool(exp->common.ctx);
+    NBDSendFileData d = {
+        .out_fd = client->sioc->fd,
+        .in_fd  = fd,
+        .offset = file_offset,
+        .bytes  = size,
+    };
+    int ret = 0;
+
+    qemu_co_mutex_lock(&client->send_lock);
+    client->send_coroutine = qemu_coroutine_self();
+
+    if (qio_channel_writev_all(client->ioc, iov, niov, errp) < 0) {
+        ret = -EIO;
+        goto out;
+    }
+
+    while (d.bytes) {
+        ret = thread_pool_submit_co(pool, nbd_sendfile_worker, &d);
+        if (ret != -EAGAIN) {
+            break;
+        }
+        qio_channel_yield(client->ioc, G_IO_OUT);
+    }
+
+    if (d.bytes) {
+        size_t done = size - d.bytes;
+
+        trace_nbd_co_send_file_fallback(offset + done, d.bytes, ret);
+        if (ret == -EINVAL || ret == -ENOSYS || ret == -EOPNOTSUPP) {
+            client->zero_copy = false;
+        }
+        ret = blk_pread(exp->common.blk, offset + done, data + done, d.bytes);
+        if (ret < 0) {
+            error_setg_errno(errp, -ret, "reading from file failed");
+            ret = -EIO;
+            goto out;
+        }
+        ret = qio_channel_write_all(client->ioc, (char *)data + done, d.bytes,
+                                    errp) < 0 ? -EIO : 0;
+    } else {
+        ret = 0;
+    }
+
+out:
+    client->send_coroutine = NULL;
+    qemu_co_mutex_unlock(&client->send_lock);
+    return ret;
+}
+#endif
+
+/*
+ * Send a read reply for @size bytes of the export at @offset without
+ * copying the payload through a buffer, if the export is a raw image on a
+ * host file and the channel is not encrypted.  @data must be able to hold
+ * @size bytes, it is only used if sendfile() fails part way.
+ * Returns -ENOTSUP without sending anything if the payload would have to
+ * be read into @data, and -EIO if sending fails.
+ */
+static int coroutine_fn nbd_co_send_read_file(NBDClient *client,
+                                              uint64_t handle,
+                                              uint64_t offset,
+                                              uint8_t *data,
+                                              size_t size,
+                                              bool final,
+                                              Error **errp)
+{
+#ifdef CONFIG_SENDFILE
+    NBDExport *exp = client->exp;
+    uint64_t file_offset = offset;
+    NBDSimpleReply reply;
+    NBDStructuredReadData chunk;
+    struct iovec iov[1];
+    int fd, ret;
+
+    if (!client->zero_copy || client->ioc != QIO_CHANNEL(client->sioc)) {
+        return -ENOTSUP;
+    }
+
+    /* Keep the node from being drained or reopened while we use its fd */
+    blk_inc_in_flight(exp->common.blk);
+
+    fd = bdrv_get_host_fd(blk_bs(exp->common.blk), &file_offset, size);
+    if (fd < 0) {
+        ret = -ENOTSUP;
+        goto out;
+    }
+
+    trace_nbd_co_send_file(handle, offset, file_offset, size);
+    if (client->structured_reply) {
+        set_be_chunk(&chunk.h, final ? NBD_REPLY_FLAG_DONE : 0,
+                     NBD_REPLY_TYPE_OFFSET_DATA, handle,
+                     sizeof(chunk) - sizeof(chunk.h) + size);
+        stq_be_p(&chunk.offset, offset);
+        iov[0] = (struct iovec) { .iov_base = &chunk,
+                                  .iov_len = sizeof(chunk) };
+    } else {
+        set_be_simple_reply(&reply, 0, handle);
+        iov[0] = (struct iovec) { .iov_base = &reply,
+                                  .iov_len = sizeof(reply) };
+    }
+
+    ret = nbd_co_send_iov_file(client, iov, 1, offset, fd, file_offset,
+                               data, size, errp);
+
+out:
+    blk_dec_in_flight(exp->common.blk);
+    return ret;
+#else
+    return -ENOTSUP;
+#endif
+}
+
 /* Do a sparse read and send the structured reply to the client.
  * Returns -errno if sending fails. bdrv_block_status_above() failure is
  * reported to the client, at which point this function succeeds.
@@ -1899,15 +2073,20 @@ static int coroutine_fn nbd_co_send_sparse_read(NBDClient *client,
             stl_be_p(&chunk.length, pnum);
             ret = nbd_co_send_iov(client, iov, 1, errp);
         } else {
-            ret = blk_pread(exp->common.blk, offset + progress,
-                            data + progress, pnum);
-            if (ret < 0) {
-                error_setg_errno(errp, -ret, "reading from file failed");
-                break;
+            ret = nbd_co_send_read_file(client, handle, offset + progress,
+                                        data + progress, pnum, final, errp);
+            if (ret == -ENOTSUP) {
+                ret = blk_pread(exp->common.blk, offset + progress,
+                                data + progress, pnum);
+                if (ret < 0) {
+                    error_setg_errno(errp, -ret, "reading from file failed");
+                    break;
+                }
+                ret = nbd_co_send_structured_read(client, handle,
+                                                  offset + progress,
+                                                  data + progress, pnum,
+                                                  final, errp);
             }
-            ret = nbd_co_send_structured_read(client, handle, offset + progress,
-                                              data + progress, pnum, final,
-                                              errp);
         }
 
         if (ret < 0) {
@@ -2302,6 +2481,14 @@ static coroutine_fn int nbd_do_cmd_read(NBDClient *client, NBDRequest *request,
                                        data, request->len, errp);
     }
 
+    if (request->len) {
+        ret = nbd_co_send_read_file(client, request->handle, request->from,
+                                    data, request->len, true, errp);
+        if (ret != -ENOTSUP) {
+            return ret;
+        }
+    }
+
     ret = blk_pread(exp->common.blk, request->from, data, request->len);
     if (ret < 0) {
         return nbd_send_generic_reply(client, request->handle, ret,
@@ -2615,6 +2802,7 @@ void nbd_client_new(QIOChannelSocket *sioc,
     client->ioc = QIO_CHANNEL(sioc);
     object_ref(OBJECT(client->ioc));
     client->close_fn = close_fn;
+    client->zero_copy = true;
 
     co = qemu_coroutine_create(nbd_co_client_start, client);
     qemu_coroutine_enter(co);
@@ -0,0 +1,493 @@
+/*
+ * AF_XDP network backend
+ *
+ * Each queue pair owns an AF_XDP socket bound to one queue of a host
+ * network interface, together with a UMEM area that holds the packet
+ * frames.  Received frames are handed to the peer straight from the UMEM
+ * and recycled through the fill ring; transmitted packets are copied into
+ * free UMEM frames and reclaimed through the completion ring.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include <net/if.h>
+#include <linux/if_link.h>
+#include <bpf/libbpf.h>
+#include <bpf/xsk.h>
+
+#include "net/net.h"
+#include "clients.h"
+#include "qapi/error.h"
+#include "qemu/error-report.h"
+#include "qemu/iov.h"
+#include "qemu/main-loop.h"
+
+/* Frames per queue pair, shared equally between receive and transmit */
+#define AF_XDP_NUM_FRAMES       4096
+#define AF_XDP_FRAME_SIZE       XSK_UMEM__DEFAULT_FRAME_SIZE
+#define AF_XDP_RING_SIZE        (AF_XDP_NUM_FRAMES / 2)
+
+/* Maximum number of descriptors handled per ring operation */
+#define AF_XDP_BATCH_SIZE       64
+
+typedef struct AFXDPState {
+    NetClientState      nc;
+
+    struct xsk_socket   *xsk;
+    struct xsk_ring_cons rx;
+    struct xsk_ring_prod tx;
+    struct xsk_ring_cons cq;
+    struct xsk_ring_prod fq;
+
+    struct xsk_umem     *umem;
+    void                *buffer;
+
+    /* UMEM frames available for transmission */
+    uint64_t            pool[AF_XDP_RING_SIZE];
+    int                 n_pool;
+
+    char                ifname[IFNAMSIZ];
+    int                 ifindex;
+    uint32_t            xdp_flags;
+    /* This backend loaded the XDP program and has to remove it */
+    bool                prog_attached;
+    bool                read_poll;
+    bool                write_poll;
+    AioContext          *ctx;
+} AFXDPState;
+
+static void af_xdp_send(void *opaque);
+static void af_xdp_writable(void *opaque);
+static bool af_xdp_poll_rx(void *opaque);
+
+/* Set the event-loop handlers for the AF_XDP backend. */
+static void af_xdp_update_fd_handler(AFXDPState *s)
+{
+    if (!s->xsk) {
+        return;
+    }
+    aio_set_fd_handler(s->ctx, xsk_socket__fd(s->xsk), false,
+                       s->read_poll ? af_xdp_send : NULL,
+                       s->write_poll ? af_xdp_writable : NULL,
+                       s->read_poll ? af_xdp_poll_rx : NULL,
+                       s);
+}
+
+/* Update the read handler. */
+static void af_xdp_read_poll(AFXDPState *s, bool enable)
+{
+    if (s->read_poll != enable) {
+        s->read_poll = enable;
+        af_xdp_update_fd_handler(s);
+    }
+}
+
+/* Update the write handler. */
+static void af_xdp_write_poll(AFXDPState *s, bool enable)
+{
+    if (s->write_poll != enable) {
+        s->write_poll = enable;
+        af_xdp_update_fd_handler(s);
+    }
+}
+
+static void af_xdp_poll(NetClientState *nc, bool enable)
+{
+    AFXDPState *s = DO_UPCAST(AFXDPState, nc, nc);
+
+    if (s->read_poll != enable || s->write_poll != enable) {
+        s->write_poll = enable;
+        s->read_poll  = enable;
+        af_xdp_update_fd_handler(s);
+    }
+}
+
+static void af_xdp_set_aio_context(NetClientState *nc, AioContext *ctx)
+{
+    AFXDPState *s = DO_UPCAST(AFXDPState, nc, nc);
+
+    if (!ctx) {
+        ctx = iohandler_get_aio_context();
+    }
+    if (s->ctx == ctx) {
+        return;
+    }
+
+    aio_set_fd_handler(s->ctx, xsk_socket__fd(s->xsk), false,
+                       NULL, NULL, NULL, NULL);
+    s->ctx = ctx;
+    af_xdp_update_fd_handler(s);
+}
+
+/* Return the frames of completed transmissions to the pool. */
+static void af_xdp_complete_tx(AFXDPState *s)
+{
+    uint32_t idx = 0;
+    uint32_t i, n;
+
+    n = xsk_ring_cons__peek(&s->cq, AF_XDP_BATCH_SIZE, &idx);
+    for (i = 0; i < n; i++) {
+        s->pool[s->n_pool++] = *xsk_ring_cons__comp_addr(&s->cq, idx++);
+    }
+    xsk_ring_cons__release(&s->cq, n);
+}
+
+static void af_xdp_kick_tx(AFXDPState *s)
+{
+    if (xsk_ring_prod__needs_wakeup(&s->tx)) {
+        sendto(xsk_socket__fd(s->xsk), NULL, 0, MSG_DONTWAIT, NULL, 0);
+    }
+}
+
+/*
+ * The fd_write() callback, invoked when the socket has room in its
+ * transmit ring again.  Reclaim completed frames and flush the packets
+ * that were queued meanwhile.
+ */
+static void af_xdp_writable(void *opaque)
+{
+    AFXDPState *s = opaque;
+
+    af_xdp_complete_tx(s);
+    af_xdp_write_poll(s, false);
+    qemu_flush_queued_packets(&s->nc);
+}
+
+static int af_xdp_receive_iov_batch(NetClientState *nc,
+                                    const struct iovec **iovs,
+                                    const int *iovcnts, int count)
+{
+    AFXDPState *s = DO_UPCAST(AFXDPState, nc, nc);
+    uint32_t idx = 0;
+    int i, n;
+
+    af_xdp_complete_tx(s);
+
+    /* Oversized packets are dropped, like the other backends do */
+    for (n = 0; n < count && n < s->n_pool; n++) {
+        if (iov_size(iovs[n], iovcnts[n]) > AF_XDP_FRAME_SIZE) {
+            break;
+        }
+    }
+    if (n == 0 && count && s->n_pool) {
+        return 1;
+    }
+
+    n = xsk_ring_prod__reserve(&s->tx, n, &idx);
+    if (!n) {
+        /* Make sure the kernel drains the ring and tells us when it did */
+        af_xdp_kick_tx(s);
+        af_xdp_write_poll(s, true);
+        return 0;
+    }
+
+    for (i = 0; i < n; i++) {
+        struct xdp_desc *desc = xsk_ring_prod__tx_desc(&s->tx, idx++);
+        uint64_t addr = s->pool[--s->n_pool];
+
+        desc->addr = addr;
+        desc->len = iov_to_buf(iovs[i], iovcnts[i], 0,
+                               xsk_umem__get_data(s->buffer, addr),
+                               AF_XDP_FRAME_SIZE);
+    }
+    xsk_ring_prod__submit(&s->tx, n);
+    af_xdp_kick_tx(s);
+
+    if (n < count) {
+        af_xdp_write_poll(s, true);
+    }
+    return n;
+}
+
+static ssize_t af_xdp_receive_iov(NetClientState *nc,
+                                  const struct iovec *iov, int iovcnt)
+{
+    if (!af_xdp_receive_iov_batch(nc, &iov, &iovcnt, 1)) {
+        return 0;
+    }
+    return iov_size(iov, iovcnt);
+}
+
+static ssize_t af_xdp_receive(NetClientState *nc,
+                              const uint8_t *buf, size_t size)
+{
+    struct iovec iov = {
+        .iov_base = (void *)buf,
+        .iov_len = size,
+    };
+
+    return af_xdp_receive_iov(nc, &iov, 1);
+}
+
+/* Complete a previous send (backend --> guest) and enable the
+   fd_read callback. */
+static void af_xdp_send_completed(NetClientState *nc, ssize_t len)
+{
+    AFXDPState *s = DO_UPCAST(AFXDPState, nc, nc);
+
+    af_xdp_read_poll(s, true);
+}
+
+/*
+ * Pass up to AF_XDP_BATCH_SIZE received frames to the peer and give the
+ * frames back to the kernel through the fill ring.  Returns the number of
+ * frames processed.
+ */
+static int af_xdp_do_send(AFXDPState *s)
+{
+    uint64_t addrs[AF_XDP_BATCH_SIZE];
+    uint32_t idx = 0, fq_idx = 0;
+    uint32_t i, n;
+
+    n = xsk_ring_cons__peek(&s->rx, AF_XDP_BATCH_SIZE, &idx);
+    for (i = 0; i < n; ) {
+        const struct xdp_desc *desc = xsk_ring_cons__rx_desc(&s->rx, idx++);
+        ssize_t size;
+
+        addrs[i++] = desc->addr;
+        size = qemu_send_packet_async(&s->nc,
+                                      xsk_umem__get_data(s->buffer,
+                                                         desc->addr),
+                                      desc->len, af_xdp_send_completed);
+        if (size == 0) {
+            /* The packet was copied into the peer's queue, the frame can
+             * be recycled; stop reading until the queue drains. */
+            af_xdp_read_poll(s, false);
+            break;
+        }
+    }
+    /* Un-peek the descriptors that were left for later */
+    s->rx.cached_cons -= n - i;
+    xsk_ring_cons__release(&s->rx, i);
+    if (!i) {
+        return 0;
+    }
+
+    /* The fill ring is sized for every receive frame, so this can't fail */
+    n = xsk_ring_prod__reserve(&s->fq, i, &fq_idx);
+    assert(n == i);
+    for (n = 0; n < i; n++) {
+        *xsk_ring_prod__fill_addr(&s->fq, fq_idx++) =
+            xsk_umem__extract_addr(addrs[n]);
+    }
+    xsk_ring_prod__submit(&s->fq, i);
+    if (xsk_ring_prod__needs_wakeup(&s->fq)) {
+        recvfrom(xsk_socket__fd(s->xsk), NULL, 0, MSG_DONTWAIT, NULL, NULL);
+    }
+    return i;
+}
+
+static void af_xdp_send(void *opaque)
+{
+    AFXDPState *s = opaque;
+
+    while (s->read_poll && af_xdp_do_send(s) == AF_XDP_BATCH_SIZE) {
+        /* keep going while full batches come in */
+    }
+}
+
+/*
+ * Polling handler: when the backend runs in an IOThread with polling
+ * enabled (poll-max-ns), the receive ring is busy-polled instead of
+ * waiting for the socket to become readable.
+ */
+static bool af_xdp_poll_rx(void *opaque)
+{
+    AFXDPState *s = opaque;
+
+    return af_xdp_do_send(s) > 0;
+}
+
+/* Flush and close. */
+static void af_xdp_cleanup(NetClientState *nc)
+{
+    AFXDPState *s = DO_UPCAST(AFXDPState, nc, nc);
+
+    qemu_purge_queued_packets(nc);
+
+    af_xdp_poll(nc, false);
+    xsk_socket__delete(s->xsk);
+    s->xsk = NULL;
+    xsk_umem__delete(s->umem);
+    s->umem = NULL;
+    qemu_vfree(s->buffer);
+    s->buffer = NULL;
+
+    /*
+     * The XDP program is shared by all queues.  Leave it alone if it was
+     * already attached to the interface when the backend was created.
+     */
+    if (s->prog_attached) {
+        bpf_set_link_xdp_fd(s->ifindex, -1, s->xdp_flags);
+        s->prog_attached = false;
+    }
+}
+
+/* NetClientInfo methods */
+static NetClientInfo net_af_xdp_info = {
+    .type = NET_CLIENT_DRIVER_AF_XDP,
+    .size = sizeof(AFXDPState),
+    .receive = af_xdp_receive,
+    .receive_iov = af_xdp_receive_iov,
+    .receive_iov_batch = af_xdp_receive_iov_batch,
+    .poll = af_xdp_poll,
+    .cleanup = af_xdp_cleanup,
+    .set_aio_context = af_xdp_set_aio_context,
+};
+
+static int af_xdp_umem_create(AFXDPState *s, Error **errp)
+{
+    struct xsk_umem_config config = {
+        .fill_size = AF_XDP_RING_SIZE,
+        .comp_size = AF_XDP_RING_SIZE,
+        .frame_size = AF_XDP_FRAME_SIZE,
+        .frame_headroom = 0,
+    };
+    uint64_t size = (uint64_t)AF_XDP_NUM_FRAMES * AF_XDP_FRAME_SIZE;
+    uint32_t idx = 0;
+    int i, ret;
+
+    s->buffer = qemu_memalign(qemu_real_host_page_size, size);
+    memset(s->buffer, 0, size);
+
+    ret = xsk_umem__create(&s->umem, s->buffer, size, &s->fq, &s->cq,
+                           &config);
+    if (ret) {
+        qemu_vfree(s->buffer);
+        s->buffer = NULL;
+        error_setg_errno(errp, -ret, "failed to create AF_XDP UMEM");
+        return -1;
+    }
+
+    /* The first half of the frames is used for receiving... */
+    ret = xsk_ring_prod__reserve(&s->fq, AF_XDP_RING_SIZE, &idx);
+    assert(ret == AF_XDP_RING_SIZE);
+    for (i = 0; i < AF_XDP_RING_SIZE; i++) {
+        *xsk_ring_prod__fill_addr(&s->fq, idx++) =
+            (uint64_t)i * AF_XDP_FRAME_SIZE;
+    }
+    xsk_ring_prod__submit(&s->fq, AF_XDP_RING_SIZE);
+
+    /* ... and the second half for transmitting. */
+    for (i = 0; i < AF_XDP_RING_SIZE; i++) {
+        s->pool[i] = (uint64_t)(AF_XDP_RING_SIZE + i) * AF_XDP_FRAME_SIZE;
+    }
+    s->n_pool = AF_XDP_RING_SIZE;
+    return 0;
+}
+
+static int af_xdp_socket_create(AFXDPState *s,
+                                const NetdevAFXDPOptions *opts,
+                                int queue_id, Error **errp)
+{
+    struct xsk_socket_config config = {
+        .rx_size = AF_XDP_RING_SIZE,
+        .tx_size = AF_XDP_RING_SIZE,
+        .bind_flags = XDP_USE_NEED_WAKEUP,
+    };
+    uint32_t xdp_flags[2];
+    uint32_t prog_id;
+    bool had_prog;
+    int i, n = 0, ret = -EINVAL;
+
+    if (opts->has_force_copy && opts->force_copy) {
+        config.bind_flags |= XDP_COPY;
+    }
+
+    /* Without an explicit mode, prefer native XDP and fall back to skb */
+    if (!opts->has_mode || opts->mode == AFXDP_MODE_NATIVE) {
+        xdp_flags[n++] = XDP_FLAGS_DRV_MODE;
+    }
+    if (!opts->has_mode || opts->mode == AFXDP_MODE_SKB) {
+        xdp_flags[n++] = XDP_FLAGS_SKB_MODE;
+    }
+
+    for (i = 0; i < n; i++) {
+        /*
+         * libbpf only loads its program if none is attached yet.  If that
+         * cannot be checked, assume that the program belongs to someone else.
+         */
+        prog_id = 0;
+        had_prog = bpf_get_link_xdp_id(s->ifindex, &prog_id,
+                                       xdp_flags[i]) < 0 || prog_id;
+        config.xdp_flags = xdp_flags[i] | XDP_FLAGS_UPDATE_IF_NOEXIST;
+        ret = xsk_socket__create(&s->xsk, s->ifname, queue_id, s->umem,
+                                 &s->rx, &s->tx, &config);
+        if (ret == 0) {
+            s->xdp_flags = xdp_flags[i];
+            s->prog_attached = !had_prog;
+            return 0;
+        }
+    }
+
+    error_setg_errno(errp, -ret,
+                     "failed to create AF_XDP socket for %s queue %d",
+                     s->ifname, queue_id);
+    return -1;
+}
+
+/* The exported init function
+ *
+ * ... -netdev af-xdp,ifname="..."
+ */
+int net_init_af_xdp(const Netdev *netdev,
+                    const char *name, NetClientState *peer, Error **errp)
+{
+    const NetdevAFXDPOptions *opts = &netdev->u.af_xdp;
+    int64_t queues = opts->has_queues ? opts->queues : 1;
+    int64_t start_queue = opts->has_start_queue ? opts->start_queue : 0;
+    unsigned int ifindex;
+    NetClientState *nc;
+    AFXDPState *s;
+    int64_t i;
+
+    assert(netdev->type == NET_CLIENT_DRIVER_AF_XDP);
+
+    if (queues < 1 || queues > MAX_QUEUE_NUM) {
+        error_setg(errp, "queues must be between 1 and %d", MAX_QUEUE_NUM);
+        return -1;
+    }
+    if (start_queue < 0 || start_queue > INT_MAX - queues) {
+        error_setg(errp, "invalid start-queue %" PRId64, start_queue);
+        return -1;
+    }
+    if (strlen(opts->ifname) >= IFNAMSIZ) {
+        error_setg(errp, "interface name '%s' is too long", opts->ifname);
+        return -1;
+    }
+    ifindex = if_nametoindex(opts->ifname);
+    if (!ifindex) {
+        error_setg_errno(errp, errno, "failed to get ifindex for '%s'",
+                         opts->ifname);
+        return -1;
+    }
+
+    for (i = 0; i < queues; i++) {
+        nc = qemu_new_net_client(&net_af_xdp_info, peer, "af-xdp", name);
+        nc->queue_index = i;
+        s = DO_UPCAST(AFXDPState, nc, nc);
+        pstrcpy(s->ifname, sizeof(s->ifname), opts->ifname);
+        s->ifindex = ifindex;
+        s->ctx = iohandler_get_aio_context();
+
+        if (af_xdp_umem_create(s, errp) < 0 ||
+            af_xdp_socket_create(s, opts, start_queue + i, errp) < 0) {
+            goto fail;
+        }
+
+        snprintf(nc->info_str, sizeof(nc->info_str),
+                 "af-xdp: ifname=%s queue=%" PRId64 " mode=%s",
+                 s->ifname, start_queue + i,
+                 s->xdp_flags & XDP_FLAGS_DRV_MODE ? "native" : "skb");
+        af_xdp_read_poll(s, true); /* Initially only poll for reads. */
+    }
+
+    return 0;
+
+fail:
+    /* This also cleans up the queues that were set up before */
+    qemu_del_net_client(nc);
+    return -1;
+}
@@ -19,24 +19,45 @@
 #include "net/checksum.h"
 #include "net/eth.h"
 
+/*
+ * The one's complement sum does not depend on byte order, so add up the
+ * buffer in host-endian 32-bit words, which the compiler can vectorize,
+ * and only swap the folded result.  The value returned is already folded
+ * to 16 bits.
+ */
 uint32_t net_checksum_add_cont(int len, uint8_t *buf, int seq)
 {
-    uint32_t sum1 = 0, sum2 = 0;
+    uint64_t sum = 0;
+    uint32_t res;
     int i;
 
-    for (i = 0; i < len - 1; i += 2) {
-        sum1 += (uint32_t)buf[i];
-        sum2 += (uint32_t)buf[i + 1];
+    for (i = 0; i + 4 <= len; i += 4) {
+        sum += ldl_he_p(buf + i);
+    }
+    if (i + 2 <= len) {
+        sum += lduw_he_p(buf + i);
+        i += 2;
     }
     if (i < len) {
-        sum1 += (uint32_t)buf[i];
+        /* A trailing odd byte is the high byte of a big-endian word */
+#ifdef HOST_WORDS_BIGENDIAN
+        sum += (uint32_t)buf[i] << 8;
+#else
+        sum += buf[i];
+#endif
     }
 
-    if (seq & 1) {
-        return sum1 + (sum2 << 8);
-    } else {
-        return sum2 + (sum1 << 8);
-    }
+    sum = (sum & 0xffffffff) + (sum >> 32);
+    sum = (sum & 0xffffffff) + (sum >> 32);
+    res = (sum & 0xffff) + (sum >> 16);
+    res = (res & 0xffff) + (res >> 16);
+    res = (res & 0xffff) + (res >> 16);
+
+    /* Now res is the sum of big-endian words if seq is even */
+#ifndef HOST_WORDS_BIGENDIAN
+    seq++;
+#endif
+    return seq & 1 ? bswap16(res) : res;
 }
 
 uint16_t net_checksum_finish(uint32_t sum)
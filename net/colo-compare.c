@@ -49,13 +49,9 @@ static NotifierList colo_compare_notifiers =
 #define COMPARE_READ_LEN_MAX NET_BUFSIZE
 #define MAX_QUEUE_SIZE 1024
 
-#define COLO_COMPARE_FREE_PRIMARY     0x01
-#define COLO_COMPARE_FREE_SECONDARY   0x02
-
 #define REGULAR_PACKET_CHECK_MS 1000
 #define DEFAULT_TIME_OUT_MS 3000
-
-/* #define DEBUG_COLO_PACKETS */
+#define MAX_COMPARE_WORKERS 64
 
 static QemuMutex colo_compare_mutex;
 static bool colo_compare_active;
@@ -103,6 +99,44 @@ typedef struct SendEntry {
     uint8_t *buf;
 } SendEntry;
 
+/* A packet in flight between the compare iothread and a worker shard */
+typedef struct CompareItem {
+    Packet *pkt;
+    ConnectionKey key;
+    int mode;
+    QSLIST_ENTRY(CompareItem) next;
+} CompareItem;
+
+typedef QSLIST_HEAD(, CompareItem) CompareItemList;
+
+/*
+ * Connection tracking is partitioned by 5-tuple hash.  Each shard owns
+ * its connections exclusively, so the compare path takes no locks.
+ * Without workers there is a single shard that runs inline in the
+ * colo-compare iothread; otherwise each shard has a thread of its own and
+ * packets are handed to it through a lock-free list.
+ */
+typedef struct CompareShard {
+    struct CompareState *s;
+    /* NULL if the shard runs in the colo-compare iothread */
+    IOThread *iothread;
+    AioContext *ctx;
+
+    /*
+     * Record the connection that through the NIC
+     * Element type: Connection
+     */
+    GQueue conn_list;
+    /* Record the connection without repetition */
+    GHashTable *connection_track_table;
+    QEMUTimer *packet_check_timer;
+
+    CompareItemList rx_list;
+    QEMUBH *rx_bh;
+    QEMUBH *flush_bh;
+    QEMUBH *event_bh;
+} CompareShard;
+
 struct CompareState {
     Object parent;
 
@@ -122,20 +156,20 @@ struct CompareState {
     bool vnet_hdr;
     uint64_t compare_timeout;
     uint32_t expired_scan_cycle;
+    uint32_t workers;
 
-    /*
-     * Record the connection that through the NIC
-     * Element type: Connection
-     */
-    GQueue conn_list;
-    /* Record the connection without repetition */
-    GHashTable *connection_track_table;
+    CompareShard *shards;
+    uint32_t nr_shards;
 
     IOThread *iothread;
     GMainContext *worker_context;
-    QEMUTimer *packet_check_timer;
 
-    QEMUBH *event_bh;
+    /* Primary packets released by worker shards, newest first */
+    CompareItemList tx_list;
+    QEMUBH *tx_bh;
+    /* A worker shard asked for a checkpoint */
+    bool checkpoint_pending;
+
     enum colo_event event;
 
     QTAILQ_ENTRY(CompareState) next;
@@ -194,27 +228,35 @@ static void colo_compare_inconsistency_notify(CompareState *s)
     }
 }
 
-/* Use restricted to colo_insert_packet() */
-static gint seq_sorter(Packet *a, Packet *b, gpointer data)
+static void colo_compare_shard_inconsistency_notify(CompareShard *cs)
 {
-    return a->tcp_seq - b->tcp_seq;
+    CompareState *s = cs->s;
+
+    if (!cs->iothread) {
+        colo_compare_inconsistency_notify(s);
+        return;
+    }
+
+    /*
+     * Requests from all shards are folded into a single notification,
+     * sent from the colo-compare iothread.
+     */
+    qatomic_set(&s->checkpoint_pending, true);
+    qemu_bh_schedule(s->tx_bh);
 }
 
-static void fill_pkt_tcp_info(void *data, uint32_t *max_ack)
+/* Take all items queued on @src, oldest first */
+static void compare_item_list_take(CompareItemList *dst, CompareItemList *src)
 {
-    Packet *pkt = data;
-    struct tcp_hdr *tcphd;
+    CompareItemList lifo;
+    CompareItem *item;
 
-    tcphd = (struct tcp_hdr *)pkt->transport_header;
-
-    pkt->tcp_seq = ntohl(tcphd->th_seq);
-    pkt->tcp_ack = ntohl(tcphd->th_ack);
-    *max_ack = *max_ack > pkt->tcp_ack ? *max_ack : pkt->tcp_ack;
-    pkt->header_size = pkt->transport_header - (uint8_t *)pkt->data
-                       + (tcphd->th_off << 2) - pkt->vnet_hdr_len;
-    pkt->payload_size = pkt->size - pkt->header_size;
-    pkt->seq_end = pkt->tcp_seq + pkt->payload_size;
-    pkt->flags = tcphd->th_flags;
+    QSLIST_MOVE_ATOMIC(&lifo, src);
+    QSLIST_INIT(dst);
+    while ((item = QSLIST_FIRST(&lifo))) {
+        QSLIST_REMOVE_HEAD(&lifo, next);
+        QSLIST_INSERT_HEAD(dst, item, next);
+    }
 }
 
 /*
@@ -224,54 +266,27 @@ static void fill_pkt_tcp_info(void *data, uint32_t *max_ack)
 static int colo_insert_packet(GQueue *queue, Packet *pkt, uint32_t *max_ack)
 {
     if (g_queue_get_length(queue) <= max_queue_size) {
-        if (pkt->ip->ip_p == IPPROTO_TCP) {
-            fill_pkt_tcp_info(pkt, max_ack);
-            g_queue_insert_sorted(queue,
-                                  pkt,
-                                  (GCompareDataFunc)seq_sorter,
-                                  NULL);
-        } else {
-            g_queue_push_tail(queue, pkt);
-        }
+        connection_queue_packet(queue, pkt, max_ack);
         return 1;
     }
     return 0;
 }
 
 /*
- * Return 0 on success, if return -1 means the pkt
- * is unsupported(arp and ipv6) and will be sent later
+ * Queue @pkt on its connection in the shard that owns it.
  */
-static int packet_enqueue(CompareState *s, int mode, Connection **con)
+static Connection *packet_enqueue(CompareShard *cs, int mode, Packet *pkt,
+                                  ConnectionKey *key)
 {
-    ConnectionKey key;
-    Packet *pkt = NULL;
     Connection *conn;
     int ret;
 
-    if (mode == PRIMARY_IN) {
-        pkt = packet_new(s->pri_rs.buf,
-                         s->pri_rs.packet_len,
-                         s->pri_rs.vnet_hdr_len);
-    } else {
-        pkt = packet_new(s->sec_rs.buf,
-                         s->sec_rs.packet_len,
-                         s->sec_rs.vnet_hdr_len);
-    }
-
-    if (parse_packet_early(pkt)) {
-        packet_destroy(pkt, NULL);
-        pkt = NULL;
-        return -1;
-    }
-    fill_connection_key(pkt, &key);
-
-    conn = connection_get(s->connection_track_table,
-                          &key,
-                          &s->conn_list);
+    conn = connection_get(cs->connection_track_table,
+                          key,
+                          &cs->conn_list);
 
     if (!conn->processing) {
-        g_queue_push_tail(&s->conn_list, conn);
+        g_queue_push_tail(&cs->conn_list, conn);
         conn->processing = true;
     }
 
@@ -288,327 +303,49 @@ static int packet_enqueue(CompareState *s, int mode, Connection **con)
         pkt = NULL;
     }
 
-    *con = conn;
-
-    return 0;
-}
-
-static inline bool after(uint32_t seq1, uint32_t seq2)
-{
-        return (int32_t)(seq1 - seq2) > 0;
-}
-
-static void colo_release_primary_pkt(CompareState *s, Packet *pkt)
-{
-    int ret;
-    ret = compare_chr_send(s,
-                           pkt->data,
-                           pkt->size,
-                           pkt->vnet_hdr_len,
-                           false,
-                           true);
-    if (ret < 0) {
-        error_report("colo send primary packet failed");
-    }
-    trace_colo_compare_main("packet same and release packet");
-    packet_destroy_partial(pkt, NULL);
+    return conn;
 }
 
 /*
- * The IP packets sent by primary and secondary
- * will be compared in here
- * TODO support ip fragment, Out-Of-Order
- * return:    0  means packet same
- *            > 0 || < 0 means packet different
+ * Pass a primary packet on to outdev; this consumes @pkt.  Worker shards
+ * can't write to outdev themselves because frames from different shards
+ * would interleave, so they hand the packet back to the colo-compare
+ * iothread.
  */
-static int colo_compare_packet_payload(Packet *ppkt,
-                                       Packet *spkt,
-                                       uint16_t poffset,
-                                       uint16_t soffset,
-                                       uint16_t len)
-
+static int colo_send_primary_pkt(CompareShard *cs, Packet *pkt)
 {
-    if (trace_event_get_state_backends(TRACE_COLO_COMPARE_IP_INFO)) {
-        char pri_ip_src[20], pri_ip_dst[20], sec_ip_src[20], sec_ip_dst[20];
-
-        strcpy(pri_ip_src, inet_ntoa(ppkt->ip->ip_src));
-        strcpy(pri_ip_dst, inet_ntoa(ppkt->ip->ip_dst));
-        strcpy(sec_ip_src, inet_ntoa(spkt->ip->ip_src));
-        strcpy(sec_ip_dst, inet_ntoa(spkt->ip->ip_dst));
-
-        trace_colo_compare_ip_info(ppkt->size, pri_ip_src,
-                                   pri_ip_dst, spkt->size,
-                                   sec_ip_src, sec_ip_dst);
-    }
-
-    return memcmp(ppkt->data + poffset, spkt->data + soffset, len);
-}
-
-/*
- * return true means that the payload is consist and
- * need to make the next comparison, false means do
- * the checkpoint
-*/
-static bool colo_mark_tcp_pkt(Packet *ppkt, Packet *spkt,
-                              int8_t *mark, uint32_t max_ack)
-{
-    *mark = 0;
-
-    if (ppkt->tcp_seq == spkt->tcp_seq && ppkt->seq_end == spkt->seq_end) {
-        if (!colo_compare_packet_payload(ppkt, spkt,
-                                        ppkt->header_size, spkt->header_size,
-                                        ppkt->payload_size)) {
-            *mark = COLO_COMPARE_FREE_SECONDARY | COLO_COMPARE_FREE_PRIMARY;
-            return true;
-        }
-    }
-
-    /* one part of secondary packet payload still need to be compared */
-    if (!after(ppkt->seq_end, spkt->seq_end)) {
-        if (!colo_compare_packet_payload(ppkt, spkt,
-                                        ppkt->header_size + ppkt->offset,
-                                        spkt->header_size + spkt->offset,
-                                        ppkt->payload_size - ppkt->offset)) {
-            if (!after(ppkt->tcp_ack, max_ack)) {
-                *mark = COLO_COMPARE_FREE_PRIMARY;
-                spkt->offset += ppkt->payload_size - ppkt->offset;
-                return true;
-            } else {
-                /* secondary guest hasn't ack the data, don't send
-                 * out this packet
-                 */
-                return false;
-            }
-        }
-    } else {
-        /* primary packet is longer than secondary packet, compare
-         * the same part and mark the primary packet offset
-         */
-        if (!colo_compare_packet_payload(ppkt, spkt,
-                                        ppkt->header_size + ppkt->offset,
-                                        spkt->header_size + spkt->offset,
-                                        spkt->payload_size - spkt->offset)) {
-            *mark = COLO_COMPARE_FREE_SECONDARY;
-            ppkt->offset += spkt->payload_size - spkt->offset;
-            return true;
-        }
-    }
-
-    return false;
-}
-
-static void colo_compare_tcp(CompareState *s, Connection *conn)
-{
-    Packet *ppkt = NULL, *spkt = NULL;
-    int8_t mark;
-
-    /*
-     * If ppkt and spkt have the same payload, but ppkt's ACK
-     * is greater than spkt's ACK, in this case we can not
-     * send the ppkt because it will cause the secondary guest
-     * to miss sending some data in the next. Therefore, we
-     * record the maximum ACK in the current queue at both
-     * primary side and secondary side. Only when the ack is
-     * less than the smaller of the two maximum ack, then we
-     * can ensure that the packet's payload is acknowledged by
-     * primary and secondary.
-    */
-    uint32_t min_ack = conn->pack > conn->sack ? conn->sack : conn->pack;
-
-pri:
-    if (g_queue_is_empty(&conn->primary_list)) {
-        return;
-    }
-    ppkt = g_queue_pop_head(&conn->primary_list);
-sec:
-    if (g_queue_is_empty(&conn->secondary_list)) {
-        g_queue_push_head(&conn->primary_list, ppkt);
-        return;
-    }
-    spkt = g_queue_pop_head(&conn->secondary_list);
-
-    if (ppkt->tcp_seq == ppkt->seq_end) {
-        colo_release_primary_pkt(s, ppkt);
-        ppkt = NULL;
-    }
-
-    if (ppkt && conn->compare_seq && !after(ppkt->seq_end, conn->compare_seq)) {
-        trace_colo_compare_main("pri: this packet has compared");
-        colo_release_primary_pkt(s, ppkt);
-        ppkt = NULL;
-    }
-
-    if (spkt->tcp_seq == spkt->seq_end) {
-        packet_destroy(spkt, NULL);
-        if (!ppkt) {
-            goto pri;
-        } else {
-            goto sec;
-        }
-    } else {
-        if (conn->compare_seq && !after(spkt->seq_end, conn->compare_seq)) {
-            trace_colo_compare_main("sec: this packet has compared");
-            packet_destroy(spkt, NULL);
-            if (!ppkt) {
-                goto pri;
-            } else {
-                goto sec;
-            }
-        }
-        if (!ppkt) {
-            g_queue_push_head(&conn->secondary_list, spkt);
-            goto pri;
-        }
-    }
-
-    if (colo_mark_tcp_pkt(ppkt, spkt, &mark, min_ack)) {
-        trace_colo_compare_tcp_info("pri",
-                                    ppkt->tcp_seq, ppkt->tcp_ack,
-                                    ppkt->header_size, ppkt->payload_size,
-                                    ppkt->offset, ppkt->flags);
-
-        trace_colo_compare_tcp_info("sec",
-                                    spkt->tcp_seq, spkt->tcp_ack,
-                                    spkt->header_size, spkt->payload_size,
-                                    spkt->offset, spkt->flags);
-
-        if (mark == COLO_COMPARE_FREE_PRIMARY) {
-            conn->compare_seq = ppkt->seq_end;
-            colo_release_primary_pkt(s, ppkt);
-            g_queue_push_head(&conn->secondary_list, spkt);
-            goto pri;
-        } else if (mark == COLO_COMPARE_FREE_SECONDARY) {
-            conn->compare_seq = spkt->seq_end;
-            packet_destroy(spkt, NULL);
-            goto sec;
-        } else if (mark == (COLO_COMPARE_FREE_PRIMARY | COLO_COMPARE_FREE_SECONDARY)) {
-            conn->compare_seq = ppkt->seq_end;
-            colo_release_primary_pkt(s, ppkt);
-            packet_destroy(spkt, NULL);
-            goto pri;
-        }
-    } else {
-        g_queue_push_head(&conn->primary_list, ppkt);
-        g_queue_push_head(&conn->secondary_list, spkt);
-
-#ifdef DEBUG_COLO_PACKETS
-        qemu_hexdump(stderr, "colo-compare ppkt", ppkt->data, ppkt->size);
-        qemu_hexdump(stderr, "colo-compare spkt", spkt->data, spkt->size);
-#endif
+    CompareState *s = cs->s;
+    CompareItem *item;
+    int ret;
 
-        colo_compare_inconsistency_notify(s);
+    if (!cs->iothread) {
+        ret = compare_chr_send(s,
+                               pkt->data,
+                               pkt->size,
+                               pkt->vnet_hdr_len,
+                               false,
+                               true);
+        packet_destroy_partial(pkt, NULL);
+        return ret;
     }
-}
-
 
-/*
- * Called from the compare thread on the primary
- * for compare udp packet
- */
-static int colo_packet_compare_udp(Packet *spkt, Packet *ppkt)
-{
-    uint16_t network_header_length = ppkt->ip->ip_hl << 2;
-    uint16_t offset = network_header_length + ETH_HLEN + ppkt->vnet_hdr_len;
-
-    trace_colo_compare_main("compare udp");
-
-    /*
-     * Because of ppkt and spkt are both in the same connection,
-     * The ppkt's src ip, dst ip, src port, dst port, ip_proto all are
-     * same with spkt. In addition, IP header's Identification is a random
-     * field, we can handle it in IP fragmentation function later.
-     * COLO just concern the response net packet payload from primary guest
-     * and secondary guest are same or not, So we ignored all IP header include
-     * other field like TOS,TTL,IP Checksum. we only need to compare
-     * the ip payload here.
-     */
-    if (ppkt->size != spkt->size) {
-        trace_colo_compare_main("UDP: payload size of packets are different");
-        return -1;
-    }
-    if (colo_compare_packet_payload(ppkt, spkt, offset, offset,
-                                    ppkt->size - offset)) {
-        trace_colo_compare_udp_miscompare("primary pkt size", ppkt->size);
-        trace_colo_compare_udp_miscompare("Secondary pkt size", spkt->size);
-#ifdef DEBUG_COLO_PACKETS
-        qemu_hexdump(stderr, "colo-compare pri pkt", ppkt->data, ppkt->size);
-        qemu_hexdump(stderr, "colo-compare sec pkt", spkt->data, spkt->size);
-#endif
-        return -1;
-    } else {
-        return 0;
-    }
+    item = g_slice_new(CompareItem);
+    item->pkt = pkt;
+    item->mode = PRIMARY_IN;
+    QSLIST_INSERT_HEAD_ATOMIC(&s->tx_list, item, next);
+    qemu_bh_schedule(s->tx_bh);
+    return 0;
 }
 
-/*
- * Called from the compare thread on the primary
- * for compare icmp packet
- */
-static int colo_packet_compare_icmp(Packet *spkt, Packet *ppkt)
+static void colo_release_primary_pkt(CompareShard *cs, Packet *pkt)
 {
-    uint16_t network_header_length = ppkt->ip->ip_hl << 2;
-    uint16_t offset = network_header_length + ETH_HLEN + ppkt->vnet_hdr_len;
-
-    trace_colo_compare_main("compare icmp");
-
-    /*
-     * Because of ppkt and spkt are both in the same connection,
-     * The ppkt's src ip, dst ip, src port, dst port, ip_proto all are
-     * same with spkt. In addition, IP header's Identification is a random
-     * field, we can handle it in IP fragmentation function later.
-     * COLO just concern the response net packet payload from primary guest
-     * and secondary guest are same or not, So we ignored all IP header include
-     * other field like TOS,TTL,IP Checksum. we only need to compare
-     * the ip payload here.
-     */
-    if (ppkt->size != spkt->size) {
-        trace_colo_compare_main("ICMP: payload size of packets are different");
-        return -1;
-    }
-    if (colo_compare_packet_payload(ppkt, spkt, offset, offset,
-                                    ppkt->size - offset)) {
-        trace_colo_compare_icmp_miscompare("primary pkt size",
-                                           ppkt->size);
-        trace_colo_compare_icmp_miscompare("Secondary pkt size",
-                                           spkt->size);
-#ifdef DEBUG_COLO_PACKETS
-        qemu_hexdump(stderr, "colo-compare pri pkt", ppkt->data, ppkt->size);
-        qemu_hexdump(stderr, "colo-compare sec pkt", spkt->data, spkt->size);
-#endif
-        return -1;
-    } else {
-        return 0;
-    }
-}
-
-/*
- * Called from the compare thread on the primary
- * for compare other packet
- */
-static int colo_packet_compare_other(Packet *spkt, Packet *ppkt)
-{
-    uint16_t offset = ppkt->vnet_hdr_len;
-
-    trace_colo_compare_main("compare other");
-    if (trace_event_get_state_backends(TRACE_COLO_COMPARE_IP_INFO)) {
-        char pri_ip_src[20], pri_ip_dst[20], sec_ip_src[20], sec_ip_dst[20];
-
-        strcpy(pri_ip_src, inet_ntoa(ppkt->ip->ip_src));
-        strcpy(pri_ip_dst, inet_ntoa(ppkt->ip->ip_dst));
-        strcpy(sec_ip_src, inet_ntoa(spkt->ip->ip_src));
-        strcpy(sec_ip_dst, inet_ntoa(spkt->ip->ip_dst));
-
-        trace_colo_compare_ip_info(ppkt->size, pri_ip_src,
-                                   pri_ip_dst, spkt->size,
-                                   sec_ip_src, sec_ip_dst);
-    }
+    int ret;
 
-    if (ppkt->size != spkt->size) {
-        trace_colo_compare_main("Other: payload size of packets are different");
-        return -1;
+    ret = colo_send_primary_pkt(cs, pkt);
+    if (ret < 0) {
+        error_report("colo send primary packet failed");
     }
-    return colo_compare_packet_payload(ppkt, spkt, offset, offset,
-                                       ppkt->size - offset);
+    trace_colo_compare_main("packet same and release packet");
 }
 
 static int colo_old_packet_check_one(Packet *pkt, int64_t *check_time)
@@ -634,8 +371,10 @@ void colo_compare_unregister_notifier(Notifier *notify)
 }
 
 static int colo_old_packet_check_one_conn(Connection *conn,
-                                          CompareState *s)
+                                          CompareShard *cs)
 {
+    CompareState *s = cs->s;
+
     if (!g_queue_is_empty(&conn->primary_list)) {
         if (g_queue_find_custom(&conn->primary_list,
                                 &s->compare_timeout,
@@ -654,7 +393,7 @@ static int colo_old_packet_check_one_conn(Connection *conn,
 
 out:
     /* Do checkpoint will flush old packet */
-    colo_compare_inconsistency_notify(s);
+    colo_compare_shard_inconsistency_notify(cs);
     return 0;
 }
 
@@ -665,72 +404,54 @@ out:
  */
 static void colo_old_packet_check(void *opaque)
 {
-    CompareState *s = opaque;
+    CompareShard *cs = opaque;
 
     /*
      * If we find one old packet, stop finding job and notify
      * COLO frame do checkpoint.
      */
-    g_queue_find_custom(&s->conn_list, s,
+    g_queue_find_custom(&cs->conn_list, cs,
                         (GCompareFunc)colo_old_packet_check_one_conn);
 }
 
-static void colo_compare_packet(CompareState *s, Connection *conn,
-                                int (*HandlePacket)(Packet *spkt,
-                                Packet *ppkt))
+static void colo_compare_shard_release(Packet *pkt, void *opaque)
 {
-    Packet *pkt = NULL;
-    GList *result = NULL;
+    colo_release_primary_pkt(opaque, pkt);
+}
 
-    while (!g_queue_is_empty(&conn->primary_list) &&
-           !g_queue_is_empty(&conn->secondary_list)) {
-        pkt = g_queue_pop_head(&conn->primary_list);
-        result = g_queue_find_custom(&conn->secondary_list,
-                 pkt, (GCompareFunc)HandlePacket);
+static void colo_compare_shard_inconsistency(void *opaque)
+{
+    colo_compare_shard_inconsistency_notify(opaque);
+}
 
-        if (result) {
-            colo_release_primary_pkt(s, pkt);
-            g_queue_remove(&conn->secondary_list, result->data);
-        } else {
-            /*
-             * If one packet arrive late, the secondary_list or
-             * primary_list will be empty, so we can't compare it
-             * until next comparison. If the packets in the list are
-             * timeout, it will trigger a checkpoint request.
-             */
-            trace_colo_compare_main("packet different");
-            g_queue_push_head(&conn->primary_list, pkt);
+static const ConnectionCompareOps colo_compare_shard_ops = {
+    .release_primary = colo_compare_shard_release,
+    .inconsistency = colo_compare_shard_inconsistency,
+};
 
-            colo_compare_inconsistency_notify(s);
-            break;
-        }
-    }
+static void colo_compare_shard_packet(CompareShard *cs, int mode,
+                                      Packet *pkt, ConnectionKey *key)
+{
+    Connection *conn = packet_enqueue(cs, mode, pkt, key);
+
+    /* compare packet in the specified connection */
+    connection_compare(conn, &colo_compare_shard_ops, cs);
 }
 
 /*
- * Called from the compare thread on the primary
- * for compare packet with secondary list of the
- * specified connection when a new packet was
- * queued to it.
+ * Called from a worker shard's thread with the packets the colo-compare
+ * iothread handed over since the last run.
  */
-static void colo_compare_connection(void *opaque, void *user_data)
+static void colo_compare_shard_rx(void *opaque)
 {
-    CompareState *s = user_data;
-    Connection *conn = opaque;
+    CompareShard *cs = opaque;
+    CompareItemList list;
+    CompareItem *item, *next_item;
 
-    switch (conn->ip_proto) {
-    case IPPROTO_TCP:
-        colo_compare_tcp(s, conn);
-        break;
-    case IPPROTO_UDP:
-        colo_compare_packet(s, conn, colo_packet_compare_udp);
-        break;
-    case IPPROTO_ICMP:
-        colo_compare_packet(s, conn, colo_packet_compare_icmp);
-        break;
-    default:
-        colo_compare_packet(s, conn, colo_packet_compare_other);
-        break;
+    compare_item_list_take(&list, &cs->rx_list);
+    QSLIST_FOREACH_SAFE(item, &list, next, next_item) {
+        colo_compare_shard_packet(cs, item->mode, item->pkt, &item->key);
+        g_slice_free(CompareItem, item);
     }
 }
 
@@ -903,12 +624,12 @@ static void compare_notify_chr(void *opaque, const uint8_t *buf, int size)
  */
 static void check_old_packet_regular(void *opaque)
 {
-    CompareState *s = opaque;
+    CompareShard *cs = opaque;
 
     /* if have old packet we will notify checkpoint */
-    colo_old_packet_check(s);
-    timer_mod(s->packet_check_timer, qemu_clock_get_ms(QEMU_CLOCK_HOST) +
-              s->expired_scan_cycle);
+    colo_old_packet_check(cs);
+    timer_mod(cs->packet_check_timer, qemu_clock_get_ms(QEMU_CLOCK_HOST) +
+              cs->s->expired_scan_cycle);
 }
 
 /* Public API, Used for COLO frame to notify compare event */
@@ -924,9 +645,13 @@ void colo_notify_compares_event(void *opaque, int event, Error **errp)
 
     qemu_mutex_lock(&event_mtx);
     QTAILQ_FOREACH(s, &net_compares, next) {
+        uint32_t i;
+
         s->event = event;
-        qemu_bh_schedule(s->event_bh);
-        event_unhandled_count++;
+        for (i = 0; i < s->nr_shards; i++) {
+            qemu_bh_schedule(s->shards[i].event_bh);
+            event_unhandled_count++;
+        }
     }
     /* Wait all compare threads to finish handling this event */
     while (event_unhandled_count > 0) {
@@ -937,35 +662,57 @@ void colo_notify_compares_event(void *opaque, int event, Error **errp)
     qemu_mutex_unlock(&colo_compare_mutex);
 }
 
-static void colo_compare_timer_init(CompareState *s)
+static void colo_compare_timer_init(CompareShard *cs)
 {
-    AioContext *ctx = iothread_get_aio_context(s->iothread);
-
-    s->packet_check_timer = aio_timer_new(ctx, QEMU_CLOCK_HOST,
+    cs->packet_check_timer = aio_timer_new(cs->ctx, QEMU_CLOCK_HOST,
                                 SCALE_MS, check_old_packet_regular,
-                                s);
-    timer_mod(s->packet_check_timer, qemu_clock_get_ms(QEMU_CLOCK_HOST) +
-              s->expired_scan_cycle);
+                                cs);
+    timer_mod(cs->packet_check_timer, qemu_clock_get_ms(QEMU_CLOCK_HOST) +
+              cs->s->expired_scan_cycle);
 }
 
-static void colo_compare_timer_del(CompareState *s)
+static void colo_compare_timer_del(CompareShard *cs)
 {
-    if (s->packet_check_timer) {
-        timer_del(s->packet_check_timer);
-        timer_free(s->packet_check_timer);
-        s->packet_check_timer = NULL;
+    if (cs->packet_check_timer) {
+        timer_del(cs->packet_check_timer);
+        timer_free(cs->packet_check_timer);
+        cs->packet_check_timer = NULL;
     }
  }
 
 static void colo_flush_packets(void *opaque, void *user_data);
 
+static void colo_compare_shard_flush(void *opaque)
+{
+    CompareShard *cs = opaque;
+
+    g_queue_foreach(&cs->conn_list, colo_flush_packets, cs);
+}
+
+/* Flush every shard, each one from its own thread */
+static void colo_compare_flush_shards(CompareState *s)
+{
+    uint32_t i;
+
+    for (i = 0; i < s->nr_shards; i++) {
+        CompareShard *cs = &s->shards[i];
+
+        if (cs->iothread) {
+            qemu_bh_schedule(cs->flush_bh);
+        } else {
+            colo_compare_shard_flush(cs);
+        }
+    }
+}
+
 static void colo_compare_handle_event(void *opaque)
 {
-    CompareState *s = opaque;
+    CompareShard *cs = opaque;
+    CompareState *s = cs->s;
 
     switch (s->event) {
     case COLO_EVENT_CHECKPOINT:
-        g_queue_foreach(&s->conn_list, colo_flush_packets, s);
+        colo_compare_shard_flush(cs);
         break;
     case COLO_EVENT_FAILOVER:
         break;
@@ -980,9 +727,61 @@ static void colo_compare_handle_event(void *opaque)
     qemu_mutex_unlock(&event_mtx);
 }
 
+/*
+ * Called from the colo-compare iothread to send the primary packets
+ * released by worker shards, and to do the checkpoint notification
+ * they requested.
+ */
+static void colo_compare_tx(void *opaque)
+{
+    CompareState *s = opaque;
+    CompareItemList list;
+    CompareItem *item, *next_item;
+
+    compare_item_list_take(&list, &s->tx_list);
+    QSLIST_FOREACH_SAFE(item, &list, next, next_item) {
+        Packet *pkt = item->pkt;
+
+        compare_chr_send(s,
+                         pkt->data,
+                         pkt->size,
+                         pkt->vnet_hdr_len,
+                         false,
+                         true);
+        packet_destroy_partial(pkt, NULL);
+        g_slice_free(CompareItem, item);
+    }
+
+    if (qatomic_xchg(&s->checkpoint_pending, false)) {
+        colo_compare_inconsistency_notify(s);
+    }
+}
+
+static void colo_compare_shard_init(CompareState *s, CompareShard *cs)
+{
+    cs->s = s;
+    cs->ctx = iothread_get_aio_context(cs->iothread ?: s->iothread);
+
+    g_queue_init(&cs->conn_list);
+    cs->connection_track_table = g_hash_table_new_full(connection_key_hash,
+                                                       connection_key_equal,
+                                                       g_free,
+                                                       connection_destroy);
+    QSLIST_INIT(&cs->rx_list);
+
+    colo_compare_timer_init(cs);
+    cs->event_bh = aio_bh_new(cs->ctx, colo_compare_handle_event, cs);
+    if (cs->iothread) {
+        cs->rx_bh = aio_bh_new(cs->ctx, colo_compare_shard_rx, cs);
+        cs->flush_bh = aio_bh_new(cs->ctx, colo_compare_shard_flush, cs);
+    }
+}
+
 static void colo_compare_iothread(CompareState *s)
 {
     AioContext *ctx = iothread_get_aio_context(s->iothread);
+    uint32_t i;
+
     object_ref(OBJECT(s->iothread));
     s->worker_context = iothread_get_g_main_context(s->iothread);
 
@@ -998,8 +797,12 @@ static void colo_compare_iothread(CompareState *s)
                                  s, s->worker_context, true);
     }
 
-    colo_compare_timer_init(s);
-    s->event_bh = aio_bh_new(ctx, colo_compare_handle_event, s);
+    QSLIST_INIT(&s->tx_list);
+    s->tx_bh = aio_bh_new(ctx, colo_compare_tx, s);
+
+    for (i = 0; i < s->nr_shards; i++) {
+        colo_compare_shard_init(s, &s->shards[i]);
+    }
 }
 
 static char *compare_get_pri_indev(Object *obj, Error **errp)
@@ -1134,6 +937,34 @@ static void compare_set_expired_scan_cycle(Object *obj, Visitor *v,
     s->expired_scan_cycle = value;
 }
 
+static void compare_get_workers(Object *obj, Visitor *v,
+                                const char *name, void *opaque,
+                                Error **errp)
+{
+    CompareState *s = COLO_COMPARE(obj);
+    uint32_t value = s->workers;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void compare_set_workers(Object *obj, Visitor *v,
+                                const char *name, void *opaque,
+                                Error **errp)
+{
+    CompareState *s = COLO_COMPARE(obj);
+    uint32_t value;
+
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+    if (value > MAX_COMPARE_WORKERS) {
+        error_setg(errp, "Property '%s.%s' must not exceed %d",
+                   object_get_typename(obj), name, MAX_COMPARE_WORKERS);
+        return;
+    }
+    s->workers = value;
+}
+
 static void get_max_queue_size(Object *obj, Visitor *v,
                                const char *name, void *opaque,
                                Error **errp)
@@ -1165,12 +996,44 @@ out:
     error_propagate(errp, local_err);
 }
 
+/*
+ * Return 0 on success, if return -1 means the pkt
+ * is unsupported(arp and ipv6) and will be sent later
+ */
+static int packet_dispatch(CompareState *s, int mode, SocketReadState *rs)
+{
+    ConnectionKey key;
+    CompareShard *cs;
+    CompareItem *item;
+    Packet *pkt;
+
+    pkt = packet_new(rs->buf, rs->packet_len, rs->vnet_hdr_len);
+    if (parse_packet_early(pkt)) {
+        packet_destroy(pkt, NULL);
+        return -1;
+    }
+    fill_connection_key(pkt, &key);
+
+    if (!s->workers) {
+        colo_compare_shard_packet(&s->shards[0], mode, pkt, &key);
+        return 0;
+    }
+
+    cs = &s->shards[connection_key_shard(&key, s->nr_shards)];
+    item = g_slice_new(CompareItem);
+    item->pkt = pkt;
+    item->key = key;
+    item->mode = mode;
+    QSLIST_INSERT_HEAD_ATOMIC(&cs->rx_list, item, next);
+    qemu_bh_schedule(cs->rx_bh);
+    return 0;
+}
+
 static void compare_pri_rs_finalize(SocketReadState *pri_rs)
 {
     CompareState *s = container_of(pri_rs, CompareState, pri_rs);
-    Connection *conn = NULL;
 
-    if (packet_enqueue(s, PRIMARY_IN, &conn)) {
+    if (packet_dispatch(s, PRIMARY_IN, pri_rs)) {
         trace_colo_compare_main("primary: unsupported packet in");
         compare_chr_send(s,
                          pri_rs->buf,
@@ -1178,22 +1041,15 @@ static void compare_pri_rs_finalize(SocketReadState *pri_rs)
                          pri_rs->vnet_hdr_len,
                          false,
                          false);
-    } else {
-        /* compare packet in the specified connection */
-        colo_compare_connection(conn, s);
     }
 }
 
 static void compare_sec_rs_finalize(SocketReadState *sec_rs)
 {
     CompareState *s = container_of(sec_rs, CompareState, sec_rs);
-    Connection *conn = NULL;
 
-    if (packet_enqueue(s, SECONDARY_IN, &conn)) {
+    if (packet_dispatch(s, SECONDARY_IN, sec_rs)) {
         trace_colo_compare_main("secondary: unsupported packet in");
-    } else {
-        /* compare packet in the specified connection */
-        colo_compare_connection(conn, s);
     }
 }
 
@@ -1215,7 +1071,7 @@ static void compare_notify_rs_finalize(SocketReadState *notify_rs)
                                   notify_rs->buf,
                                   notify_rs->packet_len)) {
         /* colo-compare do checkpoint, flush pri packet and remove sec packet */
-        g_queue_foreach(&s->conn_list, colo_flush_packets, s);
+        colo_compare_flush_shards(s);
     } else {
         error_report("COLO compare got unsupported instruction");
     }
@@ -1251,6 +1107,43 @@ static int find_and_check_chardev(Chardev **chr,
     return 0;
 }
 
+static void colo_compare_destroy_workers(CompareState *s)
+{
+    uint32_t i;
+
+    for (i = 0; i < s->nr_shards; i++) {
+        if (s->shards[i].iothread) {
+            iothread_destroy(s->shards[i].iothread);
+        }
+    }
+    g_free(s->shards);
+    s->shards = NULL;
+    s->nr_shards = 0;
+}
+
+/*
+ * Spawn one thread per worker shard.  Without workers, the single shard
+ * runs in the colo-compare iothread.
+ */
+static bool colo_compare_create_workers(CompareState *s, Error **errp)
+{
+    const char *id = object_get_canonical_path_component(OBJECT(s));
+    uint32_t i;
+
+    s->nr_shards = MAX(s->workers, 1);
+    s->shards = g_new0(CompareShard, s->nr_shards);
+    for (i = 0; i < s->workers; i++) {
+        g_autofree char *name = g_strdup_printf("%s-worker%u", id, i);
+
+        s->shards[i].iothread = iothread_create(name, errp);
+        if (!s->shards[i].iothread) {
+            colo_compare_destroy_workers(s);
+            return false;
+        }
+    }
+    return true;
+}
+
 /*
  * Called from the main thread on the primary
  * to setup colo-compare.
@@ -1330,12 +1223,9 @@ static void colo_compare_complete(UserCreatable *uc, Error **errp)
         g_queue_init(&s->notify_sendco.send_list);
     }
 
-    g_queue_init(&s->conn_list);
-
-    s->connection_track_table = g_hash_table_new_full(connection_key_hash,
-                                                      connection_key_equal,
-                                                      g_free,
-                                                      connection_destroy);
+    if (!colo_compare_create_workers(s, errp)) {
+        return;
+    }
 
     colo_compare_iothread(s);
 
@@ -1353,19 +1243,13 @@ static void colo_compare_complete(UserCreatable *uc, Error **errp)
 
 static void colo_flush_packets(void *opaque, void *user_data)
 {
-    CompareState *s = user_data;
+    CompareShard *cs = user_data;
     Connection *conn = opaque;
     Packet *pkt = NULL;
 
     while (!g_queue_is_empty(&conn->primary_list)) {
         pkt = g_queue_pop_head(&conn->primary_list);
-        compare_chr_send(s,
-                         pkt->data,
-                         pkt->size,
-                         pkt->vnet_hdr_len,
-                         false,
-                         true);
-        packet_destroy_partial(pkt, NULL);
+        colo_send_primary_pkt(cs, pkt);
     }
     while (!g_queue_is_empty(&conn->secondary_list)) {
         pkt = g_queue_pop_head(&conn->secondary_list);
@@ -1410,6 +1294,10 @@ static void colo_compare_init(Object *obj)
                         get_max_queue_size,
                         set_max_queue_size, NULL, NULL);
 
+    object_property_add(obj, "workers", "uint32",
+                        compare_get_workers,
+                        compare_set_workers, NULL, NULL);
+
     s->vnet_hdr = false;
     object_property_add_bool(obj, "vnet_hdr_support", compare_get_vnet_hdr,
                              compare_set_vnet_hdr);
@@ -1419,6 +1307,9 @@ static void colo_compare_finalize(Object *obj)
 {
     CompareState *s = COLO_COMPARE(obj);
     CompareState *tmp = NULL;
+    CompareItemList items;
+    CompareItem *item, *next_item;
+    uint32_t i;
 
     qemu_mutex_lock(&colo_compare_mutex);
     QTAILQ_FOREACH(tmp, &net_compares, next) {
@@ -1441,9 +1332,20 @@ static void colo_compare_finalize(Object *obj)
         qemu_chr_fe_deinit(&s->chr_notify_dev, false);
     }
 
-    colo_compare_timer_del(s);
+    for (i = 0; i < s->nr_shards; i++) {
+        CompareShard *cs = &s->shards[i];
 
-    qemu_bh_delete(s->event_bh);
+        colo_compare_timer_del(cs);
+        qemu_bh_delete(cs->event_bh);
+        if (cs->iothread) {
+            qemu_bh_delete(cs->rx_bh);
+            qemu_bh_delete(cs->flush_bh);
+            /* From here on the shard is only touched by this thread */
+            iothread_destroy(cs->iothread);
+            cs->iothread = NULL;
+        }
+    }
+    qemu_bh_delete(s->tx_bh);
 
     AioContext *ctx = iothread_get_aio_context(s->iothread);
     aio_context_acquire(ctx);
@@ -1454,18 +1356,37 @@ static void colo_compare_finalize(Object *obj)
     aio_context_release(ctx);
 
     /* Release all unhandled packets after compare thead exited */
-    g_queue_foreach(&s->conn_list, colo_flush_packets, s);
+    compare_item_list_take(&items, &s->tx_list);
+    QSLIST_FOREACH_SAFE(item, &items, next, next_item) {
+        colo_send_primary_pkt(&s->shards[0], item->pkt);
+        g_slice_free(CompareItem, item);
+    }
+    for (i = 0; i < s->nr_shards; i++) {
+        CompareShard *cs = &s->shards[i];
+
+        g_queue_foreach(&cs->conn_list, colo_flush_packets, cs);
+        compare_item_list_take(&items, &cs->rx_list);
+        QSLIST_FOREACH_SAFE(item, &items, next, next_item) {
+            if (item->mode == PRIMARY_IN) {
+                colo_send_primary_pkt(cs, item->pkt);
+            } else {
+                packet_destroy(item->pkt, NULL);
+            }
+            g_slice_free(CompareItem, item);
+        }
+    }
     AIO_WAIT_WHILE(NULL, !s->out_sendco.done);
 
-    g_queue_clear(&s->conn_list);
     g_queue_clear(&s->out_sendco.send_list);
     if (s->notify_dev) {
         g_queue_clear(&s->notify_sendco.send_list);
     }
 
-    if (s->connection_track_table) {
-        g_hash_table_destroy(s->connection_track_table);
+    for (i = 0; i < s->nr_shards; i++) {
+        g_queue_clear(&s->shards[i].conn_list);
+        g_hash_table_destroy(s->shards[i].connection_track_table);
     }
+    g_free(s->shards);
 
     object_unref(OBJECT(s->iothread));
 
@@ -86,7 +86,15 @@ typedef struct Connection {
     uint32_t fin_ack_seq; /* the seq of 'fin=1,ack=1' */
 } Connection;
 
+typedef struct ConnectionCompareOps {
+    /* Pass on a primary packet that matched; this consumes @pkt */
+    void (*release_primary)(Packet *pkt, void *opaque);
+    /* The primary and the secondary diverged, a checkpoint is needed */
+    void (*inconsistency)(void *opaque);
+} ConnectionCompareOps;
+
 uint32_t connection_key_hash(const void *opaque);
+uint32_t connection_key_shard(const ConnectionKey *key, uint32_t nr_shards);
 int connection_key_equal(const void *opaque1, const void *opaque2);
 int parse_packet_early(Packet *pkt);
 void extract_ip_and_port(uint32_t tmp_ports, ConnectionKey *key, Packet *pkt);
@@ -103,5 +111,8 @@ void connection_hashtable_reset(GHashTable *connection_track_table);
 Packet *packet_new(const void *data, int size, int vnet_hdr_len);
 void packet_destroy(void *opaque, void *user_data);
 void packet_destroy_partial(void *opaque, void *user_data);
+void connection_queue_packet(GQueue *queue, Packet *pkt, uint32_t *max_ack);
+void connection_compare(Connection *conn, const ConnectionCompareOps *ops,
+                        void *opaque);
 
 #endif /* NET_COLO_H */
@@ -0,0 +1,474 @@
+/*
+ * Software generic receive offload
+ *
+ * Coalesces in-order TCP segments of the same flow into a single large
+ * frame, the way the host kernel does for tap, so that backends without
+ * a virtio-net header can still hand 64 KiB frames to the guest.  Every
+ * TCP segment has its checksums validated before it is considered;
+ * merged frames leave with a partial checksum (VIRTIO_NET_HDR_F_NEEDS_CSUM)
+ * and single segments with VIRTIO_NET_HDR_F_DATA_VALID.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bswap.h"
+#include "net/checksum.h"
+#include "net/eth.h"
+#include "net/gro.h"
+#include "trace.h"
+
+#define GRO_MAX_FLOWS 8
+
+#define GRO_IP4_HLEN 20
+#define GRO_IP6_HLEN 40
+#define GRO_TCP_HLEN 20
+#define GRO_TCP_CSUM_OFFSET 16
+
+/* Ethernet and IPv6 header followed by the largest IPv6 payload */
+#define GRO_MAX_FRAME (ETH_HLEN + GRO_IP6_HLEN + 65535)
+
+typedef struct NetGROFlow {
+    /* Ethernet frame holding the merged segments */
+    uint8_t *buf;
+    size_t size;
+    size_t l4_off;
+    /* Size of all headers, up to the TCP payload */
+    size_t hdr_len;
+    uint32_t next_seq;
+    uint16_t mss;
+    /* IPv4 ID of the first segment, and whether the IDs increment */
+    uint16_t ip_id;
+    bool ip_id_inc;
+    unsigned int segs;
+    uint64_t age;
+    bool ipv6;
+    bool active;
+} NetGROFlow;
+
+struct NetGRO {
+    NetGROOutput *output;
+    void *opaque;
+    QEMUBH *bh;
+    bool csum;
+    bool tso4;
+    bool tso6;
+    /* The last flush did not complete, refuse new frames until it does */
+    bool blocked;
+    uint64_t age;
+    NetGROFlow flows[GRO_MAX_FLOWS];
+};
+
+typedef struct NetGROSeg {
+    const uint8_t *buf;
+    /* Size of the IP packet plus the Ethernet header, without padding */
+    size_t size;
+    size_t l4_off;
+    size_t hdr_len;
+    size_t payload;
+    uint32_t seq;
+    uint16_t ip_id;
+    bool ip_df;
+    uint8_t flags;
+    bool ipv6;
+    bool csum_ok;
+} NetGROSeg;
+
+enum {
+    GRO_SEG_OTHER,      /* not TCP over IP, pass it through */
+    GRO_SEG_TCP,        /* TCP, but can't be merged */
+    GRO_SEG_MERGE,      /* TCP segment that is a merge candidate */
+};
+
+static int net_gro_parse(NetGRO *gro, const uint8_t *buf, size_t size,
+                         NetGROSeg *seg)
+{
+    const uint8_t *ip = buf + ETH_HLEN;
+    const uint8_t *tcp;
+    size_t l4_len, tcp_len;
+    uint32_t sum;
+
+    if (!gro->csum || size < ETH_HLEN) {
+        return GRO_SEG_OTHER;
+    }
+
+    switch (lduw_be_p(buf + 12)) {
+    case ETH_P_IP: {
+        size_t ip_len;
+
+        /* Version 4, without options */
+        if (size < ETH_HLEN + GRO_IP4_HLEN || ip[0] != 0x45 ||
+            ip[9] != IP_PROTO_TCP) {
+            return GRO_SEG_OTHER;
+        }
+        ip_len = lduw_be_p(ip + 2);
+        if (ip_len < GRO_IP4_HLEN + GRO_TCP_HLEN ||
+            ETH_HLEN + ip_len > size ||
+            (lduw_be_p(ip + 6) & (IP_MF | IP_OFFMASK)) ||
+            net_raw_checksum((uint8_t *)ip, GRO_IP4_HLEN)) {
+            return GRO_SEG_OTHER;
+        }
+        seg->ipv6 = false;
+        seg->ip_id = lduw_be_p(ip + 4);
+        seg->ip_df = lduw_be_p(ip + 6) & IP_DF;
+        seg->size = ETH_HLEN + ip_len;
+        seg->l4_off = ETH_HLEN + GRO_IP4_HLEN;
+        l4_len = ip_len - GRO_IP4_HLEN;
+        sum = net_checksum_add(8, (uint8_t *)ip + 12);
+        break;
+    }
+    case ETH_P_IPV6: {
+        size_t plen;
+
+        /* No extension headers */
+        if (size < ETH_HLEN + GRO_IP6_HLEN || (ip[0] >> 4) != 6 ||
+            ip[6] != IP_PROTO_TCP) {
+            return GRO_SEG_OTHER;
+        }
+        plen = lduw_be_p(ip + 4);
+        if (plen < GRO_TCP_HLEN || ETH_HLEN + GRO_IP6_HLEN + plen > size) {
+            return GRO_SEG_OTHER;
+        }
+        seg->ipv6 = true;
+        seg->size = ETH_HLEN + GRO_IP6_HLEN + plen;
+        seg->l4_off = ETH_HLEN + GRO_IP6_HLEN;
+        l4_len = plen;
+        sum = net_checksum_add(32, (uint8_t *)ip + 8);
+        break;
+    }
+    default:
+        return GRO_SEG_OTHER;
+    }
+
+    tcp = buf + seg->l4_off;
+    tcp_len = (tcp[12] >> 4) << 2;
+    if (tcp_len < GRO_TCP_HLEN || tcp_len > l4_len) {
+        return GRO_SEG_OTHER;
+    }
+
+    seg->buf = buf;
+    seg->hdr_len = seg->l4_off + tcp_len;
+    seg->payload = l4_len - tcp_len;
+    seg->seq = ldl_be_p(tcp + 4);
+    seg->flags = tcp[13];
+
+    sum += IP_PROTO_TCP + l4_len;
+    sum += net_checksum_add(l4_len, (uint8_t *)tcp);
+    seg->csum_ok = !net_checksum_finish(sum);
+
+    if (!seg->csum_ok || !(seg->ipv6 ? gro->tso6 : gro->tso4) ||
+        !seg->payload || (seg->flags & ~TH_PUSH) != TH_ACK) {
+        return GRO_SEG_TCP;
+    }
+    return GRO_SEG_MERGE;
+}
+
+static size_t net_gro_flow_max_size(NetGROFlow *flow)
+{
+    /* The IPv4 total length covers the IP header, the IPv6 one does not */
+    return ETH_HLEN + (flow->ipv6 ? GRO_IP6_HLEN : 0) + 65535;
+}
+
+/* Same addresses and ports */
+static bool net_gro_flow_match(NetGROFlow *flow, const NetGROSeg *seg)
+{
+    const uint8_t *a = flow->buf + ETH_HLEN;
+    const uint8_t *b = seg->buf + ETH_HLEN;
+
+    if (!flow->active || flow->ipv6 != seg->ipv6) {
+        return false;
+    }
+    if (seg->ipv6 ? memcmp(a + 8, b + 8, 32) : memcmp(a + 12, b + 12, 8)) {
+        return false;
+    }
+    return !memcmp(flow->buf + flow->l4_off, seg->buf + seg->l4_off, 4);
+}
+
+static NetGROFlow *net_gro_find_flow(NetGRO *gro, const NetGROSeg *seg)
+{
+    int i;
+
+    for (i = 0; i < GRO_MAX_FLOWS; i++) {
+        if (net_gro_flow_match(&gro->flows[i], seg)) {
+            return &gro->flows[i];
+        }
+    }
+    return NULL;
+}
+
+static bool net_gro_ip_id_match(NetGROFlow *flow, const NetGROSeg *seg)
+{
+    bool df = lduw_be_p(flow->buf + ETH_HLEN + 6) & IP_DF;
+
+    if (flow->segs == 1) {
+        return seg->ip_id == (uint16_t)(flow->ip_id + 1) ||
+               (df && seg->ip_df && seg->ip_id == flow->ip_id);
+    }
+    if (flow->ip_id_inc) {
+        return seg->ip_id == (uint16_t)(flow->ip_id + flow->segs);
+    }
+    return seg->ip_df && seg->ip_id == flow->ip_id;
+}
+
+static bool net_gro_can_merge(NetGROFlow *flow, const NetGROSeg *seg)
+{
+    const uint8_t *a = flow->buf;
+    const uint8_t *b = seg->buf;
+    const uint8_t *ta = a + flow->l4_off;
+    const uint8_t *tb = b + seg->l4_off;
+
+    /* MAC addresses */
+    if (memcmp(a, b, 2 * ETH_ALEN)) {
+        return false;
+    }
+
+    if (seg->ipv6) {
+        /* Traffic class, flow label and hop limit */
+        if (memcmp(a + ETH_HLEN, b + ETH_HLEN, 4) ||
+            a[ETH_HLEN + 7] != b[ETH_HLEN + 7]) {
+            return false;
+        }
+    } else {
+        /* TOS and TTL */
+        if (a[ETH_HLEN + 1] != b[ETH_HLEN + 1] ||
+            a[ETH_HLEN + 8] != b[ETH_HLEN + 8]) {
+            return false;
+        }
+
+        /*
+         * Like Linux, only merge segments whose IDs can be regenerated
+         * when the frame is segmented again: incrementing by one per
+         * segment, or the same ID on every segment with DF set.
+         */
+        if (!net_gro_ip_id_match(flow, seg)) {
+            return false;
+        }
+    }
+
+    /* Same acknowledgement number and TCP options */
+    if (seg->hdr_len != flow->hdr_len || memcmp(ta + 8, tb + 8, 4) ||
+        memcmp(ta + GRO_TCP_HLEN, tb + GRO_TCP_HLEN,
+               seg->hdr_len - seg->l4_off - GRO_TCP_HLEN)) {
+        return false;
+    }
+
+    return seg->seq == flow->next_seq && seg->payload <= flow->mss &&
+           flow->size + seg->payload <= net_gro_flow_max_size(flow);
+}
+
+static void net_gro_flow_start(NetGRO *gro, NetGROFlow *flow,
+                               const NetGROSeg *seg)
+{
+    if (!flow->buf) {
+        flow->buf = g_malloc(GRO_MAX_FRAME);
+    }
+    memcpy(flow->buf, seg->buf, seg->size);
+    flow->size = seg->size;
+    flow->l4_off = seg->l4_off;
+    flow->hdr_len = seg->hdr_len;
+    flow->next_seq = seg->seq + seg->payload;
+    flow->mss = seg->payload;
+    flow->ip_id = seg->ip_id;
+    flow->ip_id_inc = false;
+    flow->segs = 1;
+    flow->age = gro->age++;
+    flow->ipv6 = seg->ipv6;
+    flow->active = true;
+}
+
+static void net_gro_flow_append(NetGROFlow *flow, const NetGROSeg *seg)
+{
+    uint8_t *tcp = flow->buf + flow->l4_off;
+
+    if (flow->segs == 1 && !flow->ipv6) {
+        flow->ip_id_inc = seg->ip_id != flow->ip_id;
+    }
+
+    memcpy(flow->buf + flow->size, seg->buf + seg->hdr_len, seg->payload);
+    flow->size += seg->payload;
+    flow->next_seq += seg->payload;
+    flow->segs++;
+
+    /* The window and PSH flag come from the latest segment */
+    memcpy(tcp + 14, seg->buf + seg->l4_off + 14, 2);
+    tcp[13] |= seg->flags & TH_PUSH;
+}
+
+static bool net_gro_flow_flush(NetGRO *gro, NetGROFlow *flow)
+{
+    struct virtio_net_hdr hdr = {
+        .gso_type = VIRTIO_NET_HDR_GSO_NONE,
+    };
+    uint8_t *ip = flow->buf + ETH_HLEN;
+    size_t l4_len = flow->size - flow->l4_off;
+
+    if (flow->segs == 1) {
+        /* The segment is unmodified and its checksum was validated */
+        hdr.flags = VIRTIO_NET_HDR_F_DATA_VALID;
+    } else {
+        uint32_t sum;
+
+        if (flow->ipv6) {
+            stw_be_p(ip + 4, l4_len);
+            sum = net_checksum_add(32, ip + 8);
+            hdr.gso_type = VIRTIO_NET_HDR_GSO_TCPV6;
+        } else {
+            stw_be_p(ip + 2, flow->size - ETH_HLEN);
+            stw_he_p(ip + 10, 0);
+            stw_be_p(ip + 10, net_raw_checksum(ip, GRO_IP4_HLEN));
+            sum = net_checksum_add(8, ip + 12);
+            hdr.gso_type = VIRTIO_NET_HDR_GSO_TCPV4;
+        }
+
+        /* Leave the pseudo header sum for whoever completes the checksum */
+        sum += IP_PROTO_TCP + l4_len;
+        stw_be_p(flow->buf + flow->l4_off + GRO_TCP_CSUM_OFFSET,
+                 (uint16_t)~net_checksum_finish(sum));
+
+        hdr.flags = VIRTIO_NET_HDR_F_NEEDS_CSUM;
+        hdr.hdr_len = flow->hdr_len;
+        hdr.gso_size = flow->mss;
+        hdr.csum_start = flow->l4_off;
+        hdr.csum_offset = GRO_TCP_CSUM_OFFSET;
+    }
+
+    trace_net_gro_flush(gro, flow->segs, flow->size);
+    if (!gro->output(gro->opaque, &hdr, flow->buf, flow->size)) {
+        return false;
+    }
+    flow->active = false;
+    return true;
+}
+
+/* Find a free flow slot, making room if needed */
+static NetGROFlow *net_gro_alloc_flow(NetGRO *gro)
+{
+    NetGROFlow *oldest = NULL;
+    int i;
+
+    for (i = 0; i < GRO_MAX_FLOWS; i++) {
+        NetGROFlow *flow = &gro->flows[i];
+
+        if (!flow->active) {
+            return flow;
+        }
+        if (!oldest || flow->age < oldest->age) {
+            oldest = flow;
+        }
+    }
+    return net_gro_flow_flush(gro, oldest) ? oldest : NULL;
+}
+
+ssize_t net_gro_receive(NetGRO *gro, const uint8_t *buf, size_t size)
+{
+    struct virtio_net_hdr hdr = {
+        .gso_type = VIRTIO_NET_HDR_GSO_NONE,
+    };
+    NetGROFlow *flow;
+    NetGROSeg seg;
+    int type;
+
+    if (gro->blocked && !net_gro_flush(gro)) {
+        return 0;
+    }
+
+    type = net_gro_parse(gro, buf, size, &seg);
+    if (type == GRO_SEG_OTHER) {
+        return gro->output(gro->opaque, &hdr, buf, size);
+    }
+
+    flow = net_gro_find_flow(gro, &seg);
+    if (flow && type == GRO_SEG_MERGE && net_gro_can_merge(flow, &seg)) {
+        net_gro_flow_append(flow, &seg);
+        if ((seg.flags & TH_PUSH) || seg.payload < flow->mss ||
+            flow->size + flow->mss > net_gro_flow_max_size(flow)) {
+            gro->blocked = !net_gro_flow_flush(gro, flow);
+        }
+        return size;
+    }
+
+    /* Keep the segments of a flow in order */
+    if (flow && !net_gro_flow_flush(gro, flow)) {
+        gro->blocked = true;
+        return 0;
+    }
+
+    if (type == GRO_SEG_MERGE && !(seg.flags & TH_PUSH)) {
+        flow = net_gro_alloc_flow(gro);
+        if (!flow) {
+            gro->blocked = true;
+            return 0;
+        }
+        net_gro_flow_start(gro, flow, &seg);
+        qemu_bh_schedule(gro->bh);
+        return size;
+    }
+
+    if (seg.csum_ok) {
+        hdr.flags = VIRTIO_NET_HDR_F_DATA_VALID;
+    }
+    return gro->output(gro->opaque, &hdr, buf, size);
+}
+
+bool net_gro_flush(NetGRO *gro)
+{
+    int i;
+
+    for (i = 0; i < GRO_MAX_FLOWS; i++) {
+        NetGROFlow *flow = &gro->flows[i];
+
+        if (flow->active && !net_gro_flow_flush(gro, flow)) {
+            gro->blocked = true;
+            return false;
+        }
+    }
+    gro->blocked = false;
+    return true;
+}
+
+static void net_gro_bh(void *opaque)
+{
+    net_gro_flush(opaque);
+}
+
+void net_gro_set_offload(NetGRO *gro, bool csum, bool tso4, bool tso6)
+{
+    /* Segments held so far were merged for the old settings */
+    net_gro_flush(gro);
+
+    gro->csum = csum;
+    gro->tso4 = csum && tso4;
+    gro->tso6 = csum && tso6;
+}
+
+void net_gro_set_aio_context(NetGRO *gro, AioContext *ctx)
+{
+    qemu_bh_delete(gro->bh);
+    gro->bh = aio_bh_new(ctx, net_gro_bh, gro);
+    qemu_bh_schedule(gro->bh);
+}
+
+NetGRO *net_gro_new(AioContext *ctx, NetGROOutput *output, void *opaque)
+{
+    NetGRO *gro = g_new0(NetGRO, 1);
+
+    gro->output = output;
+    gro->opaque = opaque;
+    gro->bh = aio_bh_new(ctx, net_gro_bh, gro);
+    return gro;
+}
+
+void net_gro_free(NetGRO *gro)
+{
+    int i;
+
+    if (!gro) {
+        return;
+    }
+    qemu_bh_delete(gro->bh);
+    for (i = 0; i < GRO_MAX_FLOWS; i++) {
+        g_free(gro->flows[i].buf);
+    }
+    g_free(gro);
+}
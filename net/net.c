@@ -528,6 +528,33 @@ int qemu_set_vnet_be(NetClientState *nc, bool is_be)
 #endif
 }
 
+/*
+ * A client can only be serviced from an IOThread if its backend supports
+ * switching AioContext and no netfilter sits on either end of the link;
+ * filters are still driven from the main loop.
+ */
+bool qemu_can_set_aio_context(NetClientState *nc)
+{
+    if (!nc || !nc->info->set_aio_context) {
+        return false;
+    }
+    if (!QTAILQ_EMPTY(&nc->filters)) {
+        return false;
+    }
+    return !nc->peer || QTAILQ_EMPTY(&nc->peer->filters);
+}
+
+/*
+ * Move @nc's event handlers to @ctx, or back to the main loop if @ctx is NULL.
+ *
+ * Context: QEMU global mutex held, @nc quiesced in its current AioContext
+ */
+void qemu_set_aio_context(NetClientState *nc, AioContext *ctx)
+{
+    assert(nc->info->set_aio_context);
+    nc->info->set_aio_context(nc, ctx);
+}
+
 int qemu_can_send_packet(NetClientState *sender)
 {
     int vm_running = runstate_is_running();
@@ -747,9 +774,11 @@ static ssize_t qemu_deliver_packet_iov(NetClientState *sender,
     return ret;
 }
 
-ssize_t qemu_sendv_packet_async(NetClientState *sender,
-                                const struct iovec *iov, int iovcnt,
-                                NetPacketSent *sent_cb)
+static ssize_t qemu_sendv_packet_async_with_flags(NetClientState *sender,
+                                                  unsigned flags,
+                                                  const struct iovec *iov,
+                                                  int iovcnt,
+                                                  NetPacketSent *sent_cb)
 {
     NetQueue *queue;
     size_t size = iov_size(iov, iovcnt);
@@ -765,22 +794,43 @@ ssize_t qemu_sendv_packet_async(NetClientState *sender,
 
     /* Let filters handle the packet first */
     ret = filter_receive_iov(sender, NET_FILTER_DIRECTION_TX, sender,
-                             QEMU_NET_PACKET_FLAG_NONE, iov, iovcnt, sent_cb);
+                             flags, iov, iovcnt, sent_cb);
     if (ret) {
         return ret;
     }
 
     ret = filter_receive_iov(sender->peer, NET_FILTER_DIRECTION_RX, sender,
-                             QEMU_NET_PACKET_FLAG_NONE, iov, iovcnt, sent_cb);
+                             flags, iov, iovcnt, sent_cb);
     if (ret) {
         return ret;
     }
 
     queue = sender->peer->incoming_queue;
 
-    return qemu_net_queue_send_iov(queue, sender,
-                                   QEMU_NET_PACKET_FLAG_NONE,
-                                   iov, iovcnt, sent_cb);
+    return qemu_net_queue_send_iov(queue, sender, flags, iov, iovcnt, sent_cb);
+}
+
+ssize_t qemu_sendv_packet_async(NetClientState *sender,
+                                const struct iovec *iov, int iovcnt,
+                                NetPacketSent *sent_cb)
+{
+    return qemu_sendv_packet_async_with_flags(sender,
+                                              QEMU_NET_PACKET_FLAG_NONE,
+                                              iov, iovcnt, sent_cb);
+}
+
+/*
+ * Like qemu_sendv_packet_async(), but if the packet has to be queued the
+ * queue keeps pointing at the data in @iov instead of copying it.  The
+ * caller must leave that data alone until @sent_cb has been called.
+ */
+ssize_t qemu_sendv_packet_async_nocopy(NetClientState *sender,
+                                       const struct iovec *iov, int iovcnt,
+                                       NetPacketSent *sent_cb)
+{
+    return qemu_sendv_packet_async_with_flags(sender,
+                                              QEMU_NET_PACKET_FLAG_NOCOPY,
+                                              iov, iovcnt, sent_cb);
 }
 
 ssize_t
@@ -789,6 +839,48 @@ qemu_sendv_packet(NetClientState *nc, const struct iovec *iov, int iovcnt)
     return qemu_sendv_packet_async(nc, iov, iovcnt, NULL);
 }
 
+/*
+ * Send @count packets described by @iovs/@iovcnts.  If the peer supports
+ * it and nothing (filters, queued packets) needs to see the packets one at
+ * a time, they are handed over with a single receive_iov_batch call;
+ * otherwise, or for what the peer did not accept, fall back to
+ * qemu_sendv_packet_async().
+ *
+ * Returns the number of packets sent or dropped.  If that is less than
+ * @count, the next packet has been queued without copying its data, as
+ * with qemu_sendv_packet_async_nocopy(), and @sent_cb will be called once
+ * it is delivered; packets after it have not been touched.
+ */
+int qemu_sendv_packet_batch_async(NetClientState *sender,
+                                  const struct iovec **iovs,
+                                  const int *iovcnts, int count,
+                                  NetPacketSent *sent_cb)
+{
+    NetClientState *peer = sender->peer;
+    int i = 0;
+
+    if (sender->link_down || !peer) {
+        return count;
+    }
+
+    if (peer->info->receive_iov_batch && !peer->link_down &&
+        !peer->receive_disabled &&
+        QTAILQ_EMPTY(&sender->filters) && QTAILQ_EMPTY(&peer->filters) &&
+        qemu_net_queue_idle(peer->incoming_queue) &&
+        qemu_can_send_packet(sender)) {
+        i = peer->info->receive_iov_batch(peer, iovs, iovcnts, count);
+        assert(i >= 0 && i <= count);
+    }
+
+    for (; i < count; i++) {
+        if (qemu_sendv_packet_async_nocopy(sender, iovs[i], iovcnts[i],
+                                           sent_cb) == 0) {
+            break;
+        }
+    }
+    return i;
+}
+
 NetClientState *qemu_find_netdev(const char *id)
 {
     NetClientState *nc;
@@ -964,6 +1056,9 @@ static int (* const net_client_init_fun[NET_CLIENT_DRIVER__MAX])(
 #ifdef CONFIG_NETMAP
         [NET_CLIENT_DRIVER_NETMAP]    = net_init_netmap,
 #endif
+#ifdef CONFIG_AF_XDP
+        [NET_CLIENT_DRIVER_AF_XDP]    = net_init_af_xdp,
+#endif
 #ifdef CONFIG_NET_BRIDGE
         [NET_CLIENT_DRIVER_BRIDGE]    = net_init_bridge,
 #endif
@@ -1052,6 +1147,9 @@ void show_netdevs(void)
 #ifdef CONFIG_NETMAP
         "netmap",
 #endif
+#ifdef CONFIG_AF_XDP
+        "af-xdp",
+#endif
 #ifdef CONFIG_POSIX
         "vhost-user",
 #endif
@@ -1177,11 +1275,18 @@ static void netfilter_print_info(Monitor *mon, NetFilterState *nf)
 void print_net_client(Monitor *mon, NetClientState *nc)
 {
     NetFilterState *nf;
+    NetQueueStats stats;
 
     monitor_printf(mon, "%s: index=%d,type=%s,%s\n", nc->name,
                    nc->queue_index,
                    NetClientDriver_str(nc->info->type),
                    nc->info_str);
+    qemu_net_queue_get_stats(nc->incoming_queue, &stats);
+    if (stats.queued || stats.dropped) {
+        monitor_printf(mon, "queue: depth=%" PRIu32 ",peak=%" PRIu32
+                       ",queued=%" PRIu64 ",dropped=%" PRIu64 "\n",
+                       stats.depth, stats.peak, stats.queued, stats.dropped);
+    }
     if (!QTAILQ_EMPTY(&nc->filters)) {
         monitor_printf(mon, "filters:\n");
     }
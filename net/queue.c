@@ -23,6 +23,7 @@
 
 #include "qemu/osdep.h"
 #include "net/queue.h"
+#include "qemu/iov.h"
 #include "qemu/queue.h"
 #include "net/net.h"
 
@@ -34,28 +35,58 @@
  * If a sent callback is provided to send(), the caller must handle a
  * zero return from the delivery handler by not sending any more packets
  * until we have invoked the callback. Only in that case will we queue
- * the packet.
+ * the packet.  If the caller also passed QEMU_NET_PACKET_FLAG_NOCOPY, it
+ * keeps its buffers unchanged until the callback runs, so only the iovec
+ * array is saved and the data is not copied.
  *
- * If a sent callback isn't provided, we just drop the packet to avoid
- * unbounded queueing.
+ * If a sent callback isn't provided, we just drop the packet once
+ * nq_maxlen packets are queued, to avoid unbounded queueing.
+ *
+ * Queued packets live in a ring of pointers that doubles in size when it
+ * is full.  Packets without a sent callback can make it grow up to
+ * nq_maxlen entries, packets with one beyond that.  Packet buffers of up
+ * to NET_QUEUE_POOL_BUF_SIZE bytes are recycled through a per-queue pool,
+ * so that a queue under steady backpressure does not allocate.
  */
 
+/* Initial number of ring slots, must be a power of two */
+#define NET_QUEUE_RING_SIZE     64
+/* Data size of pooled packets, large enough for a full-sized frame */
+#define NET_QUEUE_POOL_BUF_SIZE 2048
+/* Number of free packets kept for reuse */
+#define NET_QUEUE_POOL_MAX      64
+
 struct NetPacket {
-    QTAILQ_ENTRY(NetPacket) entry;
+    QSIMPLEQ_ENTRY(NetPacket) next;
     NetClientState *sender;
     unsigned flags;
     int size;
     NetPacketSent *sent_cb;
-    uint8_t data[];
+    const struct iovec *iov;
+    int iovcnt;
+    struct iovec iov_buf;
+    /* Size of data[] */
+    size_t capacity;
+    /* The packet data, or the iovec array of QEMU_NET_PACKET_FLAG_NOCOPY */
+    uint8_t data[] QEMU_ALIGNED(8);
 };
 
+typedef QSIMPLEQ_HEAD(, NetPacket) NetPacketList;
+
 struct NetQueue {
     void *opaque;
     uint32_t nq_maxlen;
     uint32_t nq_count;
     NetQueueDeliverFunc *deliver;
 
-    QTAILQ_HEAD(, NetPacket) packets;
+    NetPacket **ring;
+    uint32_t ring_size;
+    uint32_t ring_head;
+
+    NetPacketList pool;
+    uint32_t pool_count;
+
+    NetQueueStats stats;
 
     unsigned delivering : 1;
 };
@@ -71,22 +102,111 @@ NetQueue *qemu_new_net_queue(NetQueueDeliverFunc *deliver, void *opaque)
     queue->nq_count = 0;
     queue->deliver = deliver;
 
-    QTAILQ_INIT(&queue->packets);
+    queue->ring_size = NET_QUEUE_RING_SIZE;
+    queue->ring = g_new(NetPacket *, queue->ring_size);
+    queue->ring_head = 0;
+
+    QSIMPLEQ_INIT(&queue->pool);
 
     queue->delivering = 0;
 
     return queue;
 }
 
+static NetPacket *qemu_net_packet_alloc(NetQueue *queue, size_t capacity)
+{
+    NetPacket *packet;
+
+    if (capacity <= NET_QUEUE_POOL_BUF_SIZE) {
+        packet = QSIMPLEQ_FIRST(&queue->pool);
+        if (packet) {
+            QSIMPLEQ_REMOVE_HEAD(&queue->pool, next);
+            queue->pool_count--;
+            return packet;
+        }
+        capacity = NET_QUEUE_POOL_BUF_SIZE;
+    }
+
+    packet = g_malloc(sizeof(NetPacket) + capacity);
+    packet->capacity = capacity;
+    return packet;
+}
+
+static void qemu_net_packet_free(NetQueue *queue, NetPacket *packet)
+{
+    if (packet->capacity == NET_QUEUE_POOL_BUF_SIZE &&
+        queue->pool_count < NET_QUEUE_POOL_MAX) {
+        QSIMPLEQ_INSERT_HEAD(&queue->pool, packet, next);
+        queue->pool_count++;
+        return;
+    }
+    g_free(packet);
+}
+
+static NetPacket **qemu_net_queue_slot(NetQueue *queue, uint32_t i)
+{
+    return &queue->ring[(queue->ring_head + i) & (queue->ring_size - 1)];
+}
+
+static void qemu_net_queue_grow(NetQueue *queue)
+{
+    NetPacket **ring;
+    uint32_t i;
+
+    ring = g_new(NetPacket *, queue->ring_size * 2);
+    for (i = 0; i < queue->nq_count; i++) {
+        ring[i] = *qemu_net_queue_slot(queue, i);
+    }
+    g_free(queue->ring);
+    queue->ring = ring;
+    queue->ring_size *= 2;
+    queue->ring_head = 0;
+}
+
+static void qemu_net_queue_push_tail(NetQueue *queue, NetPacket *packet)
+{
+    if (queue->nq_count == queue->ring_size) {
+        qemu_net_queue_grow(queue);
+    }
+    *qemu_net_queue_slot(queue, queue->nq_count) = packet;
+    queue->nq_count++;
+
+    queue->stats.queued++;
+    queue->stats.peak = MAX(queue->stats.peak, queue->nq_count);
+}
+
+static void qemu_net_queue_push_head(NetQueue *queue, NetPacket *packet)
+{
+    if (queue->nq_count == queue->ring_size) {
+        qemu_net_queue_grow(queue);
+    }
+    queue->ring_head = (queue->ring_head - 1) & (queue->ring_size - 1);
+    queue->ring[queue->ring_head] = packet;
+    queue->nq_count++;
+}
+
+static NetPacket *qemu_net_queue_pop_head(NetQueue *queue)
+{
+    NetPacket *packet = queue->ring[queue->ring_head];
+
+    queue->ring_head = (queue->ring_head + 1) & (queue->ring_size - 1);
+    queue->nq_count--;
+    return packet;
+}
+
 void qemu_del_net_queue(NetQueue *queue)
 {
-    NetPacket *packet, *next;
+    NetPacket *packet;
 
-    QTAILQ_FOREACH_SAFE(packet, &queue->packets, entry, next) {
-        QTAILQ_REMOVE(&queue->packets, packet, entry);
+    while (queue->nq_count) {
+        g_free(qemu_net_queue_pop_head(queue));
+    }
+    while ((packet = QSIMPLEQ_FIRST(&queue->pool))) {
+        QSIMPLEQ_REMOVE_HEAD(&queue->pool, next);
         g_free(packet);
     }
 
+    g_free(queue->ring);
     g_free(queue);
 }
 
@@ -97,20 +217,12 @@ static void qemu_net_queue_append(NetQueue *queue,
                                   size_t size,
                                   NetPacketSent *sent_cb)
 {
-    NetPacket *packet;
-
-    if (queue->nq_count >= queue->nq_maxlen && !sent_cb) {
-        return; /* drop if queue full and no callback */
-    }
-    packet = g_malloc(sizeof(NetPacket) + size);
-    packet->sender = sender;
-    packet->flags = flags;
-    packet->size = size;
-    packet->sent_cb = sent_cb;
-    memcpy(packet->data, buf, size);
+    struct iovec iov = {
+        .iov_base = (void *)buf,
+        .iov_len = size
+    };
 
-    queue->nq_count++;
-    QTAILQ_INSERT_TAIL(&queue->packets, packet, entry);
+    qemu_net_queue_append_iov(queue, sender, flags, &iov, 1, sent_cb);
 }
 
 void qemu_net_queue_append_iov(NetQueue *queue,
@@ -125,27 +237,33 @@ void qemu_net_queue_append_iov(NetQueue *queue,
     int i;
 
     if (queue->nq_count >= queue->nq_maxlen && !sent_cb) {
+        queue->stats.dropped++;
         return; /* drop if queue full and no callback */
     }
     for (i = 0; i < iovcnt; i++) {
         max_len += iov[i].iov_len;
     }
 
-    packet = g_malloc(sizeof(NetPacket) + max_len);
+    if (sent_cb && (flags & QEMU_NET_PACKET_FLAG_NOCOPY)) {
+        /* The sender waits for sent_cb, keep pointing at its buffers */
+        packet = qemu_net_packet_alloc(queue, iovcnt * sizeof(*iov));
+        memcpy(packet->data, iov, iovcnt * sizeof(*iov));
+        packet->iov = (struct iovec *)packet->data;
+        packet->iovcnt = iovcnt;
+        packet->size = max_len;
+    } else {
+        packet = qemu_net_packet_alloc(queue, max_len);
+        packet->size = iov_to_buf(iov, iovcnt, 0, packet->data, max_len);
+        packet->iov_buf.iov_base = packet->data;
+        packet->iov_buf.iov_len = packet->size;
+        packet->iov = &packet->iov_buf;
+        packet->iovcnt = 1;
+    }
     packet->sender = sender;
     packet->sent_cb = sent_cb;
-    packet->flags = flags;
-    packet->size = 0;
-
-    for (i = 0; i < iovcnt; i++) {
-        size_t len = iov[i].iov_len;
-
-        memcpy(packet->data + packet->size, iov[i].iov_base, len);
-        packet->size += len;
-    }
+    packet->flags = flags & ~QEMU_NET_PACKET_FLAG_NOCOPY;
 
-    queue->nq_count++;
-    QTAILQ_INSERT_TAIL(&queue->packets, packet, entry);
+    qemu_net_queue_push_tail(queue, packet);
 }
 
 static ssize_t qemu_net_queue_deliver(NetQueue *queue,
@@ -234,41 +352,61 @@ ssize_t qemu_net_queue_send_iov(NetQueue *queue,
 
 void qemu_net_queue_purge(NetQueue *queue, NetClientState *from)
 {
-    NetPacket *packet, *next;
+    NetPacketList purged = QSIMPLEQ_HEAD_INITIALIZER(purged);
+    NetPacket *packet;
+    uint32_t i, count = 0;
 
-    QTAILQ_FOREACH_SAFE(packet, &queue->packets, entry, next) {
+    for (i = 0; i < queue->nq_count; i++) {
+        packet = *qemu_net_queue_slot(queue, i);
         if (packet->sender == from) {
-            QTAILQ_REMOVE(&queue->packets, packet, entry);
-            queue->nq_count--;
-            if (packet->sent_cb) {
-                packet->sent_cb(packet->sender, 0);
-            }
-            g_free(packet);
+            QSIMPLEQ_INSERT_TAIL(&purged, packet, next);
+        } else {
+            *qemu_net_queue_slot(queue, count++) = packet;
+        }
+    }
+    queue->stats.dropped += queue->nq_count - count;
+    queue->nq_count = count;
+
+    /* sent_cb may send again, so only call it once the ring is consistent */
+    while ((packet = QSIMPLEQ_FIRST(&purged))) {
+        QSIMPLEQ_REMOVE_HEAD(&purged, next);
+        if (packet->sent_cb) {
+            packet->sent_cb(packet->sender, 0);
         }
+        qemu_net_packet_free(queue, packet);
     }
 }
 
+/* Whether a packet sent now would be delivered directly, not queued */
+bool qemu_net_queue_idle(NetQueue *queue)
+{
+    return !queue->delivering && !queue->nq_count;
+}
+
+void qemu_net_queue_get_stats(NetQueue *queue, NetQueueStats *stats)
+{
+    *stats = queue->stats;
+    stats->depth = queue->nq_count;
+}
+
 bool qemu_net_queue_flush(NetQueue *queue)
 {
     if (queue->delivering)
         return false;
 
-    while (!QTAILQ_EMPTY(&queue->packets)) {
+    while (queue->nq_count) {
         NetPacket *packet;
         int ret;
 
-        packet = QTAILQ_FIRST(&queue->packets);
-        QTAILQ_REMOVE(&queue->packets, packet, entry);
-        queue->nq_count--;
+        packet = qemu_net_queue_pop_head(queue);
 
-        ret = qemu_net_queue_deliver(queue,
-                                     packet->sender,
-                                     packet->flags,
-                                     packet->data,
-                                     packet->size);
+        ret = qemu_net_queue_deliver_iov(queue,
+                                         packet->sender,
+                                         packet->flags,
+                                         packet->iov,
+                                         packet->iovcnt);
         if (ret == 0) {
-            queue->nq_count++;
-            QTAILQ_INSERT_HEAD(&queue->packets, packet, entry);
+            qemu_net_queue_push_head(queue, packet);
             return false;
         }
 
@@ -276,7 +414,7 @@ bool qemu_net_queue_flush(NetQueue *queue)
             packet->sent_cb(packet->sender, ret);
         }
 
-        g_free(packet);
+        qemu_net_packet_free(queue, packet);
     }
     return true;
 }
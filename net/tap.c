@@ -40,6 +40,7 @@
 #include "qemu-common.h"
 #include "qemu/cutils.h"
 #include "qemu/error-report.h"
+#include "qemu/iov.h"
 #include "qemu/main-loop.h"
 #include "qemu/sockets.h"
 
@@ -47,6 +48,19 @@
 
 #include "net/vhost_net.h"
 
+#ifdef CONFIG_LINUX_IO_URING
+#include <liburing.h>
+
+/* Maximum number of packets written by one io_uring_enter() */
+#define TAP_BATCH_MAX 64
+
+/* Number of reads kept in flight on the tap device */
+#define TAP_RX_BATCH 16
+
+/* user_data of the requests that cancel reads */
+#define TAP_RX_CANCEL UINTPTR_MAX
+#endif
+
 typedef struct TAPState {
     NetClientState nc;
     int fd;
@@ -61,6 +75,25 @@ typedef struct TAPState {
     VHostNetState *vhost_net;
     unsigned host_vnet_hdr_len;
     Notifier exit;
+    AioContext *ctx;
+#ifdef CONFIG_LINUX_IO_URING
+    /* Guest transmit, see tap_write_batch() */
+    struct io_uring tx_ring;
+    bool tx_ring_ready;
+    bool tx_ring_failed;
+    struct iovec tx_iov[TAP_BATCH_MAX];
+    int tx_inflight;
+    bool tx_waiting;
+
+    /* Host receive, see tap_rx_submit() */
+    struct io_uring rx_ring;
+    bool rx_ring_ready;
+    bool rx_ring_failed;
+    uint8_t *rx_bufs;
+    struct iovec rx_iov[TAP_RX_BATCH];
+    bool rx_inflight[TAP_RX_BATCH];
+    int rx_queued;
+#endif
 } TAPState;
 
 static void launch_script(const char *setup_script, const char *ifname,
@@ -68,13 +101,39 @@ static void launch_script(const char *setup_script, const char *ifname,
 
 static void tap_send(void *opaque);
 static void tap_writable(void *opaque);
+#ifdef CONFIG_LINUX_IO_URING
+static void tap_tx_ring_ready(void *opaque);
+static void tap_rx_ring_ready(void *opaque);
+static bool tap_rx_ring_init(TAPState *s);
+static void tap_rx_submit(TAPState *s);
+#endif
 
 static void tap_update_fd_handler(TAPState *s)
 {
-    qemu_set_fd_handler(s->fd,
-                        s->read_poll && s->enabled ? tap_send : NULL,
-                        s->write_poll && s->enabled ? tap_writable : NULL,
-                        s);
+    bool reading = s->read_poll && s->enabled;
+
+#ifdef CONFIG_LINUX_IO_URING
+    if (s->tx_ring_ready) {
+        aio_set_fd_handler(s->ctx, s->tx_ring.ring_fd, false,
+                           tap_tx_ring_ready, NULL, NULL, s);
+    }
+
+    /* With the receive ring, the event loop waits for it instead of s->fd */
+    if (reading && tap_rx_ring_init(s)) {
+        tap_rx_submit(s);
+    }
+    if (s->rx_ring_ready) {
+        aio_set_fd_handler(s->ctx, s->rx_ring.ring_fd, false,
+                           reading ? tap_rx_ring_ready : NULL,
+                           NULL, NULL, s);
+        reading = false;
+    }
+#endif
+
+    aio_set_fd_handler(s->ctx, s->fd, false,
+                       reading ? tap_send : NULL,
+                       s->write_poll && s->enabled ? tap_writable : NULL,
+                       NULL, s);
 }
 
 static void tap_read_poll(TAPState *s, bool enable)
@@ -102,6 +161,14 @@ static ssize_t tap_write_packet(TAPState *s, const struct iovec *iov, int iovcnt
 {
     ssize_t len;
 
+#ifdef CONFIG_LINUX_IO_URING
+    if (s->tx_inflight) {
+        /* Writing now could overtake the burst, tap_tx_ring_ready() retries */
+        s->tx_waiting = true;
+        return 0;
+    }
+#endif
+
     do {
         len = writev(s->fd, iov, iovcnt);
     } while (len == -1 && errno == EINTR);
@@ -133,6 +200,163 @@ static ssize_t tap_receive_iov(NetClientState *nc, const struct iovec *iov,
     return tap_write_packet(s, iovp, iovcnt);
 }
 
+#ifdef CONFIG_LINUX_IO_URING
+/*
+ * Guest transmit: the packets of a burst are copied, so that the caller
+ * can complete them right away, and written with a single io_uring_enter()
+ * that does not wait for them.  tap_tx_ring_ready() reaps the completions
+ * from the event loop.  The writes are linked, so they reach the tap
+ * device in order; a write that fails cancels the rest of its burst, which
+ * drops those packets like a failing writev() drops one.
+ *
+ * While writes are in flight, tap_write_packet() queues packets instead of
+ * letting them overtake the burst, and the queue is flushed once the ring
+ * is idle again.
+ */
+static bool tap_tx_ring_init(TAPState *s)
+{
+    if (!s->tx_ring_ready && !s->tx_ring_failed) {
+        if (io_uring_queue_init(TAP_BATCH_MAX, &s->tx_ring, 0) < 0) {
+            s->tx_ring_failed = true;
+        } else {
+            s->tx_ring_ready = true;
+            tap_update_fd_handler(s);
+        }
+    }
+    return s->tx_ring_ready;
+}
+
+static void tap_tx_complete(TAPState *s, struct io_uring_cqe *cqe)
+{
+    int slot = (uintptr_t)io_uring_cqe_get_data(cqe);
+
+    io_uring_cqe_seen(&s->tx_ring, cqe);
+    g_free(s->tx_iov[slot].iov_base);
+    s->tx_iov[slot].iov_base = NULL;
+    s->tx_inflight--;
+}
+
+static void tap_tx_ring_ready(void *opaque)
+{
+    TAPState *s = opaque;
+    struct io_uring_cqe *cqe;
+
+    while (s->tx_inflight && io_uring_peek_cqe(&s->tx_ring, &cqe) == 0) {
+        tap_tx_complete(s, cqe);
+    }
+
+    if (!s->tx_inflight && s->tx_waiting) {
+        s->tx_waiting = false;
+        qemu_flush_queued_packets(&s->nc);
+    }
+}
+
+/* Wait for the writes in flight, so that the ring can go away */
+static void tap_tx_ring_drain(TAPState *s)
+{
+    struct io_uring_cqe *cqe;
+
+    while (s->tx_inflight) {
+        if (io_uring_wait_cqe(&s->tx_ring, &cqe) == 0) {
+            tap_tx_complete(s, cqe);
+        }
+    }
+}
+
+static void tap_tx_ring_cleanup(TAPState *s)
+{
+    if (s->tx_ring_ready) {
+        tap_tx_ring_drain(s);
+        aio_set_fd_handler(s->ctx, s->tx_ring.ring_fd, false,
+                           NULL, NULL, NULL, NULL);
+        io_uring_queue_exit(&s->tx_ring);
+        s->tx_ring_ready = false;
+    }
+}
+
+/*
+ * Submit up to TAP_BATCH_MAX packets.  Returns the number of packets that
+ * were taken, or -1 if io_uring cannot be used.
+ */
+static int tap_write_batch(TAPState *s, const struct iovec **iovs,
+                           const int *iovcnts, int count)
+{
+    struct io_uring_sqe *sqe = NULL;
+    size_t hdr_len = 0;
+    int i, ret;
+
+    if (!tap_tx_ring_init(s)) {
+        return -1;
+    }
+
+    if (s->tx_inflight) {
+        s->tx_waiting = true;
+        return 0;
+    }
+
+    if (s->host_vnet_hdr_len && !s->using_vnet_hdr) {
+        hdr_len = s->host_vnet_hdr_len;
+    }
+
+    count = MIN(count, TAP_BATCH_MAX);
+    for (i = 0; i < count; i++) {
+        size_t size = iov_size(iovs[i], iovcnts[i]);
+        uint8_t *buf = g_malloc(hdr_len + size);
+
+        /* The header that tap expects is all zeroes, as in tap_receive_iov() */
+        memset(buf, 0, hdr_len);
+        iov_to_buf(iovs[i], iovcnts[i], 0, buf + hdr_len, size);
+        s->tx_iov[i].iov_base = buf;
+        s->tx_iov[i].iov_len = hdr_len + size;
+
+        sqe = io_uring_get_sqe(&s->tx_ring);
+        io_uring_prep_writev(sqe, s->fd, &s->tx_iov[i], 1, 0);
+        io_uring_sqe_set_data(sqe, (void *)(uintptr_t)i);
+        sqe->flags |= IOSQE_IO_LINK;
+    }
+    sqe->flags &= ~IOSQE_IO_LINK;
+
+    do {
+        ret = io_uring_submit(&s->tx_ring);
+    } while (ret == -EINTR);
+    s->tx_inflight = MAX(ret, 0);
+    if (ret == count) {
+        return count;
+    }
+
+    /*
+     * Unsubmitted writes would stay in the submission queue, so wait for
+     * the ones that went through and drop the ring with the others
+     */
+    tap_tx_ring_cleanup(s);
+    s->tx_ring_failed = true;
+    for (i = 0; i < count; i++) {
+        g_free(s->tx_iov[i].iov_base);
+        s->tx_iov[i].iov_base = NULL;
+    }
+    return ret > 0 ? ret : -1;
+}
+
+static int tap_receive_iov_batch(NetClientState *nc, const struct iovec **iovs,
+                                 const int *iovcnts, int count)
+{
+    TAPState *s = DO_UPCAST(TAPState, nc, nc);
+    int i, ret;
+
+    ret = tap_write_batch(s, iovs, iovcnts, count);
+    if (ret >= 0) {
+        return ret;
+    }
+
+    for (i = 0; i < count; i++) {
+        if (tap_receive_iov(nc, iovs[i], iovcnts[i]) == 0) {
+            break;
+        }
+    }
+    return i;
+}
+#endif
+
 static ssize_t tap_receive_raw(NetClientState *nc, const uint8_t *buf, size_t size)
 {
     TAPState *s = DO_UPCAST(TAPState, nc, nc);
@@ -181,6 +405,210 @@ static void tap_send_completed(NetClientState *nc, ssize_t len)
     tap_read_poll(s, true);
 }
 
+#ifdef CONFIG_LINUX_IO_URING
+/*
+ * Host receive: TAP_RX_BATCH reads are kept in flight on the tap device,
+ * and one io_uring_enter() resubmits all the buffers that were passed on.
+ * A read on an empty device waits in the kernel, so the event loop only
+ * wakes up for the ring.  Completions come in the order in which the
+ * reads took packets from the device, which is the order they are passed
+ * on in.
+ *
+ * If the peer queues a packet, its buffer stays in use and the remaining
+ * completions wait in the ring until tap_rx_send_completed().
+ */
+static bool tap_rx_ring_init(TAPState *s)
+{
+    int i;
+
+    if (!s->rx_ring_ready && !s->rx_ring_failed) {
+        /* Leave room for one cancel request per read */
+        if (io_uring_queue_init(TAP_RX_BATCH * 2, &s->rx_ring, 0) < 0) {
+            s->rx_ring_failed = true;
+            return false;
+        }
+        s->rx_bufs = g_malloc(TAP_RX_BATCH * NET_BUFSIZE);
+        for (i = 0; i < TAP_RX_BATCH; i++) {
+            s->rx_iov[i].iov_base = s->rx_bufs + i * NET_BUFSIZE;
+            s->rx_iov[i].iov_len = NET_BUFSIZE;
+        }
+        s->rx_queued = -1;
+        s->rx_ring_ready = true;
+    }
+    return s->rx_ring_ready;
+}
+
+/* Closing the ring cancels the reads that are still in flight */
+static void tap_rx_ring_exit(TAPState *s)
+{
+    aio_set_fd_handler(s->ctx, s->rx_ring.ring_fd, false,
+                       NULL, NULL, NULL, NULL);
+    io_uring_queue_exit(&s->rx_ring);
+    /* A packet queued by the peer still uses its buffer, see tap_cleanup() */
+    if (s->rx_queued < 0) {
+        g_free(s->rx_bufs);
+        s->rx_bufs = NULL;
+    }
+    memset(s->rx_inflight, 0, sizeof(s->rx_inflight));
+    s->rx_ring_ready = false;
+}
+
+/* Fall back to tap_send() */
+static void tap_rx_ring_fail(TAPState *s)
+{
+    tap_rx_ring_exit(s);
+    s->rx_ring_failed = true;
+    tap_update_fd_handler(s);
+}
+
+/*
+ * Take back the reads in flight, for example before vhost-net uses the
+ * device.  Packets that were read already are dropped.
+ */
+static void tap_rx_cancel(TAPState *s)
+{
+    struct io_uring_sqe *sqe;
+    struct io_uring_cqe *cqe;
+    uintptr_t data;
+    int i, ret, inflight = 0, cancels = 0;
+
+    if (!s->rx_ring_ready) {
+        return;
+    }
+
+    for (i = 0; i < TAP_RX_BATCH; i++) {
+        if (s->rx_inflight[i]) {
+            sqe = io_uring_get_sqe(&s->rx_ring);
+            io_uring_prep_cancel(sqe, (void *)(uintptr_t)i, 0);
+            io_uring_sqe_set_data(sqe, (void *)TAP_RX_CANCEL);
+            inflight++;
+        }
+    }
+    if (!inflight) {
+        return;
+    }
+
+    do {
+        ret = io_uring_submit(&s->rx_ring);
+    } while (ret == -EINTR);
+    if (ret != inflight) {
+        /* Only closing the ring can cancel the reads now */
+        tap_rx_ring_fail(s);
+        return;
+    }
+
+    while (inflight || cancels < ret) {
+        if (io_uring_wait_cqe(&s->rx_ring, &cqe) < 0) {
+            continue;
+        }
+        data = (uintptr_t)io_uring_cqe_get_data(cqe);
+        io_uring_cqe_seen(&s->rx_ring, cqe);
+        if (data == TAP_RX_CANCEL) {
+            cancels++;
+        } else {
+            s->rx_inflight[data] = false;
+            inflight--;
+        }
+    }
+}
+
+static void tap_rx_ring_cleanup(TAPState *s)
+{
+    tap_rx_cancel(s);
+    if (s->rx_ring_ready) {
+        tap_rx_ring_exit(s);
+    }
+}
+
+static void tap_rx_submit(TAPState *s)
+{
+    struct io_uring_sqe *sqe;
+    int i, ret, n = 0;
+
+    for (i = 0; i < TAP_RX_BATCH; i++) {
+        if (s->rx_inflight[i] || i == s->rx_queued) {
+            continue;
+        }
+        sqe = io_uring_get_sqe(&s->rx_ring);
+        io_uring_prep_readv(sqe, s->fd, &s->rx_iov[i], 1, 0);
+        io_uring_sqe_set_data(sqe, (void *)(uintptr_t)i);
+        s->rx_inflight[i] = true;
+        n++;
+    }
+    if (!n) {
+        return;
+    }
+
+    do {
+        ret = io_uring_submit(&s->rx_ring);
+    } while (ret == -EINTR);
+    if (ret != n) {
+        tap_rx_ring_fail(s);
+    }
+}
+
+static void tap_rx_send_completed(NetClientState *nc, ssize_t len)
+{
+    TAPState *s = DO_UPCAST(TAPState, nc, nc);
+
+    s->rx_queued = -1;
+    tap_read_poll(s, true);
+}
+
+static void tap_rx_ring_ready(void *opaque)
+{
+    TAPState *s = opaque;
+    struct io_uring_cqe *cqe;
+    int packets = 0;
+
+    while (s->read_poll && s->enabled &&
+           io_uring_peek_cqe(&s->rx_ring, &cqe) == 0) {
+        int slot = (uintptr_t)io_uring_cqe_get_data(cqe);
+        uint8_t *buf = s->rx_iov[slot].iov_base;
+        int size = cqe->res;
+        struct iovec iov;
+
+        io_uring_cqe_seen(&s->rx_ring, cqe);
+        s->rx_inflight[slot] = false;
+        if (size == -EAGAIN) {
+            /* This kernel does not wait for packets on the device */
+            tap_rx_ring_fail(s);
+            return;
+        }
+        if (size <= 0) {
+            continue;
+        }
+
+        if (s->host_vnet_hdr_len && !s->using_vnet_hdr) {
+            buf  += s->host_vnet_hdr_len;
+            size -= s->host_vnet_hdr_len;
+        }
+
+        s->rx_queued = slot;
+        iov.iov_base = buf;
+        iov.iov_len = size;
+        size = qemu_sendv_packet_async_nocopy(&s->nc, &iov, 1,
+                                              tap_rx_send_completed);
+        if (size == 0) {
+            tap_read_poll(s, false);
+            return;
+        }
+        s->rx_queued = -1;
+
+        /* Do not hog the event loop, see tap_send() */
+        packets++;
+        if (packets >= 50) {
+            break;
+        }
+    }
+
+    if (s->read_poll && s->enabled) {
+        tap_rx_submit(s);
+    }
+}
+#endif
+
+/* Read one packet at a time, without io_uring or its receive ring */
 static void tap_send(void *opaque)
 {
     TAPState *s = opaque;
@@ -189,6 +617,7 @@ static void tap_send(void *opaque)
 
     while (true) {
         uint8_t *buf = s->buf;
+        struct iovec iov;
 
         size = tap_read_packet(s->fd, s->buf, sizeof(s->buf));
         if (size <= 0) {
@@ -200,7 +629,11 @@ static void tap_send(void *opaque)
             size -= s->host_vnet_hdr_len;
         }
 
-        size = qemu_send_packet_async(&s->nc, buf, size, tap_send_completed);
+        /* s->buf is not touched again until tap_send_completed() */
+        iov.iov_base = buf;
+        iov.iov_len = size;
+        size = qemu_sendv_packet_async_nocopy(&s->nc, &iov, 1,
+                                              tap_send_completed);
         if (size == 0) {
             tap_read_poll(s, false);
             break;
@@ -326,6 +759,12 @@ static void tap_cleanup(NetClientState *nc)
 
     tap_read_poll(s, false);
     tap_write_poll(s, false);
+#ifdef CONFIG_LINUX_IO_URING
+    tap_tx_ring_cleanup(s);
+    tap_rx_ring_cleanup(s);
+    g_free(s->rx_bufs);
+    s->rx_bufs = NULL;
+#endif
     close(s->fd);
     s->fd = -1;
 }
@@ -335,6 +774,38 @@ static void tap_poll(NetClientState *nc, bool enable)
     TAPState *s = DO_UPCAST(TAPState, nc, nc);
     tap_read_poll(s, enable);
     tap_write_poll(s, enable);
+#ifdef CONFIG_LINUX_IO_URING
+    /* vhost-net is going to read from the device */
+    if (!enable) {
+        tap_rx_cancel(s);
+    }
+#endif
+}
+
+static void tap_set_aio_context(NetClientState *nc, AioContext *ctx)
+{
+    TAPState *s = DO_UPCAST(TAPState, nc, nc);
+
+    if (!ctx) {
+        ctx = iohandler_get_aio_context();
+    }
+    if (s->ctx == ctx) {
+        return;
+    }
+
+    aio_set_fd_handler(s->ctx, s->fd, false, NULL, NULL, NULL, NULL);
+#ifdef CONFIG_LINUX_IO_URING
+    if (s->tx_ring_ready) {
+        aio_set_fd_handler(s->ctx, s->tx_ring.ring_fd, false,
+                           NULL, NULL, NULL, NULL);
+    }
+    if (s->rx_ring_ready) {
+        aio_set_fd_handler(s->ctx, s->rx_ring.ring_fd, false,
+                           NULL, NULL, NULL, NULL);
+    }
+#endif
+    s->ctx = ctx;
+    tap_update_fd_handler(s);
 }
 
 int tap_get_fd(NetClientState *nc)
@@ -352,6 +823,9 @@ static NetClientInfo net_tap_info = {
     .receive = tap_receive,
     .receive_raw = tap_receive_raw,
     .receive_iov = tap_receive_iov,
+#ifdef CONFIG_LINUX_IO_URING
+    .receive_iov_batch = tap_receive_iov_batch,
+#endif
     .poll = tap_poll,
     .cleanup = tap_cleanup,
     .has_ufo = tap_has_ufo,
@@ -362,6 +836,7 @@ static NetClientInfo net_tap_info = {
     .set_vnet_hdr_len = tap_set_vnet_hdr_len,
     .set_vnet_le = tap_set_vnet_le,
     .set_vnet_be = tap_set_vnet_be,
+    .set_aio_context = tap_set_aio_context,
 };
 
 static TAPState *net_tap_fd_init(NetClientState *peer,
@@ -378,6 +853,7 @@ static TAPState *net_tap_fd_init(NetClientState *peer,
     s = DO_UPCAST(TAPState, nc, nc);
 
     s->fd = fd;
+    s->ctx = iohandler_get_aio_context();
     s->host_vnet_hdr_len = vnet_hdr ? sizeof(struct virtio_net_hdr) : 0;
     s->using_vnet_hdr = false;
     s->has_ufo = tap_probe_has_ufo(s->fd);
@@ -1030,6 +1506,10 @@ int tap_disable(NetClientState *nc)
             qemu_purge_queued_packets(nc);
             s->enabled = false;
             tap_update_fd_handler(s);
+#ifdef CONFIG_LINUX_IO_URING
+            /* Reads on a detached queue would never complete */
+            tap_rx_cancel(s);
+#endif
         }
         return ret;
     }
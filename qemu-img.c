@@ -49,6 +49,7 @@
 #include "block/blockjob.h"
 #include "block/qapi.h"
 #include "crypto/init.h"
+#include "crypto/hash.h"
 #include "trace/control.h"
 #include "qemu/throttle.h"
 #include "block/throttle-groups.h"
@@ -83,6 +84,8 @@ enum {
     OPTION_MERGE = 274,
     OPTION_BITMAPS = 275,
     OPTION_FORCE = 276,
+    OPTION_ADAPTIVE = 277,
+    OPTION_DEDUP = 278,
 };
 
 typedef enum OutputFormat {
@@ -1673,6 +1676,26 @@ enum ImgConvertBlockStatus {
 #define MAX_COROUTINES 16
 #define CONVERT_THROTTLE_GROUP "img_convert"
 
+/* Block status of a part of the source, as found by the scan in --adaptive */
+typedef struct ImgConvertExtent {
+    int64_t sector_num;
+    int nb_sectors;
+    enum ImgConvertBlockStatus status;
+} ImgConvertExtent;
+
+/* Target cluster whose content was written by --dedup, indexed by digest */
+#define CONVERT_DEDUP_DIGEST_LEN 32 /* SHA-256 */
+typedef struct ImgConvertDedupEntry {
+    uint8_t digest[CONVERT_DEDUP_DIGEST_LEN];
+    int64_t offset;
+} ImgConvertDedupEntry;
+
+/* Unit of work of the parallel block status scan */
+#define CONVERT_SCAN_CHUNK_SECTORS ((1 * GiB) >> BDRV_SECTOR_BITS)
+
+/* How often the number of active coroutines is reconsidered */
+#define CONVERT_ADAPT_INTERVAL_NS (500 * SCALE_MS)
+
 typedef struct ImgConvertState {
     BlockBackend **src;
     int64_t *src_sectors;
@@ -1705,6 +1728,32 @@ typedef struct ImgConvertState {
     int64_t wait_sector_num[MAX_COROUTINES];
     CoMutex lock;
     int ret;
+
+    /* --adaptive */
+    bool adaptive;
+    GArray **scan_extents;      /* extents found per scan chunk */
+    int64_t scan_nb_chunks;
+    int64_t scan_next_chunk;
+    GArray *extents;            /* ImgConvertExtent covering the source */
+    guint next_extent;
+    int active_limit;           /* coroutines allowed to issue requests */
+    int busy_coroutines;        /* coroutines that are not parked */
+    int peak_active_limit;
+    int adapt_dir;
+    CoQueue parked;
+    int64_t window_start_ns;
+    int64_t window_bytes;
+    int64_t window_latency_ns;
+    int64_t window_reqs;
+    double window_prev_tput;
+    double window_prev_latency;
+    int64_t scan_ns;
+    int64_t copy_ns;
+
+    /* --dedup */
+    bool dedup;
+    GHashTable *dedup_index;    /* set of ImgConvertDedupEntry */
+    int64_t dedup_clusters;     /* clusters that were shared, not written */
 } ImgConvertState;
 
 static void convert_select_part(ImgConvertState *s, int64_t sector_num,
@@ -1719,7 +1768,15 @@ static void convert_select_part(ImgConvertState *s, int64_t sector_num,
     }
 }
 
-static int convert_iteration_sectors(ImgConvertState *s, int64_t sector_num)
+/*
+ * Find the block status at @sector_num and return the number of sectors up to
+ * @end that can be handled with it in one request.  @status and
+ * @sector_next_status cache the result of the last block status query.
+ */
+static int convert_scan_sectors(ImgConvertState *s, int64_t sector_num,
+                                int64_t end,
+                                enum ImgConvertBlockStatus *status,
+                                int64_t *sector_next_status)
 {
     int64_t src_cur_offset;
     int ret, n, src_cur;
@@ -1727,8 +1784,8 @@ static int convert_iteration_sectors(ImgConvertState *s, int64_t sector_num)
 
     convert_select_part(s, sector_num, &src_cur, &src_cur_offset);
 
-    assert(s->total_sectors > sector_num);
-    n = MIN(s->total_sectors - sector_num, BDRV_REQUEST_MAX_SECTORS);
+    assert(end > sector_num);
+    n = MIN(end - sector_num, BDRV_REQUEST_MAX_SECTORS);
 
     if (s->target_backing_sectors >= 0) {
         if (sector_num >= s->target_backing_sectors) {
@@ -1740,7 +1797,7 @@ static int convert_iteration_sectors(ImgConvertState *s, int64_t sector_num)
         }
     }
 
-    if (s->sector_next_status <= sector_num) {
+    if (*sector_next_status <= sector_num) {
         uint64_t offset = (sector_num - src_cur_offset) * BDRV_SECTOR_SIZE;
         int64_t count;
         int tail;
@@ -1785,7 +1842,7 @@ static int convert_iteration_sectors(ImgConvertState *s, int64_t sector_num)
         n = DIV_ROUND_UP(count, BDRV_SECTOR_SIZE);
 
         /*
-         * Avoid that s->sector_next_status becomes unaligned to the source
+         * Avoid that *sector_next_status becomes unaligned to the source
          * request alignment and/or cluster size to avoid unnecessary read
          * cycles.
          */
@@ -1795,18 +1852,18 @@ static int convert_iteration_sectors(ImgConvertState *s, int64_t sector_num)
         }
 
         if (ret & BDRV_BLOCK_ZERO) {
-            s->status = post_backing_zero ? BLK_BACKING_FILE : BLK_ZERO;
+            *status = post_backing_zero ? BLK_BACKING_FILE : BLK_ZERO;
         } else if (ret & BDRV_BLOCK_DATA) {
-            s->status = BLK_DATA;
+            *status = BLK_DATA;
         } else {
-            s->status = s->target_has_backing ? BLK_BACKING_FILE : BLK_DATA;
+            *status = s->target_has_backing ? BLK_BACKING_FILE : BLK_DATA;
         }
 
-        s->sector_next_status = sector_num + n;
+        *sector_next_status = sector_num + n;
     }
 
-    n = MIN(n, s->sector_next_status - sector_num);
-    if (s->status == BLK_DATA) {
+    n = MIN(n, *sector_next_status - sector_num);
+    if (*status == BLK_DATA) {
         n = MIN(n, s->buf_sectors);
     }
 
@@ -1815,8 +1872,8 @@ static int convert_iteration_sectors(ImgConvertState *s, int64_t sector_num)
      * cluster allocated. */
     if (s->compressed) {
         if (n < s->cluster_sectors) {
-            n = MIN(s->cluster_sectors, s->total_sectors - sector_num);
-            s->status = BLK_DATA;
+            n = MIN(s->cluster_sectors, end - sector_num);
+            *status = BLK_DATA;
         } else {
             n = QEMU_ALIGN_DOWN(n, s->cluster_sectors);
         }
@@ -1825,6 +1882,188 @@ static int convert_iteration_sectors(ImgConvertState *s, int64_t sector_num)
     return n;
 }
 
+static int convert_iteration_sectors(ImgConvertState *s, int64_t sector_num)
+{
+    return convert_scan_sectors(s, sector_num, s->total_sectors, &s->status,
+                                &s->sector_next_status);
+}
+
+/*
+ * Scan chunks of the source for their block status until none is left.
+ * Several of these coroutines run in parallel, so that the block status
+ * of different parts and sources of the image is fetched concurrently.
+ */
+static void coroutine_fn convert_co_scan(void *opaque)
+{
+    ImgConvertState *s = opaque;
+
+    while (s->ret == -EINPROGRESS && s->scan_next_chunk < s->scan_nb_chunks) {
+        int64_t chunk = s->scan_next_chunk++;
+        int64_t sector_num = chunk * CONVERT_SCAN_CHUNK_SECTORS;
+        int64_t end = MIN(sector_num + CONVERT_SCAN_CHUNK_SECTORS,
+                          s->total_sectors);
+        enum ImgConvertBlockStatus status = BLK_DATA;
+        int64_t sector_next_status = 0;
+        GArray *extents = g_array_new(false, false, sizeof(ImgConvertExtent));
+
+        s->scan_extents[chunk] = extents;
+        while (sector_num < end) {
+            ImgConvertExtent e;
+            int n = convert_scan_sectors(s, sector_num, end, &status,
+                                         &sector_next_status);
+            if (n < 0) {
+                s->ret = n;
+                break;
+            }
+
+            e = (ImgConvertExtent) {
+                .sector_num = sector_num,
+                .nb_sectors = n,
+                .status     = status,
+            };
+            g_array_append_val(extents, e);
+            sector_num += n;
+        }
+    }
+
+    s->running_coroutines--;
+}
+
+/* Fetch the block status of the whole source before the copy starts */
+static int convert_scan_extents(ImgConvertState *s)
+{
+    int64_t start_ns = get_clock();
+    int64_t i;
+    guint j;
+    int ret;
+
+    s->scan_nb_chunks = DIV_ROUND_UP(s->total_sectors,
+                                     CONVERT_SCAN_CHUNK_SECTORS);
+    s->scan_next_chunk = 0;
+    s->scan_extents = g_new0(GArray *, s->scan_nb_chunks);
+    s->ret = -EINPROGRESS;
+
+    for (i = 0; i < MIN(s->num_coroutines, s->scan_nb_chunks); i++) {
+        Coroutine *co = qemu_coroutine_create(convert_co_scan, s);
+        s->running_coroutines++;
+        qemu_coroutine_enter(co);
+    }
+
+    while (s->running_coroutines) {
+        main_loop_wait(false);
+    }
+
+    ret = s->ret == -EINPROGRESS ? 0 : s->ret;
+
+    s->extents = g_array_new(false, false, sizeof(ImgConvertExtent));
+    for (i = 0; i < s->scan_nb_chunks; i++) {
+        GArray *extents = s->scan_extents[i];
+
+        if (!extents) {
+            continue;
+        }
+        for (j = 0; j < extents->len; j++) {
+            ImgConvertExtent *e = &g_array_index(extents, ImgConvertExtent, j);
+
+            if (e->status == BLK_DATA ||
+                (!s->min_sparse && e->status == BLK_ZERO)) {
+                s->allocated_sectors += e->nb_sectors;
+            }
+        }
+        g_array_append_vals(s->extents, extents->data, extents->len);
+        g_array_free(extents, true);
+    }
+    g_free(s->scan_extents);
+    s->scan_extents = NULL;
+
+    s->scan_ns = get_clock() - start_ns;
+    return ret;
+}
+
+/*
+ * Return the number of sectors from s->sector_num to the end of the extent
+ * that contains it, and set s->status to the status of that extent.
+ */
+static int convert_next_extent(ImgConvertState *s)
+{
+    ImgConvertExtent *e;
+
+    for (;;) {
+        assert(s->next_extent < s->extents->len);
+        e = &g_array_index(s->extents, ImgConvertExtent, s->next_extent);
+        if (s->sector_num < e->sector_num + e->nb_sectors) {
+            break;
+        }
+        s->next_extent++;
+    }
+
+    assert(s->sector_num >= e->sector_num);
+    s->status = e->status;
+    return e->sector_num + e->nb_sectors - s->sector_num;
+}
+
+/* Wait while more coroutines are busy than the adaptive limit allows */
+static void coroutine_fn convert_co_throttle(ImgConvertState *s)
+{
+    while (s->busy_coroutines > s->active_limit &&
+           s->ret == -EINPROGRESS && s->sector_num < s->total_sectors) {
+        s->busy_coroutines--;
+        qemu_co_queue_wait(&s->parked, NULL);
+        s->busy_coroutines++;
+    }
+}
+
+/*
+ * Account a finished request and, once per CONVERT_ADAPT_INTERVAL_NS, move
+ * the number of active coroutines by one.  The direction is kept as long as
+ * throughput improves; it is reversed when throughput drops, and the count
+ * shrinks when only the latency grows, because additional requests then
+ * just queue up below us.
+ */
+static void convert_adapt(ImgConvertState *s, int nb_sectors,
+                          int64_t latency_ns)
+{
+    int64_t now = get_clock();
+    double tput, latency;
+    int limit;
+
+    s->window_bytes += (int64_t)nb_sectors << BDRV_SECTOR_BITS;
+    s->window_latency_ns += latency_ns;
+    s->window_reqs++;
+    if (now - s->window_start_ns < CONVERT_ADAPT_INTERVAL_NS) {
+        return;
+    }
+
+    tput = (double)s->window_bytes / (now - s->window_start_ns);
+    latency = (double)s->window_latency_ns / s->window_reqs;
+
+    if (s->window_prev_tput > 0) {
+        if (tput < s->window_prev_tput * 0.95) {
+            s->adapt_dir = -s->adapt_dir;
+        } else if (tput < s->window_prev_tput * 1.05 &&
+                   latency > s->window_prev_latency * 1.1) {
+            s->adapt_dir = -1;
+        }
+    }
+
+    limit = MAX(1, MIN(s->active_limit + s->adapt_dir, s->num_coroutines));
+    if (limit == s->active_limit) {
+        /* Reached a bound; try the other way next time */
+        s->adapt_dir = -s->adapt_dir;
+    } else if (limit > s->active_limit) {
+        qemu_co_queue_next(&s->parked);
+    }
+    s->active_limit = limit;
+    s->peak_active_limit = MAX(s->peak_active_limit, limit);
+
+    s->window_prev_tput = tput;
+    s->window_prev_latency = latency;
+    s->window_start_ns = now;
+    s->window_bytes = 0;
+    s->window_latency_ns = 0;
+    s->window_reqs = 0;
+}
+
 static int coroutine_fn convert_co_read(ImgConvertState *s, int64_t sector_num,
                                         int nb_sectors, uint8_t *buf)
 {
@@ -1878,6 +2117,114 @@ static int coroutine_fn convert_co_read(ImgConvertState *s, int64_t sector_num,
     return 0;
 }
 
+static guint convert_dedup_hash(gconstpointer key)
+{
+    const ImgConvertDedupEntry *e = key;
+    guint h;
+
+    /* The digest is uniformly distributed already */
+    memcpy(&h, e->digest, sizeof(h));
+    return h;
+}
+
+static gboolean convert_dedup_equal(gconstpointer a, gconstpointer b)
+{
+    const ImgConvertDedupEntry *ea = a, *eb = b;
+
+    return !memcmp(ea->digest, eb->digest, sizeof(ea->digest));
+}
+
+/*
+ * Write @nb_sectors from @buf to the target, except for the full target
+ * clusters whose content has been written before: those are made to share
+ * the host cluster of the earlier copy.  Clusters are only added to the
+ * index once their write has completed, so that the data they are shared
+ * from is stable.
+ */
+static int coroutine_fn convert_co_write_dedup(ImgConvertState *s,
+                                               int64_t sector_num,
+                                               int nb_sectors, uint8_t *buf,
+                                               BdrvRequestFlags flags)
+{
+    int64_t cluster_bytes = s->cluster_sectors << BDRV_SECTOR_BITS;
+    int64_t offset = sector_num << BDRV_SECTOR_BITS;
+    int64_t end = offset + ((int64_t)nb_sectors << BDRV_SECTOR_BITS);
+    int64_t start = QEMU_ALIGN_UP(offset, cluster_bytes);
+    int64_t pending = offset;   /* start of the data not written yet */
+    GPtrArray *written = g_ptr_array_new_with_free_func(g_free);
+    int64_t pos;
+    guint i;
+    int ret = 0;
+
+    for (pos = start; pos + cluster_bytes <= end; pos += cluster_bytes) {
+        uint8_t *cluster_buf = buf + (pos - offset);
+        ImgConvertDedupEntry *e = g_new0(ImgConvertDedupEntry, 1);
+        ImgConvertDedupEntry *found;
+        uint8_t *digest = e->digest;
+        size_t digest_len = sizeof(e->digest);
+
+        ret = qcrypto_hash_bytes(QCRYPTO_HASH_ALG_SHA256,
+                                 (const char *)cluster_buf, cluster_bytes,
+                                 &digest, &digest_len, NULL);
+        if (ret < 0) {
+            g_free(e);
+            ret = -EIO;
+            goto out;
+        }
+        e->offset = pos;
+
+        found = g_hash_table_lookup(s->dedup_index, e);
+        if (!found) {
+            g_ptr_array_add(written, e);
+            continue;
+        }
+        g_free(e);
+
+        if (pos > pending) {
+            ret = blk_co_pwrite(s->target, pending, pos - pending,
+                                buf + (pending - offset), flags);
+            if (ret < 0) {
+                goto out;
+            }
+        }
+
+        ret = blk_co_share_clusters(s->target, found->offset, pos,
+                                    cluster_bytes);
+        if (ret == -ENOTSUP) {
+            ret = blk_co_pwrite(s->target, pos, cluster_bytes, cluster_buf,
+                                flags);
+        } else if (ret == 0) {
+            s->dedup_clusters++;
+        }
+        if (ret < 0) {
+            goto out;
+        }
+        pending = pos + cluster_bytes;
+    }
+
+    if (end > pending) {
+        ret = blk_co_pwrite(s->target, pending, end - pending,
+                            buf + (pending - offset), flags);
+        if (ret < 0) {
+            goto out;
+        }
+    }
+
+    /* Everything was written, the new clusters can be shared from now on */
+    for (i = 0; i < written->len; i++) {
+        ImgConvertDedupEntry *e = g_ptr_array_index(written, i);
+
+        if (!g_hash_table_contains(s->dedup_index, e)) {
+            g_ptr_array_index(written, i) = NULL;
+            g_hash_table_add(s->dedup_index, e);
+        }
+    }
+    ret = 0;
+
+out:
+    g_ptr_array_free(written, true);
+    return ret;
+}
 
 static int coroutine_fn convert_co_write(ImgConvertState *s, int64_t sector_num,
                                          int nb_sectors, uint8_t *buf,
@@ -1911,8 +2258,13 @@ static int coroutine_fn convert_co_write(ImgConvertState *s, int64_t sector_num,
                 (s->compressed &&
                  !buffer_is_zero(buf, n * BDRV_SECTOR_SIZE)))
             {
-                ret = blk_co_pwrite(s->target, sector_num << BDRV_SECTOR_BITS,
-                                    n << BDRV_SECTOR_BITS, buf, flags);
+                if (s->dedup) {
+                    ret = convert_co_write_dedup(s, sector_num, n, buf, flags);
+                } else {
+                    ret = blk_co_pwrite(s->target,
+                                        sector_num << BDRV_SECTOR_BITS,
+                                        n << BDRV_SECTOR_BITS, buf, flags);
+                }
                 if (ret < 0) {
                     return ret;
                 }
@@ -1995,15 +2347,24 @@ static void coroutine_fn convert_co_do_copy(void *opaque)
     while (1) {
         int n;
         int64_t sector_num;
+        int64_t start_ns = 0;
         enum ImgConvertBlockStatus status;
         bool copy_range;
 
+        if (s->adaptive) {
+            convert_co_throttle(s);
+        }
+
         qemu_co_mutex_lock(&s->lock);
         if (s->ret != -EINPROGRESS || s->sector_num >= s->total_sectors) {
             qemu_co_mutex_unlock(&s->lock);
             break;
         }
-        n = convert_iteration_sectors(s, s->sector_num);
+        if (s->extents) {
+            n = convert_next_extent(s);
+        } else {
+            n = convert_iteration_sectors(s, s->sector_num);
+        }
         if (n < 0) {
             qemu_co_mutex_unlock(&s->lock);
             s->ret = n;
@@ -2026,6 +2387,10 @@ static void coroutine_fn convert_co_do_copy(void *opaque)
                                         s->allocated_sectors, 0);
         }
 
+        if (s->adaptive) {
+            start_ns = get_clock();
+        }
+
 retry:
         copy_range = s->copy_range && s->status == BLK_DATA;
         if (status == BLK_DATA && !copy_range) {
@@ -2082,6 +2447,15 @@ retry:
                 }
             }
         }
+
+        if (s->adaptive) {
+            convert_adapt(s, n, get_clock() - start_ns);
+        }
+    }
+
+    if (s->adaptive) {
+        /* Let parked coroutines see that there is nothing left to do */
+        qemu_co_queue_restart_all(&s->parked);
     }
 
     qemu_vfree(buf);
@@ -2097,6 +2471,7 @@ static int convert_do_copy(ImgConvertState *s)
 {
     int ret, i, n;
     int64_t sector_num = 0;
+    int64_t copy_start_ns;
 
     /* Check whether we have zero initialisation or can get it efficiently */
     if (!s->has_zero_init && s->target_is_new && s->min_sparse &&
@@ -2114,22 +2489,41 @@ static int convert_do_copy(ImgConvertState *s)
         s->buf_sectors = s->cluster_sectors;
     }
 
-    while (sector_num < s->total_sectors) {
-        n = convert_iteration_sectors(s, sector_num);
-        if (n < 0) {
-            return n;
+    if (s->adaptive) {
+        ret = convert_scan_extents(s);
+        if (ret < 0) {
+            return ret;
         }
-        if (s->status == BLK_DATA || (!s->min_sparse && s->status == BLK_ZERO))
-        {
-            s->allocated_sectors += n;
+    } else {
+        while (sector_num < s->total_sectors) {
+            n = convert_iteration_sectors(s, sector_num);
+            if (n < 0) {
+                return n;
+            }
+            if (s->status == BLK_DATA ||
+                (!s->min_sparse && s->status == BLK_ZERO))
+            {
+                s->allocated_sectors += n;
+            }
+            sector_num += n;
         }
-        sector_num += n;
     }
 
     /* Do the copy */
     s->sector_next_status = 0;
     s->ret = -EINPROGRESS;
 
+    copy_start_ns = get_clock();
+    if (s->adaptive) {
+        /* Start with half of the coroutines and adapt from there */
+        qemu_co_queue_init(&s->parked);
+        s->active_limit = MAX(1, s->num_coroutines / 2);
+        s->peak_active_limit = s->active_limit;
+        s->busy_coroutines = s->num_coroutines;
+        s->adapt_dir = 1;
+        s->window_start_ns = get_clock();
+    }
+
     qemu_co_mutex_init(&s->lock);
     for (i = 0; i < s->num_coroutines; i++) {
         s->co[i] = qemu_coroutine_create(convert_co_do_copy, s);
@@ -2141,6 +2535,8 @@ static int convert_do_copy(ImgConvertState *s)
         main_loop_wait(false);
     }
 
+    s->copy_ns = get_clock() - copy_start_ns;
+
     if (s->compressed && !s->ret) {
         /* signal EOF to align */
         ret = blk_pwrite_compressed(s->target, 0, NULL, 0);
@@ -2152,6 +2548,35 @@ static int convert_do_copy(ImgConvertState *s)
     return s->ret;
 }
 
+/*
+ * The statistics go to stderr, so that stdout only has the progress output
+ * as without --adaptive and --dedup.
+ */
+static void convert_print_stats(ImgConvertState *s)
+{
+    double scan_secs = (double)s->scan_ns / NANOSECONDS_PER_SECOND;
+    double copy_secs = (double)s->copy_ns / NANOSECONDS_PER_SECOND;
+    double copied_mib = (double)(s->allocated_done << BDRV_SECTOR_BITS) / MiB;
+
+    if (s->extents) {
+        fprintf(stderr, "Block status: %u extents in %.3f s\n",
+                s->extents->len, scan_secs);
+        fprintf(stderr, "Copy: %.1f MiB in %.3f s (%.1f MiB/s), "
+                "up to %d of %ld coroutines active\n",
+                copied_mib, copy_secs,
+                copy_secs > 0 ? copied_mib / copy_secs : 0,
+                s->peak_active_limit, s->num_coroutines);
+    }
+    if (s->dedup) {
+        fprintf(stderr, "Dedup: %" PRId64 " clusters (%.1f MiB) shared "
+                "instead of written, %u distinct clusters\n",
+                s->dedup_clusters,
+                (double)(s->dedup_clusters * s->cluster_sectors
+                         << BDRV_SECTOR_BITS) / MiB,
+                g_hash_table_size(s->dedup_index));
+    }
+}
+
 static int convert_copy_bitmaps(BlockDriverState *src, BlockDriverState *dst)
 {
     BdrvDirtyBitmap *bm;
@@ -2218,6 +2643,7 @@ static int img_convert(int argc, char **argv)
     bool force_share = false;
     bool explict_min_sparse = false;
     bool bitmaps = false;
+    bool explicit_num_coroutines = false;
     int64_t rate_limit = 0;
 
     ImgConvertState s = (ImgConvertState) {
@@ -2239,6 +2665,8 @@ static int img_convert(int argc, char **argv)
             {"salvage", no_argument, 0, OPTION_SALVAGE},
             {"target-is-zero", no_argument, 0, OPTION_TARGET_IS_ZERO},
             {"bitmaps", no_argument, 0, OPTION_BITMAPS},
+            {"adaptive", no_argument, 0, OPTION_ADAPTIVE},
+            {"dedup", no_argument, 0, OPTION_DEDUP},
             {0, 0, 0, 0}
         };
         c = getopt_long(argc, argv, ":hf:O:B:Cco:l:S:pt:T:qnm:WUr:",
@@ -2331,6 +2759,7 @@ static int img_convert(int argc, char **argv)
                              " coroutines is between 1 and %d", MAX_COROUTINES);
                 goto fail_getopt;
             }
+            explicit_num_coroutines = true;
             break;
         case 'W':
             s.wr_in_order = false;
@@ -2373,9 +2802,20 @@ static int img_convert(int argc, char **argv)
         case OPTION_BITMAPS:
             bitmaps = true;
             break;
+        case OPTION_ADAPTIVE:
+            s.adaptive = true;
+            break;
+        case OPTION_DEDUP:
+            s.dedup = true;
+            break;
         }
     }
 
+    if (s.adaptive && !explicit_num_coroutines) {
+        /* -m is the upper bound in adaptive mode */
+        s.num_coroutines = MAX_COROUTINES;
+    }
+
     if (!out_fmt && !tgt_image_opts) {
         out_fmt = "raw";
     }
@@ -2401,6 +2841,11 @@ static int img_convert(int argc, char **argv)
         goto fail_getopt;
     }
 
+    if (s.dedup && (s.compressed || s.copy_range)) {
+        error_report("Cannot use --dedup with -c or -C");
+        goto fail_getopt;
+    }
+
     if (tgt_image_opts && !skip_create) {
         error_report("--target-image-opts requires use of -n flag");
         goto fail_getopt;
@@ -2737,6 +3182,24 @@ static int img_convert(int argc, char **argv)
         set_rate_limit(s.target, rate_limit);
     }
 
+    if (s.adaptive && !s.compressed) {
+        /* Compressed clusters must still be written in order */
+        s.wr_in_order = false;
+    }
+
+    if (s.dedup) {
+        if (s.compressed || !s.cluster_sectors ||
+            !out_bs->drv->bdrv_co_share_clusters) {
+            error_report("--dedup requires an uncompressed target format "
+                         "that can share clusters, such as qcow2");
+            ret = -1;
+            goto out;
+        }
+        s.dedup_index = g_hash_table_new_full(convert_dedup_hash,
+                                              convert_dedup_equal,
+                                              g_free, NULL);
+    }
+
     ret = convert_do_copy(&s);
 
     /* Now copy the bitmaps */
@@ -2749,6 +3212,15 @@ out:
         qemu_progress_print(100, 0);
     }
     qemu_progress_end();
+    if (progress && !ret && (s.adaptive || s.dedup)) {
+        convert_print_stats(&s);
+    }
+    if (s.extents) {
+        g_array_free(s.extents, true);
+    }
+    if (s.dedup_index) {
+        g_hash_table_destroy(s.dedup_index);
+    }
     qemu_opts_del(opts);
     qemu_opts_free(create_opts);
     qobject_unref(open_opts);
@@ -115,7 +115,9 @@ DEF("accel", HAS_ARG, QEMU_OPTION_accel,
     "                igd-passthru=on|off (enable Xen integrated Intel graphics passthrough, default=off)\n"
     "                kernel-irqchip=on|off|split controls accelerated irqchip support (default=on)\n"
     "                kvm-shadow-mem=size of KVM shadow MMU in bytes\n"
+    "                coalesced-mmio-thread=on|off (drain coalesced MMIO in a separate thread, default=off)\n"
     "                tb-size=n (TCG translation block cache size)\n"
+    "                tb-evict=on|off (recycle old TCG code regions instead of flushing, default=off)\n"
     "                thread=single|multi (enable multi-threaded TCG)\n", QEMU_ARCH_ALL)
 SRST
 ``-accel name[,prop=value[,...]]``
@@ -140,9 +142,26 @@ SRST
     ``kvm-shadow-mem=size``
         Defines the size of the KVM shadow MMU.
 
+    ``coalesced-mmio-thread=on|off``
+        Drain the KVM coalesced MMIO and PIO ring in a separate thread,
+        instead of only when the guest accesses a region that needs the
+        pending writes.  Writes to devices that support it are dispatched
+        without taking the global lock.  Devices can coalesce more of
+        their registers with their ``x-coalesced-io`` property, where
+        available; that property requires this option.  The default is
+        off.
+
     ``tb-size=n``
         Controls the size (in MiB) of the TCG translation block cache.
 
+    ``tb-evict=on|off``
+        When the TCG translation block cache fills up, discard only the
+        oldest code regions, and the translation blocks in them, rather
+        than flushing the whole cache.  This mostly helps multi-threaded
+        TCG with many vCPUs, where the cache is split into many regions.
+        The number of evictions and the region occupancy are shown by
+        ``info jit``.  The default is off.
+
     ``thread=single|multi``
         Controls number of TCG threads. When the TCG is multi-threaded
         there will be one thread per vCPU therefor taking advantage of
@@ -2459,6 +2478,12 @@ DEF("netdev", HAS_ARG, QEMU_OPTION_netdev,
     "                VALE port (created on the fly) called 'name' ('nmname' is name of the \n"
     "                netmap device, defaults to '/dev/netmap')\n"
 #endif
+#ifdef CONFIG_AF_XDP
+    "-netdev af-xdp,id=str,ifname=name[,mode=native|skb][,force-copy=on|off]\n"
+    "         [,queues=n][,start-queue=m]\n"
+    "                attach to the existing network interface 'name' with AF_XDP\n"
+    "                sockets, using 'n' queue pairs starting at device queue 'm'\n"
+#endif
 #ifdef CONFIG_POSIX
     "-netdev vhost-user,id=str,chardev=dev[,vhostforce=on|off]\n"
     "                configure a vhost-user network, backed by a chardev 'dev'\n"
@@ -2926,6 +2951,36 @@ SRST
         # launch QEMU instance
         |qemu_system| linux.img -nic vde,sock=/tmp/myswitch
 
+``-netdev af-xdp,id=id,ifname=name[,mode=native|skb][,force-copy=on|off][,queues=n][,start-queue=m]``
+    Configure an AF_XDP backend attached to the host network interface
+    ifname.  Each of the n queue pairs (default 1) uses its own AF_XDP
+    socket, bound to device queues m, m+1, ... (default 0), and maps to a
+    queue pair of a multiqueue virtio-net device.  The XDP program runs in
+    the driver (``mode=native``) or generically (``mode=skb``); by default
+    native mode is tried first.  Zero-copy is used when the driver
+    supports it, unless ``force-copy=on``.  Traffic on the selected device
+    queues is taken away from the host network stack.  If the interface
+    already has an XDP program, it is reused and left attached when the
+    backend is removed.
+
+    When the virtio-net device runs its datapath in an IOThread, the
+    receive rings are busy-polled for up to the IOThread's
+    ``poll-max-ns``.  This option is only available if QEMU has been
+    compiled with libbpf AF_XDP support.
+
+    Example, using a veth pair in a network namespace:
+
+    .. parsed-literal::
+
+        ip netns add ns1
+        ip link add veth0 type veth peer name veth1 netns ns1
+        ip link set veth0 up
+        ip -n ns1 link set veth1 up
+        |qemu_system| linux.img \\
+                -object iothread,id=io0,poll-max-ns=50000 \\
+                -netdev af-xdp,id=n1,ifname=veth0,mode=skb \\
+                -device virtio-net-pci,netdev=n1,iothread=io0
+
 ``-netdev vhost-user,chardev=id[,vhostforce=on|off][,queues=n]``
     Establish a vhost-user netdev, backed by a chardev id. The chardev
     should be a unix domain socket backed one. The vhost-user uses a
@@ -4738,7 +4793,7 @@ SRST
         stored. The file format is libpcap, so it can be analyzed with
         tools such as tcpdump or Wireshark.
 
-    ``-object colo-compare,id=id,primary_in=chardevid,secondary_in=chardevid,outdev=chardevid,iothread=id[,vnet_hdr_support][,notify_dev=id][,compare_timeout=@var{ms}][,expired_scan_cycle=@var{ms}][,max_queue_size=@var{size}]``
+    ``-object colo-compare,id=id,primary_in=chardevid,secondary_in=chardevid,outdev=chardevid,iothread=id[,vnet_hdr_support][,notify_dev=id][,compare_timeout=@var{ms}][,expired_scan_cycle=@var{ms}][,max_queue_size=@var{size}][,workers=@var{n}]``
         Colo-compare gets packet from primary\_in chardevid and
         secondary\_in, then compare whether the payload of primary packet
         and secondary packet are the same. If same, it will output
@@ -4752,6 +4807,10 @@ SRST
         is to set the period of scanning expired primary node network packets.
         The max\_queue\_size=@var{size} is to set the max compare queue
         size depend on user environment.
+        The workers=@var{n} option spreads the connections over @var{n}
+        additional compare threads, partitioned by the hash of their
+        5-tuple, for guests with many concurrent flows. By default all
+        connections are compared in the iothread.
         If user want to use Xen COLO, need to add the notify\_dev to
         notify Xen colo-frame to do checkpoint.
 
@@ -24,6 +24,7 @@
 #include "qemu/error-report.h"
 #include "qemu/main-loop.h"
 #include "qemu/qemu-print.h"
+#include "qemu/timer.h"
 #include "qom/object.h"
 #include "trace.h"
 
@@ -51,6 +52,15 @@ static QTAILQ_HEAD(, AddressSpace) address_spaces
 
 static GHashTable *flat_views;
 
+/* Cost of rendering FlatViews, shown by "info mtree -f" */
+static struct {
+    uint64_t updates;       /* topology updates */
+    uint64_t rebuilt;       /* FlatViews rendered and dispatched anew */
+    uint64_t reused;        /* FlatViews kept because they did not change */
+    uint64_t total_ns;
+    uint64_t max_ns;
+} flatview_stats;
+
 typedef struct AddrRange AddrRange;
 
 /*
@@ -254,6 +264,23 @@ static bool flatrange_equal(FlatRange *a, FlatRange *b)
         && a->nonvolatile == b->nonvolatile;
 }
 
+/* Whether @a and @b map the same sections with the same dirty logging */
+static bool flatview_equal(FlatView *a, FlatView *b)
+{
+    unsigned i;
+
+    if (a->root != b->root || a->nr != b->nr) {
+        return false;
+    }
+    for (i = 0; i < a->nr; i++) {
+        if (!flatrange_equal(&a->ranges[i], &b->ranges[i]) ||
+            a->ranges[i].dirty_log_mask != b->ranges[i].dirty_log_mask) {
+            return false;
+        }
+    }
+    return true;
+}
+
 static FlatView *flatview_new(MemoryRegion *mr_root)
 {
     FlatView *view;
@@ -720,8 +747,15 @@ static MemoryRegion *memory_region_get_flatview_root(MemoryRegion *mr)
     return NULL;
 }
 
-/* Render a memory topology into a list of disjoint absolute ranges. */
-static FlatView *generate_memory_topology(MemoryRegion *mr)
+/*
+ * Render a memory topology into a list of disjoint absolute ranges.
+ *
+ * If that gives the same ranges as @old_view, @old_view is reused: its
+ * dispatch tree stays valid and address spaces using it need not be
+ * updated.  Most transactions only touch one of the rendered roots.
+ */
+static FlatView *generate_memory_topology(MemoryRegion *mr,
+                                          FlatView *old_view)
 {
     int i;
     FlatView *view;
@@ -735,6 +769,17 @@ static FlatView *generate_memory_topology(MemoryRegion *mr)
     }
     flatview_simplify(view);
 
+    if (old_view && flatview_equal(old_view, view)) {
+        /* Never published, no need to wait for RCU readers */
+        flatview_destroy(view);
+        flatview_ref(old_view);
+        g_hash_table_replace(flat_views, mr, old_view);
+        trace_flatview_reuse(old_view, mr);
+        flatview_stats.reused++;
+        return old_view;
+    }
+    flatview_stats.rebuilt++;
+
     view->dispatch = address_space_dispatch_new(view);
     for (i = 0; i < view->nr; i++) {
         MemoryRegionSection mrs =
@@ -988,7 +1033,7 @@ static void flatviews_init(void)
     flat_views = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL,
                                        (GDestroyNotify) flatview_unref);
     if (!empty_view) {
-        empty_view = generate_memory_topology(NULL);
+        empty_view = generate_memory_topology(NULL, NULL);
         /* We keep it alive forever in the global variable.  */
         flatview_ref(empty_view);
     } else {
@@ -999,12 +1044,13 @@ static void flatviews_init(void)
 
 static void flatviews_reset(void)
 {
+    GHashTable *old_views = flat_views;
     AddressSpace *as;
+    int64_t start = get_clock();
+    uint64_t rebuilt = flatview_stats.rebuilt;
+    uint64_t ns;
 
-    if (flat_views) {
-        g_hash_table_unref(flat_views);
-        flat_views = NULL;
-    }
+    flat_views = NULL;
     flatviews_init();
 
     /* Render unique FVs */
@@ -1015,8 +1061,21 @@ static void flatviews_reset(void)
             continue;
         }
 
-        generate_memory_topology(physmr);
+        generate_memory_topology(physmr,
+                                 old_views ?
+                                 g_hash_table_lookup(old_views, physmr) :
+                                 NULL);
+    }
+
+    if (old_views) {
+        g_hash_table_unref(old_views);
     }
+
+    ns = get_clock() - start;
+    flatview_stats.updates++;
+    flatview_stats.total_ns += ns;
+    flatview_stats.max_ns = MAX(flatview_stats.max_ns, ns);
+    trace_flatviews_reset(flatview_stats.rebuilt - rebuilt, ns);
 }
 
 static void address_space_set_flatview(AddressSpace *as)
@@ -1070,7 +1129,7 @@ static void address_space_update_topology(AddressSpace *as)
 
     flatviews_init();
     if (!g_hash_table_lookup(flat_views, physmr)) {
-        generate_memory_topology(physmr);
+        generate_memory_topology(physmr, NULL);
     }
     address_space_set_flatview(as);
 }
@@ -1242,6 +1301,7 @@ static void memory_region_initfn(Object *obj)
     mr->ops = &unassigned_mem_ops;
     mr->enabled = true;
     mr->romd_mode = true;
+    mr->global_locking = true;
     mr->destructor = memory_region_destructor_none;
     QTAILQ_INIT(&mr->subregions);
     QTAILQ_INIT(&mr->coalesced);
@@ -2329,6 +2389,16 @@ void memory_region_clear_flush_coalesced(MemoryRegion *mr)
     }
 }
 
+void memory_region_set_global_locking(MemoryRegion *mr)
+{
+    mr->global_locking = true;
+}
+
+void memory_region_clear_global_locking(MemoryRegion *mr)
+{
+    mr->global_locking = false;
+}
+
 static bool userspace_eventfd_warning;
 
 void memory_region_add_eventfd(MemoryRegion *mr,
@@ -3168,6 +3238,13 @@ void mtree_info(bool flatview, bool dispatch_tree, bool owner, bool disabled)
         /* Print */
         g_hash_table_foreach(views, mtree_print_flatview, &fvi);
 
+        qemu_printf("FlatView updates: %" PRIu64 ", rebuilt: %" PRIu64
+                    ", reused: %" PRIu64 ", time: %" PRIu64
+                    " us (max %" PRIu64 " us)\n\n",
+                    flatview_stats.updates, flatview_stats.rebuilt,
+                    flatview_stats.reused, flatview_stats.total_ns / SCALE_US,
+                    flatview_stats.max_ns / SCALE_US);
+
         /* Free */
         g_hash_table_foreach_remove(views, mtree_info_flatview_free, 0);
         g_hash_table_unref(views);
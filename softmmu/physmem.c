@@ -2725,7 +2725,8 @@ static bool prepare_mmio_access(MemoryRegion *mr)
 {
     bool release_lock = false;
 
-    if (!qemu_mutex_iothread_locked()) {
+    if (!qemu_mutex_iothread_locked() &&
+        (mr->global_locking || mr->flush_coalesced_mmio)) {
         qemu_mutex_lock_iothread();
         release_lock = true;
     }
@@ -232,9 +232,29 @@ static void (* const cpu_stfn[])(CPUArchState *env,
     cpu_stb_data_ra, cpu_stw_data_ra, cpu_stl_data_ra,
 };
 
+/* Bytes that may be processed before either pointer crosses a page.  */
+static uint32_t string_chunk(CPURXState *env, uint32_t dst, uint32_t src)
+{
+    uint32_t n = MIN(-(dst | TARGET_PAGE_MASK), -(src | TARGET_PAGE_MASK));
+    return MIN(env->regs[3], n);
+}
+
 void helper_sstr(CPURXState *env, uint32_t sz)
 {
     tcg_debug_assert(sz < 3);
+    if (sz == 0) {
+        /*
+         * Process one page per step so that R1/R3 are exact if a
+         * later page faults.
+         */
+        while (env->regs[3] != 0) {
+            uint32_t n = string_chunk(env, env->regs[1], env->regs[1]);
+            cpu_memset_data_ra(env, env->regs[1], env->regs[2], n, GETPC());
+            env->regs[1] += n;
+            env->regs[3] -= n;
+        }
+        return;
+    }
     while (env->regs[3] != 0) {
         cpu_stfn[sz](env, env->regs[1], env->regs[2], GETPC());
         env->regs[1] += 1 << sz;
@@ -251,6 +271,18 @@ static void smov(uint32_t mode, CPURXState *env)
     uint8_t tmp;
     int dir;
 
+    if (mode == OP_SMOVF) {
+        /* As for sstr, step by page so the registers are exact on fault.  */
+        while (env->regs[3] != 0) {
+            uint32_t n = string_chunk(env, env->regs[1], env->regs[2]);
+            cpu_memcpy_data_ra(env, env->regs[1], env->regs[2], n, GETPC());
+            env->regs[1] += n;
+            env->regs[2] += n;
+            env->regs[3] -= n;
+        }
+        return;
+    }
+
     dir = (mode & OP_SMOVB) ? -1 : 1;
     while (env->regs[3] != 0) {
         tmp = cpu_ldub_data_ra(env, env->regs[2], GETPC());
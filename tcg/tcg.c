@@ -31,6 +31,7 @@
 #undef DEBUG_JIT
 
 #include "qemu/error-report.h"
+#include "qemu/bitmap.h"
 #include "qemu/cutils.h"
 #include "qemu/host-utils.h"
 #include "qemu/qemu-print.h"
@@ -187,6 +188,12 @@ struct tcg_region_state {
     /* fields protected by the lock */
     size_t current; /* current region index */
     size_t agg_size_full; /* aggregate size of full regions */
+    uint64_t gen; /* allocation counter, for eviction order */
+    uint64_t *alloc_gen; /* per region: value of .gen when last assigned */
+    size_t *size_full; /* per region: contribution to .agg_size_full */
+    size_t *free_stack; /* regions recycled by tcg_region_evict() */
+    size_t n_free;
+    size_t n_evicted; /* statistics */
 };
 
 static struct tcg_region_state region;
@@ -400,22 +407,24 @@ static void tcg_region_trees_init(void)
     }
 }
 
-static struct tcg_region_tree *tc_ptr_to_region_tree(void *p)
+static size_t tc_ptr_to_region_idx(const void *p)
 {
-    size_t region_idx;
-
     if (p < region.start_aligned) {
-        region_idx = 0;
+        return 0;
     } else {
         ptrdiff_t offset = p - region.start_aligned;
 
         if (offset > region.stride * (region.n - 1)) {
-            region_idx = region.n - 1;
+            return region.n - 1;
         } else {
-            region_idx = offset / region.stride;
+            return offset / region.stride;
         }
     }
-    return region_trees + region_idx * tree_size;
+}
+
+static struct tcg_region_tree *tc_ptr_to_region_tree(void *p)
+{
+    return region_trees + tc_ptr_to_region_idx(p) * tree_size;
 }
 
 void tcg_tb_insert(TranslationBlock *tb)
@@ -511,6 +520,15 @@ static gboolean tcg_region_tree_traverse(gpointer k, gpointer v, gpointer data)
     return FALSE;
 }
 
+/* Call with rt->lock held */
+static void tcg_region_tree_reset__locked(struct tcg_region_tree *rt)
+{
+    g_tree_foreach(rt->tree, tcg_region_tree_traverse, NULL);
+    /* Increment the refcount first so that destroy acts as a reset */
+    g_tree_ref(rt->tree);
+    g_tree_destroy(rt->tree);
+}
+
 static void tcg_region_tree_reset_all(void)
 {
     size_t i;
@@ -519,10 +537,7 @@ static void tcg_region_tree_reset_all(void)
     for (i = 0; i < region.n; i++) {
         struct tcg_region_tree *rt = region_trees + i * tree_size;
 
-        g_tree_foreach(rt->tree, tcg_region_tree_traverse, NULL);
-        /* Increment the refcount first so that destroy acts as a reset */
-        g_tree_ref(rt->tree);
-        g_tree_destroy(rt->tree);
+        tcg_region_tree_reset__locked(rt);
     }
     tcg_region_tree_unlock_all();
 }
@@ -559,11 +574,17 @@ static void tcg_region_assign(TCGContext *s, size_t curr_region)
 
 static bool tcg_region_alloc__locked(TCGContext *s)
 {
-    if (region.current == region.n) {
+    size_t curr_region;
+
+    if (region.current < region.n) {
+        curr_region = region.current++;
+    } else if (region.n_free) {
+        curr_region = region.free_stack[--region.n_free];
+    } else {
         return true;
     }
-    tcg_region_assign(s, region.current);
-    region.current++;
+    region.alloc_gen[curr_region] = ++region.gen;
+    tcg_region_assign(s, curr_region);
     return false;
 }
 
@@ -574,12 +595,14 @@ static bool tcg_region_alloc__locked(TCGContext *s)
 static bool tcg_region_alloc(TCGContext *s)
 {
     bool err;
-    /* read the region size now; alloc__locked will overwrite it on success */
+    /* read the region now; alloc__locked will overwrite it on success */
     size_t size_full = s->code_gen_buffer_size;
+    size_t prev_region = tc_ptr_to_region_idx(s->code_gen_buffer);
 
     qemu_mutex_lock(&region.lock);
     err = tcg_region_alloc__locked(s);
     if (!err) {
+        region.size_full[prev_region] = size_full - TCG_HIGHWATER;
         region.agg_size_full += size_full - TCG_HIGHWATER;
     }
     qemu_mutex_unlock(&region.lock);
@@ -604,6 +627,8 @@ void tcg_region_reset_all(void)
     qemu_mutex_lock(&region.lock);
     region.current = 0;
     region.agg_size_full = 0;
+    region.n_free = 0;
+    memset(region.size_full, 0, region.n * sizeof(*region.size_full));
 
     for (i = 0; i < n_ctxs; i++) {
         TCGContext *s = qatomic_read(&tcg_ctxs[i]);
@@ -616,6 +641,83 @@ void tcg_region_reset_all(void)
     tcg_region_tree_reset_all();
 }
 
+/*
+ * Call from a safe-work context.
+ *
+ * Recycle up to @n regions, least recently allocated first, skipping any
+ * region that a TCG context is currently translating into.  @invalidate is
+ * called for each TB in a victim region, and must unlink it from the rest
+ * of the code cache; the TBs are then destroyed and the region is made
+ * available to tcg_region_alloc().  Returns the number of regions evicted;
+ * zero means the caller must fall back to a full flush.
+ */
+size_t tcg_region_evict(size_t n, GTraverseFunc invalidate)
+{
+    unsigned int n_ctxs = qatomic_read(&n_tcg_ctxs);
+    unsigned long *busy = bitmap_new(region.n);
+    size_t i, done = 0;
+
+    qemu_mutex_lock(&region.lock);
+
+    /* Regions never handed out, already free, or in use are not victims */
+    bitmap_set(busy, region.current, region.n - region.current);
+    for (i = 0; i < region.n_free; i++) {
+        set_bit(region.free_stack[i], busy);
+    }
+    for (i = 0; i < n_ctxs; i++) {
+        const TCGContext *s = qatomic_read(&tcg_ctxs[i]);
+
+        set_bit(tc_ptr_to_region_idx(s->code_gen_buffer), busy);
+    }
+
+    while (done < n) {
+        struct tcg_region_tree *rt;
+        size_t victim = region.n;
+
+        for (i = 0; i < region.n; i++) {
+            if (!test_bit(i, busy) &&
+                (victim == region.n ||
+                 region.alloc_gen[i] < region.alloc_gen[victim])) {
+                victim = i;
+            }
+        }
+        if (victim == region.n) {
+            break;
+        }
+        set_bit(victim, busy);
+
+        rt = region_trees + victim * tree_size;
+        qemu_mutex_lock(&rt->lock);
+        g_tree_foreach(rt->tree, invalidate, NULL);
+        tcg_region_tree_reset__locked(rt);
+        qemu_mutex_unlock(&rt->lock);
+
+        region.agg_size_full -= region.size_full[victim];
+        region.size_full[victim] = 0;
+        region.free_stack[region.n_free++] = victim;
+        done++;
+    }
+    region.n_evicted += done;
+
+    qemu_mutex_unlock(&region.lock);
+    g_free(busy);
+    return done;
+}
+
+/*
+ * Report region occupancy: the total number of regions, how many hold
+ * translated code (including those being filled), and how many have been
+ * recycled by tcg_region_evict() since startup.
+ */
+void tcg_region_stats(size_t *n_total, size_t *n_used, size_t *n_evicted)
+{
+    qemu_mutex_lock(&region.lock);
+    *n_total = region.n;
+    *n_used = region.current - region.n_free;
+    *n_evicted = region.n_evicted;
+    qemu_mutex_unlock(&region.lock);
+}
+
 #ifdef CONFIG_USER_ONLY
 static size_t tcg_n_regions(void)
 {
@@ -719,6 +821,9 @@ void tcg_region_init(void)
     region.stride = region_size;
     region.start = buf;
     region.start_aligned = aligned;
+    region.alloc_gen = g_new0(uint64_t, n_regions);
+    region.size_full = g_new0(size_t, n_regions);
+    region.free_stack = g_new(size_t, n_regions);
     /* page-align the end, since its last page will be a guard page */
     region.end = QEMU_ALIGN_PTR_DOWN(buf + size, page_size);
     /* account for that last guard page */
@@ -2357,6 +2462,13 @@ static TCGOp *tcg_op_alloc(TCGOpcode opc)
 TCGOp *tcg_emit_op(TCGOpcode opc)
 {
     TCGOp *op = tcg_op_alloc(opc);
+
+#ifdef CONFIG_PLUGIN
+    if (tcg_ctx->emit_before_op) {
+        QTAILQ_INSERT_BEFORE(tcg_ctx->emit_before_op, op, link);
+        return op;
+    }
+#endif
     QTAILQ_INSERT_TAIL(&tcg_ctx->ops, op, link);
     return op;
 }
@@ -0,0 +1,125 @@
+# Functional tests for the AF_XDP network backend
+#
+# Copyright (c) 2020 Red Hat, Inc.
+#
+# This work is licensed under the terms of the GNU GPL, version 2 or
+# later.  See the COPYING file in the top-level directory.
+
+import os
+import subprocess
+import tempfile
+
+from avocado import skipUnless
+from avocado_qemu import Test
+
+from qemu.machine import QEMUMachine
+
+
+def has_ip_netns():
+    try:
+        subprocess.run(['ip', 'netns', 'list'], check=True,
+                       stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+    except (OSError, subprocess.CalledProcessError):
+        return False
+    return True
+
+
+@skipUnless(os.geteuid() == 0, 'requires root to create network namespaces')
+@skipUnless(has_ip_netns(), 'requires iproute2 with network namespaces')
+class AFXDP(Test):
+    """
+    Attaches the af-xdp backend to one end of a veth pair that lives in
+    its own network namespace, so that the host network is not touched.
+
+    :avocado: tags=af_xdp,quick
+    """
+
+    netns = None
+
+    def setUp(self):
+        super().setUp()
+        self._sd = tempfile.TemporaryDirectory(prefix="avo_qemu_sock_")
+        out = subprocess.run([self.qemu_bin, '-netdev', 'help'],
+                             stdout=subprocess.PIPE,
+                             universal_newlines=True).stdout
+        if 'af-xdp' not in out.split():
+            self.cancel('QEMU was built without AF_XDP support')
+
+        self.netns = 'qemu-af-xdp-%d' % os.getpid()
+        subprocess.run(['ip', 'netns', 'add', self.netns], check=True)
+        self.ip('link', 'add', 'veth0', 'numtxqueues', '2',
+                'numrxqueues', '2', 'type', 'veth', 'peer', 'name', 'veth1')
+        self.ip('link', 'set', 'veth0', 'up')
+        self.ip('link', 'set', 'veth1', 'up')
+
+    def tearDown(self):
+        super().tearDown()
+        if self.netns:
+            subprocess.run(['ip', 'netns', 'del', self.netns])
+
+    def ip(self, *args):
+        return subprocess.run(['ip', '-n', self.netns] + list(args),
+                              check=True, stdout=subprocess.PIPE,
+                              universal_newlines=True).stdout
+
+    def xdp_attached(self):
+        return 'prog/xdp' in self.ip('link', 'show', 'dev', 'veth0')
+
+    def netns_vm(self, name):
+        """Returns a VM that runs in the test's network namespace"""
+        vm = QEMUMachine(self.qemu_bin, sock_dir=self._sd.name,
+                         wrapper=['ip', 'netns', 'exec', self.netns])
+        vm.add_args('-nodefaults', '-S')
+        self._vms[name] = vm
+        return vm
+
+    def netdev_add(self, vm, netdev_id, **kwargs):
+        return vm.qmp('netdev_add', type='af-xdp', id=netdev_id,
+                      ifname='veth0', mode='skb', **kwargs)
+
+    def test_attach_detach(self):
+        vm = self.netns_vm('default')
+        vm.launch()
+        self.assertFalse(self.xdp_attached())
+
+        self.assertEqual(self.netdev_add(vm, 'n0'), {'return': {}})
+        self.assertTrue(self.xdp_attached())
+
+        self.assertEqual(vm.qmp('netdev_del', id='n0'), {'return': {}})
+        self.assertFalse(self.xdp_attached())
+
+    def test_queue_out_of_range(self):
+        vm = self.netns_vm('default')
+        vm.launch()
+        res = self.netdev_add(vm, 'n0', start_queue=2)
+        self.assertIn('error', res)
+        self.assertFalse(self.xdp_attached())
+
+    def test_missing_interface(self):
+        vm = self.netns_vm('default')
+        vm.launch()
+        res = vm.qmp('netdev_add', type='af-xdp', id='n0', ifname='nonexist')
+        self.assertEqual(res['error']['class'], 'GenericError')
+        self.assertIn("failed to get ifindex for 'nonexist'",
+                      res['error']['desc'])
+
+    def test_shared_program_left_attached(self):
+        """
+        A backend that reuses the XDP program of another one must not
+        remove it when it goes away.
+        """
+        owner = self.netns_vm('owner')
+        owner.launch()
+        self.assertEqual(self.netdev_add(owner, 'n0', start_queue=0),
+                         {'return': {}})
+
+        user = self.netns_vm('user')
+        user.launch()
+        self.assertEqual(self.netdev_add(user, 'n0', start_queue=1),
+                         {'return': {}})
+
+        self.assertEqual(user.qmp('netdev_del', id='n0'), {'return': {}})
+        self.assertTrue(self.xdp_attached())
+
+        self.assertEqual(owner.qmp('netdev_del', id='n0'), {'return': {}})
+        self.assertFalse(self.xdp_attached())
@@ -0,0 +1,451 @@
+/*
+ * Benchmark for the sharded colo-compare connection tracking
+ *
+ * Replays a packet trace as both the primary and the secondary stream,
+ * hashing every packet to a compare shard the way colo-compare does with
+ * workers=N, and measures how fast the shards can track and compare the
+ * connections.  The trace is either a libpcap file, such as the ones
+ * written by filter-dump, or a synthetic set of interleaved TCP flows.
+ *
+ * License: GNU GPL, version 2 or later.
+ *   See the COPYING file in the top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu/atomic.h"
+#include "qemu/bswap.h"
+#include "qemu/queue.h"
+#include "qemu/thread.h"
+#include "../net/colo.h"
+#include "../net/util.h"
+
+#define PCAP_MAGIC 0xa1b2c3d4
+
+struct pcap_file_hdr {
+    uint32_t magic;
+    uint16_t version_major;
+    uint16_t version_minor;
+    int32_t thiszone;
+    uint32_t sigfigs;
+    uint32_t snaplen;
+    uint32_t linktype;
+};
+
+struct pcap_sf_pkthdr {
+    struct {
+        int32_t tv_sec;
+        int32_t tv_usec;
+    } ts;
+    uint32_t caplen;
+    uint32_t len;
+};
+
+typedef struct Frame {
+    uint8_t *data;
+    int size;
+} Frame;
+
+typedef struct BenchItem {
+    Packet *pkt;
+    ConnectionKey key;
+    bool primary;
+    QSLIST_ENTRY(BenchItem) next;
+} BenchItem;
+
+typedef QSLIST_HEAD(, BenchItem) BenchItemList;
+
+typedef struct BenchShard {
+    QemuThread thread;
+    QemuEvent event;
+    BenchItemList list;
+    bool done;
+    bool checkpoint;
+
+    GQueue conn_list;
+    GHashTable *connection_track_table;
+
+    size_t packets;
+    size_t matched;
+    size_t mismatched;
+} QEMU_ALIGNED(64) BenchShard;
+
+static const char commands_string[] =
+    " -n = number of compare workers (0 compares in the dispatching thread)\n"
+    " -r = replay this pcap file instead of a synthetic trace\n"
+    " -i = number of times the trace is replayed\n"
+    "\n"
+    "synthetic trace:\n"
+    " -f = number of TCP flows\n"
+    " -p = number of packets per flow\n"
+    " -s = TCP payload size\n"
+    " -m = rate (0.0 to 100.0) of secondary packets that differ";
+
+static unsigned int n_workers;
+static const char *pcap_file;
+static unsigned int iterations = 1;
+static unsigned int n_flows = 4096;
+static unsigned int n_pkts_per_flow = 64;
+static unsigned int payload_size = 1024;
+static double mismatch_rate;
+
+static Frame *frames;
+static size_t n_frames;
+static BenchShard *shards;
+static unsigned int n_shards;
+
+static void usage_complete(int argc, char *argv[])
+{
+    fprintf(stderr, "Usage: %s [options]\n", argv[0]);
+    fprintf(stderr, "options:\n%s\n", commands_string);
+    exit(-1);
+}
+
+static void frames_add(const uint8_t *data, int size)
+{
+    if (!(n_frames & (n_frames - 1))) {
+        frames = g_renew(Frame, frames, n_frames ? n_frames * 2 : 1);
+    }
+    frames[n_frames].data = g_memdup(data, size);
+    frames[n_frames].size = size;
+    n_frames++;
+}
+
+static void load_pcap(const char *filename)
+{
+    struct pcap_file_hdr hdr;
+    struct pcap_sf_pkthdr pkthdr;
+    uint8_t *buf = NULL;
+    bool swap;
+    FILE *f;
+
+    f = fopen(filename, "rb");
+    if (!f) {
+        fprintf(stderr, "%s: %s\n", filename, strerror(errno));
+        exit(1);
+    }
+    if (fread(&hdr, sizeof(hdr), 1, f) != 1 ||
+        (hdr.magic != PCAP_MAGIC && hdr.magic != bswap32(PCAP_MAGIC))) {
+        fprintf(stderr, "%s: not a pcap file\n", filename);
+        exit(1);
+    }
+    swap = hdr.magic != PCAP_MAGIC;
+
+    while (fread(&pkthdr, sizeof(pkthdr), 1, f) == 1) {
+        uint32_t caplen = swap ? bswap32(pkthdr.caplen) : pkthdr.caplen;
+
+        buf = g_realloc(buf, caplen);
+        if (fread(buf, caplen, 1, f) != 1) {
+            break;
+        }
+        frames_add(buf, caplen);
+    }
+    g_free(buf);
+    fclose(f);
+}
+
+static void build_synthetic_trace(void)
+{
+    size_t hdr_len = sizeof(struct eth_header) + sizeof(struct ip_header) +
+                     sizeof(struct tcp_hdr);
+    size_t size = hdr_len + payload_size;
+    uint8_t *buf = g_malloc0(size);
+    struct eth_header *eth = (struct eth_header *)buf;
+    struct ip_header *ip = (struct ip_header *)(eth + 1);
+    struct tcp_hdr *tcp = (struct tcp_hdr *)(ip + 1);
+    unsigned int i, j;
+
+    eth->h_proto = cpu_to_be16(ETH_P_IP);
+    ip->ip_ver_len = (4 << 4) | (sizeof(*ip) >> 2);
+    ip->ip_len = cpu_to_be16(size - sizeof(*eth));
+    ip->ip_ttl = 64;
+    ip->ip_p = IPPROTO_TCP;
+    ip->ip_dst = cpu_to_be32(0x0a010001);
+    tcp->th_dport = cpu_to_be16(80);
+    tcp->th_off = sizeof(*tcp) >> 2;
+    tcp->th_flags = TH_ACK;
+
+    /* Interleave the flows, as a busy server would */
+    for (j = 0; j < n_pkts_per_flow; j++) {
+        for (i = 0; i < n_flows; i++) {
+            ip->ip_src = cpu_to_be32(0x0a000000 | (i >> 16));
+            tcp->th_sport = cpu_to_be16(1024 + (i & 0xffff));
+            tcp->th_seq = cpu_to_be32(j * payload_size);
+            memset(buf + hdr_len, i + j, payload_size);
+            frames_add(buf, size);
+        }
+    }
+    g_free(buf);
+}
+
+static void bench_release_primary(Packet *pkt, void *opaque)
+{
+    BenchShard *bs = opaque;
+
+    bs->matched++;
+    packet_destroy(pkt, NULL);
+}
+
+static void bench_inconsistency(void *opaque)
+{
+    BenchShard *bs = opaque;
+
+    bs->checkpoint = true;
+}
+
+/* The same compare step that colo-compare runs for each queued packet */
+static const ConnectionCompareOps bench_compare_ops = {
+    .release_primary = bench_release_primary,
+    .inconsistency = bench_inconsistency,
+};
+
+/*
+ * A checkpoint makes both guests consistent again and flushes the packets
+ * queued so far, which is what the benchmark does to the connection that
+ * diverged.
+ */
+static void bench_checkpoint(BenchShard *bs, Connection *conn)
+{
+    bs->mismatched++;
+    bs->checkpoint = false;
+    g_queue_foreach(&conn->primary_list, packet_destroy, NULL);
+    g_queue_clear(&conn->primary_list);
+    g_queue_foreach(&conn->secondary_list, packet_destroy, NULL);
+    g_queue_clear(&conn->secondary_list);
+    conn->compare_seq = 0;
+    conn->pack = 0;
+    conn->sack = 0;
+}
+
+static void bench_shard_packet(BenchShard *bs, BenchItem *item)
+{
+    Connection *conn;
+
+    conn = connection_get(bs->connection_track_table, &item->key,
+                          &bs->conn_list);
+    if (!conn->processing) {
+        g_queue_push_tail(&bs->conn_list, conn);
+        conn->processing = true;
+    }
+    if (item->primary) {
+        connection_queue_packet(&conn->primary_list, item->pkt, &conn->pack);
+    } else {
+        connection_queue_packet(&conn->secondary_list, item->pkt,
+                                &conn->sack);
+    }
+    connection_compare(conn, &bench_compare_ops, bs);
+    if (bs->checkpoint) {
+        bench_checkpoint(bs, conn);
+    }
+    bs->packets++;
+}
+
+static void bench_shard_drain(BenchShard *bs)
+{
+    BenchItemList lifo, fifo;
+    BenchItem *item;
+
+    QSLIST_MOVE_ATOMIC(&lifo, &bs->list);
+    QSLIST_INIT(&fifo);
+    while ((item = QSLIST_FIRST(&lifo))) {
+        QSLIST_REMOVE_HEAD(&lifo, next);
+        QSLIST_INSERT_HEAD(&fifo, item, next);
+    }
+    while ((item = QSLIST_FIRST(&fifo))) {
+        QSLIST_REMOVE_HEAD(&fifo, next);
+        bench_shard_packet(bs, item);
+        g_slice_free(BenchItem, item);
+    }
+}
+
+static void *bench_worker(void *opaque)
+{
+    BenchShard *bs = opaque;
+
+    for (;;) {
+        qemu_event_reset(&bs->event);
+        if (QSLIST_EMPTY(&bs->list)) {
+            if (qatomic_read(&bs->done)) {
+                break;
+            }
+            qemu_event_wait(&bs->event);
+        }
+        bench_shard_drain(bs);
+    }
+    return NULL;
+}
+
+static void bench_dispatch(const Frame *frame, bool primary)
+{
+    BenchItem *item;
+    BenchShard *bs;
+    Packet *pkt;
+
+    pkt = packet_new(frame->data, frame->size, 0);
+    if (parse_packet_early(pkt)) {
+        packet_destroy(pkt, NULL);
+        return;
+    }
+
+    item = g_slice_new(BenchItem);
+    item->pkt = pkt;
+    item->primary = primary;
+    fill_connection_key(pkt, &item->key);
+
+    if (!n_workers) {
+        bench_shard_packet(&shards[0], item);
+        g_slice_free(BenchItem, item);
+        return;
+    }
+
+    bs = &shards[connection_key_shard(&item->key, n_shards)];
+    QSLIST_INSERT_HEAD_ATOMIC(&bs->list, item, next);
+    qemu_event_set(&bs->event);
+}
+
+static void run_bench(void)
+{
+    uint64_t threshold = mismatch_rate / 100 * UINT32_MAX;
+    uint32_t seed = 1;
+    int64_t start, elapsed;
+    size_t packets = 0, matched = 0, mismatched = 0;
+    unsigned int i, it;
+    size_t j;
+
+    n_shards = MAX(n_workers, 1);
+    shards = g_new0(BenchShard, n_shards);
+    for (i = 0; i < n_shards; i++) {
+        BenchShard *bs = &shards[i];
+
+        qemu_event_init(&bs->event, false);
+        QSLIST_INIT(&bs->list);
+        g_queue_init(&bs->conn_list);
+        bs->connection_track_table = g_hash_table_new_full(connection_key_hash,
+                                                           connection_key_equal,
+                                                           g_free,
+                                                           connection_destroy);
+    }
+
+    start = g_get_monotonic_time();
+    for (i = 0; i < n_workers; i++) {
+        qemu_thread_create(&shards[i].thread, "colo-bench", bench_worker,
+                           &shards[i], QEMU_THREAD_JOINABLE);
+    }
+
+    for (it = 0; it < iterations; it++) {
+        for (j = 0; j < n_frames; j++) {
+            Frame secondary = frames[j];
+
+            bench_dispatch(&frames[j], true);
+
+            /* xorshift32 */
+            seed ^= seed << 13;
+            seed ^= seed >> 17;
+            seed ^= seed << 5;
+            if (seed < threshold) {
+                secondary.data = g_memdup(frames[j].data, frames[j].size);
+                secondary.data[secondary.size - 1] ^= 0xff;
+                bench_dispatch(&secondary, false);
+                g_free(secondary.data);
+            } else {
+                bench_dispatch(&secondary, false);
+            }
+        }
+    }
+
+    for (i = 0; i < n_workers; i++) {
+        qatomic_set(&shards[i].done, true);
+        qemu_event_set(&shards[i].event);
+        qemu_thread_join(&shards[i].thread);
+    }
+    elapsed = g_get_monotonic_time() - start;
+
+    for (i = 0; i < n_shards; i++) {
+        BenchShard *bs = &shards[i];
+
+        printf("shard %u: %zu packets, %u connections\n", i, bs->packets,
+               g_hash_table_size(bs->connection_track_table));
+        packets += bs->packets;
+        matched += bs->matched;
+        mismatched += bs->mismatched;
+
+        g_queue_clear(&bs->conn_list);
+        g_hash_table_destroy(bs->connection_track_table);
+        qemu_event_destroy(&bs->event);
+    }
+    g_free(shards);
+
+    printf("workers:     %u\n", n_workers);
+    printf("packets:     %zu\n", packets);
+    printf("matched:     %zu\n", matched);
+    printf("mismatched:  %zu\n", mismatched);
+    printf("time:        %.3f s\n", elapsed / 1e6);
+    printf("throughput:  %.2f Mpps\n", (double)packets / elapsed);
+}
+
+static void parse_args(int argc, char *argv[])
+{
+    int c;
+
+    for (;;) {
+        c = getopt(argc, argv, "f:hi:m:n:p:r:s:");
+        if (c < 0) {
+            break;
+        }
+        switch (c) {
+        case 'f':
+            n_flows = atoi(optarg);
+            break;
+        case 'i':
+            iterations = atoi(optarg);
+            break;
+        case 'm':
+            mismatch_rate = atof(optarg);
+            break;
+        case 'n':
+            n_workers = atoi(optarg);
+            break;
+        case 'p':
+            n_pkts_per_flow = atoi(optarg);
+            break;
+        case 'r':
+            pcap_file = optarg;
+            break;
+        case 's':
+            payload_size = atoi(optarg);
+            break;
+        case 'h':
+            usage_complete(argc, argv);
+            exit(0);
+        default:
+            usage_complete(argc, argv);
+        }
+    }
+    if (!n_flows || !payload_size || mismatch_rate < 0 ||
+        mismatch_rate > 100) {
+        usage_complete(argc, argv);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    size_t i;
+
+    parse_args(argc, argv);
+
+    if (pcap_file) {
+        load_pcap(pcap_file);
+    } else {
+        build_synthetic_trace();
+    }
+    if (!n_frames) {
+        fprintf(stderr, "empty trace\n");
+        return 1;
+    }
+
+    run_bench();
+
+    for (i = 0; i < n_frames; i++) {
+        g_free(frames[i].data);
+    }
+    g_free(frames);
+    return 0;
+}
@@ -0,0 +1,161 @@
+/*
+ * Cross-check per-vCPU inline operations and conditional callbacks
+ * against the equivalent regular callbacks.
+ *
+ * License: GNU GPL, version 2 or later.
+ *   See the COPYING file in the top-level directory.
+ */
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <glib.h>
+
+#include <qemu-plugin.h>
+
+QEMU_PLUGIN_EXPORT int qemu_plugin_version = QEMU_PLUGIN_VERSION;
+
+/* call the conditional callback every COND_PERIOD executions of a TB */
+#define COND_PERIOD 16
+
+typedef struct {
+    uint64_t tb_exec_cb;
+    uint64_t tb_exec_inline;
+    uint64_t insn_exec_cb;
+    uint64_t insn_exec_inline;
+    uint64_t mem_cb;
+    uint64_t mem_inline;
+    uint64_t cond_count;
+    uint64_t cond_hits;
+    uint64_t last_store;
+} CPUCount;
+
+static struct qemu_plugin_scoreboard *counts;
+static qemu_plugin_u64 tb_exec_cb;
+static qemu_plugin_u64 tb_exec_inline;
+static qemu_plugin_u64 insn_exec_cb;
+static qemu_plugin_u64 insn_exec_inline;
+static qemu_plugin_u64 mem_cb;
+static qemu_plugin_u64 mem_inline;
+static qemu_plugin_u64 cond_count;
+static qemu_plugin_u64 cond_hits;
+static qemu_plugin_u64 last_store;
+
+static GMutex lock;
+static unsigned int n_vcpus;
+
+static void vcpu_init(qemu_plugin_id_t id, unsigned int vcpu_index)
+{
+    g_mutex_lock(&lock);
+    n_vcpus = MAX(n_vcpus, vcpu_index + 1);
+    g_mutex_unlock(&lock);
+}
+
+static void vcpu_tb_exec(unsigned int vcpu_index, void *udata)
+{
+    qemu_plugin_u64_add(tb_exec_cb, vcpu_index, 1);
+}
+
+static void vcpu_tb_cond(unsigned int vcpu_index, void *udata)
+{
+    qemu_plugin_u64_add(cond_hits, vcpu_index, 1);
+    qemu_plugin_u64_set(cond_count, vcpu_index, 0);
+}
+
+static void vcpu_insn_exec(unsigned int vcpu_index, void *udata)
+{
+    qemu_plugin_u64_add(insn_exec_cb, vcpu_index, 1);
+}
+
+static void vcpu_mem(unsigned int vcpu_index, qemu_plugin_meminfo_t info,
+                     uint64_t vaddr, void *udata)
+{
+    qemu_plugin_u64_add(mem_cb, vcpu_index, 1);
+}
+
+static void vcpu_tb_trans(qemu_plugin_id_t id, struct qemu_plugin_tb *tb)
+{
+    size_t n = qemu_plugin_tb_n_insns(tb);
+    size_t i;
+
+    qemu_plugin_register_vcpu_tb_exec_cb(tb, vcpu_tb_exec,
+                                         QEMU_PLUGIN_CB_NO_REGS, NULL);
+    qemu_plugin_register_vcpu_tb_exec_inline_per_vcpu(
+        tb, QEMU_PLUGIN_INLINE_ADD_U64, tb_exec_inline, 1);
+    qemu_plugin_register_vcpu_tb_exec_inline_per_vcpu(
+        tb, QEMU_PLUGIN_INLINE_ADD_U64, cond_count, 1);
+    qemu_plugin_register_vcpu_tb_exec_inline_per_vcpu(
+        tb, QEMU_PLUGIN_INLINE_STORE_U64, last_store, n);
+    qemu_plugin_register_vcpu_tb_exec_cond_cb(
+        tb, vcpu_tb_cond, QEMU_PLUGIN_CB_NO_REGS, QEMU_PLUGIN_COND_GE,
+        cond_count, COND_PERIOD, NULL);
+
+    for (i = 0; i < n; i++) {
+        struct qemu_plugin_insn *insn = qemu_plugin_tb_get_insn(tb, i);
+
+        qemu_plugin_register_vcpu_insn_exec_cb(insn, vcpu_insn_exec,
+                                               QEMU_PLUGIN_CB_NO_REGS, NULL);
+        qemu_plugin_register_vcpu_insn_exec_inline_per_vcpu(
+            insn, QEMU_PLUGIN_INLINE_ADD_U64, insn_exec_inline, 1);
+        qemu_plugin_register_vcpu_mem_cb(insn, vcpu_mem,
+                                         QEMU_PLUGIN_CB_NO_REGS,
+                                         QEMU_PLUGIN_MEM_RW, NULL);
+        qemu_plugin_register_vcpu_mem_inline_per_vcpu(
+            insn, QEMU_PLUGIN_MEM_RW, QEMU_PLUGIN_INLINE_ADD_U64,
+            mem_inline, 1);
+    }
+}
+
+static void plugin_exit(qemu_plugin_id_t id, void *udata)
+{
+    g_autoptr(GString) report = g_string_new("");
+    unsigned int i;
+
+    for (i = 0; i < n_vcpus; i++) {
+        uint64_t tbs = qemu_plugin_u64_get(tb_exec_inline, i);
+
+        g_assert(qemu_plugin_u64_get(tb_exec_cb, i) == tbs);
+        g_assert(qemu_plugin_u64_get(insn_exec_cb, i) ==
+                 qemu_plugin_u64_get(insn_exec_inline, i));
+        g_assert(qemu_plugin_u64_get(mem_cb, i) ==
+                 qemu_plugin_u64_get(mem_inline, i));
+        g_assert(qemu_plugin_u64_get(cond_hits, i) == tbs / COND_PERIOD);
+        g_assert(qemu_plugin_u64_get(cond_count, i) == tbs % COND_PERIOD);
+        g_assert(tbs == 0 || qemu_plugin_u64_get(last_store, i) != 0);
+    }
+    g_string_printf(report, "tb: %" PRIu64 ", insn: %" PRIu64
+                    ", mem: %" PRIu64 ", cond: %" PRIu64 "\n",
+                    qemu_plugin_u64_sum(tb_exec_inline),
+                    qemu_plugin_u64_sum(insn_exec_inline),
+                    qemu_plugin_u64_sum(mem_inline),
+                    qemu_plugin_u64_sum(cond_hits));
+    qemu_plugin_outs(report->str);
+}
+
+QEMU_PLUGIN_EXPORT
+int qemu_plugin_install(qemu_plugin_id_t id, const qemu_info_t *info,
+                        int argc, char **argv)
+{
+    counts = qemu_plugin_scoreboard_new(sizeof(CPUCount));
+    tb_exec_cb = qemu_plugin_scoreboard_u64_in_struct(counts, CPUCount,
+                                                      tb_exec_cb);
+    tb_exec_inline = qemu_plugin_scoreboard_u64_in_struct(counts, CPUCount,
+                                                          tb_exec_inline);
+    insn_exec_cb = qemu_plugin_scoreboard_u64_in_struct(counts, CPUCount,
+                                                        insn_exec_cb);
+    insn_exec_inline = qemu_plugin_scoreboard_u64_in_struct(counts, CPUCount,
+                                                            insn_exec_inline);
+    mem_cb = qemu_plugin_scoreboard_u64_in_struct(counts, CPUCount, mem_cb);
+    mem_inline = qemu_plugin_scoreboard_u64_in_struct(counts, CPUCount,
+                                                      mem_inline);
+    cond_count = qemu_plugin_scoreboard_u64_in_struct(counts, CPUCount,
+                                                      cond_count);
+    cond_hits = qemu_plugin_scoreboard_u64_in_struct(counts, CPUCount,
+                                                     cond_hits);
+    last_store = qemu_plugin_scoreboard_u64_in_struct(counts, CPUCount,
+                                                      last_store);
+
+    qemu_plugin_register_vcpu_init_cb(id, vcpu_init);
+    qemu_plugin_register_vcpu_tb_trans_cb(id, vcpu_tb_trans);
+    qemu_plugin_register_atexit_cb(id, plugin_exit, NULL);
+    return 0;
+}
@@ -55,6 +55,7 @@
 #define VHOST_USER_PROTOCOL_F_MQ 0
 #define VHOST_USER_PROTOCOL_F_LOG_SHMFD 1
 #define VHOST_USER_PROTOCOL_F_CROSS_ENDIAN   6
+#define VHOST_USER_PROTOCOL_F_LOG_RING 17
 
 #define VHOST_LOG_PAGE 0x1000
 
@@ -78,6 +79,7 @@ typedef enum VhostUserRequest {
     VHOST_USER_SET_PROTOCOL_FEATURES = 16,
     VHOST_USER_GET_QUEUE_NUM = 17,
     VHOST_USER_SET_VRING_ENABLE = 18,
+    VHOST_USER_SET_LOG_RING = 41,
     VHOST_USER_MAX
 } VhostUserRequest;
 
@@ -124,6 +126,24 @@ static VhostUserMsg m __attribute__ ((unused));
 
 #define VHOST_USER_PAYLOAD_SIZE (sizeof(m) - VHOST_USER_HDR_SIZE)
 
+/*********** FROM include/hw/virtio/vhost.h **********************************/
+
+typedef struct VhostLogRingEntry {
+    uint64_t addr;
+    uint32_t len;
+    uint32_t padding;
+} VhostLogRingEntry;
+
+typedef struct VhostLogRingHdr {
+    uint32_t num;
+    uint32_t flags;
+    uint8_t padding1[56];
+    uint32_t head;
+    uint8_t padding2[60];
+    uint32_t tail;
+    uint8_t padding3[60];
+} VhostLogRingHdr;
+
 /* The version of the protocol we support */
 #define VHOST_USER_VERSION    (0x1)
 /*****************************************************************************/
@@ -154,6 +174,10 @@ typedef struct TestServer {
     GMutex data_mutex;
     GCond data_cond;
     int log_fd;
+    bool log_ring;
+    int log_ring_fd;
+    uint64_t log_ring_size;
+    int log_ring_msgs;
     uint64_t rings;
     bool test_fail;
     int test_flags;
@@ -411,6 +435,19 @@ static void chr_read(void *opaque, const uint8_t *buf, int size)
         g_cond_broadcast(&s->data_cond);
         break;
 
+    case VHOST_USER_SET_LOG_RING:
+        g_assert(s->log_ring);
+        if (s->log_ring_fd != -1) {
+            close(s->log_ring_fd);
+            s->log_ring_fd = -1;
+        }
+        qemu_chr_fe_get_msgfds(chr, &s->log_ring_fd, 1);
+        s->log_ring_size = msg.payload.log.mmap_size;
+        s->log_ring_msgs++;
+
+        g_cond_broadcast(&s->data_cond);
+        break;
+
     case VHOST_USER_SET_VRING_BASE:
         assert(msg.payload.state.index < s->queues * 2);
         s->rings |= 0x1ULL << msg.payload.state.index;
@@ -504,6 +541,7 @@ static TestServer *test_server_new(const gchar *name,
     g_cond_init(&server->data_cond);
 
     server->log_fd = -1;
+    server->log_ring_fd = -1;
     server->queues = 1;
     server->vu_ops = ops;
 
@@ -574,6 +612,10 @@ static void test_server_free(TestServer *server)
         close(server->log_fd);
     }
 
+    if (server->log_ring_fd != -1) {
+        close(server->log_ring_fd);
+    }
+
     g_free(server->chr_name);
 
     g_main_loop_unref(server->loop);
@@ -600,6 +642,47 @@ static void wait_for_log_fd(TestServer *s)
     g_mutex_unlock(&s->data_mutex);
 }
 
+static void wait_for_log_ring_fd(TestServer *s)
+{
+    gint64 end_time;
+
+    g_mutex_lock(&s->data_mutex);
+    end_time = g_get_monotonic_time() + 5 * G_TIME_SPAN_SECOND;
+    while (s->log_ring_fd == -1) {
+        if (!g_cond_wait_until(&s->data_cond, &s->data_mutex, end_time)) {
+            /* timeout has passed */
+            g_assert(s->log_ring_fd != -1);
+            break;
+        }
+    }
+
+    g_mutex_unlock(&s->data_mutex);
+}
+
+/* Log a write to the first page through the dirty log ring */
+static void log_ring_mark_first_page(TestServer *s)
+{
+    VhostLogRingHdr *hdr;
+    VhostLogRingEntry *entry;
+    uint32_t head;
+
+    wait_for_log_ring_fd(s);
+
+    hdr = mmap(0, s->log_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+               s->log_ring_fd, 0);
+    g_assert(hdr != MAP_FAILED);
+    g_assert_cmpint(hdr->num, >, 0);
+    g_assert_cmpint(s->log_ring_size, ==,
+                    sizeof(*hdr) + hdr->num * sizeof(*entry));
+
+    head = qatomic_fetch_inc(&hdr->head);
+    g_assert_cmpint(head - qatomic_read(&hdr->tail), <, hdr->num);
+    entry = (VhostLogRingEntry *)(hdr + 1) + (head & (hdr->num - 1));
+    entry->addr = 0;
+    qatomic_store_release(&entry->len, VHOST_LOG_PAGE);
+    munmap(hdr, s->log_ring_size);
+}
+
 static void write_guest_mem(TestServer *s, uint32_t seed)
 {
     uint32_t *guest_mem;
@@ -738,6 +821,8 @@ static void test_migrate(void *obj, void *arg, QGuestAllocator *alloc)
     size = get_log_size(s);
     g_assert_cmpint(size, ==, (256 * 1024 * 1024) / (VHOST_LOG_PAGE * 8));
 
+    dest->queues = s->queues;
+    dest->log_ring = s->log_ring;
     test_server_listen(dest);
     g_string_append_printf(dest_cmdline, " -incoming %s", uri);
     append_mem_opts(dest, dest_cmdline, 256, TEST_MEMFD_AUTO);
@@ -772,7 +857,11 @@ static void test_migrate(void *obj, void *arg, QGuestAllocator *alloc)
 
     /* modify first page */
     write_guest_mem(s, 0x42);
-    log[0] = 1;
+    if (s->log_ring) {
+        log_ring_mark_first_page(s);
+    } else {
+        log[0] = 1;
+    }
     munmap(log, size);
 
     /* speed things up */
@@ -787,6 +876,13 @@ static void test_migrate(void *obj, void *arg, QGuestAllocator *alloc)
     g_assert(wait_for_fds(dest));
     read_guest_mem_server(to, dest);
 
+    if (s->log_ring) {
+        /* Sent once for the device, not for every queue pair */
+        g_mutex_lock(&s->data_mutex);
+        g_assert_cmpint(s->log_ring_msgs, ==, 1);
+        g_mutex_unlock(&s->data_mutex);
+    }
+
     g_source_destroy(source);
     g_source_unref(source);
 
@@ -928,6 +1024,15 @@ static void *vhost_user_test_setup_multiqueue(GString *cmd_line, void *arg)
     return s;
 }
 
+static void *vhost_user_test_setup_log_ring(GString *cmd_line, void *arg)
+{
+    TestServer *s = vhost_user_test_setup_multiqueue(cmd_line, arg);
+
+    s->log_ring = true;
+
+    return s;
+}
+
 static void test_multiqueue(void *obj, void *arg, QGuestAllocator *alloc)
 {
     TestServer *s = arg;
@@ -957,6 +1062,9 @@ static void vu_net_get_protocol_features(TestServer *s, CharBackend *chr,
     if (s->queues > 1) {
         msg->payload.u64 |= 1 << VHOST_USER_PROTOCOL_F_MQ;
     }
+    if (s->log_ring) {
+        msg->payload.u64 |= 1 << VHOST_USER_PROTOCOL_F_LOG_RING;
+    }
     qemu_chr_fe_write_all(chr, (uint8_t *)msg, VHOST_USER_HDR_SIZE + msg->size);
 }
 
@@ -1015,5 +1123,13 @@ static void register_vhost_user_test(void)
     qos_add_test("vhost-user/multiqueue",
                  "virtio-net",
                  test_multiqueue, &opts);
+
+    /* the ring is allocated with memfd */
+    if (qemu_memfd_check(MFD_ALLOW_SEALING)) {
+        opts.before = vhost_user_test_setup_log_ring;
+        qos_add_test("vhost-user/migrate/log-ring",
+                     "virtio-net",
+                     test_migrate, &opts);
+    }
 }
 libqos_init(register_vhost_user_test);
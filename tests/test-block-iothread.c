@@ -622,7 +622,7 @@ static void test_propagate_mirror(void)
                                   &error_abort);
 
     /* Start a mirror job */
-    mirror_start("job0", src, target, NULL, JOB_DEFAULT, 0, 0, 0,
+    mirror_start("job0", src, target, NULL, JOB_DEFAULT, 0, 0, 0, 1,
                  MIRROR_SYNC_MODE_NONE, MIRROR_OPEN_BACKING_CHAIN, false,
                  BLOCKDEV_ON_ERROR_REPORT, BLOCKDEV_ON_ERROR_REPORT,
                  false, "filter_node", MIRROR_COPY_MODE_BACKGROUND,
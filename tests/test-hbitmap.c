@@ -12,6 +12,7 @@
 #include "qemu/osdep.h"
 #include "qemu/hbitmap.h"
 #include "qemu/bitmap.h"
+#include "qemu/units.h"
 #include "block/block.h"
 
 #define LOG_BITS_PER_LONG          (BITS_PER_LONG == 32 ? 5 : 6)
@@ -1042,6 +1043,120 @@ static void test_hbitmap_next_dirty_area_after_truncate(TestHBitmapData *data,
     test_hbitmap_next_dirty_area_check(data, 0, INT64_MAX);
 }
 
+/* Fill the fixture and return a second bitmap to merge with it.  The bits
+ * of the second bitmap are already added to the shadow bitmap.
+ */
+static HBitmap *hbitmap_test_merge_init(TestHBitmapData *data)
+{
+    HBitmap *hb;
+    HBitmapIter hbi;
+    int64_t pos;
+
+    hbitmap_test_init(data, L3, 0);
+    hbitmap_test_set(data, 0, 1);
+    hbitmap_test_set(data, L1 - 1, 3);
+    hbitmap_test_set(data, L2 + 5, L1 * 3);
+
+    hb = hbitmap_alloc(L3, 0);
+    hbitmap_set(hb, L1, L1 * 2);
+    hbitmap_set(hb, L2 + 7, 10);
+    hbitmap_set(hb, L2 * 3, L2 + 1);
+    hbitmap_set(hb, L3 - 1, 1);
+
+    hbitmap_iter_init(&hbi, hb, 0);
+    while ((pos = hbitmap_iter_next(&hbi)) >= 0) {
+        data->bits[pos >> LOG_BITS_PER_LONG] |=
+            1UL << (pos & (BITS_PER_LONG - 1));
+    }
+    return hb;
+}
+
+static void test_hbitmap_merge_in_place(TestHBitmapData *data,
+                                        const void *unused)
+{
+    HBitmap *hb = hbitmap_test_merge_init(data);
+
+    g_assert(hbitmap_merge(data->hb, hb, data->hb));
+    hbitmap_test_check(data, 0);
+    hbitmap_free(hb);
+}
+
+static void test_hbitmap_merge_into_b(TestHBitmapData *data,
+                                      const void *unused)
+{
+    HBitmap *hb = hbitmap_test_merge_init(data);
+
+    g_assert(hbitmap_merge(hb, data->hb, data->hb));
+    hbitmap_test_check(data, 0);
+    hbitmap_free(hb);
+}
+
+static void test_hbitmap_merge_copy(TestHBitmapData *data,
+                                    const void *unused)
+{
+    HBitmap *hb = hbitmap_test_merge_init(data);
+    HBitmap *result = hbitmap_alloc(L3, 0);
+
+    /* Stale contents of the result must not survive */
+    hbitmap_set(result, L2 * 2, L1);
+    g_assert(hbitmap_merge(data->hb, hb, result));
+    hbitmap_free(data->hb);
+    data->hb = result;
+    hbitmap_test_check(data, 0);
+    hbitmap_free(hb);
+}
+
+/* Merge and serialize bitmaps for a 1 TiB disk with 64 KiB granularity,
+ * where one quarter of the disk is dirty.  Only run with -m perf.
+ */
+static void test_hbitmap_merge_bench(TestHBitmapData *data,
+                                     const void *unused)
+{
+    const uint64_t size = 1ULL << 40;
+    const int iterations = 100;
+    HBitmap *a = hbitmap_alloc(size, 16);
+    HBitmap *b = hbitmap_alloc(size, 16);
+    uint64_t buf_size, offset;
+    uint8_t *buf;
+    int i;
+
+    for (offset = 0; offset < size; offset += 64 * MiB) {
+        hbitmap_set(a, offset, 1 * MiB);
+        hbitmap_set(b, offset + 32 * MiB, 15 * MiB);
+    }
+
+    g_test_timer_start();
+    for (i = 0; i < iterations; i++) {
+        hbitmap_merge(a, b, a);
+    }
+    g_test_timer_elapsed();
+    g_test_message("merge: %.1f us per bitmap",
+                   g_test_timer_last() * 1e6 / iterations);
+
+    buf_size = hbitmap_serialization_size(a, 0, size);
+    buf = g_malloc(buf_size);
+    g_test_timer_start();
+    for (i = 0; i < iterations; i++) {
+        hbitmap_serialize_part(a, buf, 0, size);
+    }
+    g_test_timer_elapsed();
+    g_test_message("serialize: %.1f MiB/s",
+                   (double)buf_size * iterations / MiB / g_test_timer_last());
+
+    g_test_timer_start();
+    for (i = 0; i < iterations; i++) {
+        hbitmap_deserialize_part(b, buf, 0, size, true);
+    }
+    g_test_timer_elapsed();
+    g_test_message("deserialize: %.1f MiB/s",
+                   (double)buf_size * iterations / MiB / g_test_timer_last());
+    g_assert_cmpint(hbitmap_count(a), ==, hbitmap_count(b));
+
+    g_free(buf);
+    hbitmap_free(a);
+    hbitmap_free(b);
+}
+
 int main(int argc, char **argv)
 {
     g_test_init(&argc, &argv, NULL);
@@ -1113,6 +1228,13 @@ int main(int argc, char **argv)
     hbitmap_test_add("/hbitmap/next_dirty_area/next_dirty_area_after_truncate",
                      test_hbitmap_next_dirty_area_after_truncate);
 
+    hbitmap_test_add("/hbitmap/merge/in_place", test_hbitmap_merge_in_place);
+    hbitmap_test_add("/hbitmap/merge/into_b", test_hbitmap_merge_into_b);
+    hbitmap_test_add("/hbitmap/merge/copy", test_hbitmap_merge_copy);
+    if (g_test_perf()) {
+        hbitmap_test_add("/hbitmap/merge/bench", test_hbitmap_merge_bench);
+    }
+
     g_test_run();
 
     return 0;
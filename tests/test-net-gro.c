@@ -0,0 +1,440 @@
+/*
+ * Software generic receive offload tests
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "qemu/main-loop.h"
+#include "net/checksum.h"
+#include "net/eth.h"
+#include "net/gro.h"
+
+#define TEST_IP_HLEN 20
+#define TEST_TCP_HLEN 20
+#define TEST_L4_OFF (ETH_HLEN + TEST_IP_HLEN)
+#define TEST_MAX_FRAME 2048
+
+/* A TCP segment of the flow 10.0.0.1:1234 -> 10.0.0.2:80 */
+typedef struct TestSeg {
+    uint32_t seq;
+    size_t len;
+    uint8_t flags;
+    uint16_t ip_id;
+    bool df;
+    uint8_t ttl;
+    /* Length and content of the TCP options, 1 is NOP */
+    size_t opt_len;
+    uint8_t opt;
+    bool bad_csum;
+} TestSeg;
+
+typedef struct TestFrame {
+    struct virtio_net_hdr hdr;
+    uint8_t *buf;
+    size_t size;
+} TestFrame;
+
+static AioContext *ctx;
+static GPtrArray *frames;
+
+static ssize_t test_output(void *opaque, const struct virtio_net_hdr *hdr,
+                           const uint8_t *buf, size_t size)
+{
+    TestFrame *f = g_new0(TestFrame, 1);
+
+    f->hdr = *hdr;
+    f->buf = g_memdup(buf, size);
+    f->size = size;
+    g_ptr_array_add(frames, f);
+    return size;
+}
+
+static void test_frame_free(gpointer data)
+{
+    TestFrame *f = data;
+
+    g_free(f->buf);
+    g_free(f);
+}
+
+static TestFrame *frame(unsigned int i)
+{
+    g_assert_cmpuint(i, <, frames->len);
+    return g_ptr_array_index(frames, i);
+}
+
+/* The payload byte at sequence number @seq */
+static uint8_t payload_byte(uint32_t seq)
+{
+    return seq * 7 + 3;
+}
+
+static size_t build_segment(uint8_t *buf, const TestSeg *seg)
+{
+    static const uint8_t macs[2 * ETH_ALEN] = {
+        0x52, 0x54, 0x00, 0x00, 0x00, 0x01,
+        0x52, 0x54, 0x00, 0x00, 0x00, 0x02,
+    };
+    uint8_t *ip = buf + ETH_HLEN;
+    uint8_t *tcp = buf + TEST_L4_OFF;
+    size_t tcp_len = TEST_TCP_HLEN + seg->opt_len;
+    size_t l4_len = tcp_len + seg->len;
+    size_t i;
+
+    g_assert(!(seg->opt_len & 3));
+    g_assert(TEST_L4_OFF + l4_len <= TEST_MAX_FRAME);
+
+    memset(buf, 0, TEST_L4_OFF + tcp_len);
+    memcpy(buf, macs, sizeof(macs));
+    stw_be_p(buf + 12, ETH_P_IP);
+
+    ip[0] = 0x45;
+    stw_be_p(ip + 2, TEST_IP_HLEN + l4_len);
+    stw_be_p(ip + 4, seg->ip_id);
+    stw_be_p(ip + 6, seg->df ? IP_DF : 0);
+    ip[8] = seg->ttl ?: 64;
+    ip[9] = IP_PROTO_TCP;
+    stl_be_p(ip + 12, 0x0a000001);
+    stl_be_p(ip + 16, 0x0a000002);
+    stw_be_p(ip + 10, net_raw_checksum(ip, TEST_IP_HLEN));
+
+    stw_be_p(tcp, 1234);
+    stw_be_p(tcp + 2, 80);
+    stl_be_p(tcp + 4, seg->seq);
+    stl_be_p(tcp + 8, 1);
+    tcp[12] = (tcp_len >> 2) << 4;
+    tcp[13] = seg->flags ?: TH_ACK;
+    stw_be_p(tcp + 14, 1000);
+    memset(tcp + TEST_TCP_HLEN, seg->opt, seg->opt_len);
+    for (i = 0; i < seg->len; i++) {
+        tcp[tcp_len + i] = payload_byte(seg->seq + i);
+    }
+    stw_be_p(tcp + 16, net_checksum_tcpudp(l4_len, IP_PROTO_TCP, ip + 12,
+                                           tcp));
+    if (seg->bad_csum) {
+        tcp[16] ^= 0xff;
+    }
+
+    return TEST_L4_OFF + l4_len;
+}
+
+static void receive(NetGRO *gro, const TestSeg *seg)
+{
+    uint8_t buf[TEST_MAX_FRAME];
+    size_t size = build_segment(buf, seg);
+
+    g_assert_cmpint(net_gro_receive(gro, buf, size), ==, size);
+}
+
+static NetGRO *test_gro_new(void)
+{
+    NetGRO *gro = net_gro_new(ctx, test_output, NULL);
+
+    net_gro_set_offload(gro, true, true, true);
+    g_ptr_array_set_size(frames, 0);
+    return gro;
+}
+
+/* Flush held segments from the bottom half, like the device does */
+static void test_gro_run_bh(void)
+{
+    while (aio_poll(ctx, false)) {
+        /* nothing */
+    }
+}
+
+static uint32_t frame_seq(TestFrame *f)
+{
+    return ldl_be_p(f->buf + TEST_L4_OFF + 4);
+}
+
+/* Check a frame that left the GRO stage as a single, validated segment */
+static void check_single(TestFrame *f, uint32_t seq, size_t len)
+{
+    size_t hdr_len = TEST_L4_OFF + ((f->buf[TEST_L4_OFF + 12] >> 4) << 2);
+
+    g_assert_cmpint(f->hdr.gso_type, ==, VIRTIO_NET_HDR_GSO_NONE);
+    g_assert_cmpint(f->hdr.flags, ==, VIRTIO_NET_HDR_F_DATA_VALID);
+    g_assert_cmpuint(frame_seq(f), ==, seq);
+    g_assert_cmpuint(f->size, ==, hdr_len + len);
+}
+
+/* Check a frame that was coalesced from segments of @mss bytes */
+static void check_merged(TestFrame *f, uint32_t seq, size_t len, size_t mss)
+{
+    uint8_t *ip = f->buf + ETH_HLEN;
+    uint8_t *tcp = f->buf + TEST_L4_OFF;
+    size_t hdr_len = TEST_L4_OFF + ((tcp[12] >> 4) << 2);
+    size_t l4_len = f->size - TEST_L4_OFF;
+    size_t i;
+
+    g_assert_cmpint(f->hdr.gso_type, ==, VIRTIO_NET_HDR_GSO_TCPV4);
+    g_assert_cmpint(f->hdr.flags, ==, VIRTIO_NET_HDR_F_NEEDS_CSUM);
+    g_assert_cmpint(f->hdr.gso_size, ==, mss);
+    g_assert_cmpint(f->hdr.hdr_len, ==, hdr_len);
+    g_assert_cmpint(f->hdr.csum_start, ==, TEST_L4_OFF);
+    g_assert_cmpint(f->hdr.csum_offset, ==, 16);
+    g_assert_cmpuint(f->size, ==, hdr_len + len);
+
+    g_assert_cmpuint(lduw_be_p(ip + 2), ==, f->size - ETH_HLEN);
+    g_assert_cmpuint(net_raw_checksum(ip, TEST_IP_HLEN), ==, 0);
+    g_assert_cmpuint(frame_seq(f), ==, seq);
+    for (i = 0; i < len; i++) {
+        g_assert_cmpuint(f->buf[hdr_len + i], ==, payload_byte(seq + i));
+    }
+
+    /* Complete the partial checksum the way the guest's NIC would */
+    stw_be_p(tcp + 16, net_checksum_finish(net_checksum_add(l4_len, tcp)));
+    g_assert_cmpuint(net_checksum_tcpudp(l4_len, IP_PROTO_TCP, ip + 12, tcp),
+                     ==, 0);
+}
+
+static void test_gro_in_order(void)
+{
+    NetGRO *gro = test_gro_new();
+    uint32_t seq;
+
+    for (seq = 0; seq < 300; seq += 100) {
+        receive(gro, &(TestSeg) { .seq = seq, .len = 100,
+                                  .ip_id = 1 + seq / 100 });
+    }
+    g_assert_cmpuint(frames->len, ==, 0);
+
+    /* PSH flushes the flow right away */
+    receive(gro, &(TestSeg) { .seq = 300, .len = 100, .ip_id = 4,
+                              .flags = TH_ACK | TH_PUSH });
+    g_assert_cmpuint(frames->len, ==, 1);
+    check_merged(frame(0), 0, 400, 100);
+    g_assert_cmpuint(lduw_be_p(frame(0)->buf + ETH_HLEN + 4), ==, 1);
+    g_assert(frame(0)->buf[TEST_L4_OFF + 13] & TH_PUSH);
+
+    /* So does a segment shorter than the MSS */
+    receive(gro, &(TestSeg) { .seq = 400, .len = 100, .ip_id = 5 });
+    receive(gro, &(TestSeg) { .seq = 500, .len = 50, .ip_id = 6 });
+    g_assert_cmpuint(frames->len, ==, 2);
+    check_merged(frame(1), 400, 150, 100);
+
+    net_gro_free(gro);
+}
+
+static void test_gro_out_of_order(void)
+{
+    NetGRO *gro = test_gro_new();
+
+    receive(gro, &(TestSeg) { .seq = 0, .len = 100, .ip_id = 1 });
+    receive(gro, &(TestSeg) { .seq = 200, .len = 100, .ip_id = 2 });
+    g_assert_cmpuint(frames->len, ==, 1);
+    check_single(frame(0), 0, 100);
+
+    /* The hole is never filled, the bottom half hands over the rest */
+    test_gro_run_bh();
+    g_assert_cmpuint(frames->len, ==, 2);
+    check_single(frame(1), 200, 100);
+
+    /* A retransmission does not get merged either */
+    receive(gro, &(TestSeg) { .seq = 300, .len = 100, .ip_id = 3 });
+    receive(gro, &(TestSeg) { .seq = 300, .len = 100, .ip_id = 4 });
+    test_gro_run_bh();
+    g_assert_cmpuint(frames->len, ==, 4);
+    check_single(frame(2), 300, 100);
+    check_single(frame(3), 300, 100);
+
+    net_gro_free(gro);
+}
+
+/* @second must not be merged with a regular segment at sequence number 0 */
+static void check_no_merge(const TestSeg *first, const TestSeg *second)
+{
+    NetGRO *gro = test_gro_new();
+
+    receive(gro, first);
+    receive(gro, second);
+    net_gro_flush(gro);
+
+    g_assert_cmpuint(frames->len, ==, 2);
+    check_single(frame(0), first->seq, first->len);
+    check_single(frame(1), second->seq, second->len);
+
+    net_gro_free(gro);
+}
+
+static void test_gro_mismatch(void)
+{
+    TestSeg first = { .seq = 0, .len = 100, .ip_id = 1 };
+    TestSeg opts = { .seq = 0, .len = 100, .ip_id = 1,
+                     .opt_len = 12, .opt = 1 };
+
+    /* Different TCP flags */
+    check_no_merge(&first, &(TestSeg) { .seq = 100, .len = 100, .ip_id = 2,
+                                        .flags = TH_ACK | TH_URG });
+
+    /* Different TTL */
+    check_no_merge(&first, &(TestSeg) { .seq = 100, .len = 100, .ip_id = 2,
+                                        .ttl = 32 });
+
+    /* Options only in one of the segments */
+    check_no_merge(&first, &(TestSeg) { .seq = 100, .len = 100, .ip_id = 2,
+                                        .opt_len = 12, .opt = 1 });
+
+    /* Options of the same size, but with a different content */
+    check_no_merge(&opts, &(TestSeg) { .seq = 100, .len = 100, .ip_id = 2,
+                                       .opt_len = 12, .opt = 0x42 });
+
+    /* Larger than the MSS of the flow */
+    check_no_merge(&first, &(TestSeg) { .seq = 100, .len = 200, .ip_id = 2 });
+}
+
+static void test_gro_fin(void)
+{
+    NetGRO *gro = test_gro_new();
+
+    /* FIN flushes the held segments and passes through after them */
+    receive(gro, &(TestSeg) { .seq = 0, .len = 100, .ip_id = 1 });
+    receive(gro, &(TestSeg) { .seq = 100, .len = 100, .ip_id = 2 });
+    receive(gro, &(TestSeg) { .seq = 200, .len = 10, .ip_id = 3,
+                              .flags = TH_ACK | TH_FIN });
+    g_assert_cmpuint(frames->len, ==, 2);
+    check_merged(frame(0), 0, 200, 100);
+    check_single(frame(1), 200, 10);
+
+    /* A lone segment with PSH is not held at all */
+    receive(gro, &(TestSeg) { .seq = 210, .len = 100, .ip_id = 4,
+                              .flags = TH_ACK | TH_PUSH });
+    g_assert_cmpuint(frames->len, ==, 3);
+    check_single(frame(2), 210, 100);
+
+    net_gro_free(gro);
+}
+
+static void test_gro_bad_csum(void)
+{
+    NetGRO *gro = test_gro_new();
+
+    receive(gro, &(TestSeg) { .seq = 0, .len = 100, .ip_id = 1 });
+    receive(gro, &(TestSeg) { .seq = 100, .len = 100, .ip_id = 2,
+                              .bad_csum = true });
+    g_assert_cmpuint(frames->len, ==, 2);
+    check_single(frame(0), 0, 100);
+
+    /* Not validated, so the guest has to check it */
+    g_assert_cmpint(frame(1)->hdr.gso_type, ==, VIRTIO_NET_HDR_GSO_NONE);
+    g_assert_cmpint(frame(1)->hdr.flags, ==, 0);
+
+    net_gro_free(gro);
+}
+
+static void test_gro_ip_id(void)
+{
+    NetGRO *gro;
+
+    /* IDs that do not increment */
+    check_no_merge(&(TestSeg) { .seq = 0, .len = 100, .ip_id = 10 },
+                   &(TestSeg) { .seq = 100, .len = 100, .ip_id = 20 });
+
+    /* A fixed ID is only fine with DF */
+    check_no_merge(&(TestSeg) { .seq = 0, .len = 100, .ip_id = 7 },
+                   &(TestSeg) { .seq = 100, .len = 100, .ip_id = 7 });
+
+    gro = test_gro_new();
+    receive(gro, &(TestSeg) { .seq = 0, .len = 100, .ip_id = 7, .df = true });
+    receive(gro, &(TestSeg) { .seq = 100, .len = 100, .ip_id = 7,
+                              .df = true });
+    receive(gro, &(TestSeg) { .seq = 200, .len = 100, .ip_id = 7,
+                              .df = true, .flags = TH_ACK | TH_PUSH });
+    g_assert_cmpuint(frames->len, ==, 1);
+    check_merged(frame(0), 0, 300, 100);
+    net_gro_free(gro);
+
+    /* The frame must keep one scheme, fixed or incrementing */
+    gro = test_gro_new();
+    receive(gro, &(TestSeg) { .seq = 0, .len = 100, .ip_id = 7, .df = true });
+    receive(gro, &(TestSeg) { .seq = 100, .len = 100, .ip_id = 7,
+                              .df = true });
+    receive(gro, &(TestSeg) { .seq = 200, .len = 100, .ip_id = 9,
+                              .df = true });
+    net_gro_flush(gro);
+    g_assert_cmpuint(frames->len, ==, 2);
+    check_merged(frame(0), 0, 200, 100);
+    check_single(frame(1), 200, 100);
+    net_gro_free(gro);
+
+    /* Incrementing IDs wrap around */
+    gro = test_gro_new();
+    receive(gro, &(TestSeg) { .seq = 0, .len = 100, .ip_id = 0xffff });
+    receive(gro, &(TestSeg) { .seq = 100, .len = 100, .ip_id = 0 });
+    receive(gro, &(TestSeg) { .seq = 200, .len = 100, .ip_id = 1,
+                              .flags = TH_ACK | TH_PUSH });
+    g_assert_cmpuint(frames->len, ==, 1);
+    check_merged(frame(0), 0, 300, 100);
+    net_gro_free(gro);
+}
+
+/* The byte-at-a-time sum that net_checksum_add_cont() replaced */
+static uint32_t checksum_add_ref(int len, const uint8_t *buf, int seq)
+{
+    uint32_t sum = 0;
+    int i;
+
+    for (i = seq; i < seq + len; i++) {
+        if (i & 1) {
+            sum += buf[i - seq];
+        } else {
+            sum += (uint32_t)buf[i - seq] << 8;
+        }
+    }
+    return sum;
+}
+
+static void test_checksum_add_cont(void)
+{
+    uint8_t buf[80];
+    int len, seq, split;
+
+    for (len = 0; len < sizeof(buf); len++) {
+        buf[len] = g_test_rand_int();
+    }
+
+    for (len = 0; len <= sizeof(buf) - 3; len++) {
+        /* Both odd and even offsets, and an unaligned buffer */
+        for (seq = 0; seq < 4; seq++) {
+            g_assert_cmphex(
+                net_checksum_finish(net_checksum_add_cont(len, buf + 3, seq)),
+                ==, net_checksum_finish(checksum_add_ref(len, buf + 3, seq)));
+        }
+
+        /* Summing a buffer in two parts gives the same result */
+        for (split = 0; split <= len; split++) {
+            uint32_t sum = net_checksum_add(split, buf) +
+                           net_checksum_add_cont(len - split, buf + split,
+                                                 split);
+
+            g_assert_cmphex(net_checksum_finish(sum), ==,
+                            net_raw_checksum(buf, len));
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int ret;
+
+    qemu_init_main_loop(&error_fatal);
+    ctx = qemu_get_aio_context();
+    frames = g_ptr_array_new_with_free_func(test_frame_free);
+
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/net/gro/in-order", test_gro_in_order);
+    g_test_add_func("/net/gro/out-of-order", test_gro_out_of_order);
+    g_test_add_func("/net/gro/mismatch", test_gro_mismatch);
+    g_test_add_func("/net/gro/fin", test_gro_fin);
+    g_test_add_func("/net/gro/bad-csum", test_gro_bad_csum);
+    g_test_add_func("/net/gro/ip-id", test_gro_ip_id);
+    g_test_add_func("/net/checksum/add-cont", test_checksum_add_cont);
+
+    ret = g_test_run();
+    g_ptr_array_free(frames, true);
+    return ret;
+}
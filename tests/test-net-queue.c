@@ -0,0 +1,389 @@
+/*
+ * Network packet queue tests
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/iov.h"
+#include "net/net.h"
+#include "net/queue.h"
+
+/* Matches nq_maxlen in net/queue.c */
+#define TEST_QUEUE_MAXLEN 10000
+
+typedef struct TestPacket {
+    NetClientState *sender;
+    unsigned flags;
+    int iovcnt;
+    uint8_t *buf;
+    size_t size;
+} TestPacket;
+
+static NetClientState senders[2];
+static GPtrArray *delivered;
+static bool blocked;
+static unsigned int sent_count;
+static ssize_t sent_ret;
+
+/* net/queue.c only needs this from net/net.c */
+int qemu_can_send_packet(NetClientState *sender)
+{
+    return 1;
+}
+
+static ssize_t test_deliver(NetClientState *sender, unsigned flags,
+                            const struct iovec *iov, int iovcnt,
+                            void *opaque)
+{
+    TestPacket *p;
+
+    if (blocked) {
+        return 0;
+    }
+
+    p = g_new0(TestPacket, 1);
+    p->sender = sender;
+    p->flags = flags;
+    p->iovcnt = iovcnt;
+    p->size = iov_size(iov, iovcnt);
+    p->buf = g_malloc(p->size);
+    iov_to_buf(iov, iovcnt, 0, p->buf, p->size);
+    g_ptr_array_add(delivered, p);
+    return p->size;
+}
+
+static void test_sent(NetClientState *sender, ssize_t ret)
+{
+    sent_count++;
+    sent_ret = ret;
+}
+
+static void test_packet_free(gpointer data)
+{
+    TestPacket *p = data;
+
+    g_free(p->buf);
+    g_free(p);
+}
+
+static TestPacket *packet(unsigned int i)
+{
+    g_assert_cmpuint(i, <, delivered->len);
+    return g_ptr_array_index(delivered, i);
+}
+
+static NetQueue *test_queue_new(void)
+{
+    g_ptr_array_set_size(delivered, 0);
+    blocked = false;
+    sent_count = 0;
+    sent_ret = -1;
+    return qemu_new_net_queue(test_deliver, NULL);
+}
+
+/* Sends a @size byte packet whose bytes are all @val */
+static ssize_t send_packet(NetQueue *queue, NetClientState *sender,
+                           uint8_t val, size_t size, NetPacketSent *sent_cb)
+{
+    g_autofree uint8_t *buf = g_malloc(size);
+
+    memset(buf, val, size);
+    return qemu_net_queue_send(queue, sender, QEMU_NET_PACKET_FLAG_NONE,
+                               buf, size, sent_cb);
+}
+
+static void check_packet(unsigned int i, uint8_t val, size_t size)
+{
+    TestPacket *p = packet(i);
+    size_t j;
+
+    g_assert_cmpuint(p->size, ==, size);
+    for (j = 0; j < size; j++) {
+        g_assert_cmpuint(p->buf[j], ==, val);
+    }
+}
+
+static void test_queue_direct(void)
+{
+    NetQueue *queue = test_queue_new();
+    NetQueueStats stats;
+
+    g_assert_cmpint(send_packet(queue, &senders[0], 1, 60, test_sent), ==, 60);
+    g_assert_cmpuint(delivered->len, ==, 1);
+    check_packet(0, 1, 60);
+    /* Packets delivered right away do not complete through the callback */
+    g_assert_cmpuint(sent_count, ==, 0);
+    g_assert_true(qemu_net_queue_idle(queue));
+
+    qemu_net_queue_get_stats(queue, &stats);
+    g_assert_cmpuint(stats.queued, ==, 0);
+    g_assert_cmpuint(stats.depth, ==, 0);
+
+    qemu_del_net_queue(queue);
+}
+
+static void test_queue_ring_grow(void)
+{
+    NetQueue *queue = test_queue_new();
+    NetQueueStats stats;
+    unsigned int i;
+
+    /* More packets than the initial ring has slots */
+    blocked = true;
+    for (i = 0; i < 200; i++) {
+        g_assert_cmpint(send_packet(queue, &senders[0], i, 60 + i, test_sent),
+                        ==, 0);
+    }
+    g_assert_false(qemu_net_queue_idle(queue));
+
+    qemu_net_queue_get_stats(queue, &stats);
+    g_assert_cmpuint(stats.depth, ==, 200);
+    g_assert_cmpuint(stats.peak, ==, 200);
+    g_assert_cmpuint(stats.queued, ==, 200);
+    g_assert_cmpuint(stats.dropped, ==, 0);
+
+    /* Still blocked, nothing may be lost */
+    g_assert_false(qemu_net_queue_flush(queue));
+    qemu_net_queue_get_stats(queue, &stats);
+    g_assert_cmpuint(stats.depth, ==, 200);
+
+    blocked = false;
+    g_assert_true(qemu_net_queue_flush(queue));
+    g_assert_cmpuint(delivered->len, ==, 200);
+    for (i = 0; i < 200; i++) {
+        check_packet(i, i, 60 + i);
+    }
+    g_assert_cmpuint(sent_count, ==, 200);
+    g_assert_cmpint(sent_ret, ==, 60 + 199);
+    g_assert_true(qemu_net_queue_idle(queue));
+
+    qemu_del_net_queue(queue);
+}
+
+static void test_queue_wrap(void)
+{
+    NetQueue *queue = test_queue_new();
+    unsigned int i, round, n = 0;
+
+    /* Move the ring head around before it has to grow */
+    for (round = 0; round < 5; round++) {
+        blocked = true;
+        for (i = 0; i < 40 + round * 20; i++) {
+            send_packet(queue, &senders[0], n++, 64, test_sent);
+        }
+        blocked = false;
+        g_assert_true(qemu_net_queue_flush(queue));
+    }
+
+    g_assert_cmpuint(delivered->len, ==, n);
+    for (i = 0; i < delivered->len; i++) {
+        check_packet(i, i, 64);
+    }
+
+    qemu_del_net_queue(queue);
+}
+
+static void test_queue_drop_without_cb(void)
+{
+    NetQueue *queue = test_queue_new();
+    NetQueueStats stats;
+    unsigned int i;
+
+    blocked = true;
+    for (i = 0; i < TEST_QUEUE_MAXLEN; i++) {
+        send_packet(queue, &senders[0], i, 60, NULL);
+    }
+    qemu_net_queue_get_stats(queue, &stats);
+    g_assert_cmpuint(stats.depth, ==, TEST_QUEUE_MAXLEN);
+    g_assert_cmpuint(stats.dropped, ==, 0);
+
+    /* The queue is full: dropped without a callback, queued with one */
+    send_packet(queue, &senders[0], 0xaa, 60, NULL);
+    send_packet(queue, &senders[0], 0xbb, 60, test_sent);
+    qemu_net_queue_get_stats(queue, &stats);
+    g_assert_cmpuint(stats.depth, ==, TEST_QUEUE_MAXLEN + 1);
+    g_assert_cmpuint(stats.dropped, ==, 1);
+
+    blocked = false;
+    g_assert_true(qemu_net_queue_flush(queue));
+    g_assert_cmpuint(delivered->len, ==, TEST_QUEUE_MAXLEN + 1);
+    check_packet(0, 0, 60);
+    check_packet(TEST_QUEUE_MAXLEN - 1, (TEST_QUEUE_MAXLEN - 1) & 0xff, 60);
+    check_packet(TEST_QUEUE_MAXLEN, 0xbb, 60);
+    g_assert_cmpuint(sent_count, ==, 1);
+
+    qemu_del_net_queue(queue);
+}
+
+static void test_queue_pool(void)
+{
+    NetQueue *queue = test_queue_new();
+    unsigned int i, round;
+
+    /*
+     * Recycled packet buffers must carry the new data, and packets larger
+     * than a pooled buffer must work alongside pooled ones
+     */
+    for (round = 0; round < 3; round++) {
+        g_ptr_array_set_size(delivered, 0);
+        blocked = true;
+        for (i = 0; i < 100; i++) {
+            size_t size = i % 10 ? 60 + i * round : 9000;
+
+            send_packet(queue, &senders[0], round * 100 + i, size, test_sent);
+        }
+        blocked = false;
+        g_assert_true(qemu_net_queue_flush(queue));
+
+        g_assert_cmpuint(delivered->len, ==, 100);
+        for (i = 0; i < 100; i++) {
+            size_t size = i % 10 ? 60 + i * round : 9000;
+
+            check_packet(i, round * 100 + i, size);
+        }
+    }
+
+    qemu_del_net_queue(queue);
+}
+
+static void test_queue_copy(void)
+{
+    NetQueue *queue = test_queue_new();
+    uint8_t buf[60];
+
+    /* Without NOCOPY, the sender may reuse its buffer right away */
+    blocked = true;
+    memset(buf, 0x11, sizeof(buf));
+    qemu_net_queue_send(queue, &senders[0], QEMU_NET_PACKET_FLAG_NONE,
+                        buf, sizeof(buf), test_sent);
+    memset(buf, 0x22, sizeof(buf));
+
+    blocked = false;
+    g_assert_true(qemu_net_queue_flush(queue));
+    check_packet(0, 0x11, sizeof(buf));
+
+    qemu_del_net_queue(queue);
+}
+
+static void test_queue_nocopy(void)
+{
+    NetQueue *queue = test_queue_new();
+    uint8_t hdr[12], data[60];
+    struct iovec iov[2] = {
+        { .iov_base = hdr, .iov_len = sizeof(hdr) },
+        { .iov_base = data, .iov_len = sizeof(data) },
+    };
+    TestPacket *p;
+
+    blocked = true;
+    memset(hdr, 0x11, sizeof(hdr));
+    memset(data, 0x11, sizeof(data));
+    g_assert_cmpint(qemu_net_queue_send_iov(queue, &senders[0],
+                                            QEMU_NET_PACKET_FLAG_NOCOPY,
+                                            iov, 2, test_sent), ==, 0);
+
+    /* The data is not copied, so what the sender has when it is sent counts */
+    memset(data, 0x22, sizeof(data));
+
+    blocked = false;
+    g_assert_true(qemu_net_queue_flush(queue));
+    p = packet(0);
+    g_assert_cmpint(p->iovcnt, ==, 2);
+    g_assert_cmpuint(p->flags & QEMU_NET_PACKET_FLAG_NOCOPY, ==, 0);
+    g_assert_cmpuint(p->size, ==, sizeof(hdr) + sizeof(data));
+    g_assert_cmpuint(p->buf[0], ==, 0x11);
+    g_assert_cmpuint(p->buf[sizeof(hdr)], ==, 0x22);
+    g_assert_cmpuint(sent_count, ==, 1);
+    g_assert_cmpint(sent_ret, ==, sizeof(hdr) + sizeof(data));
+
+    qemu_del_net_queue(queue);
+}
+
+static void test_queue_nocopy_without_cb(void)
+{
+    NetQueue *queue = test_queue_new();
+    uint8_t data[60];
+    struct iovec iov = { .iov_base = data, .iov_len = sizeof(data) };
+
+    /* Nobody would wait for a callback, so the data has to be copied */
+    blocked = true;
+    memset(data, 0x11, sizeof(data));
+    qemu_net_queue_send_iov(queue, &senders[0], QEMU_NET_PACKET_FLAG_NOCOPY,
+                            &iov, 1, NULL);
+    memset(data, 0x22, sizeof(data));
+
+    blocked = false;
+    g_assert_true(qemu_net_queue_flush(queue));
+    check_packet(0, 0x11, sizeof(data));
+    g_assert_cmpuint(packet(0)->flags & QEMU_NET_PACKET_FLAG_NOCOPY, ==, 0);
+
+    qemu_del_net_queue(queue);
+}
+
+static void test_queue_purge(void)
+{
+    NetQueue *queue = test_queue_new();
+    NetQueueStats stats;
+    unsigned int i;
+
+    blocked = true;
+    for (i = 0; i < 100; i++) {
+        send_packet(queue, &senders[i % 2], i, 60, test_sent);
+    }
+
+    qemu_net_queue_purge(queue, &senders[1]);
+    g_assert_cmpuint(sent_count, ==, 50);
+    g_assert_cmpint(sent_ret, ==, 0);
+    qemu_net_queue_get_stats(queue, &stats);
+    g_assert_cmpuint(stats.depth, ==, 50);
+    g_assert_cmpuint(stats.dropped, ==, 50);
+
+    /* The packets of the other sender stay queued in order */
+    blocked = false;
+    g_assert_true(qemu_net_queue_flush(queue));
+    g_assert_cmpuint(delivered->len, ==, 50);
+    for (i = 0; i < 50; i++) {
+        check_packet(i, i * 2, 60);
+        g_assert_true(packet(i)->sender == &senders[0]);
+    }
+
+    qemu_del_net_queue(queue);
+}
+
+static void test_queue_del_nonempty(void)
+{
+    NetQueue *queue = test_queue_new();
+    unsigned int i;
+
+    blocked = true;
+    for (i = 0; i < 100; i++) {
+        send_packet(queue, &senders[0], i, i % 2 ? 60 : 9000, test_sent);
+    }
+    qemu_del_net_queue(queue);
+}
+
+int main(int argc, char **argv)
+{
+    int ret;
+
+    delivered = g_ptr_array_new_with_free_func(test_packet_free);
+
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/net/queue/direct", test_queue_direct);
+    g_test_add_func("/net/queue/ring-grow", test_queue_ring_grow);
+    g_test_add_func("/net/queue/wrap", test_queue_wrap);
+    g_test_add_func("/net/queue/drop-without-cb", test_queue_drop_without_cb);
+    g_test_add_func("/net/queue/pool", test_queue_pool);
+    g_test_add_func("/net/queue/copy", test_queue_copy);
+    g_test_add_func("/net/queue/nocopy", test_queue_nocopy);
+    g_test_add_func("/net/queue/nocopy-without-cb",
+                    test_queue_nocopy_without_cb);
+    g_test_add_func("/net/queue/purge", test_queue_purge);
+    g_test_add_func("/net/queue/del-nonempty", test_queue_del_nonempty);
+
+    ret = g_test_run();
+    g_ptr_array_free(delivered, true);
+    return ret;
+}
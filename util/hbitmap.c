@@ -101,6 +101,115 @@ struct HBitmap {
     uint64_t sizes[HBITMAP_LEVELS];
 };
 
+/* Word kernels for merging and counting the last level, which holds
+ * almost all of the data.  hb_or_words() performs dst |= src and returns
+ * the number of bits that were newly set in dst.
+ */
+static uint64_t hb_or_words_int(unsigned long *dst, const unsigned long *src,
+                                size_t n)
+{
+    uint64_t count = 0;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        count += ctpopl(src[i] & ~dst[i]);
+        dst[i] |= src[i];
+    }
+    return count;
+}
+
+static uint64_t hb_count_words_int(const unsigned long *p, size_t n)
+{
+    uint64_t count = 0;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        count += ctpopl(p[i]);
+    }
+    return count;
+}
+
+#if defined(CONFIG_AVX2_OPT) && defined(__x86_64__)
+#pragma GCC push_options
+#pragma GCC target("avx2,popcnt")
+#include <immintrin.h>
+
+/* Without -mpopcnt, ctpopl() is a library call.  Here it is one instruction,
+ * and words of src that add no bits to dst are skipped 256 bits at a time.
+ */
+static uint64_t hb_or_words_avx2(unsigned long *dst, const unsigned long *src,
+                                 size_t n)
+{
+    uint64_t count = 0;
+    size_t i;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        __m256i d = _mm256_loadu_si256((__m256i *)&dst[i]);
+        __m256i s = _mm256_loadu_si256((const __m256i *)&src[i]);
+        __m256i new = _mm256_andnot_si256(d, s);
+
+        if (!_mm256_testz_si256(new, new)) {
+            count += __builtin_popcountll(_mm256_extract_epi64(new, 0)) +
+                     __builtin_popcountll(_mm256_extract_epi64(new, 1)) +
+                     __builtin_popcountll(_mm256_extract_epi64(new, 2)) +
+                     __builtin_popcountll(_mm256_extract_epi64(new, 3));
+            _mm256_storeu_si256((__m256i *)&dst[i], _mm256_or_si256(d, s));
+        }
+    }
+    for (; i < n; i++) {
+        count += __builtin_popcountll(src[i] & ~dst[i]);
+        dst[i] |= src[i];
+    }
+    return count;
+}
+
+static uint64_t hb_count_words_popcnt(const unsigned long *p, size_t n)
+{
+    uint64_t count = 0;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        count += __builtin_popcountll(p[i]);
+    }
+    return count;
+}
+#pragma GCC pop_options
+
+#include "qemu/cpuid.h"
+#endif
+
+static uint64_t (*hb_or_words)(unsigned long *, const unsigned long *,
+                               size_t) = hb_or_words_int;
+static uint64_t (*hb_count_words)(const unsigned long *,
+                                  size_t) = hb_count_words_int;
+
+#if defined(CONFIG_AVX2_OPT) && defined(__x86_64__)
+static void __attribute__((constructor)) hbitmap_init_accel(void)
+{
+    int max = __get_cpuid_max(0, NULL);
+    int a, b, c, d, bv;
+
+    if (max < 1) {
+        return;
+    }
+    __cpuid(1, a, b, c, d);
+    if (!(c & bit_POPCNT)) {
+        return;
+    }
+    hb_count_words = hb_count_words_popcnt;
+
+    /* We must check that AVX is not just available, but usable.  */
+    if (!(c & bit_OSXSAVE) || !(c & bit_AVX) || max < 7) {
+        return;
+    }
+    __asm("xgetbv" : "=a"(bv), "=d"(d) : "c"(0));
+    __cpuid_count(7, 0, a, b, c, d);
+    if ((bv & 0x6) == 0x6 && (b & bit_AVX2)) {
+        hb_or_words = hb_or_words_avx2;
+    }
+}
+#endif
+
 /* Advance hbi to the next nonzero word and return it.  hbi->pos
  * is updated.  Returns zero if we reach the end of the bitmap.
  */
@@ -649,6 +758,7 @@ void hbitmap_serialize_part(const HBitmap *hb, uint8_t *buf,
     serialization_chunk(hb, start, count, &cur, &el_count);
     end = cur + el_count;
 
+#ifdef HOST_WORDS_BIGENDIAN
     while (cur != end) {
         unsigned long el =
             (BITS_PER_LONG == 32 ? cpu_to_le32(*cur) : cpu_to_le64(*cur));
@@ -657,6 +767,10 @@ void hbitmap_serialize_part(const HBitmap *hb, uint8_t *buf,
         buf += sizeof(el);
         cur++;
     }
+#else
+    /* The serialized format is the last level in little endian */
+    memcpy(buf, cur, (end - cur) * sizeof(unsigned long));
+#endif
 }
 
 void hbitmap_deserialize_part(HBitmap *hb, uint8_t *buf,
@@ -672,6 +786,7 @@ void hbitmap_deserialize_part(HBitmap *hb, uint8_t *buf,
     serialization_chunk(hb, start, count, &cur, &el_count);
     end = cur + el_count;
 
+#ifdef HOST_WORDS_BIGENDIAN
     while (cur != end) {
         memcpy(cur, buf, sizeof(*cur));
 
@@ -684,6 +799,9 @@ void hbitmap_deserialize_part(HBitmap *hb, uint8_t *buf,
         buf += sizeof(unsigned long);
         cur++;
     }
+#else
+    memcpy(cur, buf, (end - cur) * sizeof(unsigned long));
+#endif
     if (finish) {
         hbitmap_deserialize_finish(hb);
     }
@@ -726,6 +844,9 @@ void hbitmap_deserialize_ones(HBitmap *hb, uint64_t start, uint64_t count,
 void hbitmap_deserialize_finish(HBitmap *bitmap)
 {
     int64_t i, size, prev_size;
+    unsigned long *last = bitmap->levels[HBITMAP_LEVELS - 1];
+    uint64_t full_words = bitmap->size >> BITS_PER_LEVEL;
+    int tail_bits = bitmap->size & (BITS_PER_LONG - 1);
     int lev;
 
     /* restore levels starting from penultimate to zero level, assuming
@@ -745,7 +866,12 @@ void hbitmap_deserialize_finish(HBitmap *bitmap)
     }
 
     bitmap->levels[0][0] |= 1UL << (BITS_PER_LONG - 1);
-    bitmap->count = hb_count_between(bitmap, 0, bitmap->size - 1);
+
+    /* Bits past the end of the bitmap are not counted */
+    bitmap->count = hb_count_words(last, full_words);
+    if (tail_bits) {
+        bitmap->count += ctpopl(last[full_words] & ((1UL << tail_bits) - 1));
+    }
 }
 
 void hbitmap_free(HBitmap *hb)
@@ -864,6 +990,38 @@ static void hbitmap_sparse_merge(HBitmap *dst, const HBitmap *src)
     }
 }
 
+/**
+ * hbitmap_dense_merge: performs dst = dst | src
+ * for bitmaps with the same granularity.  Words of the last level that are
+ * zero in @src are skipped, as told by the level above it, and the dirty
+ * count is updated along the way.
+ */
+static void hbitmap_dense_merge(HBitmap *dst, const HBitmap *src)
+{
+    const int last = HBITMAP_LEVELS - 1;
+    const unsigned long *summary = src->levels[last - 1];
+    int i;
+    uint64_t j;
+
+    /* The upper levels are at most 1/64 of the size, merge them directly */
+    for (i = 0; i < last; i++) {
+        for (j = 0; j < src->sizes[i]; j++) {
+            dst->levels[i][j] |= src->levels[i][j];
+        }
+    }
+
+    for (j = 0; j < src->sizes[last - 1]; j++) {
+        uint64_t first = j << BITS_PER_LEVEL;
+
+        if (!summary[j]) {
+            continue;
+        }
+        dst->count += hb_or_words(&dst->levels[last][first],
+                                  &src->levels[last][first],
+                                  MIN(BITS_PER_LONG, src->sizes[last] - first));
+    }
+}
+
 /**
  * Given HBitmaps A and B, let R := A (BITOR) B.
  * Bitmaps A and B will not be modified,
@@ -875,7 +1033,6 @@ static void hbitmap_sparse_merge(HBitmap *dst, const HBitmap *src)
 bool hbitmap_merge(const HBitmap *a, const HBitmap *b, HBitmap *result)
 {
     int i;
-    uint64_t j;
 
     if (!hbitmap_can_merge(a, b) || !hbitmap_can_merge(a, result)) {
         return false;
@@ -905,19 +1062,21 @@ bool hbitmap_merge(const HBitmap *a, const HBitmap *b, HBitmap *result)
         return true;
     }
 
-    /* This merge is O(size), as BITS_PER_LONG and HBITMAP_LEVELS are constant.
-     * It may be possible to improve running times for sparsely populated maps
-     * by using hbitmap_iter_next, but this is suboptimal for dense maps.
+    /* Merge one of the bitmaps into a copy of the other (or into the other
+     * itself, if it is @result).  This is O(size) in the worst case, but
+     * parts of the source that are clean are skipped.
      */
     assert(a->size == b->size);
-    for (i = HBITMAP_LEVELS - 1; i >= 0; i--) {
-        for (j = 0; j < a->sizes[i]; j++) {
-            result->levels[i][j] = a->levels[i][j] | b->levels[i][j];
+    if (result == b) {
+        b = a;
+    } else if (result != a) {
+        for (i = 0; i < HBITMAP_LEVELS; i++) {
+            memcpy(result->levels[i], a->levels[i],
+                   a->sizes[i] * sizeof(unsigned long));
         }
+        result->count = a->count;
     }
-
-    /* Recompute the dirty count */
-    result->count = hb_count_between(result, 0, result->size - 1);
+    hbitmap_dense_merge(result, b);
 
     return true;
 }